@@ -0,0 +1,127 @@
+#include "job_system.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+/* Scaling benchmark for the job system: runs a synthetic frame shaped like the engine's per-frame work (transform
+ * update, frustum culling, per-worker command list recording) with 1..N workers and reports the speedup over one.
+ * Usage: job-scaling [objectCount] [frames] [maxWorkers] */
+
+namespace
+{
+
+struct Object
+{
+    float position[3];
+    float angularVelocity;
+    float radius;
+};
+
+struct Transform
+{
+    float m[16];
+};
+
+struct Frame
+{
+    const std::vector<Object>* objects;
+    std::vector<Transform> transforms;
+    std::vector<uint8_t> visible;
+    /* Stand-in for per-worker command buffers: one list of object indices per batch. */
+    std::vector<std::vector<uint32_t>> commandLists;
+};
+
+constexpr size_t batchSize = 256;
+
+void updateTransforms(Frame& frame, float time, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const Object& object = (*frame.objects)[i];
+        const float angle = object.angularVelocity * time;
+        const float c = std::cos(angle), s = std::sin(angle);
+        frame.transforms[i] = { c, 0, -s, 0,  0, 1, 0, 0,  s, 0, c, 0,
+                                object.position[0], object.position[1], object.position[2], 1 };
+    }
+}
+
+void cull(Frame& frame, size_t begin, size_t end)
+{
+    /* A symmetric 90 degree frustum looking down -z. */
+    constexpr float h = 0.70710678f;
+    constexpr float planes[4][3] = { { h, 0, -h }, { -h, 0, -h }, { 0, h, -h }, { 0, -h, -h } };
+    for (size_t i = begin; i < end; i++)
+    {
+        const float* t = frame.transforms[i].m;
+        const float radius = (*frame.objects)[i].radius;
+        bool inside = t[14] - radius < 0;
+        for (const auto& plane : planes)
+            inside = inside && plane[0] * t[12] + plane[1] * t[13] + plane[2] * t[14] >= -radius;
+        frame.visible[i] = inside;
+    }
+}
+
+void record(Frame& frame, size_t batch, size_t begin, size_t end)
+{
+    auto& list = frame.commandLists[batch];
+    list.clear();
+    for (size_t i = begin; i < end; i++)
+        if (frame.visible[i])
+            list.push_back(static_cast<uint32_t>(i));
+}
+
+void runFrame(JobSystem& jobs, Frame& frame, float time)
+{
+    const size_t count = frame.objects->size();
+    jobs.parallelFor(count, batchSize, [&](size_t begin, size_t end) { updateTransforms(frame, time, begin, end); });
+    jobs.parallelFor(count, batchSize, [&](size_t begin, size_t end) { cull(frame, begin, end); });
+    jobs.parallelFor(count, batchSize, [&](size_t begin, size_t end) { record(frame, begin / batchSize, begin, end); });
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t objectCount = argc > 1 ? std::stoul(argv[1]) : 1'000'000;
+    const int frameCount = argc > 2 ? std::stoi(argv[2]) : 50;
+    const size_t maxWorkers = argc > 3 ? std::stoul(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<Object> objects(objectCount);
+    std::minstd_rand random(42);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    for (Object& object : objects)
+        object = { { coordinate(random), coordinate(random), coordinate(random) }, coordinate(random) / 100.0f, 1.0f };
+
+    Frame frame{ &objects, std::vector<Transform>(objectCount), std::vector<uint8_t>(objectCount),
+                 std::vector<std::vector<uint32_t>>((objectCount + batchSize - 1) / batchSize) };
+
+    std::cout << objectCount << " objects, " << frameCount << " frames per run\n";
+    std::cout << "workers    ms/frame    speedup    efficiency\n";
+    double baseline = 0;
+    for (size_t workers = 1; workers <= maxWorkers; workers++)
+    {
+        JobSystem jobs(workers);
+        runFrame(jobs, frame, 0.0f); // Warm up caches and wake the workers.
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frameCount; i++)
+            runFrame(jobs, frame, static_cast<float>(i) / 60.0f);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+        if (workers == 1)
+            baseline = ms;
+        const double speedup = baseline / ms;
+        std::cout << std::setw(7) << workers << std::setw(12) << std::fixed << std::setprecision(3) << ms
+                  << std::setw(11) << std::setprecision(2) << speedup
+                  << std::setw(13) << std::setprecision(0) << speedup / static_cast<double>(workers) * 100.0 << "%\n";
+    }
+
+    size_t visible = 0;
+    for (const auto& list : frame.commandLists)
+        visible += list.size();
+    std::cout << visible << " objects visible in the last frame\n";
+}
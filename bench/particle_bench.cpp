@@ -0,0 +1,259 @@
+#include "vk_types.h"
+#include "vk_command.h"
+#include "vk_device.h"
+#include "vk_image.h"
+#include "vk_instance.h"
+#include "vk_occlusion.h"
+#include "vk_particles.h"
+#include "vk_pipeline.h"
+#include "vk_query.h"
+#include "vk_stream.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Throughput of VulkanParticleSystem at a range of particle counts, headless, into an offscreen target:
+ *     particle-bench --counts 1,4,16
+ *
+ * Every count is measured in three phases, each frame waited for and timed with GPU timestamps: simulation steps
+ * alone, draws alone, and a step followed by its draw in one submit, as the engine does it. Particles updated per
+ * second are the count over the median step time. The last phase against the sum of the first two is what running
+ * the compute and graphics work back to back costs or saves, e.g. through the barrier between them draining the GPU.
+ * The emitter revives every dead particle each step, so that the system stays full.
+ *
+ * Options:
+ *     --counts <list>      Particle counts in units of 2^20, comma separated (default 1,2,4,8,16).
+ *     --frames <count>     Frames measured per phase (default 200).
+ *     --warmup <count>     Frames run before measuring each phase (default 20).
+ *     --device <substring> Pick the device whose name contains substring. The first with a general queue otherwise. */
+
+using BenchFeatures = ValidatedFeatureList<
+    PhysicalDevicePropertiesFeature
+>;
+
+namespace
+{
+
+struct Options
+{
+    std::vector<uint32_t> counts = { 1, 2, 4, 8, 16 };
+    uint32_t frames = 200;
+    uint32_t warmup = 20;
+    std::string device;
+};
+
+Options parseOptions(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view argument = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+                throw FatalError("Missing value for " + std::string(argument));
+            return argv[++i];
+        };
+        if (argument == "--counts")
+        {
+            options.counts.clear();
+            std::istringstream list(value());
+            for (std::string count; std::getline(list, count, ',');)
+                options.counts.push_back(gsl::narrow<uint32_t>(std::stoul(count)));
+        }
+        else if (argument == "--frames")
+            options.frames = gsl::narrow<uint32_t>(std::stoul(value()));
+        else if (argument == "--warmup")
+            options.warmup = gsl::narrow<uint32_t>(std::stoul(value()));
+        else if (argument == "--device")
+            options.device = value();
+        else
+            throw FatalError("Usage: particle-bench [--counts <list>] [--frames <count>] [--warmup <count>] [--device <substring>]");
+    }
+    if (options.counts.empty() || options.frames == 0)
+        throw FatalError("Nothing to measure");
+    return options;
+}
+
+std::shared_ptr<const VulkanDevice> selectDevice(const VulkanInstance& instance, const std::string& name)
+{
+    for (const auto& device : instance.getDevices())
+        if (device->generalQueue && std::string(device->physicalDevice.getProperties().deviceName.data()).find(name) != std::string::npos)
+            return device;
+    throw FatalError("No matching device with a general queue");
+}
+
+double median(std::vector<double> milliseconds)
+{
+    std::ranges::sort(milliseconds);
+    return milliseconds[milliseconds.size() / 2];
+}
+
+/* A render pass like the engine's, into attachments of their own. */
+class OffscreenTarget
+{
+    using ColorImage = VulkanImage<vk::ImageUsageFlagBits::eColorAttachment>;
+    using DepthImage = VulkanImage<vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled>;
+
+    const VulkanDevice& device_;
+    vk::Extent2D extent_;
+    vk::Format depthFormat_;
+    vk::raii::RenderPass renderPass_;
+    ColorImage color_;
+    DepthImage depth_;
+    vk::raii::Framebuffer framebuffer_;
+
+    vk::raii::Framebuffer createFramebuffer_() const
+    {
+        const std::array attachments = { color_.view(), depth_.view() };
+        return device_.device.createFramebuffer(vk::FramebufferCreateInfo({}, *renderPass_, attachments, extent_.width, extent_.height, 1u));
+    }
+public:
+    OffscreenTarget(const VulkanDevice& device, vk::Extent2D extent) :
+        device_(device),
+        extent_(extent),
+        depthFormat_(selectDepthFormat(device)),
+        renderPass_(createRenderPass(vk::Format::eR8G8B8A8Unorm, depthFormat_, device, vk::ImageLayout::eColorAttachmentOptimal)),
+        color_(device, vk::Format::eR8G8B8A8Unorm, extent),
+        depth_(device, depthFormat_, extent),
+        framebuffer_(createFramebuffer_())
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(OffscreenTarget)
+
+    const vk::raii::RenderPass& renderPass() const noexcept { return renderPass_; }
+
+    vk::RenderPassBeginInfo renderPassInfo(gsl::span<const vk::ClearValue> clearValues) const
+    {
+        return vk::RenderPassBeginInfo(*renderPass_, *framebuffer_, vk::Rect2D({}, extent_), clearValues);
+    }
+};
+
+enum class Phase
+{
+    Simulate,
+    Draw,
+    SimulateAndDraw,
+};
+
+class ParticleBench
+{
+    constexpr static float timeStep_ = 1.0f / 60.0f;
+
+    const vk::Queue queue_;
+    VulkanStream stream_;
+    VulkanFrameTimer timer_;
+    OffscreenTarget target_;
+    glm::mat4 viewProjection_;
+public:
+    ParticleBench(const VulkanDevice& device, std::shared_ptr<VulkanCommandPool> commandPool, vk::Extent2D extent) :
+        queue_(*device.generalQueue->queue),
+        stream_(*device.device, std::move(commandPool)),
+        timer_(device, *device.generalQueue),
+        target_(device, extent),
+        viewProjection_(glm::perspectiveRH_ZO(glm::radians(60.0f), static_cast<float>(extent.width) / static_cast<float>(extent.height), 0.1f, 100.0f) *
+                        glm::lookAt(glm::vec3(0.0f, 4.0f, 12.0f), glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)))
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(ParticleBench)
+
+    const vk::raii::RenderPass& renderPass() const noexcept { return target_.renderPass(); }
+
+    /* Median GPU milliseconds of a frame of phase, after warmup frames. Every phase steps the system at least once
+     * first, so that there is something to draw. */
+    double measure(VulkanParticleSystem& particles, const ParticleSettings& settings, Phase phase, uint32_t warmup, uint32_t frames)
+    {
+        static constexpr auto clearValues = std::to_array<vk::ClearValue>({
+            vk::ClearColorValue({std::array{0.0f, 0.0f, 0.0f, 1.0f}}),
+            vk::ClearDepthStencilValue(1.0f, 0),
+        });
+        const auto renderPassInfo = target_.renderPassInfo(clearValues);
+        std::vector<double> milliseconds;
+        milliseconds.reserve(frames);
+        for (uint32_t frame = 0; frame < warmup + frames; frame++)
+        {
+            const bool step = phase != Phase::Draw || frame == 0;
+            const bool draw = phase != Phase::Simulate;
+            auto recorder = [&](const vk::CommandBuffer& commandBuffer)
+            {
+                /* Draw-only phases time only the draw, after the untimed first step. */
+                if (step && phase == Phase::Draw)
+                    particles.recordStep(commandBuffer, settings, timeStep_);
+                timer_.recordStart(commandBuffer);
+                if (step && phase != Phase::Draw)
+                    particles.recordStep(commandBuffer, settings, timeStep_);
+                if (draw)
+                {
+                    commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+                    particles.recordDraw(commandBuffer, viewProjection_, renderPassInfo.renderArea);
+                    commandBuffer.endRenderPass();
+                }
+                timer_.recordEnd(commandBuffer);
+            };
+            stream_.submitWork(queue_, recorder);
+            stream_.synchronize();
+            const double gpuMilliseconds = timer_.milliseconds();
+            if (frame >= warmup)
+                milliseconds.push_back(gpuMilliseconds);
+        }
+        return median(std::move(milliseconds));
+    }
+};
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        const VulkanInstance instance(
+            vk::ApplicationInfo("particle-bench", VK_MAKE_API_VERSION(0, 1, 0, 0), "No Engine", 0, VK_API_VERSION_1_3),
+            {}, // Validation layers would dominate every measurement.
+            gsl::make_span(BenchFeatures::instanceExtensions),
+            gsl::make_span(BenchFeatures::deviceExtensions)
+        );
+        const auto device = selectDevice(instance, options.device);
+        std::cout << "Particle throughput on " << device->physicalDevice.getProperties().deviceName.data() << std::endl;
+        if (!VulkanFrameTimer::isSupported(*device, *device->generalQueue))
+            throw FatalError("The general queue has no timestamps");
+
+        const auto commandPool = std::make_shared<VulkanCommandPool>(*device->device, 4u, *device->generalQueue);
+        ParticleBench bench(*device, commandPool, vk::Extent2D(1920, 1080));
+        for (const uint32_t millions : options.counts)
+        {
+            const auto count = gsl::narrow<uint32_t>(uint64_t{ millions } << 20);
+            if (!VulkanParticleSystem::fits(*device, count))
+            {
+                std::cout << millions << "M particles: exceed the device's storage buffer range, skipped" << std::endl;
+                continue;
+            }
+            VulkanParticleSystem particles(*device, count, *bench.renderPass());
+            ParticleSettings settings;
+            settings.emitRate = static_cast<float>(count) * 60.0f;
+
+            const double simulate = bench.measure(particles, settings, Phase::Simulate, options.warmup, options.frames);
+            const double draw = bench.measure(particles, settings, Phase::Draw, options.warmup, options.frames);
+            const double both = bench.measure(particles, settings, Phase::SimulateAndDraw, options.warmup, options.frames);
+            const double particlesPerSecond = static_cast<double>(count) / (simulate * 1e-3);
+            std::cout << std::fixed << std::setprecision(3) << std::setw(3) << millions << "M particles: simulate " << simulate
+                      << " ms (" << std::setprecision(2) << particlesPerSecond * 1e-9 << " G particles/s), draw " << std::setprecision(3)
+                      << draw << " ms, simulate + draw " << both << " ms (" << std::showpos << both - (simulate + draw) << std::noshowpos
+                      << " ms against their sum)" << std::endl;
+            device->device.waitIdle();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "particle-bench: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
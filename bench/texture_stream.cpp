@@ -0,0 +1,358 @@
+#include "vk_types.h"
+#include "job_system.h"
+#include "vk_async.h"
+#include "vk_buffer.h"
+#include "vk_command.h"
+#include "vk_deletion.h"
+#include "vk_device.h"
+#include "vk_instance.h"
+#include "vk_readback.h"
+#include "vk_stream.h"
+#include "vk_texture.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/* Streams KTX2 textures through VulkanTextureStreamer, headless, the way a level load would:
+ *     texture-stream --textures 32 --size 2048 --budget 16
+ *
+ * Textures are generated into a scratch directory first: RGBA8 with noise that differs per texture and mip, every
+ * other one with a full mip chain and the rest with only the top level, whose chains are generated on the GPU. KTX2
+ * files named on the command line are streamed along with them. Every frame calls update() once and then sleeps until
+ * the next frame is due, as a presenting engine would. The run reports after how many frames every texture was
+ * usable at some resolution, and after how many all of them were fully resident. With VK_EXT_host_image_copy, the
+ * textures with full chains are copied on the CPU, spread over the job system's workers; the time update() took on the
+ * main thread shows what that costs the frame. Once everything is resident, the generated textures are read back and
+ * compared with their files, with the loop carrying on while each readback is in flight.
+ *
+ * Textures are loaded at low priority. With --pressure, a buffer of that size is allocated at normal priority afterwards
+ * while half of the textures count as sampled every frame: if that puts VRAM over budget, textures from the other half
+ * should lose their top mips to make room, rather than the device over-committing.
+ *
+ * Options:
+ *     --textures <count>   Textures to generate (default 16).
+ *     --size <texels>      Width and height of the generated textures (default 1024).
+ *     --budget <MiB>       Bytes uploaded per frame (default 8).
+ *     --frame-ms <ms>      Frame interval (default 16).
+ *     --workers <count>    Job system workers for host copies, including the main thread (default: one per core).
+ *     --pressure <MiB>     Device-local memory to allocate once the textures are resident (default 0). Only textures
+ *                          with memory of their own, over 32 MiB such as at --size 4096, can give any back.
+ *     --device <substring> Pick the device whose name contains substring. The first with a general queue otherwise. */
+
+using BenchFeatures = ValidatedFeatureList<
+    PhysicalDevicePropertiesFeature
+>;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    uint32_t textures = 16;
+    uint32_t size = 1024;
+    vk::DeviceSize budget = vk::DeviceSize(8) << 20;
+    double frameMilliseconds = 16.0;
+    uint32_t workers = std::max(1u, std::thread::hardware_concurrency());
+    vk::DeviceSize pressure = 0;
+    std::string device;
+    std::vector<std::filesystem::path> files;
+};
+
+Options parseOptions(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view argument = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+                throw FatalError("Missing value for " + std::string(argument));
+            return argv[++i];
+        };
+        if (argument == "--textures")
+            options.textures = gsl::narrow<uint32_t>(std::stoul(value()));
+        else if (argument == "--size")
+            options.size = gsl::narrow<uint32_t>(std::stoul(value()));
+        else if (argument == "--budget")
+            options.budget = vk::DeviceSize(std::stoull(value())) << 20;
+        else if (argument == "--frame-ms")
+            options.frameMilliseconds = std::stod(value());
+        else if (argument == "--workers")
+            options.workers = gsl::narrow<uint32_t>(std::stoul(value()));
+        else if (argument == "--pressure")
+            options.pressure = vk::DeviceSize(std::stoull(value())) << 20;
+        else if (argument == "--device")
+            options.device = value();
+        else if (!argument.starts_with("--"))
+            options.files.emplace_back(argument);
+        else
+            throw FatalError("Usage: texture-stream [--textures <count>] [--size <texels>] [--budget <MiB>] [--frame-ms <ms>] "
+                             "[--workers <count>] [--pressure <MiB>] [--device <substring>] [<file.ktx2>...]");
+    }
+    if (options.textures == 0 && options.files.empty())
+        throw FatalError("Nothing to stream");
+    if (options.size == 0 || options.budget == 0 || options.workers == 0)
+        throw FatalError("Texture size, budget and workers must not be 0");
+    return options;
+}
+
+std::shared_ptr<const VulkanDevice> selectDevice(const VulkanInstance& instance, const std::string& name)
+{
+    for (const auto& device : instance.getDevices())
+        if (device->generalQueue && std::string(device->physicalDevice.getProperties().deviceName.data()).find(name) != std::string::npos)
+            return device;
+    throw FatalError("No matching device with a general queue");
+}
+
+/* Every other generated texture comes with its mips; the others have theirs generated on the GPU. */
+bool generatedWithMips(uint32_t index) noexcept { return index % 2 == 0; }
+
+/* Noise that differs per texture and mip, so that a mip copied to the wrong place shows. */
+std::vector<uint32_t> generateLevel(uint32_t seed, vk::Extent2D extent, uint32_t mip)
+{
+    const vk::Extent2D mipExtent = getMipExtent(extent, mip);
+    std::vector<uint32_t> texels(size_t{ mipExtent.width } * mipExtent.height);
+    for (uint32_t y = 0; y < mipExtent.height; y++)
+        for (uint32_t x = 0; x < mipExtent.width; x++)
+        {
+            uint32_t hash = (seed * 0x9E3779B9u) ^ (mip * 0x85EBCA6Bu) ^ (x * 0xC2B2AE35u) ^ (y * 0x27D4EB2Fu);
+            hash ^= hash >> 15;
+            hash *= 0x2C1B3C6Du;
+            hash ^= hash >> 12;
+            texels[size_t{ y } * mipExtent.width + x] = hash;
+        }
+    return texels;
+}
+
+/* Writes an RGBA8 KTX2 file with either every mip or only the top one and a level count of 0, which asks the loader to
+ * generate the rest. The data format descriptor is left out, as the streamer doesn't read it. */
+void writeKtx2(const std::filesystem::path& path, vk::Extent2D extent, uint32_t seed, bool withMips)
+{
+    constexpr std::array<uint8_t, 12> identifier = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    constexpr FormatBlockInfo block = *getFormatBlockInfo(vk::Format::eR8G8B8A8Unorm);
+    const uint32_t levelCount = withMips ? getMipLevelCount(extent) : 1;
+    /* vkFormat, typeSize, pixel extent, layer, face and level counts, supercompression, DFD and KVD ranges. */
+    const std::array<uint32_t, 13> header = {
+        VK_FORMAT_R8G8B8A8_UNORM, 1, extent.width, extent.height, 0, 0, 1, withMips ? levelCount : 0, 0, 0, 0, 0, 0,
+    };
+    const std::array<uint64_t, 2> supercompressionData = {};
+
+    /* byteOffset, byteLength and uncompressedByteLength per level, with the smallest level stored first. */
+    std::vector<std::array<uint64_t, 3>> levelIndex(levelCount);
+    uint64_t offset = sizeof(identifier) + sizeof(header) + sizeof(supercompressionData) + levelCount * sizeof(levelIndex[0]);
+    for (uint32_t mip = levelCount; mip-- > 0;)
+    {
+        const vk::DeviceSize size = getMipSize(block, extent, mip);
+        levelIndex[mip] = { offset, size, size };
+        offset += size;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        throw FatalError("Failed to create " + path.string());
+    file.write(reinterpret_cast<const char*>(identifier.data()), sizeof(identifier));
+    file.write(reinterpret_cast<const char*>(header.data()), sizeof(header));
+    file.write(reinterpret_cast<const char*>(supercompressionData.data()), sizeof(supercompressionData));
+    file.write(reinterpret_cast<const char*>(levelIndex.data()), gsl::narrow<std::streamsize>(levelIndex.size() * sizeof(levelIndex[0])));
+    for (uint32_t mip = levelCount; mip-- > 0;)
+    {
+        const std::vector<uint32_t> texels = generateLevel(seed, extent, mip);
+        file.write(reinterpret_cast<const char*>(texels.data()), gsl::narrow<std::streamsize>(texels.size() * sizeof(uint32_t)));
+    }
+    if (!file)
+        throw FatalError("Failed to write " + path.string());
+}
+
+struct Verification
+{
+    uint32_t mips = 0;
+    std::vector<std::string> mismatches;
+    std::exception_ptr error;
+    bool done = false;
+};
+
+/* Reads back every mip of the generated textures that came from their files and compares it with what was written.
+ * Each readback is awaited through the timeline waiter rather than blocked on, so the frame loop goes on meanwhile. */
+VulkanTask<> verifyTextures(VulkanTimelineWaiter& waiter, VulkanReadbackRing& ring, VulkanStream& stream, vk::Queue queue,
+                            gsl::span<const std::shared_ptr<VulkanTexture>> generated, Verification& verification)
+{
+    try
+    {
+        for (uint32_t index = 0; index < generated.size(); index++)
+        {
+            VulkanTexture& texture = *generated[index];
+            /* Mips generated on the GPU depend on its filtering, so only the top level of those is compared. */
+            const uint32_t mipCount = generatedWithMips(index) ? texture.mipLevels() : 1;
+            for (uint32_t mip = 0; mip < mipCount; mip++)
+            {
+                const ReadbackHandle readback = ring.readback(stream, queue, texture.image(), mip);
+                co_await waiter.wait(readback.event());
+                if (!std::ranges::equal(readback.getAs<uint32_t>(), generateLevel(index, texture.image().extent(), mip)))
+                    verification.mismatches.push_back("mip " + std::to_string(mip) + " of generated" + std::to_string(index) + ".ktx2");
+                verification.mips++;
+            }
+        }
+    }
+    catch (...)
+    {
+        verification.error = std::current_exception();
+    }
+    verification.done = true;
+}
+
+double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        const VulkanInstance instance(
+            vk::ApplicationInfo("texture-stream", VK_MAKE_API_VERSION(0, 1, 0, 0), "No Engine", 0, VK_API_VERSION_1_3),
+            {}, // Validation layers would dominate every measurement.
+            gsl::make_span(BenchFeatures::instanceExtensions),
+            gsl::make_span(BenchFeatures::deviceExtensions)
+        );
+        const auto device = selectDevice(instance, options.device);
+        std::cout << "Streaming textures on " << device->physicalDevice.getProperties().deviceName.data() << std::endl;
+
+        const std::filesystem::path directory = std::filesystem::temp_directory_path() / "texture-stream";
+        std::filesystem::create_directories(directory);
+        std::vector<std::filesystem::path> paths = options.files;
+        for (uint32_t i = 0; i < options.textures; i++)
+        {
+            paths.push_back(directory / ("generated" + std::to_string(i) + ".ktx2"));
+            writeKtx2(paths.back(), vk::Extent2D(options.size, options.size), i, generatedWithMips(i));
+        }
+        uintmax_t fileBytes = 0;
+        for (const auto& path : paths)
+            fileBytes += std::filesystem::file_size(path);
+
+        const auto commandPool = std::make_shared<VulkanCommandPool>(*device->device, 4u, *device->generalQueue);
+        VulkanStream stream(*device->device, commandPool);
+        const vk::Queue queue = *device->generalQueue->queue;
+        VulkanDeletionQueue deletionQueue;
+        VulkanTextureStreamer streamer(*device);
+        JobSystem jobs(options.workers);
+
+        const Clock::time_point start = Clock::now();
+        std::vector<std::shared_ptr<VulkanTexture>> textures;
+        for (const auto& path : paths)
+            textures.push_back(streamer.load(path, MemoryPriority::Low));
+        const double loadMilliseconds = millisecondsSince(start);
+
+        const auto frameInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(options.frameMilliseconds));
+        Clock::time_point nextFrame = Clock::now();
+        uint32_t frames = 0;
+        double updateMilliseconds = 0.0;
+        std::optional<std::pair<uint32_t, double>> allReady;
+        while (streamer.pending() > 0)
+        {
+            device->memory->updateBudget();
+            deletionQueue.collect();
+            const Clock::time_point updateStart = Clock::now();
+            streamer.update(stream, queue, deletionQueue, options.budget, &jobs);
+            updateMilliseconds += millisecondsSince(updateStart);
+            frames++;
+            if (!allReady && std::ranges::all_of(textures, [](const auto& texture) { return texture->ready(); }))
+                allReady.emplace(frames, millisecondsSince(start));
+            nextFrame += frameInterval;
+            std::this_thread::sleep_until(nextFrame);
+        }
+        const double residentMilliseconds = millisecondsSince(start);
+
+        Verification verification;
+        if (options.textures > 0)
+        {
+            QueueExecutor executor;
+            VulkanTimelineWaiter waiter(*device->device, executor);
+            VulkanReadbackRing ring(*device, getMipSize(*getFormatBlockInfo(vk::Format::eR8G8B8A8Unorm), vk::Extent2D(options.size, options.size), 0));
+            verifyTextures(waiter, ring, stream, queue, gsl::span(textures).subspan(options.files.size()), verification).detach();
+            while (!verification.done)
+            {
+                executor.drain();
+                nextFrame += frameInterval;
+                std::this_thread::sleep_until(nextFrame);
+            }
+            if (verification.error)
+                std::rethrow_exception(verification.error);
+        }
+
+        /* A few frames are enough for the allocation to evict, update() to shrink and the old images to retire. */
+        constexpr uint32_t pressureFrames = 3;
+        std::vector<vk::Extent2D> extents;
+        for (const auto& texture : textures)
+            extents.push_back(texture->image().extent());
+        std::optional<VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer, VulkanBufferType::DeviceLocal>> pressure;
+        for (uint32_t frame = 0; options.pressure > 0 && frame < pressureFrames; frame++)
+        {
+            device->memory->updateBudget();
+            deletionQueue.collect();
+            for (size_t i = 0; i < textures.size() / 2; i++)
+                textures[i]->markUsed();
+            if (!pressure)
+                pressure.emplace(*device, options.pressure);
+            streamer.update(stream, queue, deletionQueue, options.budget, &jobs);
+            nextFrame += frameInterval;
+            std::this_thread::sleep_until(nextFrame);
+        }
+        stream.synchronize();
+
+        std::cout << std::fixed << std::setprecision(1) << textures.size() << " textures, "
+                  << static_cast<double>(fileBytes) / (1024.0 * 1024.0) << " MiB, loaded in " << loadMilliseconds << " ms" << std::endl;
+        if (allReady)
+            std::cout << "All usable after " << allReady->first << " frames (" << allReady->second << " ms)" << std::endl;
+        std::cout << "All fully resident after " << frames << " frames (" << residentMilliseconds << " ms)" << std::endl;
+        const auto hostCopies = std::ranges::count_if(textures, [](const auto& texture) { return texture->hostCopy(); });
+        std::cout << hostCopies << " uploaded with host image copies on " << options.workers << " workers, "
+                  << textures.size() - static_cast<size_t>(hostCopies) << " through staging buffers; update() took "
+                  << updateMilliseconds / frames << " ms per frame" << std::endl;
+        if (!verification.mismatches.empty())
+            throw FatalError("Read back " + verification.mismatches.front() + " differs from the file, along with " +
+                             std::to_string(verification.mismatches.size() - 1) + " other mips");
+        if (options.textures > 0)
+            std::cout << "Verified " << verification.mips << " mips of " << options.textures << " generated textures against their files" << std::endl;
+        if (options.pressure > 0)
+        {
+            const auto shrunk = [&](size_t begin, size_t end)
+            {
+                size_t count = 0;
+                for (size_t i = begin; i < end; i++)
+                    count += textures[i]->image().extent() != extents[i];
+                return count;
+            };
+            const size_t used = textures.size() / 2;
+            std::cout << "Under " << options.pressure / (1024 * 1024) << " MiB of pressure, " << shrunk(used, textures.size()) << " of "
+                      << textures.size() - used << " unused and " << shrunk(0, used) << " of " << used << " used textures lost their top mips" << std::endl;
+        }
+        std::cout << *device->memory << std::endl;
+
+        textures.clear();
+        std::filesystem::remove_all(directory);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "texture-stream: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
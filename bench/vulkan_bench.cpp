@@ -0,0 +1,358 @@
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_command.h"
+#include "vk_device.h"
+#include "vk_instance.h"
+#include "vk_stream.h"
+#include "vk_swapchain.h"
+#include "vk_sync.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <regex>
+#include <string>
+#include <vector>
+
+/* Micro-benchmarks for the overhead of our own Vulkan wrappers, meant to run against a software ICD so that results
+ * are stable across machines, e.g. with lavapipe:
+ *     VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json vulkan-bench --baseline baseline.json
+ *
+ * Options:
+ *     --json <path>         Where to write results (default vulkan-bench.json).
+ *     --baseline <path>     Compare against an earlier --json output; exits with 1 on regressions.
+ *     --threshold <percent> Slowdown that counts as a regression (default 10).
+ *     --filter <substring>  Only run benchmarks whose name contains substring.
+ *     --device <substring>  Pick the device whose name contains substring. CPU devices are preferred otherwise. */
+
+using BenchFeatures = ValidatedFeatureList<
+    SurfaceFeature,
+    HeadlessSurfaceFeature,
+    PhysicalDevicePropertiesFeature,
+    SwapchainFeature
+>;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string jsonPath = "vulkan-bench.json";
+    std::optional<std::string> baselinePath;
+    double threshold = 10.0;
+    std::string filter;
+    std::string device;
+};
+
+struct Result
+{
+    std::string name;
+    double nsPerOp;    // Median over samples
+    double minNsPerOp;
+    uint64_t iterations;
+    double bytesPerSecond; // 0 unless the benchmark moves data
+};
+
+class Runner
+{
+    const Options& options_;
+    std::vector<Result> results_;
+public:
+    explicit Runner(const Options& options) : options_(options) {}
+
+    /* Calibrates a batch size that runs for about 10 ms, then takes the median of 15 batches. operation returns the
+     * number of operations it performed, so that setup shared between operations can be amortized. */
+    void run(const std::string& name, const std::function<uint64_t()>& operation, uint64_t bytesPerOp = 0)
+    {
+        if (name.find(options_.filter) == std::string::npos)
+            return;
+        constexpr auto batchTarget = std::chrono::milliseconds(10);
+        constexpr int sampleCount = 15;
+
+        const auto runBatch = [&](uint64_t minimumOps)
+        {
+            uint64_t ops = 0;
+            const auto start = Clock::now();
+            while (ops < minimumOps)
+                ops += operation();
+            return std::pair{ ops, std::chrono::duration<double, std::nano>(Clock::now() - start).count() };
+        };
+
+        uint64_t batchOps = 1;
+        for (;;)
+        {
+            const auto [ops, ns] = runBatch(batchOps);
+            if (ns >= std::chrono::duration<double, std::nano>(batchTarget).count() || batchOps >= (uint64_t{ 1 } << 30))
+                break;
+            batchOps = std::max(batchOps * 2, static_cast<uint64_t>(static_cast<double>(ops) * 1.2e7 / std::max(ns, 1.0)));
+        }
+
+        std::vector<double> samples;
+        uint64_t iterations = 0;
+        for (int i = 0; i < sampleCount; i++)
+        {
+            const auto [ops, ns] = runBatch(batchOps);
+            samples.push_back(ns / static_cast<double>(ops));
+            iterations += ops;
+        }
+        std::ranges::sort(samples);
+        const double median = samples[samples.size() / 2];
+        const Result result{ name, median, samples.front(), iterations, bytesPerOp ? static_cast<double>(bytesPerOp) * 1e9 / median : 0.0 };
+
+        std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(14) << result.nsPerOp << " ns/op";
+        if (result.bytesPerSecond > 0)
+            std::cout << std::setw(12) << std::setprecision(2) << result.bytesPerSecond / 1e9 << " GB/s";
+        std::cout << std::endl;
+        results_.push_back(result);
+    }
+
+    const std::vector<Result>& results() const noexcept { return results_; }
+};
+
+/* One benchmark per line, so that comparing against a baseline doesn't need a JSON library. */
+void writeJson(const std::string& path, const std::string& deviceName, const std::vector<Result>& results)
+{
+    std::ofstream file(path);
+    if (!file)
+        throw FatalError("Failed to open " + path);
+    file << "{\n  \"device\": \"" << deviceName << "\",\n  \"benchmarks\": [\n";
+    file << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        file << "    {\"name\": \"" << result.name << "\", \"ns_per_op\": " << result.nsPerOp
+             << ", \"min_ns_per_op\": " << result.minNsPerOp << ", \"iterations\": " << result.iterations
+             << ", \"bytes_per_second\": " << result.bytesPerSecond << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+std::map<std::string, double> readBaseline(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw FatalError("Failed to open baseline " + path);
+    static const std::regex entry(R"re("name":\s*"([^"]+)",\s*"ns_per_op":\s*([0-9.eE+-]+))re");
+    std::map<std::string, double> baseline;
+    for (std::string line; std::getline(file, line); )
+        if (std::smatch match; std::regex_search(line, match, entry))
+            baseline[match[1]] = std::stod(match[2]);
+    return baseline;
+}
+
+/* Returns whether any benchmark regressed by more than the threshold. */
+bool compare(const std::map<std::string, double>& baseline, const std::vector<Result>& results, double threshold)
+{
+    bool regressed = false;
+    std::cout << "\nComparison against baseline (threshold " << threshold << "%):\n";
+    for (const Result& result : results)
+    {
+        const auto found = baseline.find(result.name);
+        std::cout << std::left << std::setw(40) << result.name << std::right;
+        if (found == baseline.end())
+        {
+            std::cout << "  new" << std::endl;
+            continue;
+        }
+        const double change = (result.nsPerOp / found->second - 1.0) * 100.0;
+        const bool isRegression = change > threshold;
+        regressed |= isRegression;
+        std::cout << std::fixed << std::setprecision(1) << std::setw(10) << std::showpos << change << std::noshowpos << "%"
+                  << (isRegression ? "  REGRESSION" : "") << std::endl;
+    }
+    return regressed;
+}
+
+Options parseOptions(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view argument = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+                throw FatalError("Missing value for " + std::string(argument));
+            return argv[++i];
+        };
+        if (argument == "--json")
+            options.jsonPath = value();
+        else if (argument == "--baseline")
+            options.baselinePath = value();
+        else if (argument == "--threshold")
+            options.threshold = std::stod(value());
+        else if (argument == "--filter")
+            options.filter = value();
+        else if (argument == "--device")
+            options.device = value();
+        else
+            throw FatalError("Unknown option " + std::string(argument));
+    }
+    return options;
+}
+
+std::shared_ptr<const VulkanDevice> selectDevice(const VulkanInstance& instance, const std::string& name)
+{
+    const auto isMatch = [&](const std::shared_ptr<const VulkanDevice>& device)
+    {
+        const auto properties = device->physicalDevice.getProperties();
+        if (!name.empty())
+            return std::string(properties.deviceName.data()).find(name) != std::string::npos;
+        return properties.deviceType == vk::PhysicalDeviceType::eCpu;
+    };
+    const auto devices = instance.getDevices();
+    for (const auto& device : devices)
+        if (device->generalQueue && isMatch(device))
+            return device;
+    if (name.empty())
+        for (const auto& device : devices)
+            if (device->generalQueue)
+                return device;
+    throw FatalError("No matching device with a general queue");
+}
+
+template <VulkanBufferType bufferType>
+void benchmarkBufferCreation(Runner& runner, const VulkanDevice& device, const char* typeName)
+{
+    for (const vk::DeviceSize size : { vk::DeviceSize{ 256 }, vk::DeviceSize{ 64 } << 10, vk::DeviceSize{ 16 } << 20 })
+        runner.run(std::string("buffer.create.") + typeName + "." + std::to_string(size), [&]
+        {
+            const VulkanBuffer<vk::BufferUsageFlagBits::eTransferSrc, bufferType> buffer(device, size);
+            return uint64_t{ 1 };
+        });
+}
+
+void runBenchmarks(Runner& runner, const VulkanInstance& instance, const VulkanDevice& device)
+{
+    const VulkanQueueInfo& queueInfo = *device.generalQueue;
+    const vk::Queue queue = *queueInfo.queue;
+
+    {
+        VulkanCommandPool pool(*device.device, 16u, queueInfo);
+        runner.run("command_pool.checkout_checkin", [&]
+        {
+            auto commandBuffer = pool.checkOut();
+            return uint64_t{ 1 };
+        });
+    }
+
+    {
+        const auto pool = std::make_shared<VulkanCommandPool>(*device.device, 64u, queueInfo);
+        VulkanStream stream(*device.device, pool);
+        auto emptyRecorder = [](const vk::CommandBuffer&) {};
+        /* Submits in bursts, so that the cost per submit includes recycling but not waiting for each one. */
+        constexpr uint64_t burst = 32;
+        runner.run("stream.submit_work", [&]
+        {
+            for (uint64_t i = 0; i < burst; i++)
+                stream.submitWork(queue, emptyRecorder);
+            stream.synchronize();
+            return burst;
+        });
+        runner.run("stream.submit_synchronize", [&]
+        {
+            stream.submitWork(queue, emptyRecorder);
+            stream.synchronize();
+            return uint64_t{ 1 };
+        });
+    }
+
+    benchmarkBufferCreation<VulkanBufferType::DeviceLocal>(runner, device, "device_local");
+    benchmarkBufferCreation<VulkanBufferType::Staging>(runner, device, "staging");
+
+    {
+        constexpr size_t maxSize = size_t{ 16 } << 20;
+        const VulkanBuffer<vk::BufferUsageFlagBits::eTransferSrc, VulkanBufferType::Staging> staging(device, maxSize);
+        const std::vector<std::byte> data(maxSize, std::byte{ 0x5a });
+        for (size_t size = 256; size <= maxSize; size *= 16)
+            runner.run("buffer.copy_from." + std::to_string(size), [&]
+            {
+                staging.copyFrom(gsl::span(data).first(size));
+                return uint64_t{ 1 };
+            }, size);
+    }
+
+    {
+        const VulkanTimelineSemaphore semaphore(*device.device);
+        uint64_t value = 0;
+        runner.run("timeline.host_signal_wait", [&]
+        {
+            semaphore.signal(++value);
+            semaphore.wait(value);
+            return uint64_t{ 1 };
+        });
+    }
+
+    {
+        const auto surface = instance.getInstance().createHeadlessSurfaceEXT(vk::HeadlessSurfaceCreateInfoEXT{});
+        const auto surfaceFormats = device.physicalDevice.getSurfaceFormatsKHR(*surface);
+        if (surfaceFormats.empty() || !device.physicalDevice.getSurfaceSupportKHR(queueInfo.familyIndex, *surface))
+        {
+            std::cout << "Skipping swapchain benchmarks: headless surface not presentable" << std::endl;
+            return;
+        }
+        const VulkanSwapchain swapchain(device, *surface, surfaceFormats.front(), vk::Extent2D(256, 256), PresentPolicy::MaxThroughput);
+        const auto pool = std::make_shared<VulkanCommandPool>(*device.device, 16u, queueInfo);
+        VulkanGraphicsStream stream(*device.device, pool);
+        const auto images = swapchain.getSwapchain().getImages();
+        runner.run("swapchain.acquire_present", [&]
+        {
+            const uint32_t imageIndex = stream.acquireNextImage(queue, swapchain);
+            auto transition = [&](const vk::CommandBuffer& commandBuffer)
+            {
+                const vk::ImageMemoryBarrier barrier({}, {}, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR,
+                                                     VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, images.at(imageIndex),
+                                                     vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eBottomOfPipe,
+                                              {}, {}, {}, barrier);
+            };
+            stream.submitWork(queue, transition);
+            stream.present(queue, swapchain, imageIndex);
+            stream.synchronize();
+            return uint64_t{ 1 };
+        });
+    }
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        const VulkanInstance instance(
+            vk::ApplicationInfo("vulkan-bench", VK_MAKE_API_VERSION(0, 1, 0, 0), "No Engine", 0, VK_API_VERSION_1_3),
+            {}, // Validation layers would dominate every measurement.
+            gsl::make_span(BenchFeatures::instanceExtensions),
+            gsl::make_span(BenchFeatures::deviceExtensions)
+        );
+        const auto device = selectDevice(instance, options.device);
+        const std::string deviceName = device->physicalDevice.getProperties().deviceName.data();
+        std::cout << "\nBenchmarking on " << deviceName << "\n" << std::endl;
+
+        Runner runner(options);
+        runBenchmarks(runner, instance, *device);
+        device->device.waitIdle();
+
+        writeJson(options.jsonPath, deviceName, runner.results());
+        std::cout << "\nWrote " << options.jsonPath << std::endl;
+        if (options.baselinePath && compare(readBaseline(*options.baselinePath), runner.results(), options.threshold))
+            return 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "vulkan-bench: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,441 @@
+#include "vk_types.h"
+#include "command_capture.h"
+#include "vk_buffer.h"
+#include "vk_command.h"
+#include "vk_device.h"
+#include "vk_image.h"
+#include "vk_instance.h"
+#include "vk_occlusion.h"
+#include "vk_pipeline.h"
+#include "vk_query.h"
+#include "vk_stream.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Replays a capture written by vulkan-test --capture <file>, headlessly and as fast as the device allows, into an
+ * offscreen target of the captured size. Every frame is waited for, so that its CPU and GPU times are its own:
+ *     vulkan-replay capture.bin --csv before.csv
+ *
+ * Options:
+ *     --repeat <count>     Replay the capture this many times (default 1).
+ *     --csv <path>         Write every frame's CPU and GPU milliseconds.
+ *     --device <substring> Pick the device whose name contains substring. The first with a general queue otherwise. */
+
+using ReplayFeatures = ValidatedFeatureList<
+    PhysicalDevicePropertiesFeature
+>;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string capturePath;
+    uint32_t repeat = 1;
+    std::optional<std::string> csvPath;
+    std::string device;
+};
+
+Options parseOptions(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view argument = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+                throw FatalError("Missing value for " + std::string(argument));
+            return argv[++i];
+        };
+        if (argument == "--repeat")
+            options.repeat = gsl::narrow<uint32_t>(std::stoul(value()));
+        else if (argument == "--csv")
+            options.csvPath = value();
+        else if (argument == "--device")
+            options.device = value();
+        else if (argument.starts_with("--"))
+            throw FatalError("Unknown option " + std::string(argument));
+        else
+            options.capturePath = argument;
+    }
+    if (options.capturePath.empty())
+        throw FatalError("Usage: vulkan-replay <capture> [--repeat <count>] [--csv <path>] [--device <substring>]");
+    return options;
+}
+
+std::shared_ptr<const VulkanDevice> selectDevice(const VulkanInstance& instance, const std::string& name)
+{
+    for (const auto& device : instance.getDevices())
+        if (device->generalQueue && std::string(device->physicalDevice.getProperties().deviceName.data()).find(name) != std::string::npos)
+            return device;
+    throw FatalError("No matching device with a general queue");
+}
+
+struct FrameTiming
+{
+    double cpuMilliseconds;
+    std::optional<double> gpuMilliseconds;
+};
+
+void reportTimings(const char* name, std::vector<double> milliseconds)
+{
+    if (milliseconds.empty())
+        return;
+    std::ranges::sort(milliseconds);
+    const auto percentile = [&](double p) { return milliseconds[static_cast<size_t>(p * static_cast<double>(milliseconds.size() - 1))]; };
+    double total = 0.0;
+    for (const double value : milliseconds)
+        total += value;
+    std::cout << std::left << std::setw(6) << name << std::right << std::fixed << std::setprecision(3)
+              << "mean " << total / static_cast<double>(milliseconds.size()) << " ms, median " << percentile(0.5)
+              << " ms, p95 " << percentile(0.95) << " ms, max " << milliseconds.back() << " ms" << std::endl;
+}
+
+/* The render pass and attachments of one frame size, rebuilt when the captured size changes. */
+class ReplayTarget
+{
+    using ColorImage = VulkanImage<vk::ImageUsageFlagBits::eColorAttachment>;
+    using DepthImage = VulkanImage<vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled>;
+public:
+    constexpr static vk::Format colorFormat = vk::Format::eR8G8B8A8Unorm;
+private:
+    const VulkanDevice& device_;
+    vk::Extent2D extent_;
+    vk::raii::RenderPass renderPass_;
+    ColorImage color_;
+    DepthImage depth_;
+    vk::raii::Framebuffer framebuffer_;
+
+    vk::raii::Framebuffer createFramebuffer_() const
+    {
+        const std::array attachments = { color_.view(), depth_.view() };
+        return device_.device.createFramebuffer(vk::FramebufferCreateInfo({}, *renderPass_, attachments, extent_.width, extent_.height, 1u));
+    }
+public:
+    ReplayTarget(const VulkanDevice& device, vk::Format depthFormat, vk::Extent2D extent) :
+        device_(device),
+        extent_(extent),
+        renderPass_(createRenderPass(colorFormat, depthFormat, device, vk::ImageLayout::eColorAttachmentOptimal)),
+        color_(device, colorFormat, extent),
+        depth_(device, depthFormat, extent),
+        framebuffer_(createFramebuffer_())
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(ReplayTarget)
+
+    vk::Extent2D extent() const noexcept { return extent_; }
+
+    vk::RenderPassBeginInfo renderPassInfo(gsl::span<const vk::ClearValue> clearValues) const
+    {
+        return vk::RenderPassBeginInfo(*renderPass_, *framebuffer_, vk::Rect2D({}, extent_), clearValues);
+    }
+
+    const vk::raii::RenderPass& renderPass() const noexcept { return renderPass_; }
+};
+
+class Replayer
+{
+    /* Host-visible, so that uploads are plain copies, as the engine's instance stream does them. */
+    using ReplayBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer, VulkanBufferType::Staging>;
+
+    const VulkanDevice& device_;
+    const vk::Queue queue_;
+    vk::Format depthFormat_;
+    /* Kept across frame sizes, as the engine keeps its pipelines across window resizes. */
+    VulkanPipelineCache pipelineCache_;
+    VulkanStream stream_;
+    std::optional<VulkanFrameTimer> timer_;
+    std::optional<ReplayTarget> target_;
+    std::vector<std::optional<uint32_t>> pipelineKinds_;
+    std::vector<vk::Pipeline> pipelines_;
+    std::vector<std::optional<ReplayBuffer>> buffers_;
+
+    /* Resolves the declared pipeline ids, creating pipelines for kinds not seen before. */
+    void resolvePipelines_()
+    {
+        pipelines_.assign(pipelineKinds_.size(), nullptr);
+        for (size_t id = 0; id < pipelineKinds_.size(); id++)
+        {
+            if (!pipelineKinds_[id])
+                continue;
+            const auto depthPass = static_cast<DepthPass>(*pipelineKinds_[id]);
+            if (depthPass != DepthPass::PrePass && depthPass != DepthPass::Shading)
+                throw FatalError("Capture declares an unknown pipeline kind");
+            pipelines_[id] = pipelineCache_.get({ depthPass, ReplayTarget::colorFormat, depthFormat_ }, *target_->renderPass());
+        }
+    }
+
+    vk::Pipeline pipeline_(uint32_t id) const
+    {
+        if (id >= pipelines_.size() || !pipelines_[id])
+            throw FatalError("Capture binds an undeclared pipeline");
+        return pipelines_[id];
+    }
+
+    ReplayBuffer& buffer_(uint32_t id)
+    {
+        if (id >= buffers_.size() || !buffers_[id])
+            throw FatalError("Capture draws from a buffer it never uploaded");
+        return *buffers_[id];
+    }
+
+    void upload_(CommandCaptureReader& reader)
+    {
+        const auto upload = reader.read<capture::Upload>();
+        const auto data = reader.readBytes(gsl::narrow<size_t>(upload.size));
+        if (buffers_.size() <= upload.buffer)
+            buffers_.resize(upload.buffer + 1);
+        std::optional<ReplayBuffer>& buffer = buffers_[upload.buffer];
+        /* Every frame has completed by now, so nothing uses the old buffer any more. */
+        if (!buffer || buffer->size() < upload.offset + upload.size)
+            buffer.emplace(device_, std::bit_ceil(upload.offset + upload.size));
+        std::ranges::copy(data, buffer->mapped().subspan(gsl::narrow<size_t>(upload.offset)).begin());
+    }
+
+    static void skipCommand_(CommandCaptureReader& reader, CaptureOp op)
+    {
+        switch (op)
+        {
+        case CaptureOp::BindPipeline:     reader.read<capture::BindPipeline>(); break;
+        case CaptureOp::SetRasterState:   reader.read<capture::SetRasterState>(); break;
+        case CaptureOp::BindVertexBuffer: reader.read<capture::BindVertexBuffer>(); break;
+        case CaptureOp::BindIndexBuffer:  reader.read<capture::BindIndexBuffer>(); break;
+        case CaptureOp::PushConstants:    reader.readBytes(reader.read<capture::PushConstants>().size); break;
+        case CaptureOp::DrawIndexed:      reader.read<capture::DrawIndexed>(); break;
+        default: throw FatalError("Unexpected record in a submit");
+        }
+    }
+
+    /* Records the commands from the reader's position up to the Submit ending them, in one render pass. */
+    void recordCommands_(const vk::CommandBuffer& commandBuffer, CommandCaptureReader& reader)
+    {
+        static constexpr auto clearValues = std::to_array<vk::ClearValue>({
+            vk::ClearColorValue({std::array{0.0f, 0.0f, 0.0f, 1.0f}}),
+            vk::ClearDepthStencilValue(1.0f, 0),
+        });
+        const auto renderPassInfo = target_->renderPassInfo(clearValues);
+        commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+        const vk::Extent2D extent = target_->extent();
+        commandBuffer.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f));
+        commandBuffer.setScissor(0, renderPassInfo.renderArea);
+        for (CaptureOp op = reader.readOp(); op != CaptureOp::Submit; op = reader.readOp())
+        {
+            switch (op)
+            {
+            case CaptureOp::BindPipeline:
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline_(reader.read<capture::BindPipeline>().pipeline));
+                break;
+            case CaptureOp::SetRasterState:
+                reader.read<capture::SetRasterState>().state().record(commandBuffer);
+                break;
+            case CaptureOp::BindVertexBuffer:
+            {
+                const auto bind = reader.read<capture::BindVertexBuffer>();
+                commandBuffer.bindVertexBuffers(bind.binding, buffer_(bind.buffer).get(), bind.offset);
+                break;
+            }
+            case CaptureOp::BindIndexBuffer:
+            {
+                const auto bind = reader.read<capture::BindIndexBuffer>();
+                commandBuffer.bindIndexBuffer(buffer_(bind.buffer).get(), 0, bind.indexType);
+                break;
+            }
+            case CaptureOp::PushConstants:
+            {
+                const auto constants = reader.read<capture::PushConstants>();
+                const auto bytes = reader.readBytes(constants.size);
+                commandBuffer.pushConstants(*pipelineCache_.layout(), constants.stages, 0, constants.size, bytes.data());
+                break;
+            }
+            case CaptureOp::DrawIndexed:
+            {
+                const auto draw = reader.read<capture::DrawIndexed>();
+                commandBuffer.drawIndexed(draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+                break;
+            }
+            default:
+                throw FatalError("Unexpected record in a submit");
+            }
+        }
+        commandBuffer.endRenderPass();
+    }
+public:
+    Replayer(const VulkanDevice& device, std::shared_ptr<VulkanCommandPool> commandPool) :
+        device_(device),
+        queue_(*device.generalQueue->queue),
+        depthFormat_(selectDepthFormat(device)),
+        pipelineCache_(device),
+        stream_(*device.device, std::move(commandPool))
+    {
+        if (VulkanFrameTimer::isSupported(device, *device.generalQueue))
+            timer_.emplace(device, *device.generalQueue);
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(Replayer)
+
+    /* Replays records up to and including the next EndFrame. Empty at the end of the capture, which may have records
+     * for a frame that never began, if the engine stopped right after starting over. */
+    std::optional<FrameTiming> replayFrame(CommandCaptureReader& reader)
+    {
+        std::optional<Clock::time_point> start;
+        bool firstSubmit = true;
+        /* Where the current submit's commands start, which are recorded once its Submit shows that they are complete. */
+        std::optional<size_t> commandsBegin;
+        for (;;)
+        {
+            if (reader.atEnd() && !start)
+                return std::nullopt;
+            const size_t position = reader.position();
+            const CaptureOp op = reader.readOp();
+            switch (op)
+            {
+            case CaptureOp::DeclarePipeline:
+            {
+                const auto declaration = reader.read<capture::DeclarePipeline>();
+                if (pipelineKinds_.size() <= declaration.pipeline)
+                    pipelineKinds_.resize(declaration.pipeline + 1);
+                pipelineKinds_[declaration.pipeline] = declaration.kind;
+                break;
+            }
+            case CaptureOp::BeginFrame:
+            {
+                const auto frame = reader.read<capture::BeginFrame>();
+                const vk::Extent2D extent(frame.width, frame.height);
+                if (!target_ || target_->extent() != extent)
+                {
+                    target_.reset();
+                    target_.emplace(device_, depthFormat_, extent);
+                }
+                /* Building pipelines isn't part of the frame's time. */
+                resolvePipelines_();
+                start = Clock::now();
+                break;
+            }
+            case CaptureOp::Upload:
+                upload_(reader);
+                break;
+            case CaptureOp::Submit:
+            {
+                if (!target_)
+                    throw FatalError("Capture submits before its first frame");
+                const bool lastSubmit = reader.peekOp() == CaptureOp::EndFrame;
+                auto recorder = [&](const vk::CommandBuffer& commandBuffer)
+                {
+                    if (timer_ && firstSubmit)
+                        timer_->recordStart(commandBuffer);
+                    if (commandsBegin)
+                    {
+                        const size_t end = reader.position();
+                        reader.seek(*commandsBegin);
+                        recordCommands_(commandBuffer, reader);
+                        Ensures(reader.position() == end);
+                    }
+                    if (timer_ && lastSubmit)
+                        timer_->recordEnd(commandBuffer);
+                };
+                stream_.submitWork(queue_, recorder);
+                firstSubmit = false;
+                commandsBegin.reset();
+                break;
+            }
+            case CaptureOp::EndFrame:
+            {
+                if (!start)
+                    throw FatalError("Capture ends a frame it never began");
+                const double cpuMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - *start).count();
+                stream_.synchronize();
+                /* Frames without submits have no timestamps. */
+                if (timer_ && !firstSubmit)
+                    return FrameTiming{ cpuMilliseconds, timer_->milliseconds() };
+                return FrameTiming{ cpuMilliseconds, std::nullopt };
+            }
+            default:
+                if (!commandsBegin)
+                    commandsBegin = position;
+                skipCommand_(reader, op);
+                break;
+            }
+        }
+    }
+
+    bool measuresGpu() const noexcept { return timer_.has_value(); }
+};
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        CommandCaptureReader reader(options.capturePath);
+        const VulkanInstance instance(
+            vk::ApplicationInfo("vulkan-replay", VK_MAKE_API_VERSION(0, 1, 0, 0), "No Engine", 0, VK_API_VERSION_1_3),
+            {}, // Validation layers would dominate every measurement.
+            gsl::make_span(ReplayFeatures::instanceExtensions),
+            gsl::make_span(ReplayFeatures::deviceExtensions)
+        );
+        const auto device = selectDevice(instance, options.device);
+        std::cout << "Replaying " << options.capturePath << " on " << device->physicalDevice.getProperties().deviceName.data() << std::endl;
+
+        std::vector<FrameTiming> timings;
+        {
+            const auto commandPool = std::make_shared<VulkanCommandPool>(*device->device, 4u, *device->generalQueue);
+            Replayer replayer(*device, commandPool);
+            if (!replayer.measuresGpu())
+                std::cout << "The general queue has no timestamps; measuring CPU time only" << std::endl;
+            const size_t start = reader.position();
+            for (uint32_t i = 0; i < options.repeat; i++)
+            {
+                reader.seek(start);
+                while (const auto timing = replayer.replayFrame(reader))
+                    timings.push_back(*timing);
+            }
+            device->device.waitIdle();
+        }
+
+        std::cout << timings.size() << " frames" << std::endl;
+        std::vector<double> cpu;
+        std::vector<double> gpu;
+        for (const FrameTiming& timing : timings)
+        {
+            cpu.push_back(timing.cpuMilliseconds);
+            if (timing.gpuMilliseconds)
+                gpu.push_back(*timing.gpuMilliseconds);
+        }
+        reportTimings("CPU", cpu);
+        reportTimings("GPU", gpu);
+
+        if (options.csvPath)
+        {
+            std::ofstream file(*options.csvPath);
+            if (!file)
+                throw FatalError("Failed to open " + *options.csvPath);
+            file << "frame,cpu_ms,gpu_ms\n";
+            for (size_t i = 0; i < timings.size(); i++)
+            {
+                file << i << ',' << timings[i].cpuMilliseconds << ',';
+                if (timings[i].gpuMilliseconds)
+                    file << *timings[i].gpuMilliseconds;
+                file << '\n';
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "vulkan-replay: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "allocation_counter.h"
+
+#ifdef VULKAN_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+/* The array and nothrow forms default to calling these, so replacing the single-object forms counts every
+ * allocation. */
+
+void* operator new(std::size_t size)
+{
+    detail::globalAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    detail::globalAllocations.fetch_add(1, std::memory_order_relaxed);
+    const auto align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    void* pointer = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+    /* aligned_alloc wants the size to be a multiple of the alignment. */
+    void* pointer = std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+    if (pointer)
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/* Global operator new is replaced to count heap allocations when built with VULKAN_COUNT_ALLOCATIONS (the CMake option
+ * of the same name), for checking that steady-state frames don't allocate: the engine then fails once they do. The
+ * count is always 0 otherwise. */
+#ifdef VULKAN_COUNT_ALLOCATIONS
+constexpr bool countingAllocations = true;
+#else
+constexpr bool countingAllocations = false;
+#endif
+
+namespace detail
+{
+
+inline std::atomic<uint64_t> globalAllocations = 0;
+
+}
+
+/* Allocations through global operator new so far, from all threads. */
+inline uint64_t globalAllocationCount() noexcept
+{
+    return detail::globalAllocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "vk_types.h"
+#include "render_queue.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+/* A binary log of the logical commands of every frame: buffer uploads, pipeline binds, push constants, draws and
+ * submits, which vulkan-replay plays back headlessly so that engine changes can be compared on identical workloads.
+ * The log is a header followed by records, each a CaptureOp byte and that op's payload struct, in native byte order.
+ * Buffers and pipelines are referred to by ids the capture assigns to their handles in order of first use. */
+enum class CaptureOp : uint8_t
+{
+    DeclarePipeline,
+    BeginFrame,
+    Upload,           // followed by size bytes of data
+    BindPipeline,
+    BindVertexBuffer,
+    BindIndexBuffer,
+    PushConstants,    // followed by size bytes of constants
+    DrawIndexed,
+    Submit,
+    EndFrame,
+    SetRasterState,
+};
+
+namespace capture
+{
+
+struct Header
+{
+    constexpr static std::array<char, 4> expectedMagic = { 'V', 'K', 'C', 'P' };
+    constexpr static uint32_t currentVersion = 2;
+
+    std::array<char, 4> magic = expectedMagic;
+    uint32_t version = currentVersion;
+};
+
+/* kind tells the replay how to recreate the pipeline; the engine uses DepthPass. */
+struct DeclarePipeline { uint32_t pipeline; uint32_t kind; };
+struct BeginFrame { uint32_t width; uint32_t height; };
+struct Upload { uint64_t offset; uint64_t size; uint32_t buffer; uint32_t padding = 0; };
+struct BindPipeline { uint32_t pipeline; };
+struct BindVertexBuffer { uint64_t offset; uint32_t binding; uint32_t buffer; };
+struct BindIndexBuffer { uint32_t buffer; vk::IndexType indexType; };
+struct PushConstants { vk::ShaderStageFlags stages; uint32_t size; };
+struct SetRasterState
+{
+    vk::CullModeFlags cullMode;
+    vk::FrontFace frontFace;
+    vk::PrimitiveTopology topology;
+    vk::CompareOp depthCompare;
+    uint32_t depthTest;
+    uint32_t depthWrite;
+
+    static SetRasterState from(const RasterState& state) noexcept
+    {
+        return { state.cullMode, state.frontFace, state.topology, state.depthCompare, state.depthTest, state.depthWrite };
+    }
+    RasterState state() const noexcept
+    {
+        return { cullMode, frontFace, topology, depthTest != 0, depthWrite != 0, depthCompare };
+    }
+};
+struct DrawIndexed { uint32_t indexCount; uint32_t instanceCount; uint32_t firstIndex; int32_t vertexOffset; uint32_t firstInstance; };
+
+}
+
+/* Writes a capture. Usage per frame: beginFrame(), upload() for whatever the frame's draws read that changed,
+ * addDraw() for every draw, submit() where the engine submits, then endFrame(). Draws are buffered until submit(),
+ * which writes them in key order with redundant binds skipped, as RenderQueue would record them. Only draws whose
+ * parameters are known on the CPU can be captured, so GPU-driven draws have to be captured before culling. */
+class CommandCaptureWriter
+{
+    struct PendingDraw
+    {
+        uint64_t key;
+        uint32_t order;
+        DrawPacket packet;
+    };
+
+    std::ofstream file_;
+    std::map<vk::Buffer, uint32_t> bufferIds_;
+    std::map<vk::Pipeline, uint32_t> pipelineIds_;
+    std::vector<PendingDraw> draws_;
+    uint64_t frameCount_ = 0;
+
+    template <CaptureOp op, typename Payload>
+    void write_(const Payload& payload)
+    {
+        static_assert(std::is_trivially_copyable_v<Payload> && std::has_unique_object_representations_v<Payload>);
+        file_.put(static_cast<char>(op));
+        file_.write(reinterpret_cast<const char*>(&payload), sizeof(payload));
+    }
+    template <CaptureOp op>
+    void write_() { file_.put(static_cast<char>(op)); }
+
+    void writeBytes_(gsl::span<const std::byte> bytes)
+    {
+        file_.write(reinterpret_cast<const char*>(bytes.data()), gsl::narrow<std::streamsize>(bytes.size()));
+    }
+
+    uint32_t bufferId_(vk::Buffer buffer)
+    {
+        return bufferIds_.try_emplace(buffer, gsl::narrow<uint32_t>(bufferIds_.size())).first->second;
+    }
+    uint32_t pipelineId_(vk::Pipeline pipeline) const
+    {
+        const auto found = pipelineIds_.find(pipeline);
+        if (found == pipelineIds_.end())
+            throw FatalError("Captured a draw with an undeclared pipeline");
+        return found->second;
+    }
+public:
+    explicit CommandCaptureWriter(const std::filesystem::path& path) : file_(path, std::ios::binary)
+    {
+        if (!file_)
+            throw FatalError("Failed to open capture file " + path.string());
+        const capture::Header header;
+        file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(CommandCaptureWriter)
+
+    /* Every pipeline has to be declared before the first draw using it, with what the replay needs to recreate it. */
+    void declarePipeline(vk::Pipeline pipeline, uint32_t kind)
+    {
+        const auto id = gsl::narrow<uint32_t>(pipelineIds_.size());
+        pipelineIds_.insert_or_assign(pipeline, id);
+        write_<CaptureOp::DeclarePipeline>(capture::DeclarePipeline{ id, kind });
+    }
+
+    void beginFrame(vk::Extent2D extent)
+    {
+        Expects(draws_.empty());
+        write_<CaptureOp::BeginFrame>(capture::BeginFrame{ extent.width, extent.height });
+    }
+
+    /* What the following draws read from buffer at offset, however it got there. */
+    void upload(vk::Buffer buffer, vk::DeviceSize offset, gsl::span<const std::byte> data)
+    {
+        write_<CaptureOp::Upload>(capture::Upload{ offset, data.size(), bufferId_(buffer) });
+        writeBytes_(data);
+    }
+
+    void addDraw(uint64_t key, const DrawPacket& packet)
+    {
+        Expects(!packet.indirectBuffer);
+        draws_.push_back({ key, gsl::narrow<uint32_t>(draws_.size()), packet });
+    }
+
+    /* Writes a submit, which starts with nothing bound. withDraws puts the draws added since the last submit into it;
+     * otherwise they are left for the next one, e.g. when submitting work that isn't captured, such as culling. */
+    void submit(bool withDraws = true)
+    {
+        if (!withDraws)
+        {
+            write_<CaptureOp::Submit>();
+            return;
+        }
+        std::ranges::sort(draws_, [](const PendingDraw& a, const PendingDraw& b) { return std::tie(a.key, a.order) < std::tie(b.key, b.order); });
+        vk::Pipeline boundPipeline;
+        std::optional<RasterState> boundRaster;
+        vk::Buffer boundVertexBuffer;
+        vk::Buffer boundInstanceBuffer;
+        vk::DeviceSize boundInstanceOffset = 0;
+        vk::Buffer boundIndexBuffer;
+        vk::IndexType boundIndexType = vk::IndexType::eUint16;
+        for (const PendingDraw& draw : draws_)
+        {
+            const DrawPacket& packet = draw.packet;
+            if (packet.pipeline != boundPipeline)
+            {
+                write_<CaptureOp::BindPipeline>(capture::BindPipeline{ pipelineId_(packet.pipeline) });
+                boundPipeline = packet.pipeline;
+            }
+            if (packet.raster != boundRaster)
+            {
+                write_<CaptureOp::SetRasterState>(capture::SetRasterState::from(packet.raster));
+                boundRaster = packet.raster;
+            }
+            if (packet.vertexBuffer != boundVertexBuffer)
+            {
+                write_<CaptureOp::BindVertexBuffer>(capture::BindVertexBuffer{ 0, 0, bufferId_(packet.vertexBuffer) });
+                boundVertexBuffer = packet.vertexBuffer;
+            }
+            if (packet.instanceBuffer && (packet.instanceBuffer != boundInstanceBuffer || packet.instanceOffset != boundInstanceOffset))
+            {
+                write_<CaptureOp::BindVertexBuffer>(capture::BindVertexBuffer{ packet.instanceOffset, 1, bufferId_(packet.instanceBuffer) });
+                boundInstanceBuffer = packet.instanceBuffer;
+                boundInstanceOffset = packet.instanceOffset;
+            }
+            if (packet.indexBuffer != boundIndexBuffer || packet.indexType != boundIndexType)
+            {
+                write_<CaptureOp::BindIndexBuffer>(capture::BindIndexBuffer{ bufferId_(packet.indexBuffer), packet.indexType });
+                boundIndexBuffer = packet.indexBuffer;
+                boundIndexType = packet.indexType;
+            }
+            if (packet.pushConstantSize != 0)
+            {
+                write_<CaptureOp::PushConstants>(capture::PushConstants{ packet.pushConstantStages, packet.pushConstantSize });
+                writeBytes_(gsl::span(packet.pushConstants).first(packet.pushConstantSize));
+            }
+            write_<CaptureOp::DrawIndexed>(capture::DrawIndexed{ packet.indexCount, packet.instanceCount, packet.firstIndex,
+                                                                 packet.vertexOffset, packet.firstInstance });
+        }
+        draws_.clear();
+        write_<CaptureOp::Submit>();
+    }
+
+    void endFrame()
+    {
+        Expects(draws_.empty()); // Draws added after the last submit
+        write_<CaptureOp::EndFrame>();
+        frameCount_++;
+        if (!file_)
+            throw FatalError("Failed to write capture file");
+    }
+
+    uint64_t frameCount() const noexcept { return frameCount_; }
+};
+
+/* Reads a whole capture into memory up front, so that replaying it doesn't wait on the disk. */
+class CommandCaptureReader
+{
+    std::vector<std::byte> data_;
+    size_t position_ = 0;
+
+    gsl::span<const std::byte> take_(size_t size)
+    {
+        if (data_.size() - position_ < size)
+            throw FatalError("Truncated capture file");
+        const auto bytes = gsl::span(data_).subspan(position_, size);
+        position_ += size;
+        return bytes;
+    }
+public:
+    explicit CommandCaptureReader(const std::filesystem::path& path)
+    {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file)
+            throw FatalError("Failed to open capture file " + path.string());
+        data_.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(data_.data()), gsl::narrow<std::streamsize>(data_.size()));
+        const auto header = read<capture::Header>();
+        if (header.magic != capture::Header::expectedMagic)
+            throw FatalError(path.string() + " is not a capture file");
+        if (header.version != capture::Header::currentVersion)
+            throw FatalError("Unsupported capture version " + std::to_string(header.version));
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(CommandCaptureReader)
+
+    bool atEnd() const noexcept { return position_ == data_.size(); }
+    /* For reading a stretch of records twice. */
+    size_t position() const noexcept { return position_; }
+    void seek(size_t position)
+    {
+        Expects(position <= data_.size());
+        position_ = position;
+    }
+
+    CaptureOp peekOp() const
+    {
+        if (atEnd())
+            throw FatalError("Truncated capture file");
+        return static_cast<CaptureOp>(data_[position_]);
+    }
+    CaptureOp readOp()
+    {
+        const CaptureOp op = peekOp();
+        position_++;
+        return op;
+    }
+
+    template <typename Payload>
+    Payload read()
+    {
+        static_assert(std::is_trivially_copyable_v<Payload>);
+        Payload payload;
+        std::memcpy(&payload, take_(sizeof(Payload)).data(), sizeof(Payload));
+        return payload;
+    }
+    gsl::span<const std::byte> readBytes(size_t size) { return take_(size); }
+};
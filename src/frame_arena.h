@@ -0,0 +1,93 @@
+#pragma once
+
+#include <gsl/gsl>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+/* Bump allocator for allocations that all die together. Deallocation is a no-op; reset() frees everything at once.
+ * Chunks are kept across resets, and a reset after the arena had to grow merges them into one chunk of the combined
+ * size, so that a steady workload stops allocating after its first few frames. Not thread-safe. */
+class ArenaMemoryResource : public std::pmr::memory_resource
+{
+    constexpr static size_t minChunkSize_ = 64 * 1024;
+
+    struct Chunk
+    {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks_;
+    size_t chunkIndex_ = 0;
+    size_t chunkOffset_ = 0;
+    size_t usedBytes_ = 0;
+    size_t highWaterBytes_ = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        for (; chunkIndex_ < chunks_.size(); chunkIndex_++, chunkOffset_ = 0)
+        {
+            Chunk& chunk = chunks_[chunkIndex_];
+            void* pointer = chunk.data.get() + chunkOffset_;
+            size_t space = chunk.size - chunkOffset_;
+            if (std::align(alignment, bytes, pointer, space))
+            {
+                chunkOffset_ = chunk.size - space + bytes;
+                usedBytes_ += bytes;
+                highWaterBytes_ = std::max(highWaterBytes_, usedBytes_);
+                return pointer;
+            }
+        }
+        const size_t chunkSize = std::max({ minChunkSize_, bytes + alignment, chunks_.empty() ? 0 : chunks_.back().size * 2 });
+        chunks_.push_back({ std::make_unique_for_overwrite<std::byte[]>(chunkSize), chunkSize });
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void*, size_t, size_t) noexcept override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+public:
+    ArenaMemoryResource() = default;
+    ArenaMemoryResource(const ArenaMemoryResource&) = delete;
+    ArenaMemoryResource& operator=(const ArenaMemoryResource&) = delete;
+
+    /* Invalidates everything allocated from the arena. */
+    void reset()
+    {
+        if (chunks_.size() > 1)
+        {
+            size_t totalSize = 0;
+            for (const Chunk& chunk : chunks_)
+                totalSize += chunk.size;
+            chunks_.clear();
+            chunks_.push_back({ std::make_unique_for_overwrite<std::byte[]>(totalSize), totalSize });
+        }
+        chunkIndex_ = 0;
+        chunkOffset_ = 0;
+        usedBytes_ = 0;
+    }
+
+    size_t usedBytes() const noexcept { return usedBytes_; }
+    /* Most bytes ever in use between two resets. */
+    size_t highWaterBytes() const noexcept { return highWaterBytes_; }
+};
+
+namespace detail
+{
+
+inline thread_local std::pmr::memory_resource* frameResource = nullptr;
+
+}
+
+/* Memory resource for transient allocations on the calling thread, which must not outlive the current frame. This is
+ * the frame's arena while a VulkanFrameArenas frame is active on the thread, and the default resource otherwise, so
+ * code using it also works outside of frames and on threads without an arena. */
+inline std::pmr::memory_resource* frameMemoryResource() noexcept
+{
+    std::pmr::memory_resource* resource = detail::frameResource;
+    return resource ? resource : std::pmr::get_default_resource();
+}
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <gsl/gsl>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/* Work-stealing job system. Every worker owns a Chase-Lev deque it pushes to and pops from at the bottom, while idle
+ * workers steal from the top of other workers' deques. The thread that constructs the JobSystem is worker 0 and
+ * helps execute jobs while it waits; it is also the only thread that runs jobs submitted with main-thread affinity
+ * (SDL event handling and presentation must stay on it). */
+
+struct JobCounter
+{
+    std::atomic<uint32_t> pending = 0;
+
+    bool done() const noexcept { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+namespace detail
+{
+
+/* Type-erased job with inline storage for its closure, so that submitting a job never allocates. Closures larger than
+ * the storage should capture a pointer to their state instead. */
+struct alignas(64) Job
+{
+    constexpr static size_t storageSize = 48;
+
+    void (*invoke)(Job&) = nullptr;
+    JobCounter* counter = nullptr;
+    /* Set from submission until the job has run, while its slot can't be reused. */
+    std::atomic<bool> busy = false;
+    alignas(std::max_align_t) std::array<std::byte, storageSize> storage;
+
+    template <typename F>
+    void set(F&& function, JobCounter& jobCounter)
+    {
+        using Function = std::decay_t<F>;
+        static_assert(sizeof(Function) <= storageSize, "Job closure too large; capture a pointer to the state instead");
+        static_assert(alignof(Function) <= alignof(std::max_align_t));
+        static_assert(std::is_trivially_destructible_v<Function>, "Job closures are never destroyed, only overwritten");
+        new (storage.data()) Function(std::forward<F>(function));
+        invoke = [](Job& job) { (*std::launder(reinterpret_cast<Function*>(job.storage.data())))(); };
+        counter = &jobCounter;
+        busy.store(true, std::memory_order_relaxed);
+    }
+};
+
+struct JobThreadIdentity
+{
+    const void* system = nullptr;
+    size_t workerIndex = 0;
+};
+
+/* Chase-Lev deque as formulated for weak memory models by Lê, Pop, Cohen and Zappa Nardelli (PPoPP 2013). Fixed
+ * capacity; push() fails when full and the caller runs the job inline. */
+class WorkStealingDeque
+{
+    constexpr static int64_t capacity_ = 4096;
+    constexpr static int64_t mask_ = capacity_ - 1;
+    static_assert((capacity_ & mask_) == 0);
+
+    alignas(64) std::atomic<int64_t> top_ = 0;
+    alignas(64) std::atomic<int64_t> bottom_ = 0;
+    std::array<std::atomic<Job*>, capacity_> buffer_{};
+public:
+    /* Owner only. */
+    bool push(Job* job) noexcept
+    {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        if (bottom - top >= capacity_)
+            return false;
+        buffer_[bottom & mask_].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /* Owner only. */
+    Job* pop() noexcept
+    {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom)
+        {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job* job = buffer_[bottom & mask_].load(std::memory_order_relaxed);
+        if (top == bottom)
+        {
+            /* Last job: race any thief for it. */
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    /* Any thread. */
+    Job* steal() noexcept
+    {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return nullptr;
+        Job* job = buffer_[top & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+};
+
+}
+
+class JobSystem
+{
+    /* Jobs come from a per-worker ring, recycled after jobPoolSize submissions from the same worker. A submit whose
+     * slot is still outstanding helps run jobs until it has retired. */
+    constexpr static size_t jobPoolSize_ = 4096;
+
+    struct alignas(64) Worker
+    {
+        detail::WorkStealingDeque deque;
+        std::array<detail::Job, jobPoolSize_> jobPool;
+        size_t nextJob = 0;
+        std::minstd_rand random;
+    };
+
+    inline static thread_local detail::JobThreadIdentity identity_;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::jthread> threads_;
+
+    std::mutex mainThreadMutex_;
+    std::vector<detail::Job*> mainThreadJobs_;
+    /* Only touched by the main thread. Jobs in it are run in order through mainThreadNext_ rather than iterated, as a
+     * main-thread job that waits re-enters runMainThreadJobs_(). */
+    std::vector<detail::Job*> mainThreadRunning_;
+    size_t mainThreadNext_ = 0;
+    /* Main-thread jobs may be submitted from any worker, so they have their own pool. */
+    std::array<detail::Job, jobPoolSize_> mainThreadJobPool_;
+    size_t nextMainThreadJob_ = 0;
+
+    alignas(64) std::atomic<uint32_t> sleepingWorkers_ = 0;
+    alignas(64) std::atomic<uint32_t> wakeGeneration_ = 0;
+    std::atomic<bool> stopping_ = false;
+
+    size_t currentWorker_() const
+    {
+        Expects(identity_.system == this); // Jobs can only be submitted from the main thread or from other jobs.
+        return identity_.workerIndex;
+    }
+
+    /* Jobs must not throw: an escaping exception terminates, as it would on a std::thread. */
+    static void run_(detail::Job& job) noexcept
+    {
+        JobCounter* counter = job.counter;
+        job.invoke(job);
+        /* The slot may be reused as soon as it is released. */
+        job.busy.store(false, std::memory_order_release);
+        counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    detail::Job* findJob_(size_t workerIndex)
+    {
+        Worker& worker = *workers_[workerIndex];
+        if (detail::Job* job = worker.deque.pop())
+            return job;
+        const size_t workerCount = workers_.size();
+        const size_t start = worker.random() % workerCount;
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            const size_t victim = (start + i) % workerCount;
+            if (victim == workerIndex)
+                continue;
+            if (detail::Job* job = workers_[victim]->deque.steal())
+                return job;
+        }
+        return nullptr;
+    }
+
+    /* A nested call carries on with the batch of the call it interrupted, and only takes a new batch once that one is
+     * exhausted, so that every caller further up just finds nothing left to run. */
+    bool runMainThreadJobs_()
+    {
+        if (mainThreadNext_ == mainThreadRunning_.size())
+        {
+            mainThreadRunning_.clear();
+            mainThreadNext_ = 0;
+            const std::scoped_lock lock(mainThreadMutex_);
+            std::swap(mainThreadJobs_, mainThreadRunning_);
+        }
+        const bool ranAny = mainThreadNext_ < mainThreadRunning_.size();
+        while (mainThreadNext_ < mainThreadRunning_.size())
+            run_(*mainThreadRunning_[mainThreadNext_++]);
+        return ranAny;
+    }
+
+    /* Runs one job, if there is any, for a thread waiting on something. */
+    void help_(size_t workerIndex)
+    {
+        if (workerIndex == 0 && runMainThreadJobs_())
+            return;
+        if (detail::Job* job = findJob_(workerIndex))
+            run_(*job);
+        else
+            std::this_thread::yield();
+    }
+
+    void wakeWorkers_()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepingWorkers_.load(std::memory_order_relaxed) > 0)
+        {
+            wakeGeneration_.fetch_add(1, std::memory_order_release);
+            wakeGeneration_.notify_all();
+        }
+    }
+
+    void workerLoop_(size_t workerIndex)
+    {
+        identity_ = { this, workerIndex };
+        constexpr int spinsBeforeSleep = 64;
+        int spins = 0;
+        while (!stopping_.load(std::memory_order_acquire))
+        {
+            if (detail::Job* job = findJob_(workerIndex))
+            {
+                run_(*job);
+                spins = 0;
+                continue;
+            }
+            if (++spins < spinsBeforeSleep)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            /* Announce sleeping before the final check, so that a concurrent submit either sees us or we see its job. */
+            sleepingWorkers_.fetch_add(1, std::memory_order_seq_cst);
+            const uint32_t generation = wakeGeneration_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (detail::Job* job = findJob_(workerIndex))
+            {
+                sleepingWorkers_.fetch_sub(1, std::memory_order_relaxed);
+                run_(*job);
+            }
+            else
+            {
+                if (!stopping_.load(std::memory_order_acquire))
+                    wakeGeneration_.wait(generation, std::memory_order_acquire);
+                sleepingWorkers_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            spins = 0;
+        }
+    }
+public:
+    /* workerCount includes the calling thread. */
+    explicit JobSystem(size_t workerCount = std::max(1u, std::thread::hardware_concurrency()))
+    {
+        Expects(workerCount > 0);
+        Expects(identity_.system == nullptr);
+        workers_.reserve(workerCount);
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            workers_.push_back(std::make_unique<Worker>());
+            workers_.back()->random.seed(gsl::narrow_cast<uint32_t>(i + 1));
+        }
+        identity_ = { this, 0 };
+        threads_.reserve(workerCount - 1);
+        for (size_t i = 1; i < workerCount; i++)
+            threads_.emplace_back([this, i] { workerLoop_(i); });
+    }
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    JobSystem(JobSystem&&) = delete;
+    JobSystem& operator=(JobSystem&&) = delete;
+
+    ~JobSystem()
+    {
+        stopping_.store(true, std::memory_order_release);
+        wakeGeneration_.fetch_add(1, std::memory_order_release);
+        wakeGeneration_.notify_all();
+        threads_.clear();
+        identity_ = {};
+    }
+
+    size_t workerCount() const noexcept { return workers_.size(); }
+    /* Index of the calling worker, 0 for the main thread. Useful for per-worker resources like command pools. */
+    size_t workerIndex() const { return currentWorker_(); }
+
+    template <typename F>
+    void submit(JobCounter& counter, F&& function)
+    {
+        const size_t workerIndex = currentWorker_();
+        Worker& worker = *workers_[workerIndex];
+        detail::Job& job = worker.jobPool[worker.nextJob % jobPoolSize_];
+        while (job.busy.load(std::memory_order_acquire))
+            help_(workerIndex);
+        worker.nextJob++;
+        job.set(std::forward<F>(function), counter);
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        if (!worker.deque.push(&job))
+        {
+            run_(job);
+            return;
+        }
+        wakeWorkers_();
+    }
+
+    /* Runs function on the main thread, the next time it waits on a counter or calls runMainThreadJobs(). With
+     * jobPoolSize main-thread jobs outstanding, this waits for the main thread to run the oldest. */
+    template <typename F>
+    void submitMainThread(JobCounter& counter, F&& function)
+    {
+        const size_t workerIndex = currentWorker_();
+        for (;;)
+        {
+            {
+                const std::scoped_lock lock(mainThreadMutex_);
+                detail::Job& job = mainThreadJobPool_[nextMainThreadJob_ % jobPoolSize_];
+                if (!job.busy.load(std::memory_order_acquire))
+                {
+                    nextMainThreadJob_++;
+                    counter.pending.fetch_add(1, std::memory_order_relaxed);
+                    job.set(std::forward<F>(function), counter);
+                    mainThreadJobs_.push_back(&job);
+                    return;
+                }
+            }
+            help_(workerIndex);
+        }
+    }
+
+    void runMainThreadJobs()
+    {
+        Expects(currentWorker_() == 0);
+        runMainThreadJobs_();
+    }
+
+    /* Helps executing jobs until counter reaches zero. */
+    void wait(const JobCounter& counter)
+    {
+        const size_t workerIndex = currentWorker_();
+        while (!counter.done())
+            help_(workerIndex);
+    }
+
+    /* Splits [0, count) into batches of batchSize and runs function(begin, end) on each, returning once all are done.
+     * function must outlive the call, which it does when passed as a temporary. */
+    template <typename F>
+    void parallelFor(size_t count, size_t batchSize, F&& function)
+    {
+        Expects(batchSize > 0);
+        JobCounter counter;
+        auto* functionPointer = &function;
+        for (size_t begin = 0; begin < count; begin += batchSize)
+        {
+            const size_t end = std::min(count, begin + batchSize);
+            submit(counter, [functionPointer, begin, end] { (*functionPointer)(begin, end); });
+        }
+        wait(counter);
+    }
+};
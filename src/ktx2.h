@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vk_types.h"
+#include "mapped_file.h"
+
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+/* Header and level index of a KTX 2.0 file (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html), parsed in
+ * place. Only what the texture streamer needs is supported: 2D textures without array layers, faces or
+ * supercompression, in a format Vulkan can sample directly. Basis Universal payloads would need a transcoder. */
+class Ktx2Image
+{
+    constexpr static std::array<uint8_t, 12> identifier_ = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    struct Header
+    {
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        /* Followed by the 64-bit sgdByteOffset and sgdByteLength, which would misalign the struct and aren't needed
+         * without supercompression. */
+    };
+    static_assert(sizeof(Header) == 52);
+    constexpr static size_t levelIndexOffset_ = sizeof(identifier_) + sizeof(Header) + 2 * sizeof(uint64_t);
+
+    struct LevelIndex
+    {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    vk::Format format_;
+    vk::Extent2D extent_;
+    bool generateMips_;
+    std::vector<gsl::span<const std::byte>> levels_;
+public:
+    /* data must outlive the Ktx2Image; level data points into it. */
+    explicit Ktx2Image(gsl::span<const std::byte> data)
+    {
+        if (data.size() < levelIndexOffset_ || std::memcmp(data.data(), identifier_.data(), identifier_.size()) != 0)
+            throw FatalError("Not a KTX2 file");
+        Header header;
+        std::memcpy(&header, data.data() + identifier_.size(), sizeof(Header));
+
+        if (header.vkFormat == VK_FORMAT_UNDEFINED)
+            throw FatalError("KTX2 files with Basis Universal payloads are not supported");
+        if (header.supercompressionScheme != 0)
+            throw FatalError("Supercompressed KTX2 files are not supported");
+        if (header.pixelHeight == 0 || header.pixelDepth != 0 || header.layerCount > 1 || header.faceCount != 1)
+            throw FatalError("Only 2D KTX2 textures are supported");
+        format_ = static_cast<vk::Format>(header.vkFormat);
+        extent_ = vk::Extent2D(header.pixelWidth, header.pixelHeight);
+        /* A level count of 0 asks the loader to generate the mip chain. */
+        generateMips_ = header.levelCount == 0;
+
+        const size_t levelCount = std::max(header.levelCount, 1u);
+        if (data.size() < levelIndexOffset_ + levelCount * sizeof(LevelIndex))
+            throw FatalError("Truncated KTX2 level index");
+        levels_.reserve(levelCount);
+        for (size_t i = 0; i < levelCount; i++)
+        {
+            LevelIndex level;
+            std::memcpy(&level, data.data() + levelIndexOffset_ + i * sizeof(LevelIndex), sizeof(LevelIndex));
+            if (level.byteOffset > data.size() || level.byteLength > data.size() - level.byteOffset)
+                throw FatalError("KTX2 level data out of bounds");
+            levels_.push_back(data.subspan(gsl::narrow<size_t>(level.byteOffset), gsl::narrow<size_t>(level.byteLength)));
+        }
+    }
+
+    vk::Format format() const noexcept { return format_; }
+    vk::Extent2D extent() const noexcept { return extent_; }
+    /* Levels stored in the file; level 0 is the full-resolution one. */
+    uint32_t levelCount() const noexcept { return gsl::narrow_cast<uint32_t>(levels_.size()); }
+    bool generateMips() const noexcept { return generateMips_; }
+    gsl::span<const std::byte> level(uint32_t mip) const { return levels_.at(mip); }
+};
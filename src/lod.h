@@ -0,0 +1,79 @@
+#pragma once
+
+#include "vk_types.h"
+#include "mesh_simplifier.h"
+
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+/* Picks each object's level of detail from how large its simplification error would appear on screen: the coarsest
+ * level whose error projects to at most thresholdPixels. An object only switches once the error has moved hysteresis
+ * (as a fraction of the threshold) past it, so that objects hovering around a switching distance don't pop back and
+ * forth. Errors and distances are in the same units; scale errors of scaled objects first. */
+class LodSelector
+{
+    float pixelsPerUnit_; // of a length at distance 1, across the view direction
+    float refineAbove_;
+    float coarsenBelow_;
+public:
+    /* projection is the one the frame is rendered with; only its vertical field of view matters. */
+    LodSelector(const glm::mat4& projection, uint32_t viewportHeight, float thresholdPixels = 1.0f, float hysteresis = 0.25f) :
+        pixelsPerUnit_(0.5f * static_cast<float>(viewportHeight) * std::abs(projection[1][1])),
+        refineAbove_(thresholdPixels * (1.0f + hysteresis)),
+        coarsenBelow_(thresholdPixels * (1.0f - hysteresis))
+    {
+        Expects(thresholdPixels > 0.0f && hysteresis >= 0.0f && hysteresis < 1.0f);
+    }
+
+    float projectedError(float error, float distance) const noexcept { return error * pixelsPerUnit_ / distance; }
+
+    /* distance is to the nearest point of the object's bounds, previous the level it was drawn at last time. */
+    uint32_t select(gsl::span<const MeshLod> lods, float distance, uint32_t previous) const
+    {
+        Expects(!lods.empty());
+        if (!(distance > 0.0f))
+            return 0;
+        const uint32_t coarsest = gsl::narrow_cast<uint32_t>(lods.size() - 1);
+        uint32_t lod = std::min(previous, coarsest);
+        while (lod > 0 && projectedError(lods[lod].error, distance) > refineAbove_)
+            lod--;
+        while (lod < coarsest && projectedError(lods[lod + 1].error, distance) <= coarsenBelow_)
+            lod++;
+        return lod;
+    }
+};
+
+/* Instances and triangles submitted per level of detail, before GPU occlusion culling, against what drawing every
+ * instance at full detail would have cost. */
+class LodStats
+{
+    std::vector<uint64_t> instances_;
+    uint64_t triangles_ = 0;
+    uint64_t fullDetailTriangles_ = 0;
+public:
+    explicit LodStats(size_t lodCount) : instances_(lodCount, 0) {}
+
+    void reset() noexcept
+    {
+        std::ranges::fill(instances_, 0);
+        triangles_ = fullDetailTriangles_ = 0;
+    }
+
+    void add(gsl::span<const MeshLod> lods, size_t lod, uint64_t instanceCount)
+    {
+        instances_.at(lod) += instanceCount;
+        triangles_ += instanceCount * (lods[lod].indexCount / 3);
+        fullDetailTriangles_ += instanceCount * (lods[0].indexCount / 3);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const LodStats& stats)
+    {
+        for (size_t lod = 0; lod < stats.instances_.size(); lod++)
+            os << (lod == 0 ? "" : " / ") << stats.instances_[lod];
+        os << " instances per level, " << stats.triangles_ << " triangles of " << stats.fullDetailTriangles_ << " at full detail";
+        if (stats.triangles_ != 0)
+            os << " (" << static_cast<double>(stats.fullDetailTriangles_) / static_cast<double>(stats.triangles_) << "x fewer)";
+        return os;
+    }
+};
@@ -2,15 +2,36 @@
 
 #include <Colors.h>
 #include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
 
 int main(int argc, const char* argv[])
 {
-    std::ignore = argc;
-    std::ignore = argv;
+    /* --metrics <file.csv|file.json> exports the metrics registry for graphing.
+     * --capture <file> captures every frame's commands for vulkan-replay.
+     * --particles <count> sets the capacity of the particle system; 0 disables it.
+     * --tearing lets the swapchain fall back to immediate presents, which tear, when mailbox is unavailable. */
+    EngineOptions options;
+    const std::span arguments(argv, static_cast<size_t>(argc));
+    for (size_t i = 1; i < arguments.size(); i++)
+    {
+        const std::string_view argument = arguments[i];
+        if (argument == "--tearing")
+            options.presentPolicy = PresentPolicy::LowestLatencyTearing;
+        else if (i + 1 == arguments.size())
+            break;
+        else if (argument == "--metrics")
+            options.metricsPath = arguments[++i];
+        else if (argument == "--capture")
+            options.capturePath = arguments[++i];
+        else if (argument == "--particles")
+            options.particleCount = gsl::narrow<uint32_t>(std::stoul(arguments[++i]));
+    }
 
-    VulkanEngine engine;
     try
     {
+        VulkanEngine engine(options);
         for (;;)
             engine.run();
     }
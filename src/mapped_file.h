@@ -0,0 +1,137 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Read-only memory mapping of a whole file. Pages are faulted in as they are read, so only the parts of a file that
+ * are actually used ever get loaded. */
+class MappedFile
+{
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+
+    void close_() noexcept
+    {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = nullptr;
+#else
+        if (data_)
+            munmap(const_cast<std::byte*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+public:
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+        const auto fail = [&](const char* what)
+        {
+            close_();
+            throw FatalError(std::string(what) + " " + path.string());
+        };
+#ifdef _WIN32
+        file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            fail("Failed to open");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size))
+            fail("Failed to stat");
+        size_ = gsl::narrow<size_t>(size.QuadPart);
+        if (size_ == 0)
+            return;
+        mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_)
+            fail("Failed to map");
+        data_ = static_cast<const std::byte*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_)
+            fail("Failed to map");
+#else
+        const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0)
+            fail("Failed to open");
+        struct stat status {};
+        if (fstat(file, &status) != 0)
+        {
+            ::close(file);
+            fail("Failed to stat");
+        }
+        size_ = gsl::narrow<size_t>(status.st_size);
+        if (size_ == 0)
+        {
+            ::close(file);
+            return;
+        }
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+        /* The mapping keeps the file referenced. */
+        ::close(file);
+        if (data == MAP_FAILED)
+            fail("Failed to map");
+        data_ = static_cast<const std::byte*>(data);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept :
+        data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+#ifdef _WIN32
+        , file_(std::exchange(other.file_, INVALID_HANDLE_VALUE)), mapping_(std::exchange(other.mapping_, nullptr))
+#endif
+    {}
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close_();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+#ifdef _WIN32
+            file_ = std::exchange(other.file_, INVALID_HANDLE_VALUE);
+            mapping_ = std::exchange(other.mapping_, nullptr);
+#endif
+        }
+        return *this;
+    }
+    ~MappedFile() { close_(); }
+
+    gsl::span<const std::byte> data() const noexcept { return { data_, size_ }; }
+
+    /* Asks the OS to start reading range in, so that touching it later doesn't block on the disk. */
+    void prefetch(gsl::span<const std::byte> range) const noexcept
+    {
+        if (range.empty())
+            return;
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY entry{ const_cast<std::byte*>(range.data()), range.size() };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#else
+        const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        const auto begin = reinterpret_cast<uintptr_t>(range.data()) & ~(pageSize - 1);
+        const auto end = reinterpret_cast<uintptr_t>(range.data() + range.size());
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#endif
+    }
+};
@@ -0,0 +1,438 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/* Load-time mesh optimization: vertex deduplication, post-transform vertex cache reordering (Forsyth), overdraw
+ * reduction (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw") and vertex fetch
+ * reordering. All passes operate on triangle lists. */
+
+template <typename T>
+concept MeshIndex = std::same_as<T, uint16_t> || std::same_as<T, uint32_t>;
+
+template <typename Vertex, MeshIndex Index>
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<Index> indices;
+};
+
+struct VertexCacheStatistics
+{
+    size_t cacheMisses = 0;
+    /* Average cache miss ratio: transformed vertices per triangle. 0.5 is the ideal for large regular meshes, 3 the worst. */
+    double acmr = 0.0;
+    /* Average transform to vertex ratio: transformed vertices per referenced vertex. 1 is the ideal. */
+    double atvr = 0.0;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const VertexCacheStatistics& statistics)
+{
+    return os << "ACMR " << statistics.acmr << ", ATVR " << statistics.atvr << " (" << statistics.cacheMisses << " transforms)";
+}
+
+namespace detail
+{
+
+/* FIFO cache of post-transform vertices, as found on most hardware. */
+class VertexCacheSimulator
+{
+    std::vector<uint32_t> timestamps_;
+    uint32_t time_;
+    uint32_t cacheSize_;
+public:
+    VertexCacheSimulator(size_t vertexCount, uint32_t cacheSize)
+        : timestamps_(vertexCount, 0u), time_(cacheSize + 1u), cacheSize_(cacheSize) {}
+
+    /* Returns true on a cache miss. */
+    bool access(uint32_t vertex)
+    {
+        if (time_ - timestamps_.at(vertex) > cacheSize_)
+        {
+            timestamps_[vertex] = time_++;
+            return true;
+        }
+        return false;
+    }
+};
+
+}
+
+constexpr uint32_t defaultVertexCacheSize = 16;
+
+template <MeshIndex Index>
+VertexCacheStatistics analyzeVertexCache(gsl::span<const Index> indices, size_t vertexCount, uint32_t cacheSize = defaultVertexCacheSize)
+{
+    Expects(indices.size() % 3 == 0);
+    VertexCacheStatistics statistics;
+    if (indices.empty())
+        return statistics;
+
+    detail::VertexCacheSimulator cache(vertexCount, cacheSize);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t referencedCount = 0;
+    for (const Index index : indices)
+    {
+        statistics.cacheMisses += cache.access(index) ? 1u : 0u;
+        if (!referenced.at(index))
+        {
+            referenced[index] = true;
+            referencedCount++;
+        }
+    }
+    statistics.acmr = static_cast<double>(statistics.cacheMisses) / static_cast<double>(indices.size() / 3);
+    statistics.atvr = static_cast<double>(statistics.cacheMisses) / static_cast<double>(referencedCount);
+    return statistics;
+}
+
+/* Merges bitwise-identical vertices and rewrites the indices. Returns the new vertex count. Padding bytes take part in
+ * the comparison, so vertices with padding may not all merge; the engine's vertex structs have none. */
+template <typename Vertex, MeshIndex Index>
+size_t deduplicateVertices(std::vector<Vertex>& vertices, std::vector<Index>& indices)
+{
+    static_assert(std::is_trivially_copyable_v<Vertex>, "Vertices are compared bytewise");
+    std::vector<uint32_t> remap(vertices.size());
+    std::vector<Vertex> unique;
+    unique.reserve(vertices.size());
+    {
+        /* Keys view the original vertex storage, which is left untouched until the map is gone. */
+        std::unordered_map<std::string_view, uint32_t> lookup;
+        lookup.reserve(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const std::string_view key(reinterpret_cast<const char*>(&vertices[i]), sizeof(Vertex));
+            const auto [it, inserted] = lookup.try_emplace(key, gsl::narrow_cast<uint32_t>(unique.size()));
+            if (inserted)
+                unique.push_back(vertices[i]);
+            remap[i] = it->second;
+        }
+    }
+    for (Index& index : indices)
+        index = gsl::narrow_cast<Index>(remap.at(index));
+    vertices = std::move(unique);
+    return vertices.size();
+}
+
+/* Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Greedily emits the triangle with the best score, where
+ * vertices recently used or with few remaining triangles score higher. */
+template <MeshIndex Index>
+void optimizeVertexCache(gsl::span<Index> indices, size_t vertexCount)
+{
+    Expects(indices.size() % 3 == 0);
+    constexpr size_t cacheSize = 32;
+    constexpr size_t maxValence = 32;
+    constexpr float lastTriangleScore = 0.75f;
+    constexpr float cacheDecayPower = 1.5f;
+    constexpr float valenceBoostScale = 2.0f;
+    constexpr float valenceBoostPower = -0.5f;
+
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    static const auto [cacheScores, valenceScores] = []
+    {
+        std::array<float, cacheSize> cache{};
+        std::array<float, maxValence + 1> valence{};
+        for (size_t i = 0; i < cacheSize; i++)
+            cache[i] = i < 3 ? lastTriangleScore
+                             : std::pow(1.0f - static_cast<float>(i - 3) / static_cast<float>(cacheSize - 3), cacheDecayPower);
+        valence[0] = 0.0f;
+        for (size_t i = 1; i <= maxValence; i++)
+            valence[i] = valenceBoostScale * std::pow(static_cast<float>(i), valenceBoostPower);
+        return std::pair(cache, valence);
+    }();
+
+    /* Vertex to triangle adjacency in CSR form. */
+    std::vector<uint32_t> liveTriangles(vertexCount, 0u);
+    for (const Index index : indices)
+        liveTriangles.at(index)++;
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0u);
+    for (size_t i = 0; i < vertexCount; i++)
+        adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = gsl::narrow_cast<uint32_t>(i / 3);
+    }
+
+    constexpr int32_t notCached = -1;
+    std::vector<int32_t> cachePositions(vertexCount, notCached);
+    const auto vertexScore = [&](uint32_t vertex)
+    {
+        const uint32_t live = liveTriangles[vertex];
+        if (live == 0)
+            return -1.0f;
+        const int32_t position = cachePositions[vertex];
+        const float cacheScore = position == notCached ? 0.0f : cacheScores.at(static_cast<size_t>(position));
+        return cacheScore + valenceScores.at(std::min<size_t>(live, maxValence));
+    };
+
+    std::vector<float> vertexScores(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(v);
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<Index> output;
+    output.reserve(indices.size());
+    std::array<uint32_t, cacheSize + 3> cache{};
+    size_t cacheCount = 0;
+    size_t deadEndCursor = 0;
+
+    auto bestTriangle = std::optional<uint32_t>(
+        gsl::narrow_cast<uint32_t>(std::ranges::max_element(triangleScores) - triangleScores.begin()));
+    while (bestTriangle)
+    {
+        const uint32_t triangle = *bestTriangle;
+        emitted[triangle] = true;
+        std::array<uint32_t, cacheSize + 3> newCache{};
+        size_t newCacheCount = 0;
+        for (size_t k = 0; k < 3; k++)
+        {
+            const uint32_t vertex = indices[triangle * 3 + k];
+            output.push_back(gsl::narrow_cast<Index>(vertex));
+            newCache[newCacheCount++] = vertex;
+
+            /* Remove the triangle from the vertex's live adjacency list. */
+            const auto begin = adjacency.begin() + adjacencyOffsets[vertex];
+            const auto end = begin + liveTriangles[vertex];
+            std::iter_swap(std::find(begin, end, triangle), end - 1);
+            liveTriangles[vertex]--;
+        }
+        for (size_t i = 0; i < cacheCount; i++)
+        {
+            const uint32_t vertex = cache[i];
+            if (std::find(newCache.begin(), newCache.begin() + 3, vertex) == newCache.begin() + 3)
+                newCache[newCacheCount++] = vertex;
+        }
+        for (size_t i = cacheSize; i < newCacheCount; i++)
+        {
+            /* Evicted vertices lose their cache score. */
+            const uint32_t vertex = newCache[i];
+            cachePositions[vertex] = notCached;
+            const float score = vertexScore(vertex);
+            const float delta = score - vertexScores[vertex];
+            vertexScores[vertex] = score;
+            for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex] + liveTriangles[vertex]; a++)
+                triangleScores[adjacency[a]] += delta;
+        }
+        cacheCount = std::min(newCacheCount, cacheSize);
+        cache = newCache;
+
+        std::optional<uint32_t> next;
+        float nextScore = -1.0f;
+        for (size_t i = 0; i < cacheCount; i++)
+        {
+            const uint32_t vertex = cache[i];
+            cachePositions[vertex] = static_cast<int32_t>(i);
+            const float score = vertexScore(vertex);
+            const float delta = score - vertexScores[vertex];
+            vertexScores[vertex] = score;
+            for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex] + liveTriangles[vertex]; a++)
+            {
+                const uint32_t adjacent = adjacency[a];
+                triangleScores[adjacent] += delta;
+                if (triangleScores[adjacent] > nextScore)
+                {
+                    nextScore = triangleScores[adjacent];
+                    next = adjacent;
+                }
+            }
+        }
+        if (!next)
+        {
+            /* Dead end: nothing in the cache has triangles left, so restart from the first unemitted triangle. */
+            while (deadEndCursor < triangleCount && emitted[deadEndCursor])
+                deadEndCursor++;
+            if (deadEndCursor < triangleCount)
+                next = gsl::narrow_cast<uint32_t>(deadEndCursor);
+        }
+        bestTriangle = next;
+    }
+    std::ranges::copy(output, indices.begin());
+}
+
+/* Splits the (cache-optimized) triangle order into clusters and sorts them so that outward-facing clusters on the
+ * hull of the mesh are drawn first. threshold bounds how much the ACMR may degrade, 1.05 allows 5%. */
+template <MeshIndex Index, typename Vertex, typename PositionFn>
+    requires std::convertible_to<std::invoke_result_t<PositionFn, const Vertex&>, glm::vec3>
+void optimizeOverdraw(gsl::span<Index> indices, gsl::span<const Vertex> vertices, PositionFn&& position, float threshold = 1.05f)
+{
+    Expects(indices.size() % 3 == 0);
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    /* Hard boundaries wherever a triangle misses on all three vertices, i.e. the cache order restarted. */
+    std::vector<uint32_t> triangleMisses(triangleCount);
+    {
+        detail::VertexCacheSimulator cache(vertices.size(), defaultVertexCacheSize);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (size_t k = 0; k < 3; k++)
+                triangleMisses[t] += cache.access(indices[t * 3 + k]) ? 1u : 0u;
+    }
+    std::vector<size_t> hardBoundaries;
+    for (size_t t = 0; t < triangleCount; t++)
+        if (t == 0 || triangleMisses[t] == 3)
+            hardBoundaries.push_back(t);
+    hardBoundaries.push_back(triangleCount);
+
+    /* Soft boundaries inside each hard cluster, wherever the running ACMR is already within the threshold of the
+     * cluster's overall ACMR, so that splitting there doesn't cost cache efficiency. */
+    constexpr size_t minClusterSize = 8;
+    std::vector<size_t> clusterStarts;
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); h++)
+    {
+        const size_t begin = hardBoundaries[h];
+        const size_t end = hardBoundaries[h + 1];
+        size_t clusterMisses = 0;
+        for (size_t t = begin; t < end; t++)
+            clusterMisses += triangleMisses[t];
+        const double clusterAcmr = static_cast<double>(clusterMisses) / static_cast<double>(end - begin);
+
+        clusterStarts.push_back(begin);
+        size_t runningMisses = 0;
+        size_t runningTriangles = 0;
+        for (size_t t = begin; t < end; t++)
+        {
+            runningMisses += triangleMisses[t];
+            runningTriangles++;
+            const double runningAcmr = static_cast<double>(runningMisses) / static_cast<double>(runningTriangles);
+            if (runningTriangles >= minClusterSize && t + 1 < end && runningAcmr <= clusterAcmr * threshold)
+            {
+                clusterStarts.push_back(t + 1);
+                runningMisses = 0;
+                runningTriangles = 0;
+            }
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    glm::vec3 meshCentroid(0.0f);
+    for (const Vertex& vertex : vertices)
+        meshCentroid += glm::vec3(position(vertex));
+    meshCentroid /= static_cast<float>(std::max<size_t>(vertices.size(), 1));
+
+    struct Cluster
+    {
+        size_t begin;
+        size_t end;
+        float sortKey;
+    };
+    std::vector<Cluster> clusters;
+    clusters.reserve(clusterStarts.size() - 1);
+    for (size_t c = 0; c + 1 < clusterStarts.size(); c++)
+    {
+        Cluster cluster{ clusterStarts[c], clusterStarts[c + 1], 0.0f };
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = cluster.begin; t < cluster.end; t++)
+        {
+            const glm::vec3 p0 = position(vertices[indices[t * 3]]);
+            const glm::vec3 p1 = position(vertices[indices[t * 3 + 1]]);
+            const glm::vec3 p2 = position(vertices[indices[t * 3 + 2]]);
+            const glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+            const float triangleArea = glm::length(areaNormal);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += areaNormal;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : meshCentroid;
+        const float normalLength = glm::length(normal);
+        cluster.sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+        clusters.push_back(cluster);
+    }
+    std::ranges::stable_sort(clusters, std::ranges::greater{}, &Cluster::sortKey);
+
+    std::vector<Index> output;
+    output.reserve(indices.size());
+    for (const Cluster& cluster : clusters)
+        output.insert(output.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+    std::ranges::copy(output, indices.begin());
+}
+
+/* Reorders vertices by first use so that vertex fetches are sequential, dropping unreferenced vertices. Returns the
+ * new vertex count. */
+template <typename Vertex, MeshIndex Index>
+size_t optimizeVertexFetch(std::vector<Vertex>& vertices, gsl::span<Index> indices)
+{
+    constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (Index& index : indices)
+    {
+        uint32_t& newIndex = remap.at(index);
+        if (newIndex == unused)
+        {
+            newIndex = gsl::narrow_cast<uint32_t>(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = gsl::narrow_cast<Index>(newIndex);
+    }
+    vertices = std::move(reordered);
+    return vertices.size();
+}
+
+struct MeshOptimizationReport
+{
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    VertexCacheStatistics before;
+    VertexCacheStatistics after;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const MeshOptimizationReport& report)
+{
+    return os << "Vertices " << report.verticesBefore << " -> " << report.verticesAfter << "\n"
+              << "\tBefore: " << report.before << "\n"
+              << "\tAfter:  " << report.after;
+}
+
+/* Runs every pass in the order they depend on each other: deduplication first so the cache passes see shared
+ * vertices, overdraw after cache optimization since it clusters the cache-optimized order, and fetch last since it
+ * only renumbers vertices. */
+template <typename Vertex, MeshIndex Index, typename PositionFn>
+MeshOptimizationReport optimizeMesh(MeshData<Vertex, Index>& mesh, PositionFn&& position)
+{
+    MeshOptimizationReport report;
+    report.verticesBefore = mesh.vertices.size();
+
+    deduplicateVertices(mesh.vertices, mesh.indices);
+    /* Measured after deduplication, since cache statistics of an unshared triangle soup are trivially the worst. */
+    report.before = analyzeVertexCache<Index>(mesh.indices, mesh.vertices.size());
+    optimizeVertexCache<Index>(mesh.indices, mesh.vertices.size());
+    optimizeOverdraw<Index, Vertex>(mesh.indices, mesh.vertices, std::forward<PositionFn>(position));
+    optimizeVertexFetch<Vertex, Index>(mesh.vertices, mesh.indices);
+
+    report.verticesAfter = mesh.vertices.size();
+    report.after = analyzeVertexCache<Index>(mesh.indices, mesh.vertices.size());
+    return report;
+}
+
+/* Builds an indexed mesh from a triangle list soup, one index per vertex. Run optimizeMesh afterwards. */
+template <MeshIndex Index, typename Vertex>
+MeshData<Vertex, Index> makeIndexedMesh(std::vector<Vertex> vertices)
+{
+    Expects(vertices.size() <= std::numeric_limits<Index>::max());
+    std::vector<Index> indices(vertices.size());
+    std::iota(indices.begin(), indices.end(), Index{ 0 });
+    return { std::move(vertices), std::move(indices) };
+}
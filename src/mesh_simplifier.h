@@ -0,0 +1,288 @@
+#pragma once
+
+#include "vk_types.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+/* Load-time mesh simplification for levels of detail, by quadric error metric edge collapses (Garland and Heckbert,
+ * "Surface Simplification Using Quadric Error Metrics"). A collapse always moves a vertex onto one of its
+ * neighbours, so simplified index lists still index the original vertices and all levels of a mesh can share one
+ * vertex buffer. */
+
+/* One level of detail: a range of the mesh's index buffer, and the largest distance between it and the full-detail
+ * surface, in model units. */
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+namespace detail
+{
+
+/* Weighted sum of squared distances to a set of planes, as a symmetric 4x4 matrix, and the sum of the weights.
+ * Accumulated in double, as the terms of large, flat meshes cancel out. */
+struct Quadric
+{
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+    double weight = 0;
+
+    /* Plane ax + by + cz + d = 0 with a unit normal. */
+    static Quadric fromPlane(const glm::vec3& normal, float d, double weight) noexcept
+    {
+        const double a = normal.x, b = normal.y, c = normal.z;
+        return { weight * a * a, weight * a * b, weight * a * c, weight * a * d, weight * b * b,
+                 weight * b * c, weight * b * d, weight * c * c, weight * c * d, weight * d * d, weight };
+    }
+
+    Quadric& operator+=(const Quadric& other) noexcept
+    {
+        a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad; b2 += other.b2;
+        bc += other.bc; bd += other.bd; c2 += other.c2; cd += other.cd; d2 += other.d2;
+        weight += other.weight;
+        return *this;
+    }
+    friend Quadric operator+(Quadric left, const Quadric& right) noexcept { return left += right; }
+
+    /* The weighted mean squared distance of p to the planes. */
+    double evaluate(const glm::vec3& p) const noexcept
+    {
+        if (weight == 0.0)
+            return 0.0;
+        const double x = p.x, y = p.y, z = p.z;
+        const double result = a2 * x * x + b2 * y * y + c2 * z * z + 2.0 * (ab * x * y + ac * x * z + bc * y * z) +
+                              2.0 * (ad * x + bd * y + cd * z) + d2;
+        /* Rounding can take an exact fit slightly negative. */
+        return std::max(result / weight, 0.0);
+    }
+};
+
+inline uint64_t edgeKey(uint32_t from, uint32_t to) noexcept { return (uint64_t(from) << 32) | to; }
+
+}
+
+/* Collapses edges of a triangle list, cheapest first, until it has at most targetIndexCount indices or the next
+ * collapse would move the surface by more than maxError. Returns the largest error introduced, as a distance in model
+ * units. Open borders are kept in place by planes perpendicular to them, and vertices that share a position with
+ * another one, i.e. attribute seams, are never moved. Every pass collapses an independent set of edges, whose
+ * neighbourhoods don't overlap, and skips collapses that would flip a triangle. */
+template <MeshIndex Index, typename Vertex, typename PositionFn>
+float simplifyMesh(std::vector<Index>& indices, gsl::span<const Vertex> vertices, PositionFn&& position, size_t targetIndexCount,
+                   float maxError = std::numeric_limits<float>::max())
+{
+    Expects(indices.size() % 3 == 0);
+    using detail::Quadric;
+    /* Borders weigh as much as a large face, so that they only move where they are straight. */
+    constexpr double borderWeight = 10.0;
+
+    const size_t vertexCount = vertices.size();
+    std::vector<glm::vec3> positions(vertexCount);
+    std::ranges::transform(vertices, positions.begin(), position);
+
+    std::vector<bool> locked(vertexCount, false);
+    {
+        const auto positionKey = [&](uint32_t vertex)
+        {
+            const glm::vec3& p = positions[vertex];
+            return std::array{ std::bit_cast<uint32_t>(p.x), std::bit_cast<uint32_t>(p.y), std::bit_cast<uint32_t>(p.z) };
+        };
+        std::vector<uint32_t> order(vertexCount);
+        std::iota(order.begin(), order.end(), 0u);
+        std::ranges::sort(order, {}, positionKey);
+        for (size_t i = 1; i < order.size(); i++)
+            if (positionKey(order[i - 1]) == positionKey(order[i]))
+                locked[order[i - 1]] = locked[order[i]] = true;
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    {
+        std::vector<uint64_t> directedEdges;
+        directedEdges.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (size_t corner = 0; corner < 3; corner++)
+                directedEdges.push_back(detail::edgeKey(indices[i + corner], indices[i + (corner + 1) % 3]));
+        std::ranges::sort(directedEdges);
+
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            const glm::vec3 normal = glm::cross(positions[indices[i + 1]] - positions[indices[i]], positions[indices[i + 2]] - positions[indices[i]]);
+            const float doubleArea = glm::length(normal);
+            if (doubleArea == 0.0f)
+                continue;
+            const glm::vec3 unitNormal = normal / doubleArea;
+            const Quadric face = Quadric::fromPlane(unitNormal, -glm::dot(unitNormal, positions[indices[i]]), 0.5 * doubleArea);
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                const Index from = indices[i + corner];
+                const Index to = indices[i + (corner + 1) % 3];
+                quadrics[from] += face;
+                /* An edge without its opposite belongs to one triangle only. */
+                if (std::ranges::binary_search(directedEdges, detail::edgeKey(to, from)))
+                    continue;
+                const glm::vec3 edge = positions[to] - positions[from];
+                const float edgeLength = glm::length(edge);
+                if (edgeLength == 0.0f)
+                    continue;
+                const glm::vec3 borderNormal = glm::normalize(glm::cross(edge, unitNormal));
+                const Quadric border = Quadric::fromPlane(borderNormal, -glm::dot(borderNormal, positions[from]),
+                                                          borderWeight * edgeLength * edgeLength);
+                quadrics[from] += border;
+                quadrics[to] += border;
+            }
+        }
+    }
+
+    struct Collapse
+    {
+        Index from;
+        Index to;
+        float error;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint64_t> edges;
+    std::vector<uint32_t> triangleOffsets;
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<bool> touched;
+    float resultError = 0.0f;
+    while (indices.size() > targetIndexCount)
+    {
+        /* Every edge once, collapsed in its cheaper direction. */
+        edges.clear();
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                const Index a = indices[i + corner];
+                const Index b = indices[i + (corner + 1) % 3];
+                edges.push_back(detail::edgeKey(std::min(a, b), std::max(a, b)));
+            }
+        std::ranges::sort(edges);
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        collapses.clear();
+        for (const uint64_t edge : edges)
+        {
+            const auto a = static_cast<Index>(edge >> 32);
+            const auto b = static_cast<Index>(edge & 0xffffffffu);
+            const Quadric combined = quadrics[a] + quadrics[b];
+            const double costToB = locked[a] ? std::numeric_limits<double>::infinity() : combined.evaluate(positions[b]);
+            const double costToA = locked[b] ? std::numeric_limits<double>::infinity() : combined.evaluate(positions[a]);
+            const double cost = std::min(costToA, costToB);
+            if (!std::isfinite(cost))
+                continue;
+            const auto error = static_cast<float>(std::sqrt(cost));
+            if (error <= maxError)
+                collapses.push_back(costToB <= costToA ? Collapse{ a, b, error } : Collapse{ b, a, error });
+        }
+        std::ranges::sort(collapses, {}, &Collapse::error);
+
+        /* Triangles around each vertex, for the flip test. */
+        triangleOffsets.assign(vertexCount + 1, 0);
+        for (const Index index : indices)
+            triangleOffsets[index + 1]++;
+        std::partial_sum(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin());
+        vertexTriangles.resize(indices.size());
+        {
+            std::vector<uint32_t> cursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++)
+                vertexTriangles[cursor[indices[i]]++] = gsl::narrow_cast<uint32_t>(i / 3);
+        }
+        const auto trianglesAround = [&](Index vertex)
+        {
+            return gsl::span(vertexTriangles).subspan(triangleOffsets[vertex], triangleOffsets[vertex + 1] - triangleOffsets[vertex]);
+        };
+        const auto flips = [&](const Collapse& collapse)
+        {
+            for (const uint32_t triangle : trianglesAround(collapse.from))
+            {
+                const auto corners = gsl::span(indices).subspan(size_t{ triangle } * 3, 3);
+                if (std::ranges::find(corners, collapse.to) != corners.end())
+                    continue; // Degenerates and is removed
+                std::array<glm::vec3, 3> before;
+                std::array<glm::vec3, 3> after;
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    before[corner] = positions[corners[corner]];
+                    after[corner] = corners[corner] == collapse.from ? positions[collapse.to] : before[corner];
+                }
+                const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+                    return true;
+            }
+            return false;
+        };
+
+        touched.assign(vertexCount, false);
+        const size_t trianglesToRemove = (indices.size() - targetIndexCount + 2) / 3;
+        size_t trianglesRemoved = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (trianglesRemoved >= trianglesToRemove)
+                break;
+            if (touched[collapse.from] || touched[collapse.to] || flips(collapse))
+                continue;
+            for (const uint32_t triangle : trianglesAround(collapse.from))
+            {
+                const auto corners = gsl::span(indices).subspan(size_t{ triangle } * 3, 3);
+                if (std::ranges::find(corners, collapse.to) != corners.end())
+                    trianglesRemoved++;
+                for (const Index corner : corners)
+                    touched[corner] = true;
+            }
+            quadrics[collapse.to] += quadrics[collapse.from];
+            /* Rewritten in place; the touched one-ring keeps every other collapse in this pass away from it. */
+            for (const uint32_t triangle : trianglesAround(collapse.from))
+                for (Index& corner : gsl::span(indices).subspan(size_t{ triangle } * 3, 3))
+                    if (corner == collapse.from)
+                        corner = collapse.to;
+            resultError = std::max(resultError, collapse.error);
+        }
+        if (trianglesRemoved == 0)
+            break;
+
+        /* Drop the triangles that collapsed to lines. */
+        size_t kept = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            const Index a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a == b || b == c || c == a)
+                continue;
+            indices[kept++] = a;
+            indices[kept++] = b;
+            indices[kept++] = c;
+        }
+        indices.resize(kept);
+    }
+    return resultError;
+}
+
+/* Appends successively simpler versions of the mesh to its index buffer, each aiming for reduction times the triangles
+ * of the one before, and returns every level including the original one. Levels are simplified from the original each
+ * time, so that their errors are measured against it. Stops once a level no longer gets meaningfully smaller. */
+template <typename Vertex, MeshIndex Index, typename PositionFn>
+std::vector<MeshLod> generateLods(MeshData<Vertex, Index>& mesh, PositionFn&& position, size_t maxLevels = 8, float reduction = 0.25f)
+{
+    Expects(reduction > 0.0f && reduction < 1.0f);
+    const std::vector<Index> original = mesh.indices;
+    std::vector<MeshLod> lods = { { 0, gsl::narrow<uint32_t>(original.size()), 0.0f } };
+    while (lods.size() < maxLevels)
+    {
+        const size_t previousCount = lods.back().indexCount;
+        const size_t target = std::max<size_t>(static_cast<size_t>(static_cast<float>(previousCount / 3) * reduction), 1) * 3;
+        std::vector<Index> simplified = original;
+        const float error = simplifyMesh<Index, Vertex>(simplified, gsl::span<const Vertex>(mesh.vertices), position, target);
+        if (simplified.empty() || simplified.size() * 10 > previousCount * 9)
+            break;
+        optimizeVertexCache<Index>(simplified, mesh.vertices.size());
+        lods.push_back({ gsl::narrow<uint32_t>(mesh.indices.size()), gsl::narrow<uint32_t>(simplified.size()),
+                         std::max(error, lods.back().error) });
+        mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+    }
+    return lods;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "vk_types.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/* Load-time clustering of triangle lists into meshlets for cluster culling. A meshlet is a contiguous range of the
+ * mesh's own index buffer, so clusters draw from the same vertex and index buffers as the whole mesh; alongside them,
+ * each one stores the bounds the cull pass tests. */
+
+constexpr size_t maxMeshletVertices = 64;
+constexpr size_t maxMeshletTriangles = 124;
+
+/* As the cull shader reads it, in model space: a bounding sphere, and a cone that contains every triangle normal. The
+ * cluster faces away from any viewpoint where dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius. A
+ * cutoff of 1 never culls. Normals are cross(b - a, c - a) of each triangle (a, b, c). */
+struct Meshlet
+{
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    uint32_t firstIndex;
+    uint32_t triangleCount;
+    uint32_t vertexCount;
+    uint32_t padding = 0;
+};
+static_assert(sizeof(Meshlet) == 12 * sizeof(uint32_t));
+
+/* The meshlets of one level of detail, as a range of its mesh's meshlets. */
+struct MeshletRange
+{
+    uint32_t firstMeshlet = 0;
+    uint32_t meshletCount = 0;
+};
+
+/* All meshlets of a mesh, and which of them make up each level of detail. */
+struct MeshletData
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshletRange> lods;
+};
+
+namespace detail
+{
+
+/* Cones wider than this, as the cosine of their half-angle to the axis, cull too rarely to be worth testing. */
+constexpr float minMeshletConeSpread = 0.1f;
+
+template <typename Vertex, typename PositionFn>
+void computeMeshletBounds(Meshlet& meshlet, gsl::span<const uint32_t> meshletVertices, gsl::span<const glm::vec3> normals,
+                          gsl::span<const Vertex> vertices, PositionFn& position)
+{
+    glm::vec3 minimum(std::numeric_limits<float>::max());
+    glm::vec3 maximum(std::numeric_limits<float>::lowest());
+    for (const uint32_t vertex : meshletVertices)
+    {
+        minimum = glm::min(minimum, position(vertices[vertex]));
+        maximum = glm::max(maximum, position(vertices[vertex]));
+    }
+    meshlet.center = (minimum + maximum) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (const uint32_t vertex : meshletVertices)
+        meshlet.radius = std::max(meshlet.radius, glm::distance(meshlet.center, glm::vec3(position(vertices[vertex]))));
+
+    glm::vec3 normalSum(0.0f);
+    for (const glm::vec3& normal : normals)
+        normalSum += normal;
+    const float sumLength = glm::length(normalSum);
+    meshlet.coneAxis = sumLength > 0.0f ? normalSum / sumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    float minimumDot = sumLength > 0.0f ? 1.0f : -1.0f;
+    for (const glm::vec3& normal : normals)
+        minimumDot = std::min(minimumDot, glm::dot(normal, meshlet.coneAxis));
+    /* The sine of the spread, which the test above compares the cosine of the view angle with. */
+    meshlet.coneCutoff = minimumDot <= minMeshletConeSpread ? 1.0f : std::sqrt(1.0f - minimumDot * minimumDot);
+}
+
+}
+
+/* Splits indices, which start at firstIndex of the mesh's index buffer, into meshlets of at most maxVertices distinct
+ * vertices and maxTriangles triangles. Greedy, in index order, so that the clusters are as compact as the vertex cache
+ * optimization left the triangles; run it after optimizeMesh(). */
+template <MeshIndex Index, typename Vertex, typename PositionFn>
+std::vector<Meshlet> buildMeshlets(gsl::span<const Index> indices, uint32_t firstIndex, gsl::span<const Vertex> vertices, PositionFn&& position,
+                                   size_t maxVertices = maxMeshletVertices, size_t maxTriangles = maxMeshletTriangles)
+{
+    Expects(indices.size() % 3 == 0 && maxVertices >= 3 && maxTriangles >= 1);
+    std::vector<Meshlet> meshlets;
+    /* Which meshlet, plus one, last used each vertex. */
+    std::vector<uint32_t> vertexMeshlet(vertices.size(), 0);
+    std::vector<uint32_t> meshletVertices;
+    std::vector<glm::vec3> normals;
+    meshletVertices.reserve(maxVertices);
+    normals.reserve(maxTriangles);
+
+    Meshlet current{};
+    current.firstIndex = firstIndex;
+    const auto finish = [&]
+    {
+        if (current.triangleCount == 0)
+            return;
+        current.vertexCount = gsl::narrow_cast<uint32_t>(meshletVertices.size());
+        detail::computeMeshletBounds<Vertex>(current, meshletVertices, normals, vertices, position);
+        meshlets.push_back(current);
+        current = Meshlet{};
+        current.firstIndex = meshlets.back().firstIndex + meshlets.back().triangleCount * 3;
+        meshletVertices.clear();
+        normals.clear();
+    };
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const auto triangle = indices.subspan(i, 3);
+        const auto isNew = [&](size_t corner)
+        {
+            const Index vertex = triangle[corner];
+            return vertexMeshlet[vertex] != meshlets.size() + 1 && std::ranges::find(triangle.first(corner), vertex) == triangle.first(corner).end();
+        };
+        const size_t newVertices = size_t{ isNew(0) } + size_t{ isNew(1) } + size_t{ isNew(2) };
+        if (meshletVertices.size() + newVertices > maxVertices || current.triangleCount == maxTriangles)
+            finish();
+
+        const auto stamp = gsl::narrow_cast<uint32_t>(meshlets.size() + 1);
+        for (const Index vertex : triangle)
+            if (vertexMeshlet[vertex] != stamp)
+            {
+                vertexMeshlet[vertex] = stamp;
+                meshletVertices.push_back(vertex);
+            }
+        const glm::vec3 a = position(vertices[triangle[0]]);
+        const glm::vec3 normal = glm::cross(glm::vec3(position(vertices[triangle[1]])) - a, glm::vec3(position(vertices[triangle[2]])) - a);
+        const float length = glm::length(normal);
+        if (length > 0.0f)
+            normals.push_back(normal / length);
+        current.triangleCount++;
+    }
+    finish();
+    return meshlets;
+}
+
+/* Meshlets of every level of detail of mesh, e.g. from generateLods(). */
+template <typename Vertex, MeshIndex Index, typename PositionFn>
+MeshletData buildLodMeshlets(const MeshData<Vertex, Index>& mesh, gsl::span<const MeshLod> lods, PositionFn&& position)
+{
+    MeshletData data;
+    for (const MeshLod& lod : lods)
+    {
+        const auto indices = gsl::span<const Index>(mesh.indices).subspan(lod.firstIndex, lod.indexCount);
+        const std::vector<Meshlet> meshlets = buildMeshlets<Index, Vertex>(indices, lod.firstIndex, gsl::span<const Vertex>(mesh.vertices), position);
+        data.lods.push_back({ gsl::narrow<uint32_t>(data.meshlets.size()), gsl::narrow<uint32_t>(meshlets.size()) });
+        data.meshlets.insert(data.meshlets.end(), meshlets.begin(), meshlets.end());
+    }
+    return data;
+}
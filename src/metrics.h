@@ -0,0 +1,238 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Process-wide performance counters and gauges. Counters only ever increase, and every thread adds to its own copy of
+ * them, so updating one is an uncontended relaxed load and store with no read-modify-write; snapshot() sums the
+ * copies of all threads that ever counted. Gauges hold the last value set, from any thread. Registration takes a lock
+ * and happens once per metric, as the handles below are created; the hot paths only use the handles. */
+class MetricsRegistry
+{
+public:
+    constexpr static size_t maxCounters = 64;
+    constexpr static size_t maxGauges = 32;
+private:
+    struct Shard
+    {
+        /* Written only by the owning thread. */
+        std::array<std::atomic<uint64_t>, maxCounters> counters{};
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> counterNames_;
+    std::vector<std::string> gaugeNames_;
+    std::array<std::atomic<double>, maxGauges> gauges_{};
+    /* Kept after their threads exit, so that nothing counted is lost. */
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    MetricsRegistry() = default;
+
+    Shard& shard_()
+    {
+        /* The registry is a singleton, so one pointer per thread suffices. */
+        thread_local Shard* shard = nullptr;
+        if (!shard)
+        {
+            const std::scoped_lock lock(mutex_);
+            shard = shards_.emplace_back(std::make_unique<Shard>()).get();
+        }
+        return *shard;
+    }
+
+    static uint32_t register_(std::vector<std::string>& names, std::string_view name, size_t capacity)
+    {
+        const auto existing = std::ranges::find(names, name);
+        if (existing != names.end())
+            return gsl::narrow_cast<uint32_t>(existing - names.begin());
+        if (names.size() == capacity)
+            throw FatalError("Too many metrics registered: " + std::string(name));
+        names.emplace_back(name);
+        return gsl::narrow_cast<uint32_t>(names.size() - 1);
+    }
+public:
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(MetricsRegistry)
+
+    static MetricsRegistry& global()
+    {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    /* Registering a name twice returns the same metric. */
+    uint32_t registerCounter(std::string_view name)
+    {
+        const std::scoped_lock lock(mutex_);
+        return register_(counterNames_, name, maxCounters);
+    }
+    uint32_t registerGauge(std::string_view name)
+    {
+        const std::scoped_lock lock(mutex_);
+        return register_(gaugeNames_, name, maxGauges);
+    }
+
+    void add(uint32_t counter, uint64_t value) noexcept
+    {
+        std::atomic<uint64_t>& count = shard_().counters[counter];
+        count.store(count.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    void set(uint32_t gauge, double value) noexcept { gauges_[gauge].store(value, std::memory_order_relaxed); }
+
+    struct Snapshot
+    {
+        std::chrono::steady_clock::time_point time;
+        /* Totals since the start of the process. */
+        std::vector<std::pair<std::string, uint64_t>> counters;
+        std::vector<std::pair<std::string, double>> gauges;
+    };
+
+    /* Each value is exact, but concurrent updates may land in it or not. */
+    Snapshot snapshot() const
+    {
+        const std::scoped_lock lock(mutex_);
+        Snapshot snapshot{ std::chrono::steady_clock::now(), {}, {} };
+        snapshot.counters.reserve(counterNames_.size());
+        for (size_t i = 0; i < counterNames_.size(); i++)
+        {
+            uint64_t total = 0;
+            for (const auto& shard : shards_)
+                total += shard->counters[i].load(std::memory_order_relaxed);
+            snapshot.counters.emplace_back(counterNames_[i], total);
+        }
+        snapshot.gauges.reserve(gaugeNames_.size());
+        for (size_t i = 0; i < gaugeNames_.size(); i++)
+            snapshot.gauges.emplace_back(gaugeNames_[i], gauges_[i].load(std::memory_order_relaxed));
+        return snapshot;
+    }
+};
+
+class MetricCounter
+{
+    uint32_t id_;
+public:
+    explicit MetricCounter(std::string_view name) : id_(MetricsRegistry::global().registerCounter(name)) {}
+
+    void add(uint64_t value = 1) const noexcept { MetricsRegistry::global().add(id_, value); }
+};
+
+class MetricGauge
+{
+    uint32_t id_;
+public:
+    explicit MetricGauge(std::string_view name) : id_(MetricsRegistry::global().registerGauge(name)) {}
+
+    void set(double value) const noexcept { MetricsRegistry::global().set(id_, value); }
+};
+
+/* The engine's metrics, all registered at startup so that exports have the same columns throughout a run. */
+namespace metrics
+{
+
+inline const MetricCounter frames("frames");
+inline const MetricCounter submits("vulkan.submits");
+inline const MetricCounter commandBuffersCheckedOut("vulkan.command_buffers_checked_out");
+inline const MetricCounter deviceMemoryAllocations("vulkan.device_memory_allocations");
+inline const MetricCounter bytesUploaded("vulkan.bytes_uploaded");
+inline const MetricCounter semaphoreWaits("vulkan.semaphore_waits");
+inline const MetricCounter semaphoreWaitMicroseconds("vulkan.semaphore_wait_us");
+inline const MetricCounter draws("render.draws");
+inline const MetricCounter pipelineBinds("render.pipeline_binds");
+inline const MetricCounter pipelinesCreated("render.pipelines_created");
+inline const MetricCounter vertexInvocations("gpu.vertex_invocations");
+inline const MetricCounter clippingInvocations("gpu.clipping_invocations");
+inline const MetricCounter clippingPrimitives("gpu.clipping_primitives");
+inline const MetricCounter fragmentInvocations("gpu.fragment_invocations");
+inline const MetricGauge frameMilliseconds("frame.time_ms");
+inline const MetricGauge frameArenaHighWaterBytes("frame_arena.high_water_bytes");
+
+}
+
+/* Appends a snapshot of the registry to a file every interval, for graphing long runs. A .json file gets one JSON
+ * object per line, anything else CSV with a header. Counters are written as their increase since the previous
+ * snapshot, gauges as they are. */
+class MetricsExporter
+{
+    std::ofstream file_;
+    bool json_;
+    std::chrono::steady_clock::duration interval_;
+    std::chrono::steady_clock::time_point start_;
+    MetricsRegistry::Snapshot previous_;
+    bool headerWritten_ = false;
+
+    void writeCsv_(const MetricsRegistry::Snapshot& snapshot, double seconds)
+    {
+        if (!headerWritten_)
+        {
+            file_ << "time_s";
+            for (const auto& [name, value] : snapshot.counters)
+                file_ << ',' << name;
+            for (const auto& [name, value] : snapshot.gauges)
+                file_ << ',' << name;
+            file_ << '\n';
+            headerWritten_ = true;
+        }
+        file_ << seconds;
+        for (size_t i = 0; i < snapshot.counters.size(); i++)
+            file_ << ',' << snapshot.counters[i].second - previousCount_(i);
+        for (const auto& [name, value] : snapshot.gauges)
+            file_ << ',' << value;
+        file_ << '\n';
+    }
+
+    void writeJson_(const MetricsRegistry::Snapshot& snapshot, double seconds)
+    {
+        /* Metric names are plain identifiers, so they need no escaping. */
+        file_ << "{\"time_s\":" << seconds << ",\"counters\":{";
+        for (size_t i = 0; i < snapshot.counters.size(); i++)
+            file_ << (i == 0 ? "" : ",") << '"' << snapshot.counters[i].first << "\":" << snapshot.counters[i].second - previousCount_(i);
+        file_ << "},\"gauges\":{";
+        for (size_t i = 0; i < snapshot.gauges.size(); i++)
+            file_ << (i == 0 ? "" : ",") << '"' << snapshot.gauges[i].first << "\":" << snapshot.gauges[i].second;
+        file_ << "}}\n";
+    }
+
+    /* Metrics only ever get added at the end, so earlier indices always refer to the same counter. */
+    uint64_t previousCount_(size_t i) const noexcept { return i < previous_.counters.size() ? previous_.counters[i].second : 0; }
+public:
+    explicit MetricsExporter(const std::filesystem::path& path, std::chrono::steady_clock::duration interval = std::chrono::seconds(1)) :
+        file_(path),
+        json_(path.extension() == ".json"),
+        interval_(interval),
+        start_(std::chrono::steady_clock::now()),
+        previous_{ start_, {}, {} }
+    {
+        if (!file_)
+            throw FatalError("Failed to open metrics file " + path.string());
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(MetricsExporter)
+
+    /* Writes a snapshot if the interval has passed since the last one. Cheap otherwise. */
+    void tick()
+    {
+        if (std::chrono::steady_clock::now() - previous_.time >= interval_)
+            write();
+    }
+
+    void write()
+    {
+        MetricsRegistry::Snapshot snapshot = MetricsRegistry::global().snapshot();
+        const double seconds = std::chrono::duration<double>(snapshot.time - start_).count();
+        if (json_)
+            writeJson_(snapshot, seconds);
+        else
+            writeCsv_(snapshot, seconds);
+        /* Flushed every time, so that a crashed soak run still has its numbers. */
+        file_.flush();
+        previous_ = std::move(snapshot);
+    }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/* Stable least-significant-digit radix sort on 64-bit keys, parallelized over blocks of the input on a JobSystem.
+ * Every pass has each block count its digits, turns the per-block counts into scatter offsets and has each block
+ * scatter its elements, which keeps the sort stable. Digits that are the same for every key, like the high bits of
+ * small keys, are detected up front and their passes skipped. Keeps its histograms across sorts, so sorting doesn't
+ * allocate once warmed up. */
+class RadixSorter
+{
+    constexpr static size_t digitBits_ = 8;
+    constexpr static size_t bucketCount_ = size_t(1) << digitBits_;
+    constexpr static size_t passCount_ = 64 / digitBits_;
+    /* Below this many elements per block, splitting the work costs more than it saves. */
+    constexpr static size_t minBlockSize_ = 2048;
+
+    using Histogram = std::array<uint32_t, bucketCount_>;
+
+    std::vector<Histogram> blockHistograms_;
+    std::vector<std::array<Histogram, passCount_>> blockDigitCounts_;
+
+    static size_t digit_(uint64_t key, size_t pass) noexcept
+    {
+        return static_cast<size_t>((key >> (pass * digitBits_)) & (bucketCount_ - 1));
+    }
+public:
+    /* Sorts values by key(value) using scratch, which must be at least as large, as the second buffer. */
+    template <typename T, typename KeyFunction>
+    void sort(JobSystem& jobs, gsl::span<T> values, gsl::span<T> scratch, const KeyFunction& key)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const size_t count = values.size();
+        Expects(scratch.size() >= count);
+        Expects(count <= std::numeric_limits<uint32_t>::max());
+        if (count < 2)
+            return;
+        const size_t blockCount = std::clamp<size_t>(count / minBlockSize_, 1, jobs.workerCount() * 4);
+        const size_t blockSize = (count + blockCount - 1) / blockCount;
+        blockHistograms_.resize(blockCount);
+        blockDigitCounts_.resize(blockCount);
+
+        /* One read over all keys counts the digits of every pass, to find the passes that would not move anything. */
+        jobs.parallelFor(blockCount, 1, [&](size_t block, size_t)
+        {
+            auto& counts = blockDigitCounts_[block];
+            for (Histogram& histogram : counts)
+                histogram.fill(0);
+            const size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; i++)
+            {
+                const uint64_t k = key(values[i]);
+                for (size_t pass = 0; pass < passCount_; pass++)
+                    counts[pass][digit_(k, pass)]++;
+            }
+        });
+        std::array<bool, passCount_> skipPass{};
+        for (size_t pass = 0; pass < passCount_; pass++)
+        {
+            const size_t firstDigit = digit_(key(values[0]), pass);
+            size_t total = 0;
+            for (const auto& counts : blockDigitCounts_)
+                total += counts[pass][firstDigit];
+            skipPass[pass] = total == count;
+        }
+
+        gsl::span<T> source = values;
+        gsl::span<T> destination = scratch.first(count);
+        bool scattered = false;
+        for (size_t pass = 0; pass < passCount_; pass++)
+        {
+            if (skipPass[pass])
+                continue;
+            /* Per-block counts depend on the order, so they are recounted after every scatter. Until the first one,
+             * the counts from above still hold. */
+            if (!scattered)
+                for (size_t block = 0; block < blockCount; block++)
+                    blockHistograms_[block] = blockDigitCounts_[block][pass];
+            else
+                jobs.parallelFor(blockCount, 1, [&](size_t block, size_t)
+                {
+                    Histogram& histogram = blockHistograms_[block];
+                    histogram.fill(0);
+                    const size_t end = std::min(count, (block + 1) * blockSize);
+                    for (size_t i = block * blockSize; i < end; i++)
+                        histogram[digit_(key(source[i]), pass)]++;
+                });
+            /* Exclusive prefix sum in digit-major, block-minor order, so that equal digits keep their block order. */
+            uint32_t offset = 0;
+            for (size_t bucket = 0; bucket < bucketCount_; bucket++)
+                for (Histogram& histogram : blockHistograms_)
+                    offset += std::exchange(histogram[bucket], offset);
+            jobs.parallelFor(blockCount, 1, [&](size_t block, size_t)
+            {
+                Histogram& offsets = blockHistograms_[block];
+                const size_t end = std::min(count, (block + 1) * blockSize);
+                for (size_t i = block * blockSize; i < end; i++)
+                    destination[offsets[digit_(key(source[i]), pass)]++] = source[i];
+            });
+            std::swap(source, destination);
+            scattered = true;
+        }
+        if (source.data() != values.data())
+            std::ranges::copy(source, values.begin());
+    }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "vk_types.h"
+#include "job_system.h"
+#include "metrics.h"
+#include "radix_sort.h"
+
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <optional>
+#include <ostream>
+
+enum class DepthOrder
+{
+    FrontToBack, // opaque draws, so that early depth testing rejects hidden fragments
+    BackToFront, // blended draws
+};
+
+/* 64-bit draw sort key, most significant first: pass (4 bits), pipeline (12), material (24), depth (24). Sorting by
+ * it groups draws by pass, then by pipeline and material to minimize state changes, and orders each state group by
+ * depth. */
+struct RenderKey
+{
+    constexpr static uint32_t passBits = 4;
+    constexpr static uint32_t pipelineBits = 12;
+    constexpr static uint32_t materialBits = 24;
+    constexpr static uint32_t depthBits = 24;
+    static_assert(passBits + pipelineBits + materialBits + depthBits == 64);
+
+    /* depth is the view-space distance; negative values and NaN sort as 0. */
+    static constexpr uint64_t make(uint32_t pass, uint32_t pipeline, uint32_t material, float depth,
+                                   DepthOrder order = DepthOrder::FrontToBack) noexcept
+    {
+        Expects(pass < (1u << passBits) && pipeline < (1u << pipelineBits) && material < (1u << materialBits));
+        /* The bits of non-negative floats order like the floats themselves; their top bits are a logarithmic depth. */
+        const uint32_t depthKey = std::bit_cast<uint32_t>(depth > 0.0f ? depth : 0.0f) >> (32 - depthBits);
+        constexpr uint32_t maxDepthKey = (1u << depthBits) - 1;
+        return (uint64_t(pass) << (pipelineBits + materialBits + depthBits)) |
+               (uint64_t(pipeline) << (materialBits + depthBits)) |
+               (uint64_t(material) << depthBits) |
+               (order == DepthOrder::FrontToBack ? depthKey : maxDepthKey - depthKey);
+    }
+
+    /* The same key in another pass, e.g. for drawing something again in a depth pre-pass. */
+    static constexpr uint64_t withPass(uint64_t key, uint32_t pass) noexcept
+    {
+        Expects(pass < (1u << passBits));
+        constexpr uint32_t passShift = pipelineBits + materialBits + depthBits;
+        return (key & ((uint64_t(1) << passShift) - 1)) | (uint64_t(pass) << passShift);
+    }
+};
+
+/* Fixed-function state that graphics pipelines leave dynamic, so that one pipeline serves every combination of it.
+ * The dynamic state of VK_EXT_extended_dynamic_state, core in Vulkan 1.3. */
+struct RasterState
+{
+    vk::CullModeFlags cullMode = vk::CullModeFlagBits::eNone;
+    vk::FrontFace frontFace = vk::FrontFace::eClockwise;
+    /* Has to be of the topology class the pipeline was created with. */
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    bool depthTest = true;
+    bool depthWrite = true;
+    vk::CompareOp depthCompare = vk::CompareOp::eLess;
+
+    bool operator==(const RasterState&) const = default;
+
+    void record(const vk::CommandBuffer& commandBuffer) const
+    {
+        commandBuffer.setCullMode(cullMode);
+        commandBuffer.setFrontFace(frontFace);
+        commandBuffer.setPrimitiveTopology(topology);
+        commandBuffer.setDepthTestEnable(depthTest);
+        commandBuffer.setDepthWriteEnable(depthWrite);
+        commandBuffer.setDepthCompareOp(depthCompare);
+    }
+};
+
+/* Everything needed to replay one indexed draw. With an indirect buffer, the draw parameters come from the
+ * VkDrawIndexedIndirectCommand there instead, and indexCount and instanceCount are only upper bounds. With an indirect
+ * count buffer as well, that is a multi-draw of as many consecutive commands as the count there, up to maxDrawCount. */
+struct DrawPacket
+{
+    /* The minimum maxPushConstantsSize every device supports. */
+    constexpr static size_t pushConstantCapacity = 128;
+
+    vk::Pipeline pipeline;
+    vk::PipelineLayout pipelineLayout;
+    RasterState raster;
+    vk::Buffer vertexBuffer;
+    /* Per-instance vertex data in binding 1, for pipelines with an instance-rate binding. */
+    vk::Buffer instanceBuffer;
+    vk::DeviceSize instanceOffset = 0;
+    vk::Buffer indexBuffer;
+    vk::IndexType indexType = vk::IndexType::eUint16;
+    uint32_t indexCount = 0;
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    uint32_t instanceCount = 1;
+    uint32_t firstInstance = 0;
+    vk::Buffer indirectBuffer;
+    vk::DeviceSize indirectOffset = 0;
+    vk::Buffer indirectCountBuffer;
+    vk::DeviceSize indirectCountOffset = 0;
+    uint32_t maxDrawCount = 1;
+    vk::ShaderStageFlags pushConstantStages;
+    uint32_t pushConstantSize = 0;
+    alignas(16) std::array<std::byte, pushConstantCapacity> pushConstants;
+
+    template <typename T>
+    void setPushConstants(vk::ShaderStageFlags stages, const T& constants) noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= pushConstantCapacity);
+        pushConstantStages = stages;
+        pushConstantSize = sizeof(T);
+        std::memcpy(pushConstants.data(), &constants, sizeof(T));
+    }
+};
+
+struct RenderQueueStats
+{
+    uint64_t draws = 0;
+    uint64_t instances = 0; // Upper bound for indirect draws
+    uint64_t pipelineBinds = 0;
+    uint64_t rasterStateChanges = 0;
+    uint64_t vertexBufferBinds = 0;
+    uint64_t indexBufferBinds = 0;
+
+    RenderQueueStats& operator+=(const RenderQueueStats& other) noexcept
+    {
+        draws += other.draws;
+        instances += other.instances;
+        pipelineBinds += other.pipelineBinds;
+        rasterStateChanges += other.rasterStateChanges;
+        vertexBufferBinds += other.vertexBufferBinds;
+        indexBufferBinds += other.indexBufferBinds;
+        return *this;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const RenderQueueStats& stats)
+    {
+        return os << stats.draws << " draws of " << stats.instances << " instances, " << stats.pipelineBinds << " pipeline binds, " << stats.rasterStateChanges
+                  << " raster state changes, " << stats.vertexBufferBinds
+                  << " vertex buffer binds, " << stats.indexBufferBinds << " index buffer binds";
+    }
+};
+
+/* Collects a frame's draws from any number of threads, sorts them by key and replays them with redundant binds
+ * skipped. Storage is kept across frames, so a steady frame doesn't allocate. Usage per frame: reset(), submit() from
+ * any thread, sort() once all submissions are done, then record() ranges of the sorted draws, also from any thread. */
+class RenderQueue
+{
+    struct Entry
+    {
+        uint64_t key;
+        uint32_t packet;
+    };
+
+    std::vector<DrawPacket> packets_;
+    std::vector<Entry> entries_;
+    std::vector<Entry> scratch_;
+    std::atomic<size_t> count_ = 0;
+    RadixSorter sorter_;
+public:
+    RenderQueue() = default;
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(RenderQueue)
+
+    /* Empties the queue and makes room for capacity draws. */
+    void reset(size_t capacity)
+    {
+        Expects(capacity <= std::numeric_limits<uint32_t>::max());
+        if (packets_.size() < capacity)
+        {
+            packets_.resize(capacity);
+            entries_.resize(capacity);
+            scratch_.resize(capacity);
+        }
+        count_.store(0, std::memory_order_relaxed);
+    }
+
+    /* Thread-safe, but not with the other members. */
+    void submit(uint64_t key, const DrawPacket& packet)
+    {
+        const size_t index = count_.fetch_add(1, std::memory_order_relaxed);
+        Expects(index < packets_.size()); // Exceeded the capacity passed to reset()
+        packets_[index] = packet;
+        entries_[index] = { key, gsl::narrow_cast<uint32_t>(index) };
+    }
+
+    void sort(JobSystem& jobs)
+    {
+        const size_t count = size();
+        sorter_.sort(jobs, gsl::span(entries_).first(count), gsl::span(scratch_), [](const Entry& entry) { return entry.key; });
+    }
+
+    size_t size() const noexcept { return std::min(count_.load(std::memory_order_relaxed), packets_.size()); }
+
+    /* Replays sorted draws [begin, end) into renderArea. The bound state is tracked within the call only, as every
+     * secondary command buffer starts out with nothing bound and no dynamic state set. */
+    RenderQueueStats record(const vk::CommandBuffer& commandBuffer, size_t begin, size_t end, const vk::Rect2D& renderArea) const
+    {
+        Expects(begin <= end && end <= size());
+        RenderQueueStats stats;
+        commandBuffer.setViewport(0, vk::Viewport(static_cast<float>(renderArea.offset.x), static_cast<float>(renderArea.offset.y),
+                                                  static_cast<float>(renderArea.extent.width), static_cast<float>(renderArea.extent.height),
+                                                  0.0f, 1.0f));
+        commandBuffer.setScissor(0, renderArea);
+        std::optional<RasterState> boundRaster;
+        vk::Pipeline boundPipeline;
+        vk::Buffer boundVertexBuffer;
+        vk::Buffer boundInstanceBuffer;
+        vk::DeviceSize boundInstanceOffset = 0;
+        vk::Buffer boundIndexBuffer;
+        vk::IndexType boundIndexType = vk::IndexType::eUint16;
+        for (size_t i = begin; i < end; i++)
+        {
+            const DrawPacket& packet = packets_[entries_[i].packet];
+            if (packet.pipeline != boundPipeline)
+            {
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, packet.pipeline);
+                boundPipeline = packet.pipeline;
+                stats.pipelineBinds++;
+            }
+            if (packet.raster != boundRaster)
+            {
+                packet.raster.record(commandBuffer);
+                boundRaster = packet.raster;
+                stats.rasterStateChanges++;
+            }
+            if (packet.vertexBuffer != boundVertexBuffer)
+            {
+                commandBuffer.bindVertexBuffers(0, packet.vertexBuffer, vk::DeviceSize{ 0 });
+                boundVertexBuffer = packet.vertexBuffer;
+                stats.vertexBufferBinds++;
+            }
+            if (packet.instanceBuffer && (packet.instanceBuffer != boundInstanceBuffer || packet.instanceOffset != boundInstanceOffset))
+            {
+                commandBuffer.bindVertexBuffers(1, packet.instanceBuffer, packet.instanceOffset);
+                boundInstanceBuffer = packet.instanceBuffer;
+                boundInstanceOffset = packet.instanceOffset;
+                stats.vertexBufferBinds++;
+            }
+            if (packet.indexBuffer != boundIndexBuffer || packet.indexType != boundIndexType)
+            {
+                commandBuffer.bindIndexBuffer(packet.indexBuffer, 0, packet.indexType);
+                boundIndexBuffer = packet.indexBuffer;
+                boundIndexType = packet.indexType;
+                stats.indexBufferBinds++;
+            }
+            if (packet.pushConstantSize != 0)
+                commandBuffer.pushConstants(packet.pipelineLayout, packet.pushConstantStages, 0, packet.pushConstantSize, packet.pushConstants.data());
+            if (packet.indirectCountBuffer)
+                commandBuffer.drawIndexedIndirectCount(packet.indirectBuffer, packet.indirectOffset, packet.indirectCountBuffer, packet.indirectCountOffset,
+                                                       packet.maxDrawCount, sizeof(vk::DrawIndexedIndirectCommand));
+            else if (packet.indirectBuffer)
+                commandBuffer.drawIndexedIndirect(packet.indirectBuffer, packet.indirectOffset, 1, sizeof(vk::DrawIndexedIndirectCommand));
+            else
+                commandBuffer.drawIndexed(packet.indexCount, packet.instanceCount, packet.firstIndex, packet.vertexOffset, packet.firstInstance);
+            stats.draws++;
+            stats.instances += packet.instanceCount;
+        }
+        metrics::draws.add(stats.draws);
+        metrics::pipelineBinds.add(stats.pipelineBinds);
+        return stats;
+    }
+};
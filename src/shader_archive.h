@@ -0,0 +1,131 @@
+#pragma once
+
+#include "vk_types.h"
+#include "mapped_file.h"
+#include "shader_pack_format.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/* One compiled shader in a ShaderArchive, pointing into the mapping, with the reflection data it was packed with. */
+struct ShaderModuleInfo
+{
+    std::string_view name;
+    vk::ShaderStageFlagBits stage;
+    gsl::span<const uint32_t> code;
+    /* End of the last member of the push constant block; 0 without one. */
+    uint32_t pushConstantSize;
+    gsl::span<const shader_pack::VertexInput> vertexInputs;
+    /* Sorted by set and binding. */
+    gsl::span<const shader_pack::DescriptorBinding> descriptorBindings;
+};
+
+/* The shader archive that the build packs from src/shaders, mapped once. Looking a module up hashes its name and
+ * probes the archive's hash table, touching only the pages of the entries it compares and, on creation, of the code. */
+class ShaderArchive
+{
+    MappedFile file_;
+    shader_pack::Header header_;
+    gsl::span<const uint32_t> buckets_;
+    gsl::span<const shader_pack::Module> modules_;
+    gsl::span<const shader_pack::VertexInput> vertexInputs_;
+    gsl::span<const shader_pack::DescriptorBinding> descriptorBindings_;
+
+    template <typename T>
+    gsl::span<const T> view_(size_t offset, size_t count) const
+    {
+        const gsl::span<const std::byte> data = file_.data();
+        if (offset > data.size() || count > (data.size() - offset) / sizeof(T) || offset % alignof(T) != 0)
+            throw FatalError("Corrupt shader archive");
+        return { reinterpret_cast<const T*>(data.data() + offset), count };
+    }
+
+    static vk::ShaderStageFlagBits stage_(shader_pack::Stage stage)
+    {
+        using enum shader_pack::Stage;
+        switch (stage)
+        {
+        case Vertex:                 return vk::ShaderStageFlagBits::eVertex;
+        case TessellationControl:    return vk::ShaderStageFlagBits::eTessellationControl;
+        case TessellationEvaluation: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+        case Geometry:               return vk::ShaderStageFlagBits::eGeometry;
+        case Fragment:               return vk::ShaderStageFlagBits::eFragment;
+        case Compute:                return vk::ShaderStageFlagBits::eCompute;
+        }
+        throw FatalError("Unsupported shader stage in shader archive");
+    }
+public:
+    explicit ShaderArchive(const std::filesystem::path& path) : file_(path)
+    {
+        std::memcpy(&header_, view_<std::byte>(0, sizeof(header_)).data(), sizeof(header_));
+        if (header_.magic != shader_pack::magic || header_.version != shader_pack::version)
+            throw FatalError(path.string() + " is not a shader archive of this build");
+        if (!std::has_single_bit(header_.bucketCount))
+            throw FatalError("Corrupt shader archive");
+        size_t offset = sizeof(header_);
+        buckets_ = view_<uint32_t>(offset, header_.bucketCount);
+        offset += buckets_.size_bytes();
+        modules_ = view_<shader_pack::Module>(offset, header_.moduleCount);
+        offset += modules_.size_bytes();
+        size_t vertexInputCount = 0;
+        size_t descriptorBindingCount = 0;
+        for (const shader_pack::Module& module : modules_)
+        {
+            vertexInputCount = std::max(vertexInputCount, size_t{ module.firstVertexInput } + module.vertexInputCount);
+            descriptorBindingCount = std::max(descriptorBindingCount, size_t{ module.firstDescriptorBinding } + module.descriptorBindingCount);
+        }
+        vertexInputs_ = view_<shader_pack::VertexInput>(offset, vertexInputCount);
+        offset += vertexInputs_.size_bytes();
+        descriptorBindings_ = view_<shader_pack::DescriptorBinding>(offset, descriptorBindingCount);
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(ShaderArchive)
+
+    /* The archive the build puts next to the executable, opened on first use. */
+    static const ShaderArchive& global()
+    {
+        static const ShaderArchive archive("shaders.pack");
+        return archive;
+    }
+
+    std::optional<ShaderModuleInfo> find(std::string_view name) const
+    {
+        const uint64_t hash = shader_pack::hashName(name);
+        const uint32_t mask = header_.bucketCount - 1;
+        /* Bounded by the table size, so that a corrupt archive without an empty bucket can't probe forever. */
+        uint32_t bucket = static_cast<uint32_t>(hash) & mask;
+        for (uint32_t probe = 0; probe < header_.bucketCount; probe++, bucket = (bucket + 1) & mask)
+        {
+            const uint32_t index = buckets_[bucket];
+            if (index == shader_pack::emptyBucket)
+                return std::nullopt;
+            const shader_pack::Module& module = modules_[index];
+            if (module.nameHash != hash)
+                continue;
+            const auto moduleName = view_<char>(module.nameOffset, module.nameSize);
+            if (std::string_view(moduleName.data(), moduleName.size()) != name)
+                continue;
+            return ShaderModuleInfo{
+                name,
+                stage_(module.stage),
+                view_<uint32_t>(module.codeOffset, module.codeSize / sizeof(uint32_t)),
+                module.pushConstantSize,
+                vertexInputs_.subspan(module.firstVertexInput, module.vertexInputCount),
+                descriptorBindings_.subspan(module.firstDescriptorBinding, module.descriptorBindingCount),
+            };
+        }
+        return std::nullopt;
+    }
+
+    ShaderModuleInfo get(std::string_view name) const
+    {
+        const auto module = find(name);
+        if (!module)
+            throw FatalError("No shader " + std::string(name) + " in the shader archive");
+        return *module;
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/* Layout of the shader archive that tools/shader_pack.cpp builds from the compiled shaders and ShaderArchive maps.
+ * Kept free of Vulkan, as the packer runs on the build host. Everything is in native byte order, at offsets from the
+ * start of the file:
+ *     Header
+ *     uint32_t buckets[bucketCount]            Open-addressed hash table of module indices, emptyBucket where unused
+ *     Module modules[moduleCount]
+ *     VertexInput vertexInputs[]               Each module's as a contiguous range
+ *     DescriptorBinding descriptorBindings[]   Likewise
+ *     names                                    Not null-terminated
+ *     code                                     SPIR-V, every module 4-byte aligned */
+namespace shader_pack
+{
+
+constexpr std::array<char, 4> magic = { 'S', 'P', 'A', 'K' };
+constexpr uint32_t version = 2;
+constexpr uint32_t emptyBucket = ~0u;
+
+/* FNV-1a, so that names can be hashed at compile time. */
+constexpr uint64_t hashName(std::string_view name) noexcept
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : name)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* SPIR-V execution models, which the packer copies as they are. */
+enum class Stage : uint32_t
+{
+    Vertex = 0,
+    TessellationControl = 1,
+    TessellationEvaluation = 2,
+    Geometry = 3,
+    Fragment = 4,
+    Compute = 5,
+};
+
+enum class ComponentType : uint32_t
+{
+    Float,
+    Sint,
+    Uint,
+};
+
+/* Values of VkDescriptorType. */
+enum class DescriptorType : uint32_t
+{
+    Sampler = 0,
+    CombinedImageSampler = 1,
+    SampledImage = 2,
+    StorageImage = 3,
+    UniformTexelBuffer = 4,
+    StorageTexelBuffer = 5,
+    UniformBuffer = 6,
+    StorageBuffer = 7,
+    InputAttachment = 10,
+};
+
+struct Header
+{
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t moduleCount;
+    uint32_t bucketCount; // A power of two, at least twice moduleCount
+};
+
+struct Module
+{
+    uint64_t nameHash;
+    uint32_t nameOffset;
+    uint32_t nameSize;
+    uint32_t codeOffset;
+    uint32_t codeSize; // In bytes
+    Stage stage;
+    /* End of the last member of the push constant block; 0 without one. */
+    uint32_t pushConstantSize;
+    uint32_t firstVertexInput;
+    uint32_t vertexInputCount;
+    uint32_t firstDescriptorBinding;
+    uint32_t descriptorBindingCount;
+};
+
+/* A vertex shader input, one per location, so a matrix takes one per column. */
+struct VertexInput
+{
+    uint32_t location;
+    ComponentType type;
+    uint32_t componentCount;
+};
+
+/* A resource the shader declares, sorted by set and binding. */
+struct DescriptorBinding
+{
+    uint32_t set;
+    uint32_t binding;
+    DescriptorType type;
+    uint32_t count; // Array length, 1 for a single descriptor
+};
+
+static_assert(sizeof(Header) == 16 && sizeof(Module) == 48 && sizeof(VertexInput) == 12 && sizeof(DescriptorBinding) == 16);
+
+}
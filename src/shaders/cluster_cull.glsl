@@ -0,0 +1,142 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* Tests every meshlet of every instance of one instanced draw against the frustum, its normal cone and the Hi-Z
+ * pyramid of the previous frame, and appends an indirect command drawing each surviving meshlet of one instance. */
+
+layout(local_size_x = 64) in;
+
+/* InstanceData as 32-bit words: a column-major mat4 transform, then the packed color. */
+const uint instanceWords = 17;
+
+layout(std140, binding = 0) uniform View
+{
+	mat4 viewProjection; // Of this frame
+	mat4 hizViewProjection; // Of the frame the pyramid was built from
+	vec4 eye;
+	uint occlusionEnabled;
+} view;
+
+layout(std430, binding = 1) readonly buffer Candidates { uint candidates[]; };
+
+struct Meshlet
+{
+	vec3 center;
+	float radius;
+	vec3 coneAxis;
+	float coneCutoff;
+	uint firstIndex;
+	uint triangleCount;
+	uint vertexCount;
+	uint padding;
+};
+layout(std430, binding = 2) readonly buffer Meshlets { Meshlet meshlets[]; };
+
+struct DrawIndexedIndirectCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+layout(std430, binding = 3) writeonly buffer Commands { DrawIndexedIndirectCommand commands[]; };
+layout(std430, binding = 4) buffer Counts { uint counts[]; };
+
+layout(binding = 5) uniform sampler2D hiz;
+
+layout(push_constant) uniform constants
+{
+	uint firstInstance;
+	uint instanceCount;
+	uint firstMeshlet;
+	uint meshletCount;
+	uint firstCommand;
+	uint drawIndex;
+	uint coneCulling;
+} pushConstants;
+
+vec4 loadVec4(uint word)
+{
+    return uintBitsToFloat(uvec4(candidates[word], candidates[word + 1], candidates[word + 2], candidates[word + 3]));
+}
+
+vec4 viewProjectionRow(int i)
+{
+    return vec4(view.viewProjection[0][i], view.viewProjection[1][i], view.viewProjection[2][i], view.viewProjection[3][i]);
+}
+
+/* Gribb-Hartmann planes, as on the CPU, but left unnormalized. */
+bool isOutsideFrustum(vec3 center, float radius)
+{
+    const vec4 planes[6] = vec4[6](viewProjectionRow(3) + viewProjectionRow(0), viewProjectionRow(3) - viewProjectionRow(0),
+                                   viewProjectionRow(3) + viewProjectionRow(1), viewProjectionRow(3) - viewProjectionRow(1),
+                                   viewProjectionRow(2), viewProjectionRow(3) - viewProjectionRow(2));
+    for (int i = 0; i < 6; i++)
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz))
+            return true;
+    return false;
+}
+
+/* As in occlusion_cull.glsl. */
+bool isOccluded(vec3 center, float radius)
+{
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float nearestDepth = 1.0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        const vec3 offset = vec3((corner & 1) != 0 ? 1.0 : -1.0, (corner & 2) != 0 ? 1.0 : -1.0, (corner & 4) != 0 ? 1.0 : -1.0);
+        const vec4 clip = view.hizViewProjection * vec4(center + radius * offset, 1.0);
+        if (clip.w <= 0.0)
+            return false;
+        const vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+    minUV = clamp(minUV, 0.0, 1.0);
+    maxUV = clamp(maxUV, 0.0, 1.0);
+
+    const vec2 extent = (maxUV - minUV) * vec2(textureSize(hiz, 0));
+    const int mipCount = textureQueryLevels(hiz);
+    const int mip = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, mipCount - 1);
+    const ivec2 mipSize = textureSize(hiz, mip);
+    const ivec2 begin = clamp(ivec2(minUV * vec2(mipSize)) - 1, ivec2(0), mipSize - 1);
+    const ivec2 end = clamp(ivec2(maxUV * vec2(mipSize)) + 1, ivec2(0), mipSize - 1);
+    float farthestDepth = 0.0;
+    for (int y = begin.y; y <= end.y; y++)
+        for (int x = begin.x; x <= end.x; x++)
+            farthestDepth = max(farthestDepth, texelFetch(hiz, ivec2(x, y), mip).r);
+    return nearestDepth > farthestDepth;
+}
+
+void main() {
+    /* Neighbouring invocations share an instance, so its transform is loaded once per few meshlets. */
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= pushConstants.instanceCount * pushConstants.meshletCount)
+        return;
+    const uint instance = pushConstants.firstInstance + index / pushConstants.meshletCount;
+    const Meshlet meshlet = meshlets[pushConstants.firstMeshlet + index % pushConstants.meshletCount];
+
+    const uint base = instance * instanceWords;
+    const mat4 transform = mat4(loadVec4(base), loadVec4(base + 4), loadVec4(base + 8), loadVec4(base + 12));
+    const float scale = sqrt(max(dot(transform[0].xyz, transform[0].xyz), max(dot(transform[1].xyz, transform[1].xyz), dot(transform[2].xyz, transform[2].xyz))));
+    const vec3 center = (transform * vec4(meshlet.center, 1.0)).xyz;
+    const float radius = meshlet.radius * scale;
+
+    if (isOutsideFrustum(center, radius))
+        return;
+    if (pushConstants.coneCulling != 0 && meshlet.coneCutoff < 1.0)
+    {
+        const vec3 axis = normalize(mat3(transform) * meshlet.coneAxis);
+        const vec3 toCenter = center - view.eye.xyz;
+        if (dot(toCenter, axis) >= meshlet.coneCutoff * length(toCenter) + radius)
+            return;
+    }
+    if (view.occlusionEnabled != 0 && isOccluded(center, radius))
+        return;
+
+    const uint slot = atomicAdd(counts[pushConstants.drawIndex], 1);
+    commands[pushConstants.firstCommand + slot] = DrawIndexedIndirectCommand(meshlet.triangleCount * 3, 1, meshlet.firstIndex, 0, instance);
+}
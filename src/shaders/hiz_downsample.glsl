@@ -0,0 +1,29 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* One level of the Hi-Z pyramid: every texel is the farthest depth of the source texels it covers. Source sizes
+ * needn't be even; the footprints partition the source, so odd rows and columns are folded into their neighbours. */
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D source;
+layout(binding = 1, r32f) uniform writeonly image2D destination;
+
+layout(push_constant) uniform constants
+{
+	ivec2 sourceSize;
+	ivec2 destinationSize;
+} pushConstants;
+
+void main() {
+    const ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(texel, pushConstants.destinationSize)))
+        return;
+    const ivec2 begin = texel * pushConstants.sourceSize / pushConstants.destinationSize;
+    const ivec2 end = max((texel + 1) * pushConstants.sourceSize / pushConstants.destinationSize, begin + 1);
+    float depth = 0.0;
+    for (int y = begin.y; y < end.y; y++)
+        for (int x = begin.x; x < end.x; x++)
+            depth = max(depth, texelFetch(source, ivec2(x, y), 0).r);
+    imageStore(destination, texel, vec4(depth));
+}
@@ -0,0 +1,22 @@
+#version 450
+#pragma shader_stage(vertex)
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
+
+layout(location = 0) out vec3 fragColor;
+
+/* The depth pre-pass and the shading pass compare depths for equality. */
+invariant gl_Position;
+
+layout(push_constant) uniform constants
+{
+	mat4 viewProjection;
+} pushConstants;
+
+void main() {
+    gl_Position = pushConstants.viewProjection * instanceTransform * vec4(inPosition, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+}
@@ -0,0 +1,97 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* Tests the bounding spheres of one instanced draw's instances against the Hi-Z pyramid of the previous frame, and
+ * compacts the survivors into the visible instance buffer, counting them in the draw's indirect command. */
+
+layout(local_size_x = 64) in;
+
+/* InstanceData as 32-bit words: a column-major mat4 transform, then the packed color. */
+const uint instanceWords = 17;
+
+layout(std430, binding = 0) readonly buffer Candidates { uint candidates[]; };
+layout(std430, binding = 1) writeonly buffer Visible { uint visible[]; };
+
+struct DrawIndexedIndirectCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+layout(std430, binding = 2) buffer Draws { DrawIndexedIndirectCommand draws[]; };
+
+layout(binding = 3) uniform sampler2D hiz;
+
+layout(push_constant) uniform constants
+{
+	mat4 viewProjection; // Of the frame the pyramid was built from
+	uint firstInstance;
+	uint instanceCount;
+	uint drawIndex;
+	float boundingRadius;
+	uint occlusionEnabled;
+} pushConstants;
+
+vec3 loadVec3(uint word)
+{
+    return uintBitsToFloat(uvec3(candidates[word], candidates[word + 1], candidates[word + 2]));
+}
+
+bool isOccluded(vec3 center, float radius)
+{
+    /* Screen-space bounds and nearest depth of the sphere's bounding box. */
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float nearestDepth = 1.0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        const vec3 offset = vec3((corner & 1) != 0 ? 1.0 : -1.0, (corner & 2) != 0 ? 1.0 : -1.0, (corner & 4) != 0 ? 1.0 : -1.0);
+        const vec4 clip = pushConstants.viewProjection * vec4(center + radius * offset, 1.0);
+        /* Crossing the near plane; nothing can be in front of it. */
+        if (clip.w <= 0.0)
+            return false;
+        const vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+    minUV = clamp(minUV, 0.0, 1.0);
+    maxUV = clamp(maxUV, 0.0, 1.0);
+
+    /* The mip at which the bounds shrink to at most a texel, so that they touch at most 2x2 texels. One more texel on
+     * every side keeps the test conservative where footprints of odd-sized levels don't line up with the UVs. */
+    const vec2 extent = (maxUV - minUV) * vec2(textureSize(hiz, 0));
+    const int mipCount = textureQueryLevels(hiz);
+    const int mip = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, mipCount - 1);
+    const ivec2 mipSize = textureSize(hiz, mip);
+    const ivec2 begin = clamp(ivec2(minUV * vec2(mipSize)) - 1, ivec2(0), mipSize - 1);
+    const ivec2 end = clamp(ivec2(maxUV * vec2(mipSize)) + 1, ivec2(0), mipSize - 1);
+    float farthestDepth = 0.0;
+    for (int y = begin.y; y <= end.y; y++)
+        for (int x = begin.x; x <= end.x; x++)
+            farthestDepth = max(farthestDepth, texelFetch(hiz, ivec2(x, y), mip).r);
+    return nearestDepth > farthestDepth;
+}
+
+void main() {
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= pushConstants.instanceCount)
+        return;
+    const uint base = (pushConstants.firstInstance + index) * instanceWords;
+
+    /* The radius scales with the longest axis of the transform. */
+    const vec3 axisX = loadVec3(base);
+    const vec3 axisY = loadVec3(base + 4);
+    const vec3 axisZ = loadVec3(base + 8);
+    const float scale = sqrt(max(dot(axisX, axisX), max(dot(axisY, axisY), dot(axisZ, axisZ))));
+    const vec3 center = loadVec3(base + 12);
+    if (pushConstants.occlusionEnabled != 0 && isOccluded(center, pushConstants.boundingRadius * scale))
+        return;
+
+    const uint slot = atomicAdd(draws[pushConstants.drawIndex].instanceCount, 1);
+    const uint destination = (pushConstants.firstInstance + slot) * instanceWords;
+    for (uint word = 0; word < instanceWords; word++)
+        visible[destination + word] = candidates[base + word];
+}
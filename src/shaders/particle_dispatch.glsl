@@ -0,0 +1,72 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* Sizes a step on the GPU: takes as many particles off the dead list as the step emits and there are dead ones,
+ * appends room for them to the current alive list, empties the next one, and writes the indirect dispatches of the
+ * emit and simulate passes. */
+
+layout(local_size_x = 1) in;
+
+/* The local size of the emit and simulate passes. */
+const uint groupSize = 256u;
+
+struct DrawIndirectCommand
+{
+	uint vertexCount;
+	uint instanceCount;
+	uint firstVertex;
+	uint firstInstance;
+};
+
+struct DispatchIndirectCommand
+{
+	uint x;
+	uint y;
+	uint z;
+};
+
+/* ParticleCounters. Each alive list is counted by the vertexCount of the command that draws it. */
+layout(std430, binding = 4) buffer Counters
+{
+	DrawIndirectCommand draws[2];
+	DispatchIndirectCommand emitDispatch;
+	DispatchIndirectCommand simulateDispatch;
+	uint deadCount;
+	uint emitCount;
+	uint emitDead; // Where the emitted particles start on the dead list
+	uint emitAlive; // Where they start on the current alive list
+} counters;
+
+layout(push_constant) uniform constants
+{
+	vec4 emitterPosition; // xyz, and w the radius particles spawn within
+	vec4 emitterVelocity; // xyz, and w the spread added to it
+	vec4 gravity; // xyz, and w the time step in seconds
+	vec4 sphere; // A collider: center xyz, radius w
+	vec4 ground; // A collider: the plane of points p with dot(ground.xyz, p) + ground.w = 0, its normal pointing up
+	float restitution;
+	float lifetime;
+	uint emitRequest;
+	uint current; // The alive list the step starts from
+	uint capacity;
+	uint seed;
+	uint maxGroupCount;
+} pushConstants;
+
+uint groupCount(uint count)
+{
+    return min((count + groupSize - 1) / groupSize, pushConstants.maxGroupCount);
+}
+
+void main() {
+    const uint current = pushConstants.current;
+    const uint emitCount = min(pushConstants.emitRequest, counters.deadCount);
+    counters.deadCount -= emitCount;
+    counters.emitCount = emitCount;
+    counters.emitDead = counters.deadCount;
+    counters.emitAlive = counters.draws[current].vertexCount;
+    counters.draws[current].vertexCount += emitCount;
+    counters.draws[1u - current].vertexCount = 0;
+    counters.emitDispatch.x = groupCount(emitCount);
+    counters.simulateDispatch.x = groupCount(counters.draws[current].vertexCount);
+}
@@ -0,0 +1,94 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* Revives the particles particle_dispatch took off the dead list at the emitter, appending them to the current alive
+ * list. */
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) writeonly buffer Positions { vec4 positions[]; }; // xyz, and w the age in seconds
+layout(std430, binding = 1) writeonly buffer Velocities { vec4 velocities[]; }; // xyz, and w the lifetime in seconds
+layout(std430, binding = 2) writeonly buffer Alive { uint alive[]; }; // Two lists of capacity each
+layout(std430, binding = 3) readonly buffer Dead { uint dead[]; };
+
+struct DrawIndirectCommand
+{
+	uint vertexCount;
+	uint instanceCount;
+	uint firstVertex;
+	uint firstInstance;
+};
+
+struct DispatchIndirectCommand
+{
+	uint x;
+	uint y;
+	uint z;
+};
+
+/* ParticleCounters. Each alive list is counted by the vertexCount of the command that draws it. */
+layout(std430, binding = 4) buffer Counters
+{
+	DrawIndirectCommand draws[2];
+	DispatchIndirectCommand emitDispatch;
+	DispatchIndirectCommand simulateDispatch;
+	uint deadCount;
+	uint emitCount;
+	uint emitDead; // Where the emitted particles start on the dead list
+	uint emitAlive; // Where they start on the current alive list
+} counters;
+
+layout(push_constant) uniform constants
+{
+	vec4 emitterPosition; // xyz, and w the radius particles spawn within
+	vec4 emitterVelocity; // xyz, and w the spread added to it
+	vec4 gravity; // xyz, and w the time step in seconds
+	vec4 sphere; // A collider: center xyz, radius w
+	vec4 ground; // A collider: the plane of points p with dot(ground.xyz, p) + ground.w = 0, its normal pointing up
+	float restitution;
+	float lifetime;
+	uint emitRequest;
+	uint current; // The alive list the step starts from
+	uint capacity;
+	uint seed;
+	uint maxGroupCount;
+} pushConstants;
+
+/* PCG hash, for random numbers that depend only on the particle and the step. */
+uint hash(uint value)
+{
+    const uint state = value * 747796405u + 2891336453u;
+    const uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state >> 8) / 16777216.0;
+}
+
+vec3 randomInSphere(inout uint state)
+{
+    const float z = random(state) * 2.0 - 1.0;
+    const float angle = random(state) * 6.28318531;
+    const float radius = pow(random(state), 1.0 / 3.0);
+    return radius * vec3(sqrt(1.0 - z * z) * vec2(cos(angle), sin(angle)), z);
+}
+
+void main() {
+    const uint emitCount = counters.emitCount;
+    const uint emitDead = counters.emitDead;
+    const uint aliveBase = pushConstants.current * pushConstants.capacity + counters.emitAlive;
+    for (uint i = gl_GlobalInvocationID.x; i < emitCount; i += gl_NumWorkGroups.x * gl_WorkGroupSize.x)
+    {
+        const uint particle = dead[emitDead + i];
+        uint state = hash(particle ^ hash(pushConstants.seed));
+        const vec3 position = pushConstants.emitterPosition.xyz + randomInSphere(state) * pushConstants.emitterPosition.w;
+        const vec3 velocity = pushConstants.emitterVelocity.xyz + randomInSphere(state) * pushConstants.emitterVelocity.w;
+        const float lifetime = pushConstants.lifetime * (0.5 + 0.5 * random(state));
+        positions[particle] = vec4(position, 0.0);
+        velocities[particle] = vec4(velocity, lifetime);
+        alive[aliveBase + i] = particle;
+    }
+}
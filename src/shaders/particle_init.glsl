@@ -0,0 +1,66 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* Puts every particle on the dead list and resets the counters, once, before the first step. */
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 3) writeonly buffer Dead { uint dead[]; };
+
+struct DrawIndirectCommand
+{
+	uint vertexCount;
+	uint instanceCount;
+	uint firstVertex;
+	uint firstInstance;
+};
+
+struct DispatchIndirectCommand
+{
+	uint x;
+	uint y;
+	uint z;
+};
+
+/* ParticleCounters. Each alive list is counted by the vertexCount of the command that draws it. */
+layout(std430, binding = 4) buffer Counters
+{
+	DrawIndirectCommand draws[2];
+	DispatchIndirectCommand emitDispatch;
+	DispatchIndirectCommand simulateDispatch;
+	uint deadCount;
+	uint emitCount;
+	uint emitDead; // Where the emitted particles start on the dead list
+	uint emitAlive; // Where they start on the current alive list
+} counters;
+
+layout(push_constant) uniform constants
+{
+	vec4 emitterPosition; // xyz, and w the radius particles spawn within
+	vec4 emitterVelocity; // xyz, and w the spread added to it
+	vec4 gravity; // xyz, and w the time step in seconds
+	vec4 sphere; // A collider: center xyz, radius w
+	vec4 ground; // A collider: the plane of points p with dot(ground.xyz, p) + ground.w = 0, its normal pointing up
+	float restitution;
+	float lifetime;
+	uint emitRequest;
+	uint current; // The alive list the step starts from
+	uint capacity;
+	uint seed;
+	uint maxGroupCount;
+} pushConstants;
+
+void main() {
+    for (uint i = gl_GlobalInvocationID.x; i < pushConstants.capacity; i += gl_NumWorkGroups.x * gl_WorkGroupSize.x)
+        dead[i] = i;
+    if (gl_GlobalInvocationID.x != 0)
+        return;
+    for (uint list = 0u; list < 2u; list++)
+        counters.draws[list] = DrawIndirectCommand(0u, 1u, 0u, 0u);
+    counters.emitDispatch = DispatchIndirectCommand(0u, 1u, 1u);
+    counters.simulateDispatch = DispatchIndirectCommand(0u, 1u, 1u);
+    counters.deadCount = pushConstants.capacity;
+    counters.emitCount = 0;
+    counters.emitDead = 0;
+    counters.emitAlive = 0;
+}
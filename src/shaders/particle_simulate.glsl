@@ -0,0 +1,104 @@
+#version 450
+#pragma shader_stage(compute)
+
+/* Integrates and collides the particles of the current alive list, compacting the survivors into the next list and
+ * returning the ones that died to the dead list. The next list's count ends up in the vertexCount of the command that
+ * draws it. */
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) buffer Positions { vec4 positions[]; }; // xyz, and w the age in seconds
+layout(std430, binding = 1) buffer Velocities { vec4 velocities[]; }; // xyz, and w the lifetime in seconds
+layout(std430, binding = 2) buffer Alive { uint alive[]; }; // Two lists of capacity each
+layout(std430, binding = 3) writeonly buffer Dead { uint dead[]; };
+
+struct DrawIndirectCommand
+{
+	uint vertexCount;
+	uint instanceCount;
+	uint firstVertex;
+	uint firstInstance;
+};
+
+struct DispatchIndirectCommand
+{
+	uint x;
+	uint y;
+	uint z;
+};
+
+/* ParticleCounters. Each alive list is counted by the vertexCount of the command that draws it. */
+layout(std430, binding = 4) buffer Counters
+{
+	DrawIndirectCommand draws[2];
+	DispatchIndirectCommand emitDispatch;
+	DispatchIndirectCommand simulateDispatch;
+	uint deadCount;
+	uint emitCount;
+	uint emitDead; // Where the emitted particles start on the dead list
+	uint emitAlive; // Where they start on the current alive list
+} counters;
+
+layout(push_constant) uniform constants
+{
+	vec4 emitterPosition; // xyz, and w the radius particles spawn within
+	vec4 emitterVelocity; // xyz, and w the spread added to it
+	vec4 gravity; // xyz, and w the time step in seconds
+	vec4 sphere; // A collider: center xyz, radius w
+	vec4 ground; // A collider: the plane of points p with dot(ground.xyz, p) + ground.w = 0, its normal pointing up
+	float restitution;
+	float lifetime;
+	uint emitRequest;
+	uint current; // The alive list the step starts from
+	uint capacity;
+	uint seed;
+	uint maxGroupCount;
+} pushConstants;
+
+void main() {
+    const uint current = pushConstants.current;
+    const uint next = 1u - current;
+    const uint count = counters.draws[current].vertexCount;
+    const float timeStep = pushConstants.gravity.w;
+    const vec3 sphereCenter = pushConstants.sphere.xyz;
+    const float sphereRadius = pushConstants.sphere.w;
+    for (uint i = gl_GlobalInvocationID.x; i < count; i += gl_NumWorkGroups.x * gl_WorkGroupSize.x)
+    {
+        const uint particle = alive[current * pushConstants.capacity + i];
+        vec4 position = positions[particle];
+        vec4 velocity = velocities[particle];
+        position.w += timeStep;
+        if (position.w >= velocity.w)
+        {
+            dead[atomicAdd(counters.deadCount, 1u)] = particle;
+            continue;
+        }
+
+        velocity.xyz += pushConstants.gravity.xyz * timeStep;
+        position.xyz += velocity.xyz * timeStep;
+        /* Bounces off the ground and the sphere, losing energy along the normal. */
+        const vec3 up = pushConstants.ground.xyz;
+        const float height = dot(up, position.xyz) + pushConstants.ground.w;
+        if (height < 0.0)
+        {
+            position.xyz -= height * up;
+            const float normalSpeed = dot(velocity.xyz, up);
+            if (normalSpeed < 0.0)
+                velocity.xyz -= (1.0 + pushConstants.restitution) * normalSpeed * up;
+        }
+        const vec3 offset = position.xyz - sphereCenter;
+        const float distanceSquared = dot(offset, offset);
+        if (distanceSquared < sphereRadius * sphereRadius && distanceSquared > 0.0)
+        {
+            const vec3 normal = offset * inversesqrt(distanceSquared);
+            position.xyz = sphereCenter + normal * sphereRadius;
+            const float normalSpeed = dot(velocity.xyz, normal);
+            if (normalSpeed < 0.0)
+                velocity.xyz -= (1.0 + pushConstants.restitution) * normalSpeed * normal;
+        }
+
+        positions[particle] = position;
+        velocities[particle] = velocity;
+        alive[next * pushConstants.capacity + atomicAdd(counters.draws[next].vertexCount, 1u)] = particle;
+    }
+}
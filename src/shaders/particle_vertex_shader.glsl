@@ -0,0 +1,25 @@
+#version 450
+#pragma shader_stage(vertex)
+
+/* Draws every particle of an alive list as a point, fading from white-hot to red over its lifetime. */
+
+layout(std430, binding = 0) readonly buffer Positions { vec4 positions[]; }; // xyz, and w the age in seconds
+layout(std430, binding = 1) readonly buffer Velocities { vec4 velocities[]; }; // xyz, and w the lifetime in seconds
+layout(std430, binding = 2) readonly buffer Alive { uint alive[]; }; // Two lists of capacity each
+
+layout(location = 0) out vec3 fragColor;
+
+layout(push_constant) uniform constants
+{
+	mat4 viewProjection;
+	uint list;
+	uint capacity;
+} pushConstants;
+
+void main() {
+    const uint particle = alive[pushConstants.list * pushConstants.capacity + gl_VertexIndex];
+    const vec4 position = positions[particle];
+    gl_Position = pushConstants.viewProjection * vec4(position.xyz, 1.0);
+    gl_PointSize = 1.0;
+    fragColor = mix(vec3(1.0, 0.9, 0.6), vec3(0.8, 0.15, 0.05), position.w / velocities[particle].w);
+}
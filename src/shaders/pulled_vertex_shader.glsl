@@ -0,0 +1,35 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+#pragma shader_stage(vertex)
+
+/* instanced_vertex_shader, but fetching the mesh's vertices through a buffer device address instead of from vertex
+ * attributes, so that meshes need no vertex buffer bound. Instance data still comes from binding 1. */
+
+/* PackedVertex: a position of four halves, the last unused, and an RGBA8 color. */
+struct PackedVertex
+{
+	uint position[2];
+	uint color;
+};
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertices { PackedVertex vertices[]; };
+
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
+
+layout(location = 0) out vec3 fragColor;
+
+/* The depth pre-pass and the shading pass compare depths for equality. */
+invariant gl_Position;
+
+layout(push_constant) uniform constants
+{
+	mat4 viewProjection;
+	Vertices vertices;
+} pushConstants;
+
+void main() {
+    const PackedVertex vertex = pushConstants.vertices.vertices[gl_VertexIndex];
+    const vec3 position = vec3(unpackHalf2x16(vertex.position[0]), unpackHalf2x16(vertex.position[1]).x);
+    gl_Position = pushConstants.viewProjection * instanceTransform * vec4(position, 1.0);
+    fragColor = unpackUnorm4x8(vertex.color).rgb * instanceColor.rgb;
+}
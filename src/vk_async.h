@@ -0,0 +1,299 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_stream.h"
+#include "vk_sync.h"
+
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+/* Decides which thread a coroutine is resumed on once the GPU work it awaited has finished. */
+class VulkanExecutor
+{
+public:
+    virtual ~VulkanExecutor() = default;
+    virtual void schedule(std::coroutine_handle<> handle) = 0;
+};
+
+/* Resumes right on the waiter thread. Only for short continuations, since it delays every other pending wait. */
+class InlineExecutor final : public VulkanExecutor
+{
+public:
+    void schedule(std::coroutine_handle<> handle) override { handle.resume(); }
+};
+
+/* Collects coroutines to be resumed by whoever calls drain(), e.g. the main loop once per frame. */
+class QueueExecutor final : public VulkanExecutor
+{
+    std::mutex mutex_;
+    std::vector<std::coroutine_handle<>> ready_;
+    std::vector<std::coroutine_handle<>> draining_;
+public:
+    void schedule(std::coroutine_handle<> handle) override
+    {
+        const std::scoped_lock lock(mutex_);
+        ready_.push_back(handle);
+    }
+    void drain()
+    {
+        {
+            const std::scoped_lock lock(mutex_);
+            std::swap(ready_, draining_);
+        }
+        for (const std::coroutine_handle<> handle : draining_)
+            handle.resume();
+        draining_.clear();
+    }
+};
+
+/* One thread multiplexing every pending timeline wait through a single wait-any vkWaitSemaphores. A private timeline
+ * semaphore, signaled from the host, wakes the thread whenever a new wait is registered. */
+class VulkanTimelineWaiter
+{
+    struct Wait
+    {
+        vk::Semaphore semaphore;
+        uint64_t value;
+        std::coroutine_handle<> handle;
+        VulkanExecutor* executor;
+    };
+
+    vk::Device device_;
+    VulkanExecutor& defaultExecutor_;
+    VulkanTimelineSemaphore wakeSemaphore_;
+    std::mutex mutex_;
+    uint64_t wakeValue_ = 0;
+    std::vector<Wait> incoming_;
+    std::jthread thread_;
+
+    void wake_()
+    {
+        const std::scoped_lock lock(mutex_);
+        wakeSemaphore_.signal(++wakeValue_);
+    }
+
+    void run_(const std::stop_token& stopToken)
+    {
+        std::vector<Wait> waits;
+        std::vector<vk::Semaphore> semaphores;
+        std::vector<uint64_t> values;
+        while (!stopToken.stop_requested())
+        {
+            uint64_t wakeValue = 0;
+            {
+                const std::scoped_lock lock(mutex_);
+                waits.insert(waits.end(), incoming_.begin(), incoming_.end());
+                incoming_.clear();
+                wakeValue = wakeValue_;
+            }
+
+            semaphores.assign(1, wakeSemaphore_.get());
+            values.assign(1, wakeValue + 1);
+            for (const Wait& wait : waits)
+            {
+                semaphores.push_back(wait.semaphore);
+                values.push_back(wait.value);
+            }
+            VK_CHECK(device_.waitSemaphores(vk::SemaphoreWaitInfo(vk::SemaphoreWaitFlagBits::eAny, semaphores, values),
+                                            std::numeric_limits<uint64_t>::max()));
+
+            /* Wait-any doesn't say which semaphore fired, so check all of them, querying each semaphore once. */
+            std::optional<std::pair<vk::Semaphore, uint64_t>> lastCounter;
+            std::erase_if(waits, [&](const Wait& wait)
+            {
+                if (!lastCounter || lastCounter->first != wait.semaphore)
+                    lastCounter.emplace(wait.semaphore, device_.getSemaphoreCounterValue(wait.semaphore));
+                if (lastCounter->second < wait.value)
+                    return false;
+                wait.executor->schedule(wait.handle);
+                return true;
+            });
+        }
+    }
+public:
+    VulkanTimelineWaiter(const vk::Device& device, VulkanExecutor& defaultExecutor) :
+        device_(device), defaultExecutor_(defaultExecutor), wakeSemaphore_(device),
+        thread_([this](const std::stop_token& stopToken) { run_(stopToken); })
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanTimelineWaiter)
+
+    /* Coroutines still waiting at this point are never resumed; their owners are expected to be gone already. */
+    ~VulkanTimelineWaiter()
+    {
+        thread_.request_stop();
+        wake_();
+    }
+
+    void enqueue(const VulkanStreamEvent& event, std::coroutine_handle<> handle, VulkanExecutor& executor)
+    {
+        {
+            const std::scoped_lock lock(mutex_);
+            incoming_.push_back({ event.semaphore(), event.value(), handle, &executor });
+        }
+        wake_();
+    }
+
+    class Awaiter
+    {
+        VulkanTimelineWaiter& waiter_;
+        VulkanStreamEvent event_;
+        VulkanExecutor& executor_;
+    public:
+        Awaiter(VulkanTimelineWaiter& waiter, const VulkanStreamEvent& event, VulkanExecutor& executor) noexcept
+            : waiter_(waiter), event_(event), executor_(executor) {}
+
+        bool await_ready() const { return event_.completed(); }
+        void await_suspend(std::coroutine_handle<> handle) { waiter_.enqueue(event_, handle, executor_); }
+        void await_resume() const noexcept {}
+    };
+
+    /* co_await waiter.wait(stream.getLastEvent()) suspends until the GPU reaches the event. */
+    [[nodiscard]] Awaiter wait(const VulkanStreamEvent& event) noexcept { return Awaiter(*this, event, defaultExecutor_); }
+    [[nodiscard]] Awaiter wait(const VulkanStreamEvent& event, VulkanExecutor& executor) noexcept { return Awaiter(*this, event, executor); }
+};
+
+template <typename T = void>
+class VulkanTask;
+
+namespace detail
+{
+
+struct VulkanTaskPromiseBase
+{
+    std::coroutine_handle<> continuation_ = std::noop_coroutine();
+    std::exception_ptr exception_;
+
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept { return handle.promise().continuation_; }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+    void rethrowIfFailed() const
+    {
+        if (exception_)
+            std::rethrow_exception(exception_);
+    }
+};
+
+template <typename T>
+struct VulkanTaskPromise : VulkanTaskPromiseBase
+{
+    std::optional<T> value_;
+
+    VulkanTask<T> get_return_object() noexcept;
+    template <std::convertible_to<T> U>
+    void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+    T result()
+    {
+        rethrowIfFailed();
+        return std::move(*value_);
+    }
+};
+
+template <>
+struct VulkanTaskPromise<void> : VulkanTaskPromiseBase
+{
+    VulkanTask<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+    void result() const { rethrowIfFailed(); }
+};
+
+/* Self-owning coroutine frame used to run a detached VulkanTask to completion. */
+struct VulkanDetachedTask
+{
+    struct promise_type
+    {
+        VulkanDetachedTask get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+}
+
+/* Lazily started coroutine, run by co_await-ing it from another coroutine or by detaching it. Lets multi-stage GPU
+ * jobs be written as straight-line code:
+ *     VulkanTask<> upload(...) { stream.submitWork(...); co_await waiter.wait(stream.getLastEvent()); ... }
+ */
+template <typename T>
+class [[nodiscard]] VulkanTask
+{
+public:
+    using promise_type = detail::VulkanTaskPromise<T>;
+private:
+    std::coroutine_handle<promise_type> handle_;
+
+    static detail::VulkanDetachedTask runDetached_(VulkanTask task) { co_await std::move(task); }
+public:
+    explicit VulkanTask(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+    VulkanTask(const VulkanTask&) = delete;
+    VulkanTask& operator=(const VulkanTask&) = delete;
+    VulkanTask(VulkanTask&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    VulkanTask& operator=(VulkanTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    ~VulkanTask()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) const noexcept
+            {
+                handle.promise().continuation_ = awaiting;
+                return handle;
+            }
+            T await_resume() const { return handle.promise().result(); }
+        };
+        return Awaiter{ handle_ };
+    }
+
+    /* Starts the task with nobody awaiting it. An exception escaping a detached task terminates. */
+    void detach() &&
+    {
+        runDetached_(std::move(*this));
+    }
+};
+
+namespace detail
+{
+
+template <typename T>
+VulkanTask<T> VulkanTaskPromise<T>::get_return_object() noexcept
+{
+    return VulkanTask<T>(std::coroutine_handle<VulkanTaskPromise<T>>::from_promise(*this));
+}
+
+inline VulkanTask<void> VulkanTaskPromise<void>::get_return_object() noexcept
+{
+    return VulkanTask<void>(std::coroutine_handle<VulkanTaskPromise<void>>::from_promise(*this));
+}
+
+}
@@ -3,6 +3,7 @@
 #include "vk_types.h"
 #include "vk_command.h"
 #include "vk_device.h"
+#include "metrics.h"
 
 #include <chrono>
 #include <limits>
@@ -12,7 +13,8 @@ enum class VulkanBufferType
 {
     DeviceLocal,
     Staging,
-    HostAccessible
+    HostAccessible,
+    Readback
 };
 
 consteval vk::MemoryPropertyFlags getMemoryFlags(VulkanBufferType type) noexcept
@@ -24,71 +26,87 @@ consteval vk::MemoryPropertyFlags getMemoryFlags(VulkanBufferType type) noexcept
     case DeviceLocal:       return eDeviceLocal;
     case Staging:           return eHostVisible | eHostCoherent;
     case HostAccessible:    return eDeviceLocal | eHostVisible;
+    case Readback:          return eHostVisible | eHostCached;
     }
 }
 
+consteval MemoryCategory getMemoryCategory(vk::BufferUsageFlags usage, VulkanBufferType type) noexcept
+{
+    using enum vk::BufferUsageFlagBits;
+    if (type == VulkanBufferType::Staging)
+        return MemoryCategory::Staging;
+    if (type == VulkanBufferType::Readback)
+        return MemoryCategory::Readback;
+    if (usage & (eVertexBuffer | eIndexBuffer))
+        return MemoryCategory::Geometry;
+    return MemoryCategory::Other;
+}
+
 template <vk::BufferUsageFlags usage, VulkanBufferType bufferType>
 class VulkanBuffer
 {
 private:
     vk::DeviceSize bufferSize_;
     vk::raii::Buffer buffer_;
-    vk::DeviceSize bufferCapacity_ = 0;
-    vk::raii::DeviceMemory bufferMemory_;
+    VulkanAllocation allocation_;
+    void* mapped_ = nullptr;
 
     constexpr static vk::MemoryPropertyFlags memoryPropertyFlags_ = getMemoryFlags(bufferType);
-
-    vk::raii::DeviceMemory createBufferMemory(const VulkanDevice& device)
-    {
-        vk::MemoryRequirements memoryRequirements = buffer_.getMemoryRequirements();
-        const vk::PhysicalDeviceMemoryProperties memoryProperties = device.physicalDevice.getMemoryProperties();
-        bufferCapacity_ = memoryRequirements.size;
-
-        constexpr auto findMemoryType = [](auto& memoryRequirements, const auto& memoryProperties)
-        {
-            for (int i = std::popcount(memoryRequirements.memoryTypeBits); --i >= 0; )
-            {
-                const uint32_t memoryType = gsl::narrow<uint32_t>(std::countr_zero(memoryRequirements.memoryTypeBits));
-                if (memoryType > memoryProperties.memoryTypeCount)
-                    break;
-                if ((memoryProperties.memoryTypes.at(memoryType).propertyFlags & memoryPropertyFlags_) == memoryPropertyFlags_)
-                    return memoryType;
-                memoryRequirements.memoryTypeBits ^= 1 << memoryType;
-            }
-            throw FatalError("Failed to find suitable memory type for VulkanBuffer");
-        };
-        return device.device.allocateMemory({ bufferCapacity_, findMemoryType(memoryRequirements, memoryProperties) });
-    }
+    constexpr static MemoryCategory memoryCategory_ = getMemoryCategory(usage, bufferType);
+    constexpr static bool hasDeviceAddress_ = static_cast<bool>(usage & vk::BufferUsageFlagBits::eShaderDeviceAddress);
+    constexpr static vk::MemoryAllocateFlags allocateFlags_ = hasDeviceAddress_ ? vk::MemoryAllocateFlagBits::eDeviceAddress
+                                                                                : vk::MemoryAllocateFlags();
+    vk::DeviceAddress deviceAddress_ = 0;
 public:
-    VulkanBuffer(const VulkanDevice& device, vk::DeviceSize bufferSize) :
+    /* Low-priority device-local buffers may end up in host memory when VRAM is over budget; see VulkanMemoryManager. */
+    VulkanBuffer(const VulkanDevice& device, vk::DeviceSize bufferSize, MemoryPriority priority = MemoryPriority::Normal) :
         bufferSize_(bufferSize),
         buffer_(device.device.createBuffer(vk::BufferCreateInfo({}, bufferSize, usage, vk::SharingMode::eExclusive, {}))),
-        bufferMemory_(createBufferMemory(device))
+        allocation_(device.memory->allocate(buffer_.getMemoryRequirements(), memoryPropertyFlags_, memoryCategory_, priority, allocateFlags_))
     {
-        buffer_.bindMemory(*bufferMemory_, 0);
+        buffer_.bindMemory(*allocation_.memory(), 0);
+        if constexpr (hasDeviceAddress_)
+            deviceAddress_ = device.device.getBufferAddress(vk::BufferDeviceAddressInfo(*buffer_));
     }
     DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanBuffer)
 
     const vk::Buffer& get() const noexcept { return *buffer_; }
     constexpr vk::DeviceSize size() const { return bufferSize_; }
-    constexpr vk::DeviceSize capacity() const { return bufferCapacity_; }
+    constexpr vk::DeviceSize capacity() const { return allocation_.size(); }
+    const vk::DeviceMemory& getMemory() const noexcept { return *allocation_.memory(); }
+    const VulkanAllocation& allocation() const noexcept { return allocation_; }
+    /* Properties of the memory type actually chosen, which may be a superset of the requested ones. */
+    vk::MemoryPropertyFlags memoryFlags() const noexcept { return allocation_.flags(); }
+    bool isCoherent() const noexcept { return static_cast<bool>(allocation_.flags() & vk::MemoryPropertyFlagBits::eHostCoherent); }
+    /* For shaders to access the buffer through a pointer, e.g. in push constants, without it being bound. */
+    vk::DeviceAddress deviceAddress() const noexcept requires (hasDeviceAddress_) { return deviceAddress_; }
+
+    /* Maps the whole buffer on first use and keeps it mapped for the buffer's lifetime. Don't mix with
+     * copyFrom/copyTo, which map and unmap around each copy. */
+    gsl::span<std::byte> mapped() requires (bufferType != VulkanBufferType::DeviceLocal)
+    {
+        if (!mapped_)
+            mapped_ = allocation_.memory().mapMemory(0, VK_WHOLE_SIZE);
+        return { static_cast<std::byte*>(mapped_), gsl::narrow<size_t>(bufferSize_) };
+    }
     template <typename T, size_t N>
     void copyFrom(const gsl::span<const T, N> data) const
     {
         static_assert(bufferType == VulkanBufferType::Staging);
         assert(data.size_bytes() <= bufferSize_);
-        void* bufferPointer = bufferMemory_.mapMemory(0, data.size_bytes());
+        void* bufferPointer = allocation_.memory().mapMemory(0, data.size_bytes());
         std::memcpy(bufferPointer, data.data(), data.size_bytes());
-        bufferMemory_.unmapMemory();
+        allocation_.memory().unmapMemory();
+        metrics::bytesUploaded.add(data.size_bytes());
     }
     template <typename T, size_t N>
     void copyTo(const gsl::span<T, N> data) const
     {
         static_assert(bufferType == VulkanBufferType::Staging);
         assert(data.size_bytes() >= bufferSize_);
-        const T* bufferPointer = reinterpret_cast<T*>(bufferMemory_.mapMemory(0, bufferSize_));
+        const T* bufferPointer = reinterpret_cast<T*>(allocation_.memory().mapMemory(0, bufferSize_));
         std::memcpy(data.data(), bufferPointer, data.size_bytes());
-        bufferMemory_.unmapMemory();
+        allocation_.memory().unmapMemory();
     }
 };
 
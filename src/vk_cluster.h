@@ -0,0 +1,241 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_deletion.h"
+#include "vk_descriptor.h"
+#include "vk_device.h"
+#include "vk_occlusion.h"
+#include "vk_readback.h"
+#include "vk_shader.h"
+#include "vk_stream.h"
+#include "vk_vertex.h"
+#include "meshlet.h"
+#include "render_queue.h"
+
+#include <optional>
+#include <ostream>
+
+struct ClusterStats
+{
+    uint64_t tested = 0;
+    uint64_t visible = 0;
+
+    friend std::ostream& operator<<(std::ostream& os, const ClusterStats& stats)
+    {
+        os << stats.visible << " of " << stats.tested << " tested clusters visible";
+        if (stats.tested != 0)
+            os << " (" << 100.0 * static_cast<double>(stats.visible) / static_cast<double>(stats.tested) << "%)";
+        return os;
+    }
+};
+
+/* GPU culling of instanced draws at meshlet granularity, for drawing large meshes without mesh shaders. A compute pass
+ * tests every cluster of every instance against the frustum, optionally against its normal cone for backfacing, and
+ * against the Hi-Z pyramid of a VulkanOcclusionCuller, then appends one indexed indirect command per surviving cluster
+ * and counts them. The draw replays the commands with vkCmdDrawIndexedIndirectCount through the ordinary graphics
+ * pipeline, taking the instance from each command's firstInstance; the device needs the clusterDraws optional features.
+ *
+ * Per frame: beginFrame(), addDraw() for every instanced draw of a mesh with meshlets, recordCull() after the occlusion
+ * culler's, then endFrame(). */
+class VulkanClusterCuller
+{
+    using CommandBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+                                       VulkanBufferType::DeviceLocal>;
+    using CountBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                                     vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+                                     VulkanBufferType::DeviceLocal>;
+    using ViewBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferDst, VulkanBufferType::DeviceLocal>;
+
+    /* The cull shader reads instances as 17 words with the transform first. */
+    static_assert(sizeof(InstanceData) == 17 * sizeof(uint32_t) && offsetof(InstanceData, transform) == 0);
+
+    /* std140, written into the view buffer at the start of every cull pass. */
+    struct View
+    {
+        glm::mat4 viewProjection;
+        glm::mat4 hizViewProjection;
+        glm::vec4 eye;
+        uint32_t occlusionEnabled;
+        std::array<uint32_t, 3> padding;
+    };
+    struct PushConstants
+    {
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+        uint32_t firstCommand;
+        uint32_t drawIndex;
+        uint32_t coneCulling;
+    };
+
+    struct Draw
+    {
+        PushConstants constants;
+        vk::Buffer meshlets;
+    };
+
+    constexpr static uint32_t cullGroupSize_ = 64;
+    constexpr static uint64_t statsInterval_ = 30;
+
+    const VulkanDevice& device_;
+    /* Bound per draw, as each binds its own mesh's meshlets. */
+    VulkanPushDescriptors descriptors_;
+    vk::raii::PipelineLayout pipelineLayout_;
+    vk::raii::Pipeline pipeline_;
+    ViewBuffer view_;
+
+    std::optional<CommandBuffer> commands_;
+    std::optional<CountBuffer> counts_;
+    size_t commandCapacity_ = 0;
+    size_t drawCapacity_ = 0;
+    size_t commandCount_ = 0;
+    vk::Buffer candidates_;
+    std::vector<Draw> draws_;
+
+    VulkanReadbackRing readback_;
+    std::optional<std::pair<ReadbackHandle, uint64_t>> pendingStats_;
+    ClusterStats stats_;
+    uint64_t frameNumber_ = 0;
+
+    static vk::raii::PipelineLayout createPipelineLayout_(const VulkanDevice& device, const vk::DescriptorSetLayout& setLayout)
+    {
+        const vk::PushConstantRange pushConstants = pushConstantRange<PushConstants>({ "cluster_cull" });
+        return device.device.createPipelineLayout(vk::PipelineLayoutCreateInfo({}, setLayout, pushConstants));
+    }
+
+    void pollStats_()
+    {
+        if (!pendingStats_ || !pendingStats_->first.ready())
+            return;
+        for (const uint32_t count : pendingStats_->first.getAs<uint32_t>())
+            stats_.visible += count;
+        stats_.tested += pendingStats_->second;
+        pendingStats_.reset();
+    }
+public:
+    /* maxDraws bounds the draws per frame, for the size of the stats readbacks. */
+    VulkanClusterCuller(const VulkanDevice& device, size_t maxDraws = 1024) :
+        device_(device),
+        descriptors_(device, { "cluster_cull" }),
+        pipelineLayout_(createPipelineLayout_(device, *descriptors_.setLayout())),
+        pipeline_(createComputePipeline("cluster_cull", *pipelineLayout_, device)),
+        view_(device, sizeof(View)),
+        readback_(device, 4 * maxDraws * sizeof(uint32_t))
+    {
+        Expects(maxDraws > 0);
+        drawCapacity_ = maxDraws;
+        counts_.emplace(device_, drawCapacity_ * sizeof(uint32_t));
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanClusterCuller)
+
+    /* Makes room for commandCapacity clusters over all of the frame's draws. Outgrown buffers are handed to
+     * deletionQueue, as the previous frame may still be drawing from them. */
+    void beginFrame(size_t commandCapacity, const VulkanStream& stream, VulkanDeletionQueue& deletionQueue)
+    {
+        if (commandCapacity > commandCapacity_ || !commands_)
+        {
+            if (commands_)
+                deletionQueue.defer(stream, std::move(*commands_));
+            commandCapacity_ = std::max<size_t>(commandCapacity, 1);
+            commands_.emplace(device_, commandCapacity_ * sizeof(vk::DrawIndexedIndirectCommand));
+        }
+        descriptors_.beginFrame();
+        draws_.clear();
+        commandCount_ = 0;
+        candidates_ = nullptr;
+    }
+
+    /* Returns the draw that renders only the visible clusters of packet, an instanced draw of a mesh whose meshlets
+     * are meshlets in meshletBuffer. Cone culling is only valid for pipelines that cull back faces. All of a frame's
+     * draws have to take their instances from the same buffer. */
+    DrawPacket addDraw(const DrawPacket& packet, vk::Buffer meshletBuffer, MeshletRange meshlets, bool coneCulling)
+    {
+        Expects(draws_.size() < drawCapacity_);
+        Expects(packet.instanceBuffer && packet.instanceOffset == 0 && !packet.indirectBuffer);
+        Expects(meshletBuffer && meshlets.meshletCount > 0);
+        Expects(!candidates_ || candidates_ == packet.instanceBuffer);
+        const size_t clusterCount = size_t{ packet.instanceCount } * meshlets.meshletCount;
+        Expects(commandCount_ + clusterCount <= commandCapacity_); // Exceeded the capacity passed to beginFrame()
+        candidates_ = packet.instanceBuffer;
+
+        const auto drawIndex = gsl::narrow_cast<uint32_t>(draws_.size());
+        const auto firstCommand = gsl::narrow<uint32_t>(commandCount_);
+        draws_.push_back({ { packet.firstInstance, packet.instanceCount, meshlets.firstMeshlet, meshlets.meshletCount, firstCommand, drawIndex,
+                             coneCulling ? 1u : 0u }, meshletBuffer });
+        commandCount_ += clusterCount;
+
+        DrawPacket culled = packet;
+        culled.firstInstance = 0;
+        culled.indirectBuffer = commands_->get();
+        culled.indirectOffset = vk::DeviceSize{ firstCommand } * sizeof(vk::DrawIndexedIndirectCommand);
+        culled.indirectCountBuffer = counts_->get();
+        culled.indirectCountOffset = vk::DeviceSize{ drawIndex } * sizeof(uint32_t);
+        culled.maxDrawCount = gsl::narrow<uint32_t>(clusterCount);
+        return culled;
+    }
+
+    /* Records the cull pass, outside of the render pass and after occlusion.recordCull(), whose pyramid it tests
+     * against. viewProjection and eye are this frame's. */
+    void recordCull(const vk::CommandBuffer& commandBuffer, const VulkanOcclusionCuller& occlusion, const glm::mat4& viewProjection, const glm::vec3& eye)
+    {
+        if (draws_.empty())
+            return;
+        const std::optional<glm::mat4>& hizViewProjection = occlusion.hizViewProjection();
+        const View view{ viewProjection, hizViewProjection.value_or(glm::mat4(1.0f)), glm::vec4(eye, 1.0f), hizViewProjection ? 1u : 0u, {} };
+        commandBuffer.updateBuffer<View>(view_.get(), 0, view);
+        commandBuffer.fillBuffer(counts_->get(), 0, draws_.size() * sizeof(uint32_t), 0);
+        const vk::MemoryBarrier resetBarrier(vk::AccessFlagBits::eTransferWrite,
+                                             vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, resetBarrier, {}, {});
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline_);
+        const vk::DescriptorBufferInfo viewInfo(view_.get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo candidates(candidates_, 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo commands(commands_->get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo counts(counts_->get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorImageInfo hiz = occlusion.hizDescriptor();
+        for (const Draw& draw : draws_)
+        {
+            if (draw.constants.instanceCount == 0)
+                continue;
+            const vk::DescriptorBufferInfo meshlets(draw.meshlets, 0, VK_WHOLE_SIZE);
+            std::array writes = {
+                vk::WriteDescriptorSet({}, 0, 0, vk::DescriptorType::eUniformBuffer, {}, viewInfo),
+                vk::WriteDescriptorSet({}, 1, 0, vk::DescriptorType::eStorageBuffer, {}, candidates),
+                vk::WriteDescriptorSet({}, 2, 0, vk::DescriptorType::eStorageBuffer, {}, meshlets),
+                vk::WriteDescriptorSet({}, 3, 0, vk::DescriptorType::eStorageBuffer, {}, commands),
+                vk::WriteDescriptorSet({}, 4, 0, vk::DescriptorType::eStorageBuffer, {}, counts),
+                vk::WriteDescriptorSet({}, 5, 0, vk::DescriptorType::eCombinedImageSampler, hiz),
+            };
+            descriptors_.bind(commandBuffer, vk::PipelineBindPoint::eCompute, *pipelineLayout_, writes);
+            commandBuffer.pushConstants<PushConstants>(*pipelineLayout_, vk::ShaderStageFlagBits::eCompute, 0, draw.constants);
+            const size_t clusterCount = size_t{ draw.constants.instanceCount } * draw.constants.meshletCount;
+            commandBuffer.dispatch(gsl::narrow<uint32_t>((clusterCount + cullGroupSize_ - 1) / cullGroupSize_), 1, 1);
+        }
+        const vk::MemoryBarrier cullBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect, {}, cullBarrier, {}, {});
+    }
+
+    void endFrame(VulkanStream& stream, const vk::Queue& queue)
+    {
+        descriptors_.endFrame(stream);
+        pollStats_();
+        if (!pendingStats_ && !draws_.empty() && frameNumber_ % statsInterval_ == 0)
+        {
+            uint64_t tested = 0;
+            for (const Draw& draw : draws_)
+                tested += uint64_t{ draw.constants.instanceCount } * draw.constants.meshletCount;
+            pendingStats_.emplace(readback_.readback(stream, queue, *counts_, 0, draws_.size() * sizeof(uint32_t)), tested);
+        }
+        frameNumber_++;
+    }
+
+    /* Totals over the sampled frames since the last call. */
+    ClusterStats takeStats()
+    {
+        pollStats_();
+        return std::exchange(stats_, {});
+    }
+};
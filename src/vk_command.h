@@ -2,8 +2,10 @@
 
 #include "vk_types.h"
 #include "vk_sync.h"
+#include "metrics.h"
 
 #include <atomic>
+#include <optional>
 #include <thread>
 #include <vector>
 
@@ -24,16 +26,20 @@ class VulkanCommandPoolImpl
 
     vk::Device device_;
     size_t bufferCount_;
+    vk::CommandBufferLevel level_;
     vk::UniqueCommandPool commandPool_;
     std::vector<vk::CommandBuffer> commandBuffers_;
+    /* Fences of checked-in command buffers, unsignaled and ready for the next submit, so that checking out doesn't
+     * create one every time. */
+    std::vector<VulkanFence> fences_;
 
-    VulkanCommandPoolImpl(vk::Device device, size_t bufferCount, const VulkanQueueInfo& queueInfo)
-        : device_(device), bufferCount_(bufferCount)
+    VulkanCommandPoolImpl(vk::Device device, size_t bufferCount, const VulkanQueueInfo& queueInfo, vk::CommandBufferLevel level)
+        : device_(device), bufferCount_(bufferCount), level_(level)
     {
         const vk::CommandPoolCreateInfo commandPoolInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueInfo.familyIndex);
         commandPool_ = device.createCommandPoolUnique(commandPoolInfo);
 
-        const vk::CommandBufferAllocateInfo commandBufferInfo(*commandPool_, vk::CommandBufferLevel::ePrimary, gsl::narrow<uint32_t>(bufferCount));
+        const vk::CommandBufferAllocateInfo commandBufferInfo(*commandPool_, level_, gsl::narrow<uint32_t>(bufferCount));
         commandBuffers_ = device.allocateCommandBuffers(commandBufferInfo);
     }
 public:
@@ -44,13 +50,13 @@ public:
         device_.freeCommandBuffers(*commandPool_, commandBuffers_);
     }
 private:
-    vk::CommandBuffer checkOut()
+    std::pair<vk::CommandBuffer, VulkanFence> checkOut()
     {
         if (commandBuffers_.empty())
         {
             const auto extraBuffers = bufferCount_ / 2;
             bufferCount_ += extraBuffers;
-            const vk::CommandBufferAllocateInfo commandBufferInfo(*commandPool_, vk::CommandBufferLevel::ePrimary, gsl::narrow<uint32_t>(extraBuffers));
+            const vk::CommandBufferAllocateInfo commandBufferInfo(*commandPool_, level_, gsl::narrow<uint32_t>(extraBuffers));
             auto newCommandBuffers = device_.allocateCommandBuffers(commandBufferInfo);
             commandBuffers_.insert(
                 commandBuffers_.end(),
@@ -60,12 +66,19 @@ private:
         }
         vk::CommandBuffer commandBuffer = commandBuffers_.back();
         commandBuffers_.pop_back();
-        return commandBuffer;
+        if (fences_.empty())
+            return { commandBuffer, VulkanFence(device_) };
+        VulkanFence fence = std::move(fences_.back());
+        fences_.pop_back();
+        return { commandBuffer, std::move(fence) };
     }
 public:
-    void checkIn(vk::CommandBuffer commandBuffer) noexcept
+    /* Without a fence when its state is unknown; a new one is created instead. */
+    void checkIn(vk::CommandBuffer commandBuffer, std::optional<VulkanFence> fence) noexcept
     {
         commandBuffers_.push_back(commandBuffer);
+        if (fence)
+            fences_.push_back(std::move(*fence));
     }
 };
 
@@ -82,33 +95,53 @@ class VulkanCommandBuffer
     bool submitted_ = false;
 
     template <vk::CommandBufferUsageFlags flags>
-    void record_(VulkanCommandRecorder auto& recorder)
+    void record_(VulkanCommandRecorder auto& recorder, const vk::CommandBufferInheritanceInfo* inheritanceInfo = nullptr)
     {
-        commandBuffer_.begin({ vk::CommandBufferUsageFlags(flags) });
+        commandBuffer_.begin({ vk::CommandBufferUsageFlags(flags), inheritanceInfo });
         recorder(commandBuffer_);
         commandBuffer_.end();
     }
 
-    VulkanCommandBuffer(vk::Device device, std::shared_ptr<detail::VulkanCommandPoolImpl> commandPool, vk::CommandBuffer commandBuffer)
-        : commandPool_(commandPool), commandBuffer_(std::move(commandBuffer)), fence_(device)
+    VulkanCommandBuffer(std::shared_ptr<detail::VulkanCommandPoolImpl> commandPool, vk::CommandBuffer commandBuffer, VulkanFence fence)
+        : commandPool_(std::move(commandPool)), commandBuffer_(commandBuffer), fence_(std::move(fence))
     {}
-public:
-    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanCommandBuffer)
 
-    ~VulkanCommandBuffer()
+    void release_() noexcept
     {
-        /* Skip destructor if command buffer was moved from */
+        /* Nothing to release if command buffer was moved from */
         if (!commandPool_)
             return;
+        bool fenceReusable = false;
         try
         {
-            std::ignore = waitAndReset();
-            commandBuffer_.reset(vk::CommandBufferResetFlagBits::eReleaseResources);
+            fenceReusable = waitAndReset() == vk::Result::eSuccess && !submitted_;
+            /* Keep the command memory; the next recording will need about as much. */
+            commandBuffer_.reset();
         }
         catch (...) {}
-        commandPool_->checkIn(commandBuffer_);
+        commandPool_->checkIn(commandBuffer_, fenceReusable ? std::optional<VulkanFence>(std::move(fence_)) : std::nullopt);
+        commandPool_.reset();
+    }
+public:
+    VulkanCommandBuffer(const VulkanCommandBuffer&) = delete;
+    VulkanCommandBuffer& operator=(const VulkanCommandBuffer&) = delete;
+    VulkanCommandBuffer(VulkanCommandBuffer&&) noexcept = default;
+    /* Returns the command buffer being overwritten to its pool, which a defaulted assignment would leak. */
+    VulkanCommandBuffer& operator=(VulkanCommandBuffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release_();
+            commandPool_ = std::move(other.commandPool_);
+            commandBuffer_ = other.commandBuffer_;
+            fence_ = std::move(other.fence_);
+            submitted_ = other.submitted_;
+        }
+        return *this;
     }
 
+    ~VulkanCommandBuffer() { release_(); }
+
     void submitTo(const vk::Queue& queue, vk::SubmitInfo submitInfo)
     {
         submitted_ = true;
@@ -142,6 +175,16 @@ public:
         });
     }
 
+    /* Records a secondary command buffer to be executed inside the render pass named by inheritanceInfo. Secondaries
+     * are never submitted themselves, so keep them alive until the primary executing them has retired. */
+    void recordSecondaryOnce(const vk::CommandBufferInheritanceInfo& inheritanceInfo, VulkanCommandRecorder auto& recorder)
+    {
+        using enum vk::CommandBufferUsageFlagBits;
+        record_<eOneTimeSubmit | eRenderPassContinue>(recorder, &inheritanceInfo);
+    }
+
+    const vk::CommandBuffer& get() const noexcept { return commandBuffer_; }
+
     [[nodiscard]] vk::Result wait() const { return submitted_ ? fence_.wait() : vk::Result::eSuccess; }
     [[nodiscard]] vk::Result wait(std::chrono::nanoseconds timeout) const { return submitted_ ? fence_.wait(timeout) : vk::Result::eSuccess; }
 private:
@@ -168,21 +211,25 @@ public:
     }
 };
 
-/* Note: only handles primary command buffers. */
+/* Hands out either primary or secondary command buffers, depending on level. Like the underlying VkCommandPool, a pool
+ * must only be used by one thread at a time, so parallel recording needs one pool per thread. */
 class VulkanCommandPool
 {
     static_assert(std::_Can_scalar_delete<detail::VulkanCommandPoolImpl>::value, "Cannot delete pool impl");
     std::shared_ptr<detail::VulkanCommandPoolImpl> commandPoolImpl_;
 public:
     GSL_SUPPRESS(r.11)
-    VulkanCommandPool(vk::Device device, size_t bufferCount, const VulkanQueueInfo& queueInfo)
-        : commandPoolImpl_(new detail::VulkanCommandPoolImpl(device, bufferCount, queueInfo))
+    VulkanCommandPool(vk::Device device, size_t bufferCount, const VulkanQueueInfo& queueInfo,
+                      vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary)
+        : commandPoolImpl_(new detail::VulkanCommandPoolImpl(device, bufferCount, queueInfo, level))
     {}
     DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanCommandPool)
 
     VulkanCommandBuffer checkOut()
     {
         Expects(commandPoolImpl_); // TODO: Remove this unsafe check by getting rid of default constructor.
-        return VulkanCommandBuffer(commandPoolImpl_->device_, commandPoolImpl_, commandPoolImpl_->checkOut());
+        auto [commandBuffer, fence] = commandPoolImpl_->checkOut();
+        metrics::commandBuffersCheckedOut.add();
+        return VulkanCommandBuffer(commandPoolImpl_, commandBuffer, std::move(fence));
     }
 };
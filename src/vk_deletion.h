@@ -0,0 +1,78 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_stream.h"
+
+#include <deque>
+#include <memory>
+#include <memory_resource>
+
+/* Keeps resources alive until the stream work that may still reference them has retired, instead of stalling on
+ * the stream before destroying them. Anything movable can be handed over: buffers, memory, framebuffers, pipelines.
+ * Call collect() once per frame; it costs one semaphore counter query per stream with retiring entries.
+ *
+ * Entries and the resources moved into them are allocated from a pool that recycles what collect() frees, so a
+ * steady stream of deferred resources stops touching the global heap. */
+class VulkanDeletionQueue
+{
+    struct Entry
+    {
+        VulkanStreamEvent event;
+        std::shared_ptr<void> resource;
+    };
+    /* Declared first so that it outlives the entries allocated from it. */
+    std::pmr::unsynchronized_pool_resource pool_;
+    std::pmr::deque<Entry> pending_{ &pool_ };
+public:
+    VulkanDeletionQueue() = default;
+    /* Entries point into pool_. */
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanDeletionQueue)
+
+    ~VulkanDeletionQueue()
+    {
+        /* Only at shutdown do we have to wait for the GPU. */
+        try
+        {
+            for (const Entry& entry : pending_)
+                entry.event.synchronize();
+        }
+        catch (const vk::SystemError&) {}
+    }
+
+    /* Destroys resource once the GPU has passed event. */
+    template <typename T>
+    void defer(const VulkanStreamEvent& event, T&& resource)
+    {
+        static_assert(!std::is_lvalue_reference_v<T>, "Hand over ownership with std::move");
+        using Resource = std::remove_cvref_t<T>;
+        pending_.push_back({ event, std::allocate_shared<Resource>(std::pmr::polymorphic_allocator<Resource>(&pool_), std::forward<T>(resource)) });
+    }
+    /* Destroys resource once everything submitted to stream so far has retired. */
+    template <typename T>
+    void defer(const VulkanStream& stream, T&& resource)
+    {
+        defer(stream.getLastEvent(), std::forward<T>(resource));
+    }
+
+    /* Entries are retired in submission order, so an entry waits behind older, still pending entries from other
+     * streams. This keeps collection a single pass over the retired prefix. */
+    void collect()
+    {
+        const VulkanStream* stream = nullptr;
+        uint64_t completedValue = 0;
+        while (!pending_.empty())
+        {
+            const VulkanStreamEvent& event = pending_.front().event;
+            if (&event.stream() != stream)
+            {
+                stream = &event.stream();
+                completedValue = stream->completedValue();
+            }
+            if (event.value() > completedValue)
+                break;
+            pending_.pop_front();
+        }
+    }
+
+    size_t size() const noexcept { return pending_.size(); }
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_device.h"
+#include "vk_shader.h"
+#include "vk_stream.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+/* Descriptor sets that live for one frame, for bindings that change every frame. Each frame allocates from its own
+ * pools, which are reset together once the GPU has retired the frame, so no set is ever freed individually or updated
+ * while in use. A frame that runs out of pool space gets another pool, and keeps it in later frames. */
+class VulkanFrameDescriptors
+{
+    struct Frame
+    {
+        std::vector<vk::raii::DescriptorPool> pools;
+        size_t poolIndex = 0;
+        std::optional<VulkanStreamEvent> retireEvent;
+    };
+
+    const vk::raii::Device& device_;
+    uint32_t setsPerPool_;
+    std::vector<vk::DescriptorPoolSize> poolSizes_;
+    std::vector<std::unique_ptr<Frame>> frames_;
+    Frame* current_ = nullptr;
+
+    vk::raii::DescriptorPool createPool_() const
+    {
+        return device_.createDescriptorPool(vk::DescriptorPoolCreateInfo({}, setsPerPool_, poolSizes_));
+    }
+public:
+    /* Each pool holds setsPerPool sets and descriptorsPerPool descriptors of each type listed. */
+    VulkanFrameDescriptors(const vk::raii::Device& device, uint32_t setsPerPool, gsl::span<const vk::DescriptorPoolSize> descriptorsPerPool) :
+        device_(device), setsPerPool_(setsPerPool), poolSizes_(descriptorsPerPool.begin(), descriptorsPerPool.end())
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanFrameDescriptors)
+
+    void beginFrame()
+    {
+        const auto retired = std::ranges::find_if(frames_, [](const std::unique_ptr<Frame>& frame)
+        {
+            return !frame->retireEvent || frame->retireEvent->completed();
+        });
+        current_ = retired != frames_.end() ? retired->get() : frames_.emplace_back(std::make_unique<Frame>()).get();
+        for (const vk::raii::DescriptorPool& pool : current_->pools)
+            (*device_).resetDescriptorPool(*pool);
+        current_->poolIndex = 0;
+        current_->retireEvent.reset();
+    }
+
+    /* The set stays valid until the frame retires; write it before recording commands that use it. */
+    vk::DescriptorSet allocate(vk::DescriptorSetLayout layout)
+    {
+        Expects(current_);
+        vk::DescriptorSetAllocateInfo allocateInfo({}, 1, &layout);
+        vk::DescriptorSet set;
+        for (;; current_->poolIndex++)
+        {
+            if (current_->poolIndex == current_->pools.size())
+                current_->pools.push_back(createPool_());
+            allocateInfo.descriptorPool = *current_->pools[current_->poolIndex];
+            const vk::Result result = (*device_).allocateDescriptorSets(&allocateInfo, &set);
+            if (result == vk::Result::eSuccess)
+                return set;
+            if (result != vk::Result::eErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool)
+                throw FatalError("Failed to allocate descriptor set: " + vk::to_string(result));
+        }
+    }
+
+    /* Ends the frame. Its sets are recycled once everything submitted to stream so far has retired. */
+    void endFrame(const VulkanStream& stream)
+    {
+        Expects(current_);
+        current_->retireEvent.emplace(stream.getLastEvent());
+        current_ = nullptr;
+    }
+};
+
+/* One descriptor set whose bindings change with every draw or dispatch, e.g. per-draw buffer ranges or a texture. With
+ * VK_KHR_push_descriptor they are recorded into the command buffer itself, with no set to allocate or update. Without,
+ * every bind() takes a set from VulkanFrameDescriptors instead. The set layout is derived from the shaders' reflection,
+ * and pipeline layouts using it have to put it at `set`. */
+class VulkanPushDescriptors
+{
+    /* The minimum maxPushDescriptors every device with the extension supports. */
+    constexpr static uint32_t maxPushDescriptors_ = 32;
+
+    const VulkanDevice& device_;
+    uint32_t set_;
+    bool pushed_;
+    vk::raii::DescriptorSetLayout setLayout_;
+    std::optional<VulkanFrameDescriptors> fallback_;
+
+    static vk::raii::DescriptorSetLayout createSetLayout_(const VulkanDevice& device, gsl::span<const vk::DescriptorSetLayoutBinding> bindings,
+                                                          bool pushed)
+    {
+        const vk::DescriptorSetLayoutCreateFlags flags = pushed ? vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR
+                                                                : vk::DescriptorSetLayoutCreateFlags();
+        return device.device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo(flags, bindings));
+    }
+
+    static std::vector<vk::DescriptorPoolSize> poolSizes_(gsl::span<const vk::DescriptorSetLayoutBinding> bindings, uint32_t setsPerPool)
+    {
+        std::map<vk::DescriptorType, uint32_t> counts;
+        for (const vk::DescriptorSetLayoutBinding& binding : bindings)
+            counts[binding.descriptorType] += binding.descriptorCount * setsPerPool;
+        std::vector<vk::DescriptorPoolSize> sizes;
+        for (const auto [type, count] : counts)
+            sizes.emplace_back(type, count);
+        return sizes;
+    }
+
+    VulkanPushDescriptors(const VulkanDevice& device, const std::vector<vk::DescriptorSetLayoutBinding>& bindings, uint32_t set,
+                          uint32_t setsPerPool) :
+        device_(device),
+        set_(set),
+        pushed_(device.optionalFeatures.pushDescriptors &&
+                std::ranges::fold_left(bindings, 0u, [](uint32_t sum, const vk::DescriptorSetLayoutBinding& binding)
+                                       { return sum + binding.descriptorCount; }) <= maxPushDescriptors_),
+        setLayout_(createSetLayout_(device, bindings, pushed_))
+    {
+        if (!pushed_)
+            fallback_.emplace(device.device, setsPerPool, poolSizes_(bindings, setsPerPool));
+    }
+public:
+    /* The layout of set `set` of shaders. Without push descriptors, each frame's pools hold setsPerPool binds. */
+    VulkanPushDescriptors(const VulkanDevice& device, std::initializer_list<std::string_view> shaders, uint32_t set = 0,
+                          uint32_t setsPerPool = 16) :
+        VulkanPushDescriptors(device, descriptorSetLayoutBindings(shaders, set), set, setsPerPool)
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanPushDescriptors)
+
+    const vk::raii::DescriptorSetLayout& setLayout() const noexcept { return setLayout_; }
+    bool pushed() const noexcept { return pushed_; }
+
+    /* Bracket the binds of a frame, for the fallback to recycle its sets; see VulkanFrameDescriptors. */
+    void beginFrame()
+    {
+        if (fallback_)
+            fallback_->beginFrame();
+    }
+    void endFrame(const VulkanStream& stream)
+    {
+        if (fallback_)
+            fallback_->endFrame(stream);
+    }
+
+    /* Binds the set with the descriptors of writes, whose dstSet is ignored, for the draws or dispatches recorded
+     * after it. pipelineLayout has to have setLayout() at set. */
+    void bind(const vk::CommandBuffer& commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout,
+              gsl::span<vk::WriteDescriptorSet> writes)
+    {
+        if (pushed_)
+        {
+            for (vk::WriteDescriptorSet& write : writes)
+                write.dstSet = nullptr;
+            commandBuffer.pushDescriptorSetKHR(bindPoint, pipelineLayout, set_, writes, *device_.device.getDispatcher());
+            return;
+        }
+        const vk::DescriptorSet set = fallback_->allocate(*setLayout_);
+        for (vk::WriteDescriptorSet& write : writes)
+            write.dstSet = set;
+        device_.device.updateDescriptorSets(writes, {});
+        commandBuffer.bindDescriptorSets(bindPoint, pipelineLayout, set_, set, {});
+    }
+};
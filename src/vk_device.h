@@ -1,6 +1,11 @@
 #pragma once
 
 #include "vk_types.h"
+#include "vk_features.h"
+#include "vk_memory.h"
+#include "vk_suballocator.h"
+
+#include <memory>
 
 struct VulkanDevice
 {
@@ -8,19 +13,29 @@ struct VulkanDevice
     vk::raii::Device device;
     std::optional<VulkanQueueInfo> generalQueue;
     std::optional<VulkanQueueInfo> transferQueue;
+    VulkanOptionalFeatures optionalFeatures;
+    /* Every device memory allocation goes through here. */
+    std::unique_ptr<VulkanMemoryManager> memory;
+    /* Images share large blocks from memory instead of allocating their own. */
+    std::unique_ptr<VulkanSubAllocator> imageMemory;
 
     VulkanDevice(
         vk::raii::PhysicalDevice physicalDevice_,
         const vk::DeviceCreateInfo& deviceInfo,
         std::optional<uint32_t> generalQueueIndex,
-        std::optional<uint32_t> transferQueueIndex
+        std::optional<uint32_t> transferQueueIndex,
+        VulkanOptionalFeatures optionalFeatures_ = {}
     ) :
         physicalDevice(std::move(physicalDevice_)),
         device(physicalDevice.createDevice(deviceInfo)),
         generalQueue(getQueue_(generalQueueIndex)),
-        transferQueue(getQueue_(transferQueueIndex))
+        transferQueue(getQueue_(transferQueueIndex)),
+        optionalFeatures(optionalFeatures_),
+        memory(std::make_unique<VulkanMemoryManager>(physicalDevice, device, optionalFeatures.memoryBudget)),
+        imageMemory(std::make_unique<VulkanSubAllocator>(*memory))
     {}
-    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanDevice)
+    /* The memory manager refers to physicalDevice and device. */
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanDevice)
 private:
     std::optional<VulkanQueueInfo>
     getQueue_(std::optional<uint32_t> queueFamilyIndex)
@@ -1,9 +1,26 @@
 #include "vk_engine.h"
 #include "vk_types.h"
+#include "allocation_counter.h"
+#include "command_capture.h"
 #include "vk_buffer.h"
+#include "vk_cluster.h"
 #include "vk_command.h"
+#include "vk_deletion.h"
+#include "vk_frame_arena.h"
+#include "vk_frame_pacer.h"
+#include "vk_instancing.h"
+#include "lod.h"
+#include "meshlet.h"
+#include "vk_mesh.h"
+#include "vk_occlusion.h"
+#include "vk_particles.h"
+#include "vk_pipeline.h"
+#include "vk_query.h"
+#include "vk_shader.h"
+#include "render_queue.h"
 #include "vk_stream.h"
 #include "vk_swapchain.h"
+#include "vk_vertex.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,8 +28,10 @@
 #include <SDL_vulkan.h>
 
 #include <algorithm>
-#include <fstream>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <optional>
 #include <ranges>
 
 using std::ranges::iota_view;
@@ -29,11 +48,96 @@ using AvailableFeatures = ValidatedFeatureList<
     ValidationLayerFeatureIfEnabled
 >;
 
-struct VertexPushConstants
+/* The original triangle, subdivided into a triangle soup so that there is something for the mesh optimizer to do.
+ * Colors are interpolated the same way the rasterizer would. The inside bulges out into a shallow dome, as a flat
+ * triangle would simplify to a single one without error and leave levels of detail nothing to choose from. */
+static std::vector<SimpleVertex> createTessellatedTriangle(uint32_t subdivisions, float domeHeight)
 {
-    glm::mat4 renderMatrix;
+    constexpr auto corners = std::to_array<SimpleVertex>({
+        {{ 0.0f,-0.5f, 0.0f},{1.0f,0.0f,0.0f}},
+        {{ 0.5f, 0.5f, 0.0f},{0.0f,1.0f,0.0f}},
+        {{-0.5f, 0.5f, 0.0f},{0.0f,0.0f,1.0f}},
+    });
+    const auto vertex = [&](uint32_t row, uint32_t column)
+    {
+        const float n = static_cast<float>(subdivisions);
+        const float w1 = static_cast<float>(row - column) / n;
+        const float w2 = static_cast<float>(column) / n;
+        const float w0 = 1.0f - w1 - w2;
+        /* Zero along the edges, domeHeight in the middle. */
+        const float bulge = 27.0f * w0 * w1 * w2 * domeHeight;
+        return SimpleVertex{
+            corners[0].position * w0 + corners[1].position * w1 + corners[2].position * w2 + glm::vec3(0.0f, 0.0f, bulge),
+            corners[0].color * w0 + corners[1].color * w1 + corners[2].color * w2,
+        };
+    };
+
+    std::vector<SimpleVertex> soup;
+    soup.reserve(size_t{ 3 } * subdivisions * subdivisions);
+    for (uint32_t row = 0; row < subdivisions; row++)
+        for (uint32_t column = 0; column <= row; column++)
+        {
+            soup.insert(soup.end(), { vertex(row, column), vertex(row + 1, column), vertex(row + 1, column + 1) });
+            if (column < row)
+                soup.insert(soup.end(), { vertex(row, column), vertex(row + 1, column + 1), vertex(row, column + 1) });
+        }
+    return soup;
+}
+
+struct SceneObject
+{
+    glm::vec3 position;
+    float spinSpeed; // Degrees per frame
+    PackedColor tint;
 };
 
+/* A field of spinning triangles receding into the distance, large enough that updating, culling and recording it are
+ * worth spreading over the job system. */
+static std::vector<SceneObject> createScene(int32_t halfWidth, int32_t depth)
+{
+    std::vector<SceneObject> objects;
+    objects.reserve(size_t{ 2 } * gsl::narrow<size_t>(halfWidth) * gsl::narrow<size_t>(depth));
+    for (int32_t z = 0; z < depth; z++)
+        for (int32_t x = -halfWidth; x < halfWidth; x++)
+        {
+            const float variation = static_cast<float>((x * 7 + z * 13) & 7) / 7.0f;
+            objects.push_back({ glm::vec3(static_cast<float>(x) * 1.5f, 0.0f, static_cast<float>(z) * -1.5f),
+                                1.0f + variation * 3.5f,
+                                PackedColor::encode(glm::mix(glm::vec3(1.0f), glm::vec3(0.5f, 0.8f, 1.0f), variation)) });
+        }
+    return objects;
+}
+
+using FrustumPlanes = std::array<glm::vec4, 6>;
+
+/* Gribb-Hartmann plane extraction from a view-projection matrix, with normals pointing inwards. Clip space depth is
+ * [0, w] in Vulkan, so the near plane is the third row on its own. */
+static FrustumPlanes extractFrustumPlanes(const glm::mat4& viewProjection)
+{
+    const auto row = [&](glm::length_t i) { return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]); };
+    FrustumPlanes planes = { row(3) + row(0), row(3) - row(0), row(3) + row(1), row(3) - row(1), row(2), row(3) - row(2) };
+    for (glm::vec4& plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+    return planes;
+}
+
+static bool isSphereVisible(const FrustumPlanes& planes, const glm::vec3& center, float radius)
+{
+    return std::ranges::all_of(planes, [&](const glm::vec4& plane) { return glm::dot(glm::vec3(plane), center) + plane.w >= -radius; });
+}
+
+static void reportLatencies(const std::vector<FrameLatency>& latencies)
+{
+    if (latencies.empty())
+        return;
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    const auto [minimum, maximum] = std::ranges::minmax(latencies | std::views::transform(&FrameLatency::inputToPresent));
+    const auto total = std::ranges::fold_left(latencies | std::views::transform(&FrameLatency::inputToPresent), std::chrono::nanoseconds::zero(), std::plus{});
+    std::cout << "Input-to-" << (latencies.back().measuredAtDisplay ? "display" : "present call") << " latency over "
+              << latencies.size() << " frames: avg " << Milliseconds(total / gsl::narrow<int64_t>(latencies.size())).count()
+              << " ms, min " << Milliseconds(minimum).count() << " ms, max " << Milliseconds(maximum).count() << " ms" << std::endl;
+}
+
 static SDL_Window* createWindow(vk::Extent2D windowExtent)
 {
     SDL_Init(SDL_INIT_VIDEO);
@@ -106,81 +210,8 @@ static vk::SurfaceFormatKHR selectSurfaceFormat(const vk::SurfaceKHR& surface, c
     throw FatalError("Could not find a suitable surface");
 }
 
-static vk::raii::RenderPass createRenderPass(const vk::SurfaceFormatKHR& surfaceFormat, const VulkanDevice& device)
-{
-    auto colorAttachment = vk::AttachmentDescription({}, surfaceFormat.format, vk::SampleCountFlagBits::e1,
-                                                     vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
-                                                     vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
-                                                     vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
-    std::array attachments = { colorAttachment };
-    std::array colorAttachmentRefs = { vk::AttachmentReference(0u, vk::ImageLayout::eColorAttachmentOptimal) };
-    std::array subpasses = { vk::SubpassDescription({}, vk::PipelineBindPoint::eGraphics, {}, colorAttachmentRefs) };
-    std::array subpassDependencies = {
-        vk::SubpassDependency(VK_SUBPASS_EXTERNAL, 0u, vk::PipelineStageFlagBits::eColorAttachmentOutput,
-                              vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite)
-    };
-    const vk::RenderPassCreateInfo renderPassInfo({}, attachments, subpasses, subpassDependencies);
-    return device.device.createRenderPass(renderPassInfo);
-}
-
-static vk::raii::ShaderModule createShader(const std::string& filename, const VulkanDevice& device)
-{
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-    const size_t shaderSize = static_cast<size_t>(file.tellg());
-    std::vector<char> shaderBytes(shaderSize);
-    file.seekg(0);
-    file.read(shaderBytes.data(), shaderBytes.size());
-    std::vector<uint32_t> shaderContents((shaderSize + sizeof(uint32_t) - 1) / sizeof(uint32_t)); // ceil of shaderSize / 4
-    std::ranges::copy(
-        gsl::as_writable_bytes(gsl::span(shaderBytes)),
-        gsl::as_writable_bytes(gsl::span(shaderContents)).begin()
-    );
-
-    const vk::ShaderModuleCreateInfo shaderInfo({}, shaderContents);
-    return device.device.createShaderModule(shaderInfo);
-};
-
-static vk::raii::PipelineLayout createPipelineLayout(const VulkanDevice& device)
-{
-    const auto vertexPushConstant = vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(VertexPushConstants));
-    const auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo({}, {}, vertexPushConstant);
-    return device.device.createPipelineLayout(pipelineLayoutInfo);
-}
-
-static vk::raii::Pipeline createPipeline(const vk::RenderPass& renderPass,
-                                         const vk::PipelineLayout& pipelineLayout,
-                                         const vk::Extent2D& windowExtent,
-                                         const VulkanDevice& device)
-{
-    const auto vertexShaderModule = createShader("shaders/vertex_shader.spv", device);
-    const auto fragmentShaderModule = createShader("shaders/fragment_shader.spv", device);
-    //std::array dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
-    const auto viewport = vk::Viewport(0.0f, 0.0f, static_cast<float>(windowExtent.width), static_cast<float>(windowExtent.height), 0.0f, 1.0f);
-    const auto scissor = vk::Rect2D({ 0, 0 }, windowExtent);
-    using enum vk::ColorComponentFlagBits;
-    std::array colorBlendAttachments = { vk::PipelineColorBlendAttachmentState(false).setColorWriteMask(eR | eG | eB | eA)};
-
-    auto vertexShaderStageInfo      = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *vertexShaderModule, "main");
-    auto fragmentShaderStageInfo    = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *fragmentShaderModule, "main");
-    const std::array shaderStages   = { vertexShaderStageInfo, fragmentShaderStageInfo };
-    const auto dynamicStateInfo     = vk::PipelineDynamicStateCreateInfo({}, /*dynamicStates*/ {});
-    const VertexInfo vertexInfo     = SimpleVertex::getVertexInputInfo();
-    const auto& vertexInputInfo     = vertexInfo.info;
-    const auto inputAssemblyInfo    = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
-    const auto viewportInfo         = vk::PipelineViewportStateCreateInfo({}, viewport, scissor);
-    const auto rasterizationInfo    = vk::PipelineRasterizationStateCreateInfo({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone,
-                                                                                vk::FrontFace::eClockwise, false, {}, {}, {}, 1.0f);
-    const auto multisampleInfo      = vk::PipelineMultisampleStateCreateInfo({}, vk::SampleCountFlagBits::e1, false, 1.0f, nullptr, false, false);
-    const auto colorBlendInfo       = vk::PipelineColorBlendStateCreateInfo({}, false, {}, colorBlendAttachments);
-
-    const auto graphicsPipelineInfo = vk::GraphicsPipelineCreateInfo({}, shaderStages, &vertexInputInfo, &inputAssemblyInfo, nullptr, &viewportInfo,
-                                                                     &rasterizationInfo, &multisampleInfo, nullptr, &colorBlendInfo, &dynamicStateInfo,
-                                                                     pipelineLayout, renderPass, 0);
-    auto pipeline = device.device.createGraphicsPipeline(nullptr, graphicsPipelineInfo);
-    return pipeline;
-}
-
-VulkanEngine::VulkanEngine() :
+VulkanEngine::VulkanEngine(const EngineOptions& options) :
+    presentPolicy(options.presentPolicy),
     window({ createWindow(windowExtent), &SDL_DestroyWindow }),
     instance(std::make_shared<const VulkanInstance>(
         vk::ApplicationInfo("Triangle", VK_MAKE_API_VERSION(0, 1, 0, 0), "No Engine", 0, VK_API_VERSION_1_3),
@@ -188,8 +219,15 @@ VulkanEngine::VulkanEngine() :
         gsl::make_span(AvailableFeatures::instanceExtensions),
         gsl::make_span(AvailableFeatures::deviceExtensions)
     )),
-    device(selectDevice(*instance))
-{}
+    device(selectDevice(*instance)),
+    pipelines(*device),
+    particleCount(options.particleCount)
+{
+    if (options.metricsPath)
+        metricsExporter.emplace(*options.metricsPath);
+    if (options.capturePath)
+        capture.emplace(*options.capturePath);
+}
 
 void VulkanEngine::run()
 {
@@ -198,34 +236,159 @@ void VulkanEngine::run()
 
     const auto surface = getSurface(&*window, *instance);
     const auto surfaceFormat = selectSurfaceFormat(*surface, *device);
-    const auto swapchain = VulkanSwapchain(*device, *surface, surfaceFormat, windowExtent);
+    const auto swapchain = VulkanSwapchain(*device, *surface, surfaceFormat, windowExtent, presentPolicy);
+    VulkanFramePacer pacer(*device, swapchain, presentPolicy);
+    std::cout << "Present mode: " << vk::to_string(swapchain.presentMode())
+              << (device->optionalFeatures.presentWait ? ", paced with present wait" : ", no present wait") << std::endl;
+
+    /* Mesh optimization and simplification run on a worker while the main thread creates the pipeline. */
+    JobCounter meshReady;
+    MeshData<PackedVertex, uint16_t> packedMesh;
+    std::vector<MeshLod> triangleLods;
+    MeshletData triangleMeshlets;
+    jobs.submit(meshReady, [&packedMesh, &triangleLods, &triangleMeshlets]
+    {
+        auto mesh = makeIndexedMesh<uint16_t>(createTessellatedTriangle(64, 0.15f));
+        const auto position = [](const SimpleVertex& vertex) { return vertex.position; };
+        const auto report = optimizeMesh(mesh, position);
+        std::cout << "Optimized triangle mesh: " << report << std::endl;
+        triangleLods = generateLods(mesh, position);
+        triangleMeshlets = buildLodMeshlets(mesh, triangleLods, position);
+        std::cout << "Triangle levels of detail:";
+        for (const auto [lod, meshlets] : zip(triangleLods, triangleMeshlets.lods))
+            std::cout << ' ' << lod.indexCount / 3 << " (error " << lod.error << ", " << meshlets.meshletCount << " meshlets)";
+        std::cout << std::endl;
+
+        packedMesh.indices = std::move(mesh.indices);
+        packedMesh.vertices.reserve(mesh.vertices.size());
+        std::ranges::transform(mesh.vertices, std::back_inserter(packedMesh.vertices), PackedVertex::encode);
+    });
 
-    const auto renderPass = createRenderPass(surfaceFormat, *device);
-    const auto pipelineLayout = createPipelineLayout(*device);
-    const auto pipeline = createPipeline(*renderPass, *pipelineLayout, windowExtent, *device);
+    const vk::Format depthFormat = selectDepthFormat(*device);
+    const auto renderPass = createRenderPass(surfaceFormat.format, depthFormat, *device);
+    /* Vertices are pulled through their buffer's device address, except in captures, as a replay's buffers end up at
+     * other addresses. */
+    const VertexInput vertexInput = capture ? VertexInput::Attributes : VertexInput::Pulled;
+    std::cout << "Vertex input: " << (vertexInput == VertexInput::Pulled ? "pulled" : "attributes") << std::endl;
+    const vk::PipelineLayout pipelineLayout = *pipelines.layout();
+    const vk::Pipeline depthPrePassPipeline = pipelines.get({ DepthPass::PrePass, surfaceFormat.format, depthFormat, vertexInput }, *renderPass);
+    const vk::Pipeline pipeline = pipelines.get({ DepthPass::Shading, surfaceFormat.format, depthFormat, vertexInput }, *renderPass);
+    VulkanOcclusionCuller occlusionCuller(*device, depthFormat, windowExtent);
+    std::optional<VulkanClusterCuller> clusterCuller;
+    if (device->optionalFeatures.clusterDraws)
+        clusterCuller.emplace(*device);
+    std::cout << "Cluster culling " << (clusterCuller ? "enabled" : "unavailable, drawing whole instances") << std::endl;
+    /* A fountain over the field, bouncing off it and a ball. The field is upside down in world space, +y pointing down
+     * the screen, so gravity and the ground's normal point that way too. Every frame runs as many fixed steps as the
+     * time since the previous one calls for, so the fountain runs at the same speed at any frame rate, with as many
+     * particles emitted per second as keep the pool nearly full. */
+    std::optional<VulkanParticleSystem> particles;
+    if (particleCount > 0)
+        particles.emplace(*device, particleCount, *renderPass);
+    ParticleSettings particleSettings;
+    particleSettings.emitterPosition = glm::vec3(0.0f, -0.5f, -6.0f);
+    particleSettings.emitterVelocity = glm::vec3(0.0f, -6.0f, 0.0f);
+    particleSettings.velocitySpread = 2.0f;
+    particleSettings.gravity = glm::vec3(0.0f, 9.81f, 0.0f);
+    particleSettings.sphere = glm::vec4(1.5f, -0.5f, -6.0f, 0.75f);
+    particleSettings.ground = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+    particleSettings.emitRate = static_cast<float>(particleCount) / particleSettings.lifetime;
+    constexpr float particleTimeStep = 1.0f / 60.0f;
+    /* So that after a stall, e.g. while the window is dragged, the simulation skips ahead rather than catching up. */
+    constexpr uint32_t maxParticleSteps = 4;
+    /* Simulated time owed, starting at one step so that the first frame has something to draw. */
+    float particleTime = particleTimeStep;
+    std::cout << "Particles: " << particleCount << std::endl;
+    std::optional<VulkanPipelineStatistics> pipelineStatistics;
+    if (device->optionalFeatures.pipelineStatistics)
+        pipelineStatistics.emplace(*device);
 
     const auto commandPool = std::make_shared<VulkanCommandPool>(*device->device, 16u, *device->generalQueue);
+    /* Command pools are externally synchronized, so every worker records its secondaries into its own. */
+    std::vector<VulkanCommandPool> workerCommandPools;
+    workerCommandPools.reserve(jobs.workerCount());
+    for (size_t i = 0; i < jobs.workerCount(); i++)
+        workerCommandPools.emplace_back(*device->device, 4u, *device->generalQueue, vk::CommandBufferLevel::eSecondary);
+    /* The particle draw is recorded on the main thread, while the workers record the scene. */
+    VulkanCommandPool particleCommandPool(*device->device, 4u, *device->generalQueue, vk::CommandBufferLevel::eSecondary);
     VulkanGraphicsStream stream(*device->device, commandPool);
+    VulkanDeletionQueue deletionQueue;
+    VulkanFrameArenas frameArenas;
 
-    static constexpr auto vertices = std::to_array<SimpleVertex>({
-        {{ 0.0f,-0.5f, 0.0f},{1.0f,0.0f,0.0f}},
-        {{ 0.5f, 0.5f, 0.0f},{0.0f,1.0f,0.0f}},
-        {{-0.5f, 0.5f, 0.0f},{0.0f,0.0f,1.0f}},
-    });
-    using enum vk::BufferUsageFlagBits;
-    VulkanBuffer<eVertexBuffer | eTransferDst, VulkanBufferType::DeviceLocal> vertexBuffer(*device, sizeof(vertices));
+    jobs.wait(meshReady);
+    const VulkanMesh<PackedVertex, uint16_t, vk::BufferUsageFlagBits::eShaderDeviceAddress> triangleMesh(*device, stream, *device->generalQueue->queue, deletionQueue, packedMesh, triangleLods, triangleMeshlets);
+    constexpr float triangleBoundingRadius = 0.5f;
+    if (capture)
+    {
+        capture->declarePipeline(depthPrePassPipeline, static_cast<uint32_t>(DepthPass::PrePass));
+        capture->declarePipeline(pipeline, static_cast<uint32_t>(DepthPass::Shading));
+        capture->upload(triangleMesh.getVertexBuffer(), 0, gsl::as_bytes(gsl::span(packedMesh.vertices)));
+        capture->upload(triangleMesh.getIndexBuffer(), 0, gsl::as_bytes(gsl::span(packedMesh.indices)));
+    }
 
+    const std::vector<SceneObject> scene = createScene(32, 64);
+    constexpr size_t updateBatchSize = 256;
+    constexpr size_t recordBatchSize = 128;
+
+    /* Sort key ids; there is only one of each so far. */
+    constexpr uint32_t depthPrePass = 0;
+    constexpr uint32_t opaquePass = 1;
+    constexpr uint32_t trianglePipelineId = 0;
+    constexpr uint32_t triangleMaterialId = 0;
+    /* Every visible triangle is an instance of one draw per level of detail, whose push constants are the same for all
+     * of them. */
+    InstanceBatcher<InstanceData> instanceBatcher;
+    VulkanInstanceStream<InstanceData> instanceStream(*device);
+    std::vector<uint32_t> triangleLodBatches;
+    for (size_t lod = 0; lod < triangleMesh.lods().size(); lod++)
+    {
+        DrawPacket trianglePacket = triangleMesh.lodDrawPacket(lod, 1, vertexInput);
+        trianglePacket.pipeline = pipeline;
+        trianglePacket.pipelineLayout = pipelineLayout;
+        trianglePacket.raster = depthPassState(DepthPass::Shading);
+        triangleLodBatches.push_back(instanceBatcher.addBatch(
+            RenderKey::make(opaquePass, trianglePipelineId, triangleMaterialId, 0.0f), trianglePacket));
+    }
+    /* Levels with enough meshlets to be worth culling per cluster, up close, where a large part of an object can be
+     * outside the frustum or hidden. The triangles are double-sided, so there is no cone culling. */
+    constexpr uint32_t minClusterCulledMeshlets = 8;
+    std::vector<bool> clusterCulledLods(triangleMesh.lods().size(), false);
+    uint32_t maxClusterCulledMeshlets = 0;
+    for (size_t lod = 0; lod < clusterCulledLods.size() && clusterCuller; lod++)
     {
-        const VulkanBuffer<eTransferSrc, VulkanBufferType::Staging> stagingBuffer(*device, vertexBuffer.size());
-        stagingBuffer.copyFrom(gsl::span(vertices));
-        auto commandRecorder = recordCopyBuffers(stagingBuffer, vertexBuffer);
-        stream.submitWork(*device->generalQueue->queue, commandRecorder);
-        stream.synchronize();
+        const uint32_t meshletCount = triangleMesh.lodMeshlets(lod).meshletCount;
+        clusterCulledLods[lod] = meshletCount >= minClusterCulledMeshlets;
+        if (clusterCulledLods[lod])
+            maxClusterCulledMeshlets = std::max(maxClusterCulledMeshlets, meshletCount);
     }
+    /* The level each object was drawn at last, for hysteresis. */
+    std::vector<uint32_t> objectLods(scene.size(), 0);
+    LodStats lodStats(triangleMesh.lods().size());
+    RenderQueue renderQueue;
+    RenderQueueStats renderStats;
 
     int64_t frameNumber = 0;
+    uint64_t allocationsAtLastReport = globalAllocationCount();
+    std::vector<FrameLatency> latencies;
+    std::optional<std::chrono::steady_clock::time_point> lastFrameStart;
+    /* Frames stay in flight while the next ones are recorded, bounded by acquireNextImage(). Whichever way the loop is
+     * left, everything above has to outlive the GPU's use of it. */
+    const auto drainFrames = gsl::finally([this]() noexcept
+    {
+        try
+        {
+            device->device.waitIdle();
+        }
+        catch (const vk::SystemError&) {}
+    });
     for (;;)
     {
+        pacer.beginFrame();
+        const auto frameStart = std::chrono::steady_clock::now();
+        if (lastFrameStart)
+            particleTime += std::chrono::duration<float>(frameStart - *lastFrameStart).count();
+        lastFrameStart = frameStart;
+        std::pmr::memory_resource& frameMemory = frameArenas.beginFrame();
         for (SDL_Event e{ 0 }; SDL_PollEvent(&e) != 0; )
         {
             GSL_SUPPRESS(es.79)
@@ -246,37 +409,212 @@ void VulkanEngine::run()
             }
         }
 
+        deletionQueue.collect();
+        device->memory->updateBudget();
+        if (capture)
+            capture->beginFrame(windowExtent);
+        if (pipelineStatistics)
+        {
+            pipelineStatistics->collect([](const PipelineStatistics& statistics)
+            {
+                metrics::vertexInvocations.add(statistics.vertexInvocations);
+                metrics::clippingInvocations.add(statistics.clippingInvocations);
+                metrics::clippingPrimitives.add(statistics.clippingPrimitives);
+                metrics::fragmentInvocations.add(statistics.fragmentInvocations);
+            });
+        }
+
         const uint32_t imageIndex = stream.acquireNextImage(*device->generalQueue->queue, swapchain);
-        const auto framebuffer = device->device.createFramebuffer(
-            vk::FramebufferCreateInfo({}, *renderPass, *swapchain.getImageView(imageIndex),
-                                      windowExtent.width, windowExtent.height, 1u));
+        const std::array framebufferAttachments = { *swapchain.getImageView(imageIndex), occlusionCuller.depthView() };
+        auto framebuffer = device->device.createFramebuffer(
+            vk::FramebufferCreateInfo({}, *renderPass, framebufferAttachments, windowExtent.width, windowExtent.height, 1u));
         static constexpr auto clearValues = std::to_array<vk::ClearValue>({
             vk::ClearColorValue({std::array{0.0f, 0.0f, 0.0f, 1.0f}}),
+            vk::ClearDepthStencilValue(1.0f, 0),
         });
         const auto renderPassInfo =
             vk::RenderPassBeginInfo(*renderPass, *framebuffer, vk::Rect2D({}, windowExtent), clearValues);
-        auto recorder = [&](const vk::CommandBuffer& cmd)
+        const glm::vec3 eye(0.0f, -3.0f, 4.0f);
+        const glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        const float aspectRatio = static_cast<float>(windowExtent.width) / windowExtent.height;
+        /* Vulkan's [0, 1] clip depth, which the frustum planes and the Hi-Z pyramid assume. */
+        const glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(90.f), aspectRatio, 0.1f, 100.0f);
+        const glm::mat4 viewProjection = projection * view;
+        const FrustumPlanes frustum = extractFrustumPlanes(viewProjection);
+        const LodSelector lodSelector(projection, windowExtent.height);
+
+        /* Frustum culling, level of detail selection and transform update in one pass, adding the visible objects as
+         * instances of their mesh. */
+        instanceBatcher.reset(scene.size());
+        jobs.parallelFor(scene.size(), updateBatchSize, [&](size_t begin, size_t end)
         {
-            const glm::vec3 cameraPosition = { 0.0f,-0.1f,-2.0f };
-
-            const glm::mat4 view = glm::translate(glm::mat4(1.f), cameraPosition);
-            const float aspectRatio = static_cast<float>(windowExtent.width) / windowExtent.height;
-            const glm::mat4 projection = glm::perspective(glm::radians(90.f), aspectRatio, 0.1f, 20.0f);
-            const glm::mat4 model = glm::rotate(glm::mat4{ 1.0f }, glm::radians(frameNumber * 2.0f), glm::vec3(0, 1, 0));
+            for (size_t i = begin; i < end; i++)
+            {
+                const SceneObject& object = scene[i];
+                if (!isSphereVisible(frustum, object.position, triangleBoundingRadius))
+                    continue;
+                const glm::mat4 model = glm::rotate(glm::translate(glm::mat4(1.0f), object.position),
+                                                    glm::radians(static_cast<float>(frameNumber) * object.spinSpeed), glm::vec3(0, 1, 0));
+                const float viewDepth = -(view * glm::vec4(object.position, 1.0f)).z;
+                const float lodDistance = glm::distance(eye, object.position) - triangleBoundingRadius;
+                objectLods[i] = lodSelector.select(triangleMesh.lods(), lodDistance, objectLods[i]);
+                instanceBatcher.add(triangleLodBatches[objectLods[i]], InstanceData{ model, object.tint }, viewDepth);
+            }
+        });
+        for (const uint32_t batch : triangleLodBatches)
+        {
+            DrawPacket& packet = instanceBatcher.batchPacket(batch);
+            if (vertexInput == VertexInput::Pulled)
+                packet.setPushConstants(vk::ShaderStageFlagBits::eVertex, PulledVertexPushConstants{ viewProjection, triangleMesh.vertexAddress() });
+            else
+                packet.setPushConstants(vk::ShaderStageFlagBits::eVertex, VertexPushConstants{ viewProjection });
+        }
 
-            VertexPushConstants constants;
-            constants.renderMatrix = projection * view * model;
-            using enum vk::ShaderStageFlagBits;
-            cmd.pushConstants<VertexPushConstants>(*pipelineLayout, eVertex, 0, constants);
+        /* The frustum-culled instances are occlusion culled on the GPU, per cluster for the detailed levels. Every draw
+         * is made twice, the depth pre-pass drawing the same visible instances as the shading pass. */
+        occlusionCuller.beginFrame(scene.size(), instanceBatcher.batchCount(), stream, deletionQueue);
+        if (clusterCuller)
+            clusterCuller->beginFrame(scene.size() * maxClusterCulledMeshlets, stream, deletionQueue);
+        renderQueue.reset(2 * instanceBatcher.batchCount());
+        lodStats.reset();
+        instanceBatcher.build(jobs, instanceStream, [&](uint32_t batch, uint64_t key, const DrawPacket& packet)
+        {
+            const auto lod = gsl::narrow_cast<size_t>(std::ranges::find(triangleLodBatches, batch) - triangleLodBatches.begin());
+            lodStats.add(triangleMesh.lods(), lod, packet.instanceCount);
+            const DrawPacket culled = clusterCulledLods[lod]
+                ? clusterCuller->addDraw(packet, triangleMesh.meshletBuffer(), triangleMesh.lodMeshlets(lod), false)
+                : occlusionCuller.addDraw(packet, triangleBoundingRadius);
+            DrawPacket prePass = culled;
+            prePass.pipeline = depthPrePassPipeline;
+            prePass.raster = depthPassState(DepthPass::PrePass);
+            renderQueue.submit(RenderKey::withPass(key, depthPrePass), prePass);
+            renderQueue.submit(key, culled);
+            /* Captured before culling, which happens on the GPU, so a replay draws every frustum-culled instance. */
+            if (capture)
+            {
+                DrawPacket capturedPrePass = packet;
+                capturedPrePass.pipeline = depthPrePassPipeline;
+                capturedPrePass.raster = depthPassState(DepthPass::PrePass);
+                capture->addDraw(RenderKey::withPass(key, depthPrePass), capturedPrePass);
+                capture->addDraw(key, packet);
+            }
+        });
+        if (capture)
+            capture->upload(instanceStream.buffer(), 0, gsl::as_bytes(instanceStream.instances()));
+        renderQueue.sort(jobs);
+        /* Whatever is left under a step carries over to the next frame. */
+        const uint32_t particleSteps = std::min(static_cast<uint32_t>(particleTime / particleTimeStep), maxParticleSteps);
+        particleTime = std::min(particleTime - static_cast<float>(particleSteps) * particleTimeStep, particleTimeStep);
+        auto cullRecorder = [&](const vk::CommandBuffer& cmd)
+        {
+            occlusionCuller.recordCull(cmd);
+            if (clusterCuller)
+                clusterCuller->recordCull(cmd, occlusionCuller, viewProjection, eye);
+            if (particles)
+                for (uint32_t step = 0; step < particleSteps; step++)
+                    particles->recordStep(cmd, particleSettings, particleTimeStep);
+        };
+        stream.submitWork(*device->generalQueue->queue, cullRecorder);
+        if (capture)
+            capture->submit(false);
+
+        /* Parallel recording of the sorted draws into secondary command buffers, one per batch, from the recording
+         * worker's own pool. */
+        const vk::CommandBufferInheritanceInfo inheritanceInfo(*renderPass, 0, *framebuffer, false, {},
+            pipelineStatistics ? VulkanPipelineStatistics::inheritedStatistics() : vk::QueryPipelineStatisticFlags());
+        const size_t drawCount = renderQueue.size();
+        const size_t batchCount = (drawCount + recordBatchSize - 1) / recordBatchSize;
+        std::pmr::vector<std::optional<VulkanCommandBuffer>> secondaries(batchCount, &frameMemory);
+        std::pmr::vector<RenderQueueStats> batchStats(batchCount, &frameMemory);
+        jobs.parallelFor(drawCount, recordBatchSize, [&](size_t begin, size_t end)
+        {
+            const size_t batch = begin / recordBatchSize;
+            auto recorder = [&](const vk::CommandBuffer& cmd) { batchStats[batch] = renderQueue.record(cmd, begin, end, renderPassInfo.renderArea); };
+            auto& secondary = secondaries[batch].emplace(workerCommandPools[jobs.workerIndex()].checkOut());
+            secondary.recordSecondaryOnce(inheritanceInfo, recorder);
+        });
+        renderStats = {};
+        for (const RenderQueueStats& stats : batchStats)
+            renderStats += stats;
+        /* Drawn after the scene, which they are depth tested against. Not captured, as replays only draw the render
+         * queue's draws. */
+        std::optional<VulkanCommandBuffer> particleSecondary;
+        if (particles)
+        {
+            auto particleRecorder = [&](const vk::CommandBuffer& cmd) { particles->recordDraw(cmd, viewProjection, renderPassInfo.renderArea); };
+            particleSecondary.emplace(particleCommandPool.checkOut());
+            particleSecondary->recordSecondaryOnce(inheritanceInfo, particleRecorder);
+        }
 
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
-            cmd.bindVertexBuffers(0, vertexBuffer.get(), vk::DeviceSize{ 0 });
-            cmd.draw(gsl::narrow<uint32_t>(vertexBuffer.size()), 1, 0, 0);
+        std::pmr::vector<vk::CommandBuffer> secondaryHandles(&frameMemory);
+        secondaryHandles.reserve(secondaries.size() + 1);
+        for (const auto& secondary : secondaries)
+            secondaryHandles.push_back(secondary->get());
+        if (particleSecondary)
+            secondaryHandles.push_back(particleSecondary->get());
+        /* The pipeline statistics query has to begin outside of the render pass to cover its secondaries. */
+        auto recorder = [&](const vk::CommandBuffer& cmd)
+        {
+            if (pipelineStatistics)
+                pipelineStatistics->recordBegin(cmd);
+            cmd.beginRenderPass(renderPassInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+            if (!secondaryHandles.empty())
+                cmd.executeCommands(secondaryHandles);
+            cmd.endRenderPass();
+            if (pipelineStatistics)
+                pipelineStatistics->recordEnd(cmd);
         };
-        stream.submitWork(*device->generalQueue->queue, renderPassInfo, recorder);
-        stream.present(*device->generalQueue->queue, swapchain, imageIndex);
-        stream.synchronize();
+        stream.submitWork(*device->generalQueue->queue, recorder);
+        if (pipelineStatistics)
+            pipelineStatistics->endFrame(stream);
+        if (capture)
+        {
+            capture->submit();
+            capture->endFrame();
+        }
+        const uint64_t presentId = pacer.nextPresentId();
+        stream.present(*device->generalQueue->queue, swapchain, imageIndex, presentId);
+        pacer.framePresented(presentId);
+        deletionQueue.defer(stream, std::move(framebuffer));
+        for (auto& secondary : secondaries)
+            deletionQueue.defer(stream, std::move(*secondary));
+        if (particleSecondary)
+            deletionQueue.defer(stream, std::move(*particleSecondary));
+        if (clusterCuller)
+            clusterCuller->endFrame(stream, *device->generalQueue->queue);
+        occlusionCuller.endFrame(stream, *device->generalQueue->queue, viewProjection);
+        instanceStream.endFrame(stream);
+        frameArenas.endFrame(stream);
+
+        metrics::frames.add();
+        metrics::frameMilliseconds.set(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        metrics::frameArenaHighWaterBytes.set(static_cast<double>(frameArenas.highWaterBytes()));
+        if (metricsExporter)
+            metricsExporter->tick();
 
         frameNumber++;
+        if (frameNumber % 120 == 0)
+        {
+            /* Measured before reporting, which allocates itself. */
+            const uint64_t allocations = globalAllocationCount() - allocationsAtLastReport;
+            pacer.takeLatencies(latencies);
+            reportLatencies(latencies);
+            std::cout << "Render queue: " << renderStats << std::endl;
+            std::cout << "Occlusion culling: " << occlusionCuller.takeStats() << std::endl;
+            if (clusterCuller)
+                std::cout << "Cluster culling: " << clusterCuller->takeStats() << std::endl;
+            std::cout << "Levels of detail: " << lodStats << std::endl;
+            std::cout << *device->memory << std::endl;
+            std::cout << "Frame arenas: " << frameArenas.frameCount() << " in flight, "
+                      << frameArenas.highWaterBytes() / 1024 << " KiB high water";
+            if constexpr (countingAllocations)
+                std::cout << ", " << static_cast<double>(allocations) / 120.0 << " heap allocations per frame";
+            std::cout << std::endl;
+            /* Counting builds are there to catch frames that allocate. The first interval warms up arenas, pools and
+             * caches; capturing and exporting metrics write files as they go, which allocates. */
+            if (countingAllocations && allocations != 0 && frameNumber > 120 && !capture && !metricsExporter)
+                throw FatalError(std::to_string(allocations) + " heap allocations in the last 120 frames, which should not allocate");
+            allocationsAtLastReport = globalAllocationCount();
+        }
     }
 }
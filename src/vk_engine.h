@@ -3,19 +3,47 @@
 #include "vk_types.h"
 #include "vk_device.h"
 #include "vk_instance.h"
+#include "vk_pipeline.h"
+#include "vk_swapchain.h"
+#include "job_system.h"
+#include "metrics.h"
+#include "command_capture.h"
 
+#include <filesystem>
 #include <memory>
+#include <optional>
 
 struct SDL_Window;
 
+struct EngineOptions
+{
+    /* Snapshots of the metrics registry are appended to this every second. */
+    std::optional<std::filesystem::path> metricsPath;
+    /* Every frame's commands are captured to this, for vulkan-replay. */
+    std::optional<std::filesystem::path> capturePath;
+    /* Capacity of the GPU particle system drawn over the scene; 0 leaves it out. */
+    uint32_t particleCount = 1u << 20;
+    /* Tearing only with LowestLatencyTearing or MaxThroughput. */
+    PresentPolicy presentPolicy = PresentPolicy::LowestLatency;
+};
+
 class VulkanEngine
 {
     vk::Extent2D windowExtent = { 1280, 720 };
+    PresentPolicy presentPolicy;
     gsl::not_null<std::shared_ptr<SDL_Window>> window;
     gsl::not_null<std::shared_ptr<const VulkanInstance>> instance;
     gsl::not_null<std::shared_ptr<const VulkanDevice>> device;
+    /* Lives across run() calls, as pipelines don't depend on the window size. */
+    VulkanPipelineCache pipelines;
+    uint32_t particleCount;
+    /* Lives across run() calls so that window resizes don't restart the worker threads. */
+    JobSystem jobs;
+    /* Likewise, so that a run's metrics and commands end up in one file each. */
+    std::optional<MetricsExporter> metricsExporter;
+    std::optional<CommandCaptureWriter> capture;
 public:
-    VulkanEngine();
+    explicit VulkanEngine(const EngineOptions& options = {});
     DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanEngine)
 
     void run();
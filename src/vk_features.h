@@ -0,0 +1,282 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <algorithm>
+#include <concepts>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+/* Features the device was created with only if it supports them. Code with a fast path checks these and falls back
+ * to what every device can do otherwise. What every device has to support, such as the dynamic state of
+ * VK_EXT_extended_dynamic_state and 2 that Vulkan 1.3 made core, isn't listed. */
+struct VulkanOptionalFeatures
+{
+    bool presentWait = false; // VK_KHR_present_id and VK_KHR_present_wait
+    bool memoryBudget = false; // VK_EXT_memory_budget
+    bool textureCompressionBC = false;
+    bool textureCompressionETC2 = false;
+    bool textureCompressionASTC = false; // LDR profile
+    /* multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount, for one indirect draw per visible cluster. */
+    bool clusterDraws = false;
+    /* pipelineStatisticsQuery and inheritedQueries, for measuring passes recorded into secondary command buffers. */
+    bool pipelineStatistics = false;
+    bool hostImageCopy = false; // VK_EXT_host_image_copy
+    bool pushDescriptors = false; // VK_KHR_push_descriptor
+};
+
+/* What a physical device supports, queried once for all the features negotiated on it. */
+class VulkanDeviceCapabilities
+{
+    const vk::raii::PhysicalDevice& physicalDevice_;
+    std::vector<vk::ExtensionProperties> extensions_;
+public:
+    vk::PhysicalDeviceProperties properties;
+    /* Only queried for devices of Vulkan 1.3 or later, as the structs of later versions aren't valid before. */
+    vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features,
+                       vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceVulkan13Features> features;
+
+    explicit VulkanDeviceCapabilities(const vk::raii::PhysicalDevice& physicalDevice) :
+        physicalDevice_(physicalDevice),
+        extensions_(physicalDevice.enumerateDeviceExtensionProperties()),
+        properties(physicalDevice.getProperties())
+    {
+        if (properties.apiVersion >= VK_API_VERSION_1_3)
+            features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features,
+                                                   vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceVulkan13Features>();
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanDeviceCapabilities)
+
+    gsl::span<const vk::ExtensionProperties> extensions() const noexcept { return extensions_; }
+    bool hasExtension(std::string_view name) const
+    {
+        return std::ranges::any_of(extensions_, [name](const vk::ExtensionProperties& extension)
+                                   { return name == extension.extensionName.data(); });
+    }
+
+    const vk::PhysicalDeviceFeatures& core() const noexcept { return features.get<vk::PhysicalDeviceFeatures2>().features; }
+    template <typename T>
+    const T& core() const noexcept { return features.get<T>(); }
+
+    /* The feature struct of an extension, which only the features whose extensions are supported may ask for. */
+    template <typename T>
+    T query() const
+    {
+        return physicalDevice_.getFeatures2<vk::PhysicalDeviceFeatures2, T>().template get<T>();
+    }
+};
+
+/* Collects the extensions and features to create a device with, from the required ones and the optional ones the
+ * device turns out to support, into the structs vk::DeviceCreateInfo points to. */
+class VulkanDeviceFeatureRequest
+{
+    std::vector<const char*> extensions_;
+    vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features,
+                       vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceVulkan13Features> features_;
+    /* Extension feature structs, linked after the core ones. */
+    std::vector<std::shared_ptr<void>> extensionFeatures_;
+    void* extensionChain_ = nullptr;
+public:
+    explicit VulkanDeviceFeatureRequest(gsl::span<const char* const> requiredExtensions) :
+        extensions_(requiredExtensions.begin(), requiredExtensions.end())
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanDeviceFeatureRequest)
+
+    void addExtension(const char* name)
+    {
+        if (std::ranges::find_if(extensions_, [name](const char* extension) { return std::string_view(name) == extension; }) == extensions_.end())
+            extensions_.push_back(name);
+    }
+
+    vk::PhysicalDeviceFeatures& core() noexcept { return features_.get<vk::PhysicalDeviceFeatures2>().features; }
+    template <typename T>
+    T& core() noexcept { return features_.get<T>(); }
+
+    /* A zeroed feature struct of an extension, linked into the chain the first time it's asked for. */
+    template <typename T>
+    T& add()
+    {
+        for (auto* next = static_cast<vk::BaseOutStructure*>(extensionChain_); next; next = next->pNext)
+            if (next->sType == T::structureType)
+                return *reinterpret_cast<T*>(next);
+        auto features = std::make_shared<T>();
+        features->pNext = extensionChain_;
+        extensionChain_ = features.get();
+        extensionFeatures_.push_back(features);
+        return *features;
+    }
+
+    /* Refers to this request, so it has to outlive the device's creation. */
+    vk::DeviceCreateInfo createInfo(gsl::span<const vk::DeviceQueueCreateInfo> queueInfos)
+    {
+        features_.get<vk::PhysicalDeviceVulkan13Features>().pNext = extensionChain_;
+        return vk::DeviceCreateInfo({}, queueInfos, {}, extensions_, nullptr, &features_.get<vk::PhysicalDeviceFeatures2>());
+    }
+};
+
+/* A Feature that a device may lack, enabled only where isSupported() holds and all its device extensions exist,
+ * which then sets the flag in VulkanOptionalFeatures that code branches on. */
+template <typename T>
+concept OptionalFeature = Feature<T> && requires(const VulkanDeviceCapabilities& device, VulkanDeviceFeatureRequest& request)
+{
+    { T::name } -> std::convertible_to<std::string_view>;
+    { T::flag } -> std::convertible_to<bool VulkanOptionalFeatures::*>;
+    { T::isSupported(device) } -> std::same_as<bool>;
+    T::enable(request);
+};
+
+struct EmptyOptionalFeature : EmptyFeature
+{
+    static bool isSupported(const VulkanDeviceCapabilities&) { return true; }
+    static void enable(VulkanDeviceFeatureRequest&) {}
+};
+
+template <OptionalFeature... Args>
+struct OptionalFeatureList
+{
+    /* Enables every feature in the list that the device supports in request, returning which. */
+    static VulkanOptionalFeatures negotiate(const VulkanDeviceCapabilities& device, VulkanDeviceFeatureRequest& request)
+    {
+        VulkanOptionalFeatures enabled;
+        (negotiate_<Args>(device, request, enabled), ...);
+        return enabled;
+    }
+
+    static void print(std::ostream& out, const VulkanOptionalFeatures& enabled)
+    {
+        ((out << "\t" << Args::name << (enabled.*Args::flag ? "" : " (unavailable)") << "\n"), ...);
+    }
+private:
+    template <OptionalFeature T>
+    static void negotiate_(const VulkanDeviceCapabilities& device, VulkanDeviceFeatureRequest& request, VulkanOptionalFeatures& enabled)
+    {
+        if (!std::ranges::all_of(T::deviceExtensions, [&device](const char* extension) { return device.hasExtension(extension); }))
+            return;
+        if (!T::isSupported(device))
+            return;
+        for (const char* extension : T::deviceExtensions)
+            request.addExtension(extension);
+        T::enable(request);
+        enabled.*T::flag = true;
+    }
+};
+
+struct PresentWaitFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "present wait";
+    constexpr static auto flag = &VulkanOptionalFeatures::presentWait;
+    constexpr static std::array deviceExtensions = {
+        VK_KHR_PRESENT_ID_EXTENSION_NAME,
+        VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+    };
+    static bool isSupported(const VulkanDeviceCapabilities& device)
+    {
+        return device.query<vk::PhysicalDevicePresentIdFeaturesKHR>().presentId &&
+               device.query<vk::PhysicalDevicePresentWaitFeaturesKHR>().presentWait;
+    }
+    static void enable(VulkanDeviceFeatureRequest& request)
+    {
+        request.add<vk::PhysicalDevicePresentIdFeaturesKHR>().presentId = true;
+        request.add<vk::PhysicalDevicePresentWaitFeaturesKHR>().presentWait = true;
+    }
+};
+struct MemoryBudgetFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "memory budget";
+    constexpr static auto flag = &VulkanOptionalFeatures::memoryBudget;
+    constexpr static std::array deviceExtensions = {
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+    };
+};
+/* Compressed texture formats are only usable when their feature is enabled. */
+struct TextureCompressionBCFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "BC texture compression";
+    constexpr static auto flag = &VulkanOptionalFeatures::textureCompressionBC;
+    static bool isSupported(const VulkanDeviceCapabilities& device) { return device.core().textureCompressionBC; }
+    static void enable(VulkanDeviceFeatureRequest& request) { request.core().textureCompressionBC = true; }
+};
+struct TextureCompressionETC2Feature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "ETC2 texture compression";
+    constexpr static auto flag = &VulkanOptionalFeatures::textureCompressionETC2;
+    static bool isSupported(const VulkanDeviceCapabilities& device) { return device.core().textureCompressionETC2; }
+    static void enable(VulkanDeviceFeatureRequest& request) { request.core().textureCompressionETC2 = true; }
+};
+struct TextureCompressionASTCFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "ASTC LDR texture compression";
+    constexpr static auto flag = &VulkanOptionalFeatures::textureCompressionASTC;
+    static bool isSupported(const VulkanDeviceCapabilities& device) { return device.core().textureCompressionASTC_LDR; }
+    static void enable(VulkanDeviceFeatureRequest& request) { request.core().textureCompressionASTC_LDR = true; }
+};
+/* Cluster culling emits a compacted stream of indirect draws, one per instance and cluster. */
+struct ClusterDrawsFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "indirect count cluster draws";
+    constexpr static auto flag = &VulkanOptionalFeatures::clusterDraws;
+    static bool isSupported(const VulkanDeviceCapabilities& device)
+    {
+        return device.core().multiDrawIndirect && device.core().drawIndirectFirstInstance &&
+               device.core<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount;
+    }
+    static void enable(VulkanDeviceFeatureRequest& request)
+    {
+        request.core().multiDrawIndirect = true;
+        request.core().drawIndirectFirstInstance = true;
+        request.core<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount = true;
+    }
+};
+struct PipelineStatisticsFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "pipeline statistics";
+    constexpr static auto flag = &VulkanOptionalFeatures::pipelineStatistics;
+    static bool isSupported(const VulkanDeviceCapabilities& device)
+    {
+        return device.core().pipelineStatisticsQuery && device.core().inheritedQueries;
+    }
+    static void enable(VulkanDeviceFeatureRequest& request)
+    {
+        request.core().pipelineStatisticsQuery = true;
+        request.core().inheritedQueries = true;
+    }
+};
+struct HostImageCopyFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "host image copy";
+    constexpr static auto flag = &VulkanOptionalFeatures::hostImageCopy;
+    constexpr static std::array deviceExtensions = {
+        VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME,
+    };
+    static bool isSupported(const VulkanDeviceCapabilities& device)
+    {
+        return device.query<vk::PhysicalDeviceHostImageCopyFeaturesEXT>().hostImageCopy;
+    }
+    static void enable(VulkanDeviceFeatureRequest& request)
+    {
+        request.add<vk::PhysicalDeviceHostImageCopyFeaturesEXT>().hostImageCopy = true;
+    }
+};
+struct PushDescriptorFeature : EmptyOptionalFeature
+{
+    constexpr static std::string_view name = "push descriptors";
+    constexpr static auto flag = &VulkanOptionalFeatures::pushDescriptors;
+    constexpr static std::array deviceExtensions = {
+        VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+    };
+};
+
+/* Every optional feature the engine has a fast path for, negotiated on every device. */
+using EngineOptionalFeatures = OptionalFeatureList<
+    PresentWaitFeature,
+    MemoryBudgetFeature,
+    TextureCompressionBCFeature,
+    TextureCompressionETC2Feature,
+    TextureCompressionASTCFeature,
+    ClusterDrawsFeature,
+    PipelineStatisticsFeature,
+    HostImageCopyFeature,
+    PushDescriptorFeature
+>;
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "vk_types.h"
+#include "frame_arena.h"
+#include "vk_stream.h"
+
+#include <memory>
+#include <optional>
+
+/* One arena per frame in flight, for frame-scoped CPU allocations through frameMemoryResource(). A frame's arena is
+ * only reset and reused once the GPU has retired the last work the frame submitted, so frame data may also be handed
+ * to anything that lives until then. The ring grows to however many frames are in flight; nothing waits on the GPU. */
+class VulkanFrameArenas
+{
+    struct Frame
+    {
+        ArenaMemoryResource arena;
+        std::optional<VulkanStreamEvent> retireEvent;
+    };
+
+    std::vector<std::unique_ptr<Frame>> frames_;
+    Frame* current_ = nullptr;
+
+    void unbind_() noexcept
+    {
+        if (current_ && detail::frameResource == &current_->arena)
+            detail::frameResource = nullptr;
+        current_ = nullptr;
+    }
+public:
+    VulkanFrameArenas() = default;
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanFrameArenas)
+
+    /* A frame may be left without endFrame(), e.g. when a resize restarts the render loop. */
+    ~VulkanFrameArenas() { unbind_(); }
+
+    /* Starts a frame on the calling thread, which frameMemoryResource() then allocates from. */
+    std::pmr::memory_resource& beginFrame()
+    {
+        unbind_();
+        const auto retired = std::ranges::find_if(frames_, [](const std::unique_ptr<Frame>& frame)
+        {
+            return !frame->retireEvent || frame->retireEvent->completed();
+        });
+        current_ = retired != frames_.end() ? retired->get() : frames_.emplace_back(std::make_unique<Frame>()).get();
+        current_->arena.reset();
+        current_->retireEvent.reset();
+        detail::frameResource = &current_->arena;
+        return current_->arena;
+    }
+
+    /* Ends the frame. Its arena is reused once everything submitted to stream so far has retired. */
+    void endFrame(const VulkanStream& stream)
+    {
+        Expects(current_);
+        current_->retireEvent.emplace(stream.getLastEvent());
+        unbind_();
+    }
+
+    /* Arenas in the ring, i.e. the most frames that were in flight at once. */
+    size_t frameCount() const noexcept { return frames_.size(); }
+    size_t highWaterBytes() const noexcept
+    {
+        size_t bytes = 0;
+        for (const auto& frame : frames_)
+            bytes = std::max(bytes, frame->arena.highWaterBytes());
+        return bytes;
+    }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_device.h"
+#include "vk_swapchain.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+struct FrameLatency
+{
+    uint64_t presentId;
+    std::chrono::nanoseconds inputToPresent;
+    /* True when measured until the image reached the display through VK_KHR_present_wait. Otherwise it was only
+     * measured until vkQueuePresentKHR returned, which misses the time spent queued in the presentation engine. */
+    bool measuredAtDisplay;
+};
+
+/* Paces the start of CPU frames and measures input-to-present latency. Call beginFrame() right before sampling input,
+ * then present with nextPresentId() and report it through framePresented().
+ *
+ * With present wait, a thread timestamps every present as it reaches the display. Frames then start only after the
+ * previous one was displayed, so at most one frame is ever queued. Under either LowestLatency policy the start is
+ * additionally delayed by an adaptive slack, so that input is sampled as late as possible while still making the next
+ * refresh. */
+class VulkanFramePacer
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct PendingPresent
+    {
+        uint64_t presentId;
+        Clock::time_point inputTime;
+    };
+
+    const vk::raii::SwapchainKHR& swapchain_;
+    const PresentPolicy policy_;
+    const bool presentWait_;
+
+    /* Main thread only. */
+    uint64_t lastPresentId_ = 0;
+    Clock::time_point inputTime_;
+    Clock::duration startDelay_ = Clock::duration::zero();
+    uint64_t pacedPresentId_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable_any changed_;
+    /* Oldest first. A vector, since a deque would keep allocating nodes as presents pass through it. */
+    std::vector<PendingPresent> pending_;
+    uint64_t displayedId_ = 0;
+    Clock::time_point displayedTime_;
+    Clock::duration refreshInterval_ = Clock::duration::zero();
+    bool missedRefresh_ = false;
+    std::vector<FrameLatency> latencies_;
+    std::jthread waiter_;
+
+    void recordDisplayed_(const PendingPresent& present, Clock::time_point now)
+    {
+        if (displayedId_ != 0 && present.presentId == displayedId_ + 1)
+        {
+            const Clock::duration interval = now - displayedTime_;
+            /* Consecutive displays are one refresh apart, unless a frame missed its refresh. */
+            missedRefresh_ = refreshInterval_ != Clock::duration::zero() && interval > refreshInterval_ * 3 / 2;
+            if (!missedRefresh_)
+                refreshInterval_ = refreshInterval_ == Clock::duration::zero() ? interval : (refreshInterval_ * 7 + interval) / 8;
+        }
+        displayedId_ = present.presentId;
+        displayedTime_ = now;
+        latencies_.push_back({ present.presentId, now - present.inputTime, true });
+    }
+
+    void waitForPresents_(const std::stop_token& stopToken)
+    {
+        constexpr uint64_t timeout = std::chrono::nanoseconds(std::chrono::milliseconds(100)).count();
+        std::unique_lock lock(mutex_);
+        while (changed_.wait(lock, stopToken, [this] { return !pending_.empty(); }))
+        {
+            const PendingPresent present = pending_.front();
+            lock.unlock();
+            vk::Result result = vk::Result::eErrorOutOfDateKHR;
+            try
+            {
+                result = swapchain_.waitForPresent(present.presentId, timeout);
+            }
+            catch (const vk::SystemError&) {}
+            const Clock::time_point now = Clock::now();
+            lock.lock();
+            /* A present that never reaches the display, e.g. of a minimized window, must not keep the destructor's
+             * join waiting, as the predicate stays true while it is pending. */
+            if (result == vk::Result::eTimeout)
+            {
+                if (stopToken.stop_requested())
+                    break;
+                continue;
+            }
+            pending_.erase(pending_.begin());
+            /* On errors the swapchain is about to be recreated; drop the sample but unblock beginFrame(). */
+            if (result == vk::Result::eSuccess || result == vk::Result::eSuboptimalKHR)
+                recordDisplayed_(present, now);
+            else
+                displayedId_ = present.presentId;
+            changed_.notify_all();
+        }
+    }
+
+    /* Slowly moves the frame start towards the next refresh, backing off quickly whenever a frame misses it. */
+    void adjustStartDelay_()
+    {
+        if (missedRefresh_)
+            startDelay_ /= 2;
+        else
+            startDelay_ = std::min<Clock::duration>(startDelay_ + refreshInterval_ / 32, refreshInterval_ * 3 / 4);
+    }
+public:
+    VulkanFramePacer(const VulkanDevice& device, const VulkanSwapchain& swapchain, PresentPolicy policy) :
+        swapchain_(swapchain.getSwapchain()), policy_(policy), presentWait_(device.optionalFeatures.presentWait)
+    {
+        if (presentWait_)
+            waiter_ = std::jthread([this](const std::stop_token& stopToken) { waitForPresents_(stopToken); });
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanFramePacer)
+
+    /* Blocks until the frame should start and returns the time input is sampled at. */
+    Clock::time_point beginFrame()
+    {
+        if (presentWait_ && policy_ != PresentPolicy::MaxThroughput)
+        {
+            std::unique_lock lock(mutex_);
+            /* Bounded, because a minimized window may never display anything. */
+            changed_.wait_for(lock, std::chrono::milliseconds(100), [this] { return displayedId_ >= lastPresentId_; });
+            const bool lowestLatency = policy_ == PresentPolicy::LowestLatency || policy_ == PresentPolicy::LowestLatencyTearing;
+            if (lowestLatency && displayedId_ != 0 && refreshInterval_ != Clock::duration::zero())
+            {
+                /* Adjust once per displayed frame, then sleep out the delay from the moment it was displayed. */
+                if (pacedPresentId_ != displayedId_)
+                {
+                    pacedPresentId_ = displayedId_;
+                    adjustStartDelay_();
+                }
+                const Clock::time_point start = displayedTime_ + startDelay_;
+                lock.unlock();
+                std::this_thread::sleep_until(start);
+            }
+        }
+        inputTime_ = Clock::now();
+        return inputTime_;
+    }
+
+    /* 0 when present wait isn't available, which VulkanGraphicsStream::present() takes as no present ID. */
+    uint64_t nextPresentId() noexcept { return presentWait_ ? lastPresentId_ + 1 : 0; }
+
+    void framePresented(uint64_t presentId)
+    {
+        const std::scoped_lock lock(mutex_);
+        if (presentId == 0)
+        {
+            latencies_.push_back({ 0, Clock::now() - inputTime_, false });
+            return;
+        }
+        Expects(presentId == lastPresentId_ + 1);
+        lastPresentId_ = presentId;
+        pending_.push_back({ presentId, inputTime_ });
+        changed_.notify_all();
+    }
+
+    /* Swaps the latencies measured since the last call, oldest first, into latencies. Its previous contents are
+     * dropped and its capacity is recorded into from then on, so passing the same vector every time stops either side
+     * from allocating once both have grown to a reporting interval's worth. */
+    void takeLatencies(std::vector<FrameLatency>& latencies)
+    {
+        latencies.clear();
+        const std::scoped_lock lock(mutex_);
+        std::swap(latencies, latencies_);
+    }
+
+    /* Estimated display refresh interval; zero until two consecutive frames were displayed. */
+    Clock::duration refreshInterval()
+    {
+        const std::scoped_lock lock(mutex_);
+        return refreshInterval_;
+    }
+};
@@ -0,0 +1,359 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_device.h"
+#include "vk_suballocator.h"
+#include "metrics.h"
+
+#include <bit>
+#include <optional>
+
+enum class CompressionScheme
+{
+    None,
+    BC,
+    ETC2,
+    ASTC,
+};
+
+/* Texel block of a format: 1x1 for uncompressed formats. */
+struct FormatBlockInfo
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;
+    CompressionScheme compression;
+};
+
+/* Block layout of the formats textures come in; nullopt for anything else. */
+constexpr std::optional<FormatBlockInfo> getFormatBlockInfo(vk::Format format) noexcept
+{
+    using enum vk::Format;
+    using enum CompressionScheme;
+    const auto value = static_cast<uint32_t>(format);
+    if (value >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && value <= VK_FORMAT_BC7_SRGB_BLOCK)
+    {
+        /* BC1 and BC4 pack a block into 8 bytes, the others into 16. */
+        const bool halfBlock = value <= VK_FORMAT_BC1_RGBA_SRGB_BLOCK || value == VK_FORMAT_BC4_UNORM_BLOCK || value == VK_FORMAT_BC4_SNORM_BLOCK;
+        return FormatBlockInfo{ 4, 4, halfBlock ? 8u : 16u, BC };
+    }
+    if (value >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && value <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK)
+    {
+        const bool fullBlock = value == VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK || value == VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK ||
+                               value >= VK_FORMAT_EAC_R11G11_UNORM_BLOCK;
+        return FormatBlockInfo{ 4, 4, fullBlock ? 16u : 8u, ETC2 };
+    }
+    if (value >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && value <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+    {
+        /* UNORM and SRGB variants alternate, in order of block size. */
+        constexpr std::array<std::pair<uint32_t, uint32_t>, 14> extents = { {
+            { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 },
+            { 8, 8 }, { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 },
+        } };
+        const auto [width, height] = extents.at((value - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2);
+        return FormatBlockInfo{ width, height, 16, ASTC };
+    }
+    switch (format)
+    {
+    case eR8Unorm:
+    case eR8Srgb:
+        return FormatBlockInfo{ 1, 1, 1, None };
+    case eR8G8Unorm:
+    case eR8G8Srgb:
+    case eR16Sfloat:
+    case eD16Unorm:
+        return FormatBlockInfo{ 1, 1, 2, None };
+    case eR8G8B8A8Unorm:
+    case eR8G8B8A8Srgb:
+    case eB8G8R8A8Unorm:
+    case eB8G8R8A8Srgb:
+    case eA2B10G10R10UnormPack32:
+    case eB10G11R11UfloatPack32:
+    case eR16G16Sfloat:
+    case eR32Sfloat:
+    case eD32Sfloat:
+    case eD24UnormS8Uint:
+        return FormatBlockInfo{ 1, 1, 4, None };
+    case eR16G16B16A16Sfloat:
+    case eR32G32Sfloat:
+        return FormatBlockInfo{ 1, 1, 8, None };
+    case eR32G32B32A32Sfloat:
+        return FormatBlockInfo{ 1, 1, 16, None };
+    default:
+        return std::nullopt;
+    }
+}
+
+constexpr vk::ImageAspectFlags getFormatAspect(vk::Format format) noexcept
+{
+    using enum vk::Format;
+    switch (format)
+    {
+    case eD16Unorm:
+    case eX8D24UnormPack32:
+    case eD32Sfloat:
+        return vk::ImageAspectFlagBits::eDepth;
+    case eD16UnormS8Uint:
+    case eD24UnormS8Uint:
+    case eD32SfloatS8Uint:
+        return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+    default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+constexpr vk::Extent2D getMipExtent(vk::Extent2D extent, uint32_t mip) noexcept
+{
+    return { std::max(extent.width >> mip, 1u), std::max(extent.height >> mip, 1u) };
+}
+
+/* Levels in a full mip chain down to 1x1. */
+constexpr uint32_t getMipLevelCount(vk::Extent2D extent) noexcept
+{
+    return gsl::narrow_cast<uint32_t>(std::bit_width(std::max(extent.width, extent.height)));
+}
+
+/* Tightly packed size of one mip level, as copied from a buffer with a zero row length. */
+constexpr vk::DeviceSize getMipSize(const FormatBlockInfo& block, vk::Extent2D extent, uint32_t mip) noexcept
+{
+    const vk::Extent2D mipExtent = getMipExtent(extent, mip);
+    const vk::DeviceSize blocksWide = (mipExtent.width + block.width - 1) / block.width;
+    const vk::DeviceSize blocksHigh = (mipExtent.height + block.height - 1) / block.height;
+    return blocksWide * blocksHigh * block.bytes;
+}
+
+consteval MemoryCategory getMemoryCategory(vk::ImageUsageFlags usage) noexcept
+{
+    return (usage & vk::ImageUsageFlagBits::eSampled) ? MemoryCategory::Texture : MemoryCategory::Other;
+}
+
+/* Stages and accesses that use an image in a given layout, for the source and destination scopes of a transition. */
+struct ImageLayoutAccess
+{
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+};
+
+constexpr ImageLayoutAccess getLayoutAccess(vk::ImageLayout layout) noexcept
+{
+    using enum vk::ImageLayout;
+    using Stage = vk::PipelineStageFlagBits;
+    using Access = vk::AccessFlagBits;
+    switch (layout)
+    {
+    case eUndefined:
+        return { Stage::eTopOfPipe, {} };
+    case eTransferSrcOptimal:
+        return { Stage::eTransfer, Access::eTransferRead };
+    case eTransferDstOptimal:
+        return { Stage::eTransfer, Access::eTransferWrite };
+    case eShaderReadOnlyOptimal:
+        return { Stage::eVertexShader | Stage::eFragmentShader | Stage::eComputeShader, Access::eShaderRead };
+    case eColorAttachmentOptimal:
+        return { Stage::eColorAttachmentOutput, Access::eColorAttachmentRead | Access::eColorAttachmentWrite };
+    case eDepthStencilAttachmentOptimal:
+    case eDepthAttachmentOptimal:
+        return { Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+                 Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite };
+    case ePresentSrcKHR:
+        return { Stage::eBottomOfPipe, {} };
+    default:
+        return { Stage::eAllCommands, Access::eMemoryRead | Access::eMemoryWrite };
+    }
+}
+
+/* 2D image with its own memory from the device's image sub-allocator, and a view of all mips when the usage allows
+ * views. Layouts are tracked per mip on the host as commands are recorded, so transitions only need the new layout.
+ * This assumes the image's commands execute in the order they were recorded: record them on one stream, or
+ * resynchronize with assumeLayout() after handing the image to another one. */
+template <vk::ImageUsageFlags usage>
+class VulkanImage
+{
+private:
+    vk::Format format_;
+    vk::Extent2D extent_;
+    uint32_t mipLevels_;
+    vk::ImageAspectFlags aspect_;
+    vk::FormatFeatureFlags formatFeatures_;
+    vk::raii::Image image_;
+    VulkanSubAllocation memory_;
+    vk::raii::ImageView view_ = nullptr;
+    std::vector<vk::ImageLayout> layouts_;
+
+    constexpr static MemoryCategory memoryCategory_ = getMemoryCategory(usage);
+    constexpr static bool hasView_ = static_cast<bool>(usage & (vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+                                                                vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment |
+                                                                vk::ImageUsageFlagBits::eInputAttachment));
+public:
+    /* extraUsage is for usage that only some devices support, such as eHostTransferEXT. */
+    VulkanImage(const VulkanDevice& device, vk::Format format, vk::Extent2D extent, uint32_t mipLevels = 1,
+                MemoryPriority priority = MemoryPriority::Normal, vk::ImageUsageFlags extraUsage = {}) :
+        format_(format),
+        extent_(extent),
+        mipLevels_(mipLevels),
+        aspect_(getFormatAspect(format)),
+        formatFeatures_(device.physicalDevice.getFormatProperties(format).optimalTilingFeatures),
+        image_(device.device.createImage(vk::ImageCreateInfo({}, vk::ImageType::e2D, format, vk::Extent3D(extent, 1), mipLevels, 1,
+                                                             vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal, usage | extraUsage,
+                                                             vk::SharingMode::eExclusive, {}, vk::ImageLayout::eUndefined))),
+        memory_(device.imageMemory->allocate(image_.getMemoryRequirements(), vk::MemoryPropertyFlagBits::eDeviceLocal, memoryCategory_, priority)),
+        layouts_(mipLevels, vk::ImageLayout::eUndefined)
+    {
+        Expects(mipLevels > 0 && mipLevels <= getMipLevelCount(extent));
+        image_.bindMemory(*memory_.memory(), memory_.offset());
+        if constexpr (hasView_)
+            view_ = createView(device, 0, mipLevels_);
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanImage)
+
+    const vk::Image& get() const noexcept { return *image_; }
+    /* View of all mips. */
+    vk::ImageView view() const noexcept requires hasView_ { return *view_; }
+    vk::Format format() const noexcept { return format_; }
+    vk::Extent2D extent() const noexcept { return extent_; }
+    uint32_t mipLevels() const noexcept { return mipLevels_; }
+    vk::ImageLayout layout(uint32_t mip) const { return layouts_.at(mip); }
+    const VulkanSubAllocation& memory() const noexcept { return memory_; }
+
+    /* View of mipCount mips starting at baseMip, e.g. for sampling only the mips that are resident. */
+    vk::raii::ImageView createView(const VulkanDevice& device, uint32_t baseMip, uint32_t mipCount) const requires hasView_
+    {
+        Expects(baseMip + mipCount <= mipLevels_);
+        const vk::ImageViewCreateInfo viewInfo({}, *image_, vk::ImageViewType::e2D, format_, {},
+                                               vk::ImageSubresourceRange(aspect_, baseMip, mipCount, 0, 1));
+        return device.device.createImageView(viewInfo);
+    }
+
+    /* Records a barrier moving mips [baseMip, baseMip + mipCount) to newLayout, covering whatever stages used them in
+     * their previous layouts. Mips already in newLayout are left alone. */
+    void recordTransition(const vk::CommandBuffer& commandBuffer, vk::ImageLayout newLayout, uint32_t baseMip = 0,
+                          uint32_t mipCount = VK_REMAINING_MIP_LEVELS)
+    {
+        const uint32_t endMip = mipCount == VK_REMAINING_MIP_LEVELS ? mipLevels_ : baseMip + mipCount;
+        Expects(baseMip < endMip && endMip <= mipLevels_);
+        const ImageLayoutAccess destination = getLayoutAccess(newLayout);
+        vk::PipelineStageFlags sourceStages;
+        std::vector<vk::ImageMemoryBarrier> barriers;
+        for (uint32_t mip = baseMip; mip < endMip;)
+        {
+            /* One barrier per run of mips sharing a layout. */
+            const vk::ImageLayout oldLayout = layouts_[mip];
+            uint32_t runEnd = mip + 1;
+            while (runEnd < endMip && layouts_[runEnd] == oldLayout)
+                runEnd++;
+            if (oldLayout != newLayout)
+            {
+                const ImageLayoutAccess source = getLayoutAccess(oldLayout);
+                sourceStages |= source.stages;
+                barriers.emplace_back(source.access, destination.access, oldLayout, newLayout, VK_QUEUE_FAMILY_IGNORED,
+                                      VK_QUEUE_FAMILY_IGNORED, *image_, vk::ImageSubresourceRange(aspect_, mip, runEnd - mip, 0, 1));
+                std::fill(layouts_.begin() + mip, layouts_.begin() + runEnd, newLayout);
+            }
+            mip = runEnd;
+        }
+        if (!barriers.empty())
+            commandBuffer.pipelineBarrier(sourceStages, destination.stages, {}, {}, {}, barriers);
+    }
+
+    /* For layout changes made outside recordTransition(), such as by a render pass's final layout. */
+    void assumeLayout(vk::ImageLayout layout, uint32_t baseMip = 0, uint32_t mipCount = VK_REMAINING_MIP_LEVELS)
+    {
+        const uint32_t endMip = mipCount == VK_REMAINING_MIP_LEVELS ? mipLevels_ : baseMip + mipCount;
+        Expects(endMip <= mipLevels_);
+        std::fill(layouts_.begin() + baseMip, layouts_.begin() + endMip, layout);
+    }
+
+    /* Copies a tightly packed mip from source at offset, leaving the mip in TransferDstOptimal. */
+    template <vk::BufferUsageFlags bufferUsage, VulkanBufferType bufferType>
+    void recordCopyFromBuffer(const vk::CommandBuffer& commandBuffer, const VulkanBuffer<bufferUsage, bufferType>& source,
+                              vk::DeviceSize offset, uint32_t mip)
+    {
+        static_assert(static_cast<bool>(bufferUsage & vk::BufferUsageFlagBits::eTransferSrc), "Source buffer must have TransferSrc buffer usage flag");
+        static_assert(static_cast<bool>(usage & vk::ImageUsageFlagBits::eTransferDst), "Image must have TransferDst image usage flag");
+        recordTransition(commandBuffer, vk::ImageLayout::eTransferDstOptimal, mip, 1);
+        const vk::Extent2D mipExtent = getMipExtent(extent_, mip);
+        const vk::BufferImageCopy region(offset, 0, 0, vk::ImageSubresourceLayers(aspect_, mip, 0, 1), {}, vk::Extent3D(mipExtent, 1));
+        commandBuffer.copyBufferToImage(source.get(), *image_, vk::ImageLayout::eTransferDstOptimal, region);
+    }
+
+    /* Copies sourceMip of source into mip, whose extents have to match, leaving them in TransferSrcOptimal and
+     * TransferDstOptimal respectively. */
+    template <vk::ImageUsageFlags sourceUsage>
+    void recordCopyFromImage(const vk::CommandBuffer& commandBuffer, VulkanImage<sourceUsage>& source, uint32_t sourceMip, uint32_t mip)
+    {
+        static_assert(static_cast<bool>(sourceUsage & vk::ImageUsageFlagBits::eTransferSrc), "Source image must have TransferSrc image usage flag");
+        static_assert(static_cast<bool>(usage & vk::ImageUsageFlagBits::eTransferDst), "Image must have TransferDst image usage flag");
+        const vk::Extent2D mipExtent = getMipExtent(extent_, mip);
+        Expects(source.format() == format_ && getMipExtent(source.extent(), sourceMip) == mipExtent);
+        source.recordTransition(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, sourceMip, 1);
+        recordTransition(commandBuffer, vk::ImageLayout::eTransferDstOptimal, mip, 1);
+        const vk::ImageCopy region(vk::ImageSubresourceLayers(aspect_, sourceMip, 0, 1), {}, vk::ImageSubresourceLayers(aspect_, mip, 0, 1), {},
+                                   vk::Extent3D(mipExtent, 1));
+        commandBuffer.copyImage(source.get(), vk::ImageLayout::eTransferSrcOptimal, *image_, vk::ImageLayout::eTransferDstOptimal, region);
+    }
+
+    /* Copies a mip into destination at offset, tightly packed, leaving the mip in TransferSrcOptimal. */
+    template <vk::BufferUsageFlags bufferUsage, VulkanBufferType bufferType>
+    void recordCopyToBuffer(const vk::CommandBuffer& commandBuffer, const VulkanBuffer<bufferUsage, bufferType>& destination,
+                            vk::DeviceSize offset, uint32_t mip)
+    {
+        static_assert(static_cast<bool>(bufferUsage & vk::BufferUsageFlagBits::eTransferDst), "Destination buffer must have TransferDst buffer usage flag");
+        static_assert(static_cast<bool>(usage & vk::ImageUsageFlagBits::eTransferSrc), "Image must have TransferSrc image usage flag");
+        recordTransition(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, mip, 1);
+        const vk::Extent2D mipExtent = getMipExtent(extent_, mip);
+        const vk::BufferImageCopy region(offset, 0, 0, vk::ImageSubresourceLayers(aspect_, mip, 0, 1), {}, vk::Extent3D(mipExtent, 1));
+        commandBuffer.copyImageToBuffer(*image_, vk::ImageLayout::eTransferSrcOptimal, destination.get(), region);
+    }
+
+    /* Copies a tightly packed mip from host memory with VK_EXT_host_image_copy, leaving the mip in layout, which has to
+     * be one of the device's copyDstLayouts. No command buffer or staging memory is involved, and the data is visible
+     * to everything submitted afterwards. The image needs eHostTransferEXT usage and the mip must not be in use on the
+     * device. Any thread may copy, as long as no two copy to the same mip at once. */
+    void copyFromHost(const VulkanDevice& device, gsl::span<const std::byte> data, uint32_t mip, vk::ImageLayout layout)
+    {
+        Expects(mip < mipLevels_);
+        const vk::ImageSubresourceRange range(aspect_, mip, 1, 0, 1);
+        /* The whole mip is overwritten, so its contents needn't survive the transition. */
+        device.device.transitionImageLayoutEXT(vk::HostImageLayoutTransitionInfoEXT(*image_, vk::ImageLayout::eUndefined, layout, range));
+        const vk::Extent2D mipExtent = getMipExtent(extent_, mip);
+        const vk::MemoryToImageCopyEXT region(data.data(), 0, 0, vk::ImageSubresourceLayers(aspect_, mip, 0, 1), {}, vk::Extent3D(mipExtent, 1));
+        device.device.copyMemoryToImageEXT(vk::CopyMemoryToImageInfoEXT({}, *image_, layout, region));
+        layouts_[mip] = layout;
+        metrics::bytesUploaded.add(data.size_bytes());
+    }
+
+    /* Fills mips after baseMip by successively blitting each one from the one before, then moves all of them to
+     * finalLayout. baseMip must hold the source image already. Compressed formats can't be blitted to, so their chains
+     * have to be generated offline. */
+    void recordGenerateMips(const vk::CommandBuffer& commandBuffer, uint32_t baseMip = 0,
+                            vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal)
+    {
+        static_assert(static_cast<bool>(usage & vk::ImageUsageFlagBits::eTransferSrc), "Image must have TransferSrc image usage flag");
+        static_assert(static_cast<bool>(usage & vk::ImageUsageFlagBits::eTransferDst), "Image must have TransferDst image usage flag");
+        using enum vk::FormatFeatureFlagBits;
+        if ((formatFeatures_ & (eBlitSrc | eBlitDst)) != (eBlitSrc | eBlitDst))
+            throw FatalError("Image format does not support blits; mips must be generated offline");
+        /* Box filtering needs linear filtering support; fall back to point sampling every other texel. */
+        const vk::Filter filter = (formatFeatures_ & eSampledImageFilterLinear) ? vk::Filter::eLinear : vk::Filter::eNearest;
+
+        recordTransition(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, baseMip, 1);
+        if (baseMip + 1 < mipLevels_)
+            recordTransition(commandBuffer, vk::ImageLayout::eTransferDstOptimal, baseMip + 1);
+        for (uint32_t mip = baseMip + 1; mip < mipLevels_; mip++)
+        {
+            const vk::Extent2D sourceExtent = getMipExtent(extent_, mip - 1);
+            const vk::Extent2D destinationExtent = getMipExtent(extent_, mip);
+            const vk::ImageBlit blit(
+                vk::ImageSubresourceLayers(aspect_, mip - 1, 0, 1),
+                { vk::Offset3D(0, 0, 0), vk::Offset3D(gsl::narrow<int32_t>(sourceExtent.width), gsl::narrow<int32_t>(sourceExtent.height), 1) },
+                vk::ImageSubresourceLayers(aspect_, mip, 0, 1),
+                { vk::Offset3D(0, 0, 0), vk::Offset3D(gsl::narrow<int32_t>(destinationExtent.width), gsl::narrow<int32_t>(destinationExtent.height), 1) }
+            );
+            commandBuffer.blitImage(*image_, vk::ImageLayout::eTransferSrcOptimal, *image_, vk::ImageLayout::eTransferDstOptimal, blit, filter);
+            /* Each mip is the source of the next blit. */
+            recordTransition(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, mip, 1);
+        }
+        recordTransition(commandBuffer, finalLayout, baseMip);
+    }
+};
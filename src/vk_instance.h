@@ -2,15 +2,38 @@
 
 #include "vk_types.h"
 #include "vk_device.h"
+#include "vk_features.h"
 #include "vk_validation.h"
 
+#include <algorithm>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
 
 class VulkanInstance
 {
     vk::raii::Instance instance_;
     std::vector<std::shared_ptr<const VulkanDevice>> devices_;
 
+    /* Why a device can't run the engine at all, if it can't. */
+    static std::optional<std::string> missingRequirements_(const VulkanDeviceCapabilities& device,
+                                                           gsl::span<const char* const> deviceExtensions)
+    {
+        if (device.properties.apiVersion < VK_API_VERSION_1_3)
+            return "Vulkan 1.3 is required";
+        for (const char* extension : deviceExtensions)
+            if (!device.hasExtension(extension))
+                return std::string("missing extension ") + extension;
+        if (!device.core<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore)
+            return "timeline semaphores are required";
+        if (!device.core<vk::PhysicalDeviceVulkan13Features>().synchronization2)
+            return "synchronization2 is required";
+        if (!device.core<vk::PhysicalDeviceVulkan12Features>().bufferDeviceAddress)
+            return "buffer device addresses are required";
+        return std::nullopt;
+    }
+
     vk::raii::Instance makeInstance(
         const vk::ApplicationInfo& appInfo,
         gsl::span<const char* const> validationLayers,
@@ -53,10 +76,15 @@ public:
             if (!physicalDevice.getFeatures().geometryShader)
                 continue;
 
-            auto extensions = physicalDevice.enumerateDeviceExtensionProperties();
+            const VulkanDeviceCapabilities capabilities(physicalDevice);
             std::cout << "Available device extensions:" << std::endl;
-            for (auto& extension : extensions)
+            for (auto& extension : capabilities.extensions())
                 std::cout << "\t" << extension.extensionName << std::endl;
+            if (const auto missing = missingRequirements_(capabilities, deviceExtensions))
+            {
+                std::cout << "Skipping " << capabilities.properties.deviceName << ": " << *missing << std::endl;
+                continue;
+            }
 
             std::optional<uint32_t> generalQueueIndex;
             std::optional<uint32_t> transferQueueIndex;
@@ -82,15 +110,18 @@ public:
             if (transferQueueIndex)
                 queueInfos.emplace_back(queueFlags, *transferQueueIndex, topPriority);
 
-            vk::PhysicalDeviceVulkan12Features features12;
-            features12.timelineSemaphore = true;
-            vk::PhysicalDeviceVulkan13Features features13;
-            features13.synchronization2 = true;
-            features13.pNext = &features12;
-            const vk::DeviceCreateInfo deviceInfo({}, queueInfos, {}, deviceExtensions, {}, &features13);
+            VulkanDeviceFeatureRequest request(deviceExtensions);
+            request.core<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore = true;
+            request.core<vk::PhysicalDeviceVulkan13Features>().synchronization2 = true;
+            request.core<vk::PhysicalDeviceVulkan12Features>().bufferDeviceAddress = true;
+            /* Optional features are enabled only where supported; users check VulkanDevice::optionalFeatures. */
+            const VulkanOptionalFeatures optionalFeatures = EngineOptionalFeatures::negotiate(capabilities, request);
+            std::cout << "Optional features of " << capabilities.properties.deviceName << ":" << std::endl;
+            EngineOptionalFeatures::print(std::cout, optionalFeatures);
+            const vk::DeviceCreateInfo deviceInfo = request.createInfo(queueInfos);
 
             devices_.push_back(std::make_shared<VulkanDevice>(
-                physicalDevice, deviceInfo, generalQueueIndex, transferQueueIndex));
+                physicalDevice, deviceInfo, generalQueueIndex, transferQueueIndex, optionalFeatures));
         }
     }
     DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanInstance)
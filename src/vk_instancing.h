@@ -0,0 +1,204 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_device.h"
+#include "vk_stream.h"
+#include "vk_vertex.h"
+#include "job_system.h"
+#include "radix_sort.h"
+#include "render_queue.h"
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <optional>
+
+/* Per-frame instance data in persistently mapped, host-coherent vertex buffers that the GPU reads from directly, so
+ * streaming instances costs one sequential write per instance and no copy command. Every frame gets its own buffer,
+ * reused once the GPU has retired the frame, the same way VulkanFrameArenas recycles frame memory. A buffer too small
+ * for a frame is replaced by one of the next power of two, so a steady instance count stops allocating. */
+template <VertexType Instance>
+class VulkanInstanceStream
+{
+    static_assert(vertexInputRate<Instance>() == vk::VertexInputRate::eInstance);
+    static_assert(std::is_trivially_copyable_v<Instance>);
+    constexpr static size_t minCapacity_ = 1024;
+
+    /* Also a storage buffer, for GPU culling to read the instances from. */
+    using Buffer = VulkanBuffer<vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, VulkanBufferType::Staging>;
+
+    struct Frame
+    {
+        Buffer buffer;
+        gsl::span<Instance> instances;
+        std::optional<VulkanStreamEvent> retireEvent;
+    };
+
+    const VulkanDevice& device_;
+    std::vector<std::unique_ptr<Frame>> frames_;
+    Frame* current_ = nullptr;
+    size_t currentCount_ = 0;
+
+    std::unique_ptr<Frame> createFrame_(size_t count) const
+    {
+        const size_t capacity = std::bit_ceil(std::max(count, minCapacity_));
+        auto frame = std::make_unique<Frame>(Frame{ Buffer(device_, capacity * sizeof(Instance)), {}, std::nullopt });
+        frame->instances = { reinterpret_cast<Instance*>(frame->buffer.mapped().data()), capacity };
+        return frame;
+    }
+public:
+    explicit VulkanInstanceStream(const VulkanDevice& device) : device_(device) {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanInstanceStream)
+
+    /* Starts a frame with room for count instances, to be written through the returned span, from any thread. */
+    gsl::span<Instance> beginFrame(size_t count)
+    {
+        const auto retired = std::ranges::find_if(frames_, [](const std::unique_ptr<Frame>& frame)
+        {
+            return !frame->retireEvent || frame->retireEvent->completed();
+        });
+        if (retired == frames_.end())
+            current_ = frames_.emplace_back(createFrame_(count)).get();
+        else
+        {
+            if ((*retired)->instances.size() < count)
+                *retired = createFrame_(count);
+            current_ = retired->get();
+        }
+        current_->retireEvent.reset();
+        currentCount_ = count;
+        return current_->instances.first(count);
+    }
+
+    /* Ends the frame. Its buffer is reused once everything submitted to stream so far has retired. */
+    void endFrame(const VulkanStream& stream)
+    {
+        Expects(current_);
+        current_->retireEvent.emplace(stream.getLastEvent());
+        current_ = nullptr;
+    }
+
+    /* The current frame's buffer, to bind as the instance-rate vertex buffer. */
+    const vk::Buffer& buffer() const
+    {
+        Expects(current_);
+        return current_->buffer.get();
+    }
+
+    /* The current frame's instances as written so far, e.g. to capture them. Reads write-combined memory, so slow. */
+    gsl::span<const Instance> instances() const
+    {
+        Expects(current_);
+        return current_->instances.first(currentCount_);
+    }
+};
+
+/* Turns per-object draws into instanced ones. Each distinct mesh draw is registered once as a batch; every frame,
+ * objects add their instance data to a batch from any thread, and build() gathers each batch's instances into one
+ * contiguous range of a VulkanInstanceStream and submits a single draw of all of them. Within a batch, instances are
+ * ordered front to back, so that instancing doesn't defeat early depth testing. */
+template <VertexType Instance>
+class InstanceBatcher
+{
+    struct Batch
+    {
+        uint64_t key;
+        DrawPacket packet;
+    };
+
+    /* Batch in the upper 32 bits, depth below, so that sorting groups by batch and orders each batch by depth. */
+    struct Entry
+    {
+        uint64_t key;
+        uint32_t instance;
+
+        uint32_t batch() const noexcept { return static_cast<uint32_t>(key >> 32); }
+    };
+
+    constexpr static size_t copyBatchSize_ = 4096;
+
+    std::vector<Batch> batches_;
+    std::vector<Instance> instances_;
+    std::vector<Entry> entries_;
+    std::vector<Entry> scratch_;
+    std::atomic<size_t> count_ = 0;
+    RadixSorter sorter_;
+public:
+    InstanceBatcher() = default;
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(InstanceBatcher)
+
+    /* Registers a draw of one mesh and returns the id to add its instances with. key is the RenderQueue sort key of the
+     * combined draw; packet's instanceBuffer, firstInstance and instanceCount are filled in by build(). */
+    uint32_t addBatch(uint64_t key, const DrawPacket& packet)
+    {
+        batches_.push_back({ key, packet });
+        return gsl::narrow<uint32_t>(batches_.size() - 1);
+    }
+    /* For per-frame changes to a batch's draw, such as its push constants. */
+    DrawPacket& batchPacket(uint32_t batch) { return batches_.at(batch).packet; }
+    size_t batchCount() const noexcept { return batches_.size(); }
+
+    /* Drops the previous frame's instances and makes room for capacity of them. */
+    void reset(size_t capacity)
+    {
+        Expects(capacity <= std::numeric_limits<uint32_t>::max());
+        if (instances_.size() < capacity)
+        {
+            instances_.resize(capacity);
+            entries_.resize(capacity);
+            scratch_.resize(capacity);
+        }
+        count_.store(0, std::memory_order_relaxed);
+    }
+
+    /* Thread-safe, but not with the other members. depth is the view-space distance, as for RenderKey. */
+    void add(uint32_t batch, const Instance& instance, float depth = 0.0f)
+    {
+        Expects(batch < batches_.size());
+        const size_t index = count_.fetch_add(1, std::memory_order_relaxed);
+        Expects(index < instances_.size()); // Exceeded the capacity passed to reset()
+        instances_[index] = instance;
+        const uint32_t depthKey = std::bit_cast<uint32_t>(depth > 0.0f ? depth : 0.0f);
+        entries_[index] = { (uint64_t(batch) << 32) | depthKey, gsl::narrow_cast<uint32_t>(index) };
+    }
+
+    size_t size() const noexcept { return std::min(count_.load(std::memory_order_relaxed), instances_.size()); }
+
+    /* Starts a frame of instanceStream, fills it with the added instances grouped by batch and submits one draw per
+     * non-empty batch to queue, which needs room for batchCount() more draws. */
+    void build(JobSystem& jobs, VulkanInstanceStream<Instance>& instanceStream, RenderQueue& queue)
+    {
+        build(jobs, instanceStream, [&](uint32_t, uint64_t key, const DrawPacket& packet) { queue.submit(key, packet); });
+    }
+    /* As above, but hands each batch's draw to submit(batch, key, packet), on the calling thread, for callers that
+     * transform draws on their way to the queue. */
+    template <std::invocable<uint32_t, uint64_t, const DrawPacket&> Submit>
+    void build(JobSystem& jobs, VulkanInstanceStream<Instance>& instanceStream, const Submit& submit)
+    {
+        const size_t count = size();
+        const auto entries = gsl::span(entries_).first(count);
+        sorter_.sort(jobs, entries, gsl::span(scratch_), [](const Entry& entry) { return entry.key; });
+
+        const gsl::span<Instance> destination = instanceStream.beginFrame(count);
+        /* Sequential writes, as the destination is likely write-combined. */
+        jobs.parallelFor(count, copyBatchSize_, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                destination[i] = instances_[entries[i].instance];
+        });
+
+        for (size_t begin = 0; begin < count;)
+        {
+            const uint32_t batch = entries[begin].batch();
+            const auto run = entries.subspan(begin);
+            const size_t end = begin + gsl::narrow_cast<size_t>(std::ranges::upper_bound(run, batch, {}, &Entry::batch) - run.begin());
+            DrawPacket packet = batches_[batch].packet;
+            packet.instanceBuffer = instanceStream.buffer();
+            packet.firstInstance = gsl::narrow<uint32_t>(begin);
+            packet.instanceCount = gsl::narrow<uint32_t>(end - begin);
+            submit(batch, batches_[batch].key, packet);
+            begin = end;
+        }
+    }
+};
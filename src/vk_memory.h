@@ -0,0 +1,438 @@
+#pragma once
+
+#include "vk_types.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+
+enum class MemoryCategory : uint8_t
+{
+    Geometry,
+    Texture,
+    Staging,
+    Readback,
+    Other,
+};
+constexpr size_t memoryCategoryCount = 5;
+
+constexpr const char* to_string(MemoryCategory category) noexcept
+{
+    using enum MemoryCategory;
+    switch (category)
+    {
+    case Geometry:  return "geometry";
+    case Texture:   return "texture";
+    case Staging:   return "staging";
+    case Readback:  return "readback";
+    case Other:     return "other";
+    }
+    return "?";
+}
+
+/* Low-priority device-local allocations may be demoted to host memory when their heap is over budget, and registered
+ * low and normal priority resources are evicted before anything else is. High priority is never touched. */
+enum class MemoryPriority : uint8_t
+{
+    Low,
+    Normal,
+    High,
+};
+
+class VulkanMemoryManager;
+
+/* Device memory tracked by a VulkanMemoryManager for as long as it lives. */
+class VulkanAllocation
+{
+    friend class VulkanMemoryManager;
+
+    VulkanMemoryManager* manager_ = nullptr;
+    vk::raii::DeviceMemory memory_;
+    vk::DeviceSize size_ = 0;
+    vk::MemoryPropertyFlags flags_;
+    uint32_t memoryType_ = 0;
+    uint32_t heapIndex_ = 0;
+    MemoryCategory category_ = MemoryCategory::Other;
+    bool demoted_ = false;
+
+    VulkanAllocation(VulkanMemoryManager& manager, vk::raii::DeviceMemory memory, vk::DeviceSize size, vk::MemoryPropertyFlags flags,
+                     uint32_t memoryType, uint32_t heapIndex, MemoryCategory category, bool demoted) noexcept :
+        manager_(&manager), memory_(std::move(memory)), size_(size), flags_(flags), memoryType_(memoryType), heapIndex_(heapIndex),
+        category_(category), demoted_(demoted)
+    {}
+public:
+    VulkanAllocation(const VulkanAllocation&) = delete;
+    VulkanAllocation& operator=(const VulkanAllocation&) = delete;
+    VulkanAllocation(VulkanAllocation&& other) noexcept :
+        manager_(std::exchange(other.manager_, nullptr)), memory_(std::move(other.memory_)), size_(other.size_), flags_(other.flags_),
+        memoryType_(other.memoryType_), heapIndex_(other.heapIndex_), category_(other.category_), demoted_(other.demoted_)
+    {}
+    VulkanAllocation& operator=(VulkanAllocation&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release_();
+            manager_ = std::exchange(other.manager_, nullptr);
+            memory_ = std::move(other.memory_);
+            size_ = other.size_;
+            flags_ = other.flags_;
+            memoryType_ = other.memoryType_;
+            heapIndex_ = other.heapIndex_;
+            category_ = other.category_;
+            demoted_ = other.demoted_;
+        }
+        return *this;
+    }
+    ~VulkanAllocation() { release_(); }
+
+    const vk::raii::DeviceMemory& memory() const noexcept { return memory_; }
+    vk::DeviceSize size() const noexcept { return size_; }
+    /* Properties of the memory type actually chosen, which may be a superset of the requested ones. */
+    vk::MemoryPropertyFlags flags() const noexcept { return flags_; }
+    uint32_t memoryType() const noexcept { return memoryType_; }
+    uint32_t heapIndex() const noexcept { return heapIndex_; }
+    MemoryCategory category() const noexcept { return category_; }
+    /* Whether the allocation was placed outside device-local memory because the device heap was over budget. */
+    bool demoted() const noexcept { return demoted_; }
+private:
+    inline void release_() noexcept;
+};
+
+/* Keeps a resource evictable until destroyed. Eviction calls the callback once and then deactivates the registration. */
+class EvictionRegistration
+{
+    friend class VulkanMemoryManager;
+
+    VulkanMemoryManager* manager_ = nullptr;
+    uint64_t id_ = 0;
+
+    EvictionRegistration(VulkanMemoryManager& manager, uint64_t id) noexcept : manager_(&manager), id_(id) {}
+public:
+    EvictionRegistration() = default;
+    EvictionRegistration(const EvictionRegistration&) = delete;
+    EvictionRegistration& operator=(const EvictionRegistration&) = delete;
+    EvictionRegistration(EvictionRegistration&& other) noexcept : manager_(std::exchange(other.manager_, nullptr)), id_(other.id_) {}
+    EvictionRegistration& operator=(EvictionRegistration&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            manager_ = std::exchange(other.manager_, nullptr);
+            id_ = other.id_;
+        }
+        return *this;
+    }
+    ~EvictionRegistration() { reset(); }
+
+    /* Marks the resource as used this frame; eviction picks least recently used resources first. */
+    inline void markUsed() const;
+    inline void reset() noexcept;
+};
+
+/* Per-device memory manager. Caches the memory properties, tracks the engine's own usage per heap and category, and
+ * keeps every heap inside its budget: as reported by VK_EXT_memory_budget when the device has it, otherwise a fixed
+ * fraction of the heap size. Call updateBudget() once per frame; it queries the budget and proactively evicts
+ * registered resources from heaps that have crossed the high-water mark.
+ *
+ * Eviction callbacks usually hand their resource to a VulkanDeletionQueue, so memory is only freed once the GPU is
+ * done with it. The bytes being evicted are counted as free in the meantime. */
+class VulkanMemoryManager
+{
+    friend class VulkanAllocation;
+    friend class EvictionRegistration;
+
+    /* Share of the budget the engine aims to stay under, leaving room for driver-internal allocations. */
+    constexpr static double targetUtilization_ = 0.85;
+    /* Usage above which updateBudget() starts evicting. */
+    constexpr static double highWaterUtilization_ = 0.9;
+    /* Budget assumed without VK_EXT_memory_budget. */
+    constexpr static double fallbackBudgetFraction_ = 0.8;
+
+    struct Heap
+    {
+        vk::DeviceSize size = 0;
+        vk::DeviceSize budget = 0;
+        vk::DeviceSize reportedUsage = 0;
+        /* Allocated and evicted since the last budget query, which doesn't see them yet. Without VK_EXT_memory_budget
+         * reportedUsage stays 0 and tracked usage stands in for it. */
+        vk::DeviceSize allocatedSinceUpdate = 0;
+        vk::DeviceSize evictedSinceUpdate = 0;
+        std::array<vk::DeviceSize, memoryCategoryCount> tracked{};
+        uint64_t demotions = 0;
+        uint64_t evictions = 0;
+
+        vk::DeviceSize trackedTotal() const noexcept { return std::reduce(tracked.begin(), tracked.end()); }
+        vk::DeviceSize projectedUsage() const noexcept
+        {
+            const vk::DeviceSize usage = std::max(reportedUsage + allocatedSinceUpdate, trackedTotal());
+            return usage - std::min(usage, evictedSinceUpdate);
+        }
+    };
+
+    struct Evictable
+    {
+        uint32_t heapIndex;
+        vk::DeviceSize size;
+        MemoryPriority priority;
+        uint64_t lastUsedFrame;
+        std::function<void()> evict;
+    };
+
+    const vk::raii::PhysicalDevice& physicalDevice_;
+    const vk::raii::Device& device_;
+    const bool budgetSupported_;
+    const vk::PhysicalDeviceMemoryProperties properties_;
+
+    mutable std::mutex mutex_;
+    std::vector<Heap> heaps_;
+    std::map<uint64_t, Evictable> evictables_;
+    uint64_t nextEvictableId_ = 1;
+    uint64_t frame_ = 0;
+
+    /* The lowest memory type index that has all required flags. */
+    std::optional<uint32_t> findMemoryType_(uint32_t typeBits, vk::MemoryPropertyFlags required) const noexcept
+    {
+        for (uint32_t i = 0; i < properties_.memoryTypeCount; i++)
+            if ((typeBits & (1u << i)) && (properties_.memoryTypes.at(i).propertyFlags & required) == required)
+                return i;
+        return std::nullopt;
+    }
+
+    uint32_t heapOf_(uint32_t memoryType) const { return properties_.memoryTypes.at(memoryType).heapIndex; }
+
+    bool fits_(uint32_t heapIndex, vk::DeviceSize size) const
+    {
+        const Heap& heap = heaps_.at(heapIndex);
+        return static_cast<double>(heap.projectedUsage() + size) <= static_cast<double>(heap.budget) * targetUtilization_;
+    }
+
+    /* Picks registered resources on heapIndex to free at least bytes, lowest priority and least recently used first.
+     * Called with the lock held; the returned callbacks must run after releasing it, since they free memory. */
+    std::vector<std::function<void()>> selectEvictions_(uint32_t heapIndex, vk::DeviceSize bytes)
+    {
+        std::vector<std::map<uint64_t, Evictable>::iterator> candidates;
+        for (auto it = evictables_.begin(); it != evictables_.end(); ++it)
+            if (it->second.heapIndex == heapIndex && it->second.priority != MemoryPriority::High)
+                candidates.push_back(it);
+        std::ranges::sort(candidates, {}, [](const auto& it) { return std::pair(it->second.priority, it->second.lastUsedFrame); });
+
+        std::vector<std::function<void()>> callbacks;
+        Heap& heap = heaps_.at(heapIndex);
+        vk::DeviceSize freed = 0;
+        for (const auto& it : candidates)
+        {
+            if (freed >= bytes)
+                break;
+            /* Resources used this frame can't go anywhere yet. */
+            if (it->second.lastUsedFrame == frame_)
+                continue;
+            freed += it->second.size;
+            heap.evictedSinceUpdate += it->second.size;
+            heap.evictions++;
+            callbacks.push_back(std::move(it->second.evict));
+            evictables_.erase(it);
+        }
+        return callbacks;
+    }
+
+    static void runEvictions_(const std::vector<std::function<void()>>& callbacks)
+    {
+        for (const auto& callback : callbacks)
+            callback();
+    }
+
+    void queryBudget_()
+    {
+        if (budgetSupported_)
+        {
+            const auto chain = physicalDevice_.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+            const auto& budget = chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+            for (uint32_t i = 0; i < heaps_.size(); i++)
+            {
+                heaps_[i].budget = std::min(budget.heapBudget.at(i), heaps_[i].size);
+                heaps_[i].reportedUsage = budget.heapUsage.at(i);
+            }
+        }
+        else
+            for (Heap& heap : heaps_)
+                heap.budget = static_cast<vk::DeviceSize>(static_cast<double>(heap.size) * fallbackBudgetFraction_);
+        for (Heap& heap : heaps_)
+        {
+            heap.allocatedSinceUpdate = 0;
+            heap.evictedSinceUpdate = 0;
+        }
+    }
+
+    void release_(const VulkanAllocation& allocation) noexcept
+    {
+        const std::scoped_lock lock(mutex_);
+        Heap& heap = heaps_[allocation.heapIndex_];
+        vk::DeviceSize& tracked = heap.tracked[static_cast<size_t>(allocation.category_)];
+        tracked -= std::min(tracked, allocation.size_);
+    }
+public:
+    VulkanMemoryManager(const vk::raii::PhysicalDevice& physicalDevice, const vk::raii::Device& device, bool budgetSupported) :
+        physicalDevice_(physicalDevice), device_(device), budgetSupported_(budgetSupported),
+        properties_(physicalDevice.getMemoryProperties()),
+        heaps_(properties_.memoryHeapCount)
+    {
+        for (uint32_t i = 0; i < heaps_.size(); i++)
+            heaps_[i].size = properties_.memoryHeaps.at(i).size;
+        queryBudget_();
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanMemoryManager)
+
+    const vk::PhysicalDeviceMemoryProperties& properties() const noexcept { return properties_; }
+    bool budgetSupported() const noexcept { return budgetSupported_; }
+
+    /* Allocates memory of the first type with all required flags. When the type's heap is over budget, registered
+     * resources on it are evicted first. If that isn't enough, low-priority device-local requests are demoted to a
+     * memory type on another heap. allocateFlags is e.g. eDeviceAddress for buffers with eShaderDeviceAddress usage. */
+    VulkanAllocation allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags required,
+                              MemoryCategory category, MemoryPriority priority = MemoryPriority::Normal,
+                              vk::MemoryAllocateFlags allocateFlags = {})
+    {
+        const auto memoryType = findMemoryType_(requirements.memoryTypeBits, required);
+        if (!memoryType)
+            throw FatalError("Failed to find suitable memory type");
+        uint32_t selectedType = *memoryType;
+
+        const auto demote = [&]() -> bool
+        {
+            if (priority != MemoryPriority::Low || !(required & vk::MemoryPropertyFlagBits::eDeviceLocal))
+                return false;
+            uint32_t otherHeaps = 0;
+            for (uint32_t i = 0; i < properties_.memoryTypeCount; i++)
+                if (heapOf_(i) != heapOf_(*memoryType))
+                    otherHeaps |= 1u << i;
+            const auto demotedType = findMemoryType_(requirements.memoryTypeBits & otherHeaps, required & ~vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eDeviceLocal));
+            if (!demotedType || !fits_(heapOf_(*demotedType), requirements.size))
+                return false;
+            selectedType = *demotedType;
+            heaps_[heapOf_(*memoryType)].demotions++;
+            return true;
+        };
+
+        {
+            std::unique_lock lock(mutex_);
+            if (!fits_(heapOf_(selectedType), requirements.size))
+            {
+                const auto evictions = selectEvictions_(heapOf_(selectedType), requirements.size);
+                lock.unlock();
+                runEvictions_(evictions);
+                lock.lock();
+                if (!fits_(heapOf_(selectedType), requirements.size))
+                    demote();
+            }
+        }
+
+        const vk::MemoryAllocateFlagsInfo flagsInfo(allocateFlags);
+        const auto allocateInfo = [&]
+        { return vk::MemoryAllocateInfo(requirements.size, selectedType, allocateFlags ? &flagsInfo : nullptr); };
+        vk::raii::DeviceMemory memory = [&]
+        {
+            try
+            {
+                return device_.allocateMemory(allocateInfo());
+            }
+            catch (const vk::OutOfDeviceMemoryError&)
+            {
+                /* The budget was off; over-committing would page, so demote if allowed rather than fail. */
+                const std::scoped_lock lock(mutex_);
+                if (selectedType != *memoryType || !demote())
+                    throw;
+            }
+            return device_.allocateMemory(allocateInfo());
+        }();
+        metrics::deviceMemoryAllocations.add();
+
+        const std::scoped_lock lock(mutex_);
+        const uint32_t heapIndex = heapOf_(selectedType);
+        Heap& heap = heaps_[heapIndex];
+        heap.tracked[static_cast<size_t>(category)] += requirements.size;
+        heap.allocatedSinceUpdate += requirements.size;
+        return VulkanAllocation(*this, std::move(memory), requirements.size, properties_.memoryTypes.at(selectedType).propertyFlags,
+                                selectedType, heapIndex, category, selectedType != *memoryType);
+    }
+
+    /* Lets the manager call evict to free allocation's memory when its heap runs over budget. */
+    [[nodiscard]] EvictionRegistration registerEvictable(const VulkanAllocation& allocation, MemoryPriority priority, std::function<void()> evict)
+    {
+        const std::scoped_lock lock(mutex_);
+        const uint64_t id = nextEvictableId_++;
+        evictables_.emplace(id, Evictable{ allocation.heapIndex(), allocation.size(), priority, frame_, std::move(evict) });
+        return EvictionRegistration(*this, id);
+    }
+
+    /* Once per frame: refreshes the budget and evicts from heaps above the high-water mark down to the target. */
+    void updateBudget()
+    {
+        std::vector<std::function<void()>> evictions;
+        {
+            const std::scoped_lock lock(mutex_);
+            frame_++;
+            queryBudget_();
+            for (uint32_t i = 0; i < heaps_.size(); i++)
+            {
+                const Heap& heap = heaps_[i];
+                const auto budget = static_cast<double>(heap.budget);
+                const auto usage = static_cast<double>(heap.projectedUsage());
+                if (usage <= budget * highWaterUtilization_)
+                    continue;
+                auto heapEvictions = selectEvictions_(i, static_cast<vk::DeviceSize>(usage - budget * targetUtilization_));
+                std::ranges::move(heapEvictions, std::back_inserter(evictions));
+            }
+        }
+        runEvictions_(evictions);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const VulkanMemoryManager& manager)
+    {
+        constexpr double MiB = 1024.0 * 1024.0;
+        const std::scoped_lock lock(manager.mutex_);
+        os << "Memory (" << (manager.budgetSupported_ ? "VK_EXT_memory_budget" : "estimated budget") << "):";
+        for (uint32_t i = 0; i < manager.heaps_.size(); i++)
+        {
+            const Heap& heap = manager.heaps_[i];
+            os << "\n\theap " << i << ": " << static_cast<double>(heap.projectedUsage()) / MiB << " / "
+               << static_cast<double>(heap.budget) / MiB << " MiB";
+            for (size_t category = 0; category < memoryCategoryCount; category++)
+                if (heap.tracked[category] != 0)
+                    os << ", " << to_string(static_cast<MemoryCategory>(category)) << " " << static_cast<double>(heap.tracked[category]) / MiB << " MiB";
+            if (heap.evictions != 0 || heap.demotions != 0)
+                os << ", " << heap.evictions << " evictions, " << heap.demotions << " demotions";
+        }
+        return os;
+    }
+};
+
+void VulkanAllocation::release_() noexcept
+{
+    if (!manager_)
+        return;
+    memory_.clear();
+    manager_->release_(*this);
+    manager_ = nullptr;
+}
+
+void EvictionRegistration::markUsed() const
+{
+    if (!manager_)
+        return;
+    const std::scoped_lock lock(manager_->mutex_);
+    if (const auto it = manager_->evictables_.find(id_); it != manager_->evictables_.end())
+        it->second.lastUsedFrame = manager_->frame_;
+}
+
+void EvictionRegistration::reset() noexcept
+{
+    if (!manager_)
+        return;
+    const std::scoped_lock lock(manager_->mutex_);
+    manager_->evictables_.erase(id_);
+    manager_ = nullptr;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_deletion.h"
+#include "vk_device.h"
+#include "vk_stream.h"
+#include "vk_vertex.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlet.h"
+#include "render_queue.h"
+
+#include <optional>
+
+template <MeshIndex Index>
+constexpr vk::IndexType vulkanIndexType = std::same_as<Index, uint16_t> ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+
+/* Narrows or widens an index buffer, e.g. to drop to 16-bit indices once deduplication got the vertex count low
+ * enough. */
+template <MeshIndex To, MeshIndex From>
+std::vector<To> convertIndices(gsl::span<const From> indices)
+{
+    std::vector<To> converted(indices.size());
+    std::ranges::transform(indices, converted.begin(), [](From index) { return gsl::narrow<To>(index); });
+    return converted;
+}
+
+/* Device-local vertex and index buffers for one indexed triangle list, optionally with simpler levels of detail that
+ * share its vertices and follow it in the index buffer, and with the meshlets of each level in a storage buffer. With
+ * eShaderDeviceAddress in extraVertexUsage, shaders can also pull the vertices through vertexAddress(). */
+template <VertexType Vertex, MeshIndex Index, vk::BufferUsageFlags extraVertexUsage = {}>
+class VulkanMesh
+{
+    constexpr static vk::BufferUsageFlags vertexUsage_ =
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst | extraVertexUsage;
+    constexpr static vk::BufferUsageFlags indexUsage_ = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    constexpr static vk::BufferUsageFlags meshletUsage_ = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+
+    VulkanBuffer<vertexUsage_, VulkanBufferType::DeviceLocal> vertexBuffer_;
+    VulkanBuffer<indexUsage_, VulkanBufferType::DeviceLocal> indexBuffer_;
+    std::optional<VulkanBuffer<meshletUsage_, VulkanBufferType::DeviceLocal>> meshletBuffer_;
+    std::vector<MeshLod> lods_;
+    std::vector<MeshletRange> lodMeshlets_;
+    uint32_t indexCount_;
+public:
+    /* Uploads through staging buffers which are handed to deletionQueue rather than waited on. Without lods, e.g. from
+     * generateLods(), the whole index buffer is the only level. meshlets, e.g. from buildLodMeshlets(), needs a range for
+     * every level if it has any. */
+    VulkanMesh(const VulkanDevice& device, VulkanStream& stream, const vk::Queue& queue, VulkanDeletionQueue& deletionQueue,
+               const MeshData<Vertex, Index>& mesh, gsl::span<const MeshLod> lods = {}, const MeshletData& meshlets = {}) :
+        vertexBuffer_(device, mesh.vertices.size() * sizeof(Vertex)),
+        indexBuffer_(device, mesh.indices.size() * sizeof(Index)),
+        lods_(lods.begin(), lods.end()),
+        lodMeshlets_(meshlets.lods)
+    {
+        Expects(!mesh.vertices.empty() && !mesh.indices.empty());
+        if (lods_.empty())
+            lods_.push_back({ 0, gsl::narrow<uint32_t>(mesh.indices.size()), 0.0f });
+        Expects(std::ranges::all_of(lods_, [&](const MeshLod& lod) { return size_t{ lod.firstIndex } + lod.indexCount <= mesh.indices.size(); }));
+        indexCount_ = lods_[0].indexCount;
+        Expects(meshlets.meshlets.empty() || lodMeshlets_.size() == lods_.size());
+        lodMeshlets_.resize(lods_.size());
+        using enum vk::BufferUsageFlagBits;
+        VulkanBuffer<eTransferSrc, VulkanBufferType::Staging> vertexStaging(device, vertexBuffer_.size());
+        VulkanBuffer<eTransferSrc, VulkanBufferType::Staging> indexStaging(device, indexBuffer_.size());
+        vertexStaging.copyFrom(gsl::span(mesh.vertices));
+        indexStaging.copyFrom(gsl::span(mesh.indices));
+
+        std::optional<VulkanBuffer<eTransferSrc, VulkanBufferType::Staging>> meshletStaging;
+        if (!meshlets.meshlets.empty())
+        {
+            meshletBuffer_.emplace(device, meshlets.meshlets.size() * sizeof(Meshlet));
+            meshletStaging.emplace(device, meshletBuffer_->size());
+            meshletStaging->copyFrom(gsl::span(meshlets.meshlets));
+        }
+
+        auto recorder = [&](const vk::CommandBuffer& commandBuffer)
+        {
+            recordCopyBuffers(vertexStaging, vertexBuffer_)(commandBuffer);
+            recordCopyBuffers(indexStaging, indexBuffer_)(commandBuffer);
+            if (meshletStaging)
+                recordCopyBuffers(*meshletStaging, *meshletBuffer_)(commandBuffer);
+        };
+        stream.submitWork(queue, recorder);
+        deletionQueue.defer(stream, std::move(vertexStaging));
+        deletionQueue.defer(stream, std::move(indexStaging));
+        if (meshletStaging)
+            deletionQueue.defer(stream, std::move(*meshletStaging));
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanMesh)
+
+    const vk::Buffer& getVertexBuffer() const noexcept { return vertexBuffer_.get(); }
+    const vk::Buffer& getIndexBuffer() const noexcept { return indexBuffer_.get(); }
+    vk::DeviceAddress vertexAddress() const noexcept requires (static_cast<bool>(extraVertexUsage & vk::BufferUsageFlagBits::eShaderDeviceAddress))
+    {
+        return vertexBuffer_.deviceAddress();
+    }
+    /* Of the full-detail level, which is what the record and draw members below draw. */
+    uint32_t indexCount() const noexcept { return indexCount_; }
+    gsl::span<const MeshLod> lods() const noexcept { return lods_; }
+    /* Null without meshlets. */
+    vk::Buffer meshletBuffer() const noexcept { return meshletBuffer_ ? meshletBuffer_->get() : vk::Buffer(); }
+    /* Empty without meshlets. */
+    MeshletRange lodMeshlets(size_t lod) const { return lodMeshlets_.at(lod); }
+
+    void recordBind(const vk::CommandBuffer& commandBuffer) const
+    {
+        commandBuffer.bindVertexBuffers(0, vertexBuffer_.get(), vk::DeviceSize{ 0 });
+        commandBuffer.bindIndexBuffer(indexBuffer_.get(), 0, vulkanIndexType<Index>);
+    }
+    /* Draws with whatever buffers are bound, for drawing the same mesh repeatedly after one recordBind(). */
+    void recordDrawBound(const vk::CommandBuffer& commandBuffer, uint32_t instanceCount = 1) const
+    {
+        commandBuffer.drawIndexed(indexCount_, instanceCount, lods_[0].firstIndex, 0, 0);
+    }
+    void recordDraw(const vk::CommandBuffer& commandBuffer, uint32_t instanceCount = 1) const
+    {
+        recordBind(commandBuffer);
+        recordDrawBound(commandBuffer, instanceCount);
+    }
+
+    /* Draws the mesh through a RenderQueue; pipeline and push constants are up to the caller. Pulled packets leave
+     * the vertex buffer unbound, for pipelines that get vertexAddress() in their push constants. */
+    DrawPacket drawPacket(uint32_t instanceCount = 1, VertexInput vertexInput = VertexInput::Attributes) const
+    {
+        return lodDrawPacket(0, instanceCount, vertexInput);
+    }
+    DrawPacket lodDrawPacket(size_t lod, uint32_t instanceCount = 1, VertexInput vertexInput = VertexInput::Attributes) const
+    {
+        DrawPacket packet;
+        if (vertexInput == VertexInput::Attributes)
+            packet.vertexBuffer = vertexBuffer_.get();
+        packet.indexBuffer = indexBuffer_.get();
+        packet.indexType = vulkanIndexType<Index>;
+        packet.firstIndex = lods_.at(lod).firstIndex;
+        packet.indexCount = lods_.at(lod).indexCount;
+        packet.instanceCount = instanceCount;
+        return packet;
+    }
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_deletion.h"
+#include "vk_descriptor.h"
+#include "vk_device.h"
+#include "vk_image.h"
+#include "vk_readback.h"
+#include "vk_shader.h"
+#include "vk_stream.h"
+#include "vk_vertex.h"
+#include "render_queue.h"
+
+#include <optional>
+#include <ostream>
+
+/* First depth format that can be both rendered to and sampled, in order of precision. */
+inline vk::Format selectDepthFormat(const VulkanDevice& device)
+{
+    using enum vk::FormatFeatureFlagBits;
+    constexpr vk::FormatFeatureFlags required = eDepthStencilAttachment | eSampledImage;
+    for (const vk::Format format : { vk::Format::eD32Sfloat, vk::Format::eX8D24UnormPack32, vk::Format::eD16Unorm })
+        if ((device.physicalDevice.getFormatProperties(format).optimalTilingFeatures & required) == required)
+            return format;
+    throw FatalError("No depth format can be sampled; occlusion culling needs to read depth back");
+}
+
+struct OcclusionStats
+{
+    uint64_t tested = 0;
+    uint64_t visible = 0;
+
+    friend std::ostream& operator<<(std::ostream& os, const OcclusionStats& stats)
+    {
+        os << stats.visible << " of " << stats.tested << " tested objects visible";
+        if (stats.tested != 0)
+            os << " (" << 100.0 * static_cast<double>(stats.visible) / static_cast<double>(stats.tested) << "%)";
+        return os;
+    }
+};
+
+/* GPU occlusion culling of instanced draws against a hierarchical depth (Hi-Z) pyramid. Owns the depth attachment
+ * the frame renders into. At the start of the next frame, a compute pass reduces that depth into a pyramid of
+ * farthest depths, and a second one tests every candidate instance's bounding sphere against it, compacting the
+ * survivors into a device-local instance buffer and counting them in an indirect draw. Occluded instances therefore
+ * never reach the vertex stage.
+ *
+ * Per frame: beginFrame(), addDraw() for every instanced draw, recordCull() before the render pass, which has to use
+ * depthView() as its depth attachment and leave it in ShaderReadOnlyOptimal, then endFrame(). The test uses the
+ * previous frame's depth and view-projection, so something that only just came out from behind an occluder appears
+ * a frame late. The first frame isn't occlusion culled at all. */
+class VulkanOcclusionCuller
+{
+    using DepthImage = VulkanImage<vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled>;
+    using HiZImage = VulkanImage<vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled>;
+    using VisibleBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+                                       VulkanBufferType::DeviceLocal>;
+    using IndirectBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                                        vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+                                        VulkanBufferType::DeviceLocal>;
+
+    /* The cull shader reads instances as 17 words with the transform first. */
+    static_assert(sizeof(InstanceData) == 17 * sizeof(uint32_t) && offsetof(InstanceData, transform) == 0);
+
+    struct HiZPushConstants
+    {
+        glm::ivec2 sourceSize;
+        glm::ivec2 destinationSize;
+    };
+    struct CullPushConstants
+    {
+        glm::mat4 viewProjection;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint32_t drawIndex;
+        float boundingRadius;
+        uint32_t occlusionEnabled;
+    };
+
+    struct Draw
+    {
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        float boundingRadius;
+    };
+
+    constexpr static uint32_t hizGroupSize_ = 8;
+    constexpr static uint32_t cullGroupSize_ = 64;
+    /* vkCmdUpdateBuffer's limit on the indirect commands reset per frame. */
+    constexpr static size_t maxDraws_ = 65536 / sizeof(vk::DrawIndexedIndirectCommand);
+    /* Stats come from reading back the indirect commands of every so many frames, one readback at a time. */
+    constexpr static uint64_t statsInterval_ = 30;
+
+    const VulkanDevice& device_;
+    DepthImage depth_;
+    HiZImage hiz_;
+    std::vector<vk::raii::ImageView> hizMipViews_;
+    vk::raii::Sampler sampler_;
+    vk::raii::DescriptorSetLayout hizSetLayout_;
+    /* The cull set changes with the candidate buffer every frame. */
+    VulkanPushDescriptors cullDescriptors_;
+    vk::raii::PipelineLayout hizPipelineLayout_;
+    vk::raii::PipelineLayout cullPipelineLayout_;
+    vk::raii::Pipeline hizPipeline_;
+    vk::raii::Pipeline cullPipeline_;
+    /* One static set per pyramid level. */
+    vk::raii::DescriptorPool hizDescriptorPool_;
+    std::vector<vk::DescriptorSet> hizSets_;
+
+    std::optional<VisibleBuffer> visible_;
+    std::optional<IndirectBuffer> indirect_;
+    size_t instanceCapacity_ = 0;
+    size_t drawCapacity_ = 0;
+    vk::Buffer candidates_;
+    std::vector<Draw> draws_;
+    std::vector<vk::DrawIndexedIndirectCommand> commands_;
+    /* Set once a frame has rendered into the depth attachment. */
+    std::optional<glm::mat4> depthViewProjection_;
+
+    VulkanReadbackRing readback_;
+    std::optional<std::pair<ReadbackHandle, uint64_t>> pendingStats_;
+    OcclusionStats stats_;
+    uint64_t frameNumber_ = 0;
+
+    static vk::raii::DescriptorSetLayout createSetLayout_(const VulkanDevice& device, std::string_view shader)
+    {
+        const auto bindings = descriptorSetLayoutBindings({ shader });
+        return device.device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo({}, bindings));
+    }
+
+    static vk::raii::DescriptorPool createHiZDescriptorPool_(const VulkanDevice& device, uint32_t mipLevels)
+    {
+        const std::array poolSizes = { vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, mipLevels),
+                                       vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, mipLevels) };
+        return device.device.createDescriptorPool(vk::DescriptorPoolCreateInfo({}, mipLevels, poolSizes));
+    }
+
+    template <typename PushConstants>
+    static vk::raii::PipelineLayout createPipelineLayout_(const VulkanDevice& device, const vk::DescriptorSetLayout& setLayout,
+                                                          std::string_view shader)
+    {
+        const vk::PushConstantRange pushConstants = pushConstantRange<PushConstants>({ shader });
+        return device.device.createPipelineLayout(vk::PipelineLayoutCreateInfo({}, setLayout, pushConstants));
+    }
+
+    void writeHiZSets_()
+    {
+        const std::vector<vk::DescriptorSetLayout> setLayouts(hiz_.mipLevels(), *hizSetLayout_);
+        /* Freed along with the pool. */
+        hizSets_ = (*device_.device).allocateDescriptorSets(vk::DescriptorSetAllocateInfo(*hizDescriptorPool_, setLayouts));
+        for (uint32_t mip = 0; mip < hiz_.mipLevels(); mip++)
+        {
+            /* Level 0 reduces the depth attachment, every other level the one before it. */
+            const vk::DescriptorImageInfo source = mip == 0
+                ? vk::DescriptorImageInfo(*sampler_, depth_.view(), vk::ImageLayout::eShaderReadOnlyOptimal)
+                : vk::DescriptorImageInfo(*sampler_, *hizMipViews_[mip - 1], vk::ImageLayout::eGeneral);
+            const vk::DescriptorImageInfo destination({}, *hizMipViews_[mip], vk::ImageLayout::eGeneral);
+            const std::array writes = {
+                vk::WriteDescriptorSet(hizSets_[mip], 0, 0, vk::DescriptorType::eCombinedImageSampler, source),
+                vk::WriteDescriptorSet(hizSets_[mip], 1, 0, vk::DescriptorType::eStorageImage, destination),
+            };
+            device_.device.updateDescriptorSets(writes, {});
+        }
+    }
+
+    void recordHiZ_(const vk::CommandBuffer& commandBuffer) const
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *hizPipeline_);
+        for (uint32_t mip = 0; mip < hiz_.mipLevels(); mip++)
+        {
+            const vk::Extent2D source = mip == 0 ? depth_.extent() : getMipExtent(hiz_.extent(), mip - 1);
+            const vk::Extent2D destination = getMipExtent(hiz_.extent(), mip);
+            const HiZPushConstants constants{ glm::ivec2(source.width, source.height), glm::ivec2(destination.width, destination.height) };
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *hizPipelineLayout_, 0, hizSets_[mip], {});
+            commandBuffer.pushConstants<HiZPushConstants>(*hizPipelineLayout_, vk::ShaderStageFlagBits::eCompute, 0, constants);
+            commandBuffer.dispatch((destination.width + hizGroupSize_ - 1) / hizGroupSize_, (destination.height + hizGroupSize_ - 1) / hizGroupSize_, 1);
+            /* Each level is read by the next one, and all of them by the cull pass. */
+            const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+        }
+    }
+
+    void pollStats_()
+    {
+        if (!pendingStats_ || !pendingStats_->first.ready())
+            return;
+        for (const vk::DrawIndexedIndirectCommand& command : pendingStats_->first.getAs<vk::DrawIndexedIndirectCommand>())
+            stats_.visible += command.instanceCount;
+        stats_.tested += pendingStats_->second;
+        pendingStats_.reset();
+    }
+public:
+    VulkanOcclusionCuller(const VulkanDevice& device, vk::Format depthFormat, vk::Extent2D extent) :
+        device_(device),
+        depth_(device, depthFormat, extent),
+        hiz_(device, vk::Format::eR32Sfloat, getMipExtent(extent, 1), getMipLevelCount(getMipExtent(extent, 1))),
+        sampler_(device.device.createSampler(vk::SamplerCreateInfo({}, vk::Filter::eNearest, vk::Filter::eNearest, vk::SamplerMipmapMode::eNearest,
+                                                                   vk::SamplerAddressMode::eClampToEdge, vk::SamplerAddressMode::eClampToEdge,
+                                                                   vk::SamplerAddressMode::eClampToEdge, 0.0f, false, 1.0f, false,
+                                                                   vk::CompareOp::eNever, 0.0f, VK_LOD_CLAMP_NONE))),
+        hizSetLayout_(createSetLayout_(device, "hiz_downsample")),
+        cullDescriptors_(device, { "occlusion_cull" }, 0, 4),
+        hizPipelineLayout_(createPipelineLayout_<HiZPushConstants>(device, *hizSetLayout_, "hiz_downsample")),
+        cullPipelineLayout_(createPipelineLayout_<CullPushConstants>(device, *cullDescriptors_.setLayout(), "occlusion_cull")),
+        hizPipeline_(createComputePipeline("hiz_downsample", *hizPipelineLayout_, device)),
+        cullPipeline_(createComputePipeline("occlusion_cull", *cullPipelineLayout_, device)),
+        hizDescriptorPool_(createHiZDescriptorPool_(device, hiz_.mipLevels())),
+        readback_(device, maxDraws_ * sizeof(vk::DrawIndexedIndirectCommand))
+    {
+        hizMipViews_.reserve(hiz_.mipLevels());
+        for (uint32_t mip = 0; mip < hiz_.mipLevels(); mip++)
+            hizMipViews_.push_back(hiz_.createView(device, mip, 1));
+        writeHiZSets_();
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanOcclusionCuller)
+
+    vk::ImageView depthView() const noexcept { return depth_.view(); }
+
+    /* For other cull passes recorded after recordCull(): the pyramid, in General layout, and the view-projection it was
+     * rendered with, if there is one yet. */
+    vk::DescriptorImageInfo hizDescriptor() const { return { *sampler_, hiz_.view(), vk::ImageLayout::eGeneral }; }
+    const std::optional<glm::mat4>& hizViewProjection() const noexcept { return depthViewProjection_; }
+
+    /* Makes room for instanceCapacity instances in drawCapacity draws. Outgrown buffers are handed to deletionQueue,
+     * as the previous frame may still be drawing from them. */
+    void beginFrame(size_t instanceCapacity, size_t drawCapacity, const VulkanStream& stream, VulkanDeletionQueue& deletionQueue)
+    {
+        Expects(drawCapacity <= maxDraws_);
+        if (instanceCapacity > instanceCapacity_ || !visible_)
+        {
+            if (visible_)
+                deletionQueue.defer(stream, std::move(*visible_));
+            instanceCapacity_ = std::max<size_t>(instanceCapacity, 1);
+            visible_.emplace(device_, instanceCapacity_ * sizeof(InstanceData));
+        }
+        if (drawCapacity > drawCapacity_ || !indirect_)
+        {
+            if (indirect_)
+                deletionQueue.defer(stream, std::move(*indirect_));
+            drawCapacity_ = std::max<size_t>(drawCapacity, 1);
+            indirect_.emplace(device_, drawCapacity_ * sizeof(vk::DrawIndexedIndirectCommand));
+        }
+        cullDescriptors_.beginFrame();
+        draws_.clear();
+        commands_.clear();
+        candidates_ = nullptr;
+    }
+
+    /* Returns the draw that renders only the visible instances of packet, which must be an instanced draw. All of a
+     * frame's draws have to take their instances from the same buffer. */
+    DrawPacket addDraw(const DrawPacket& packet, float boundingRadius)
+    {
+        Expects(draws_.size() < drawCapacity_);
+        Expects(packet.instanceBuffer && packet.instanceOffset == 0 && !packet.indirectBuffer);
+        Expects(size_t{ packet.firstInstance } + packet.instanceCount <= instanceCapacity_);
+        Expects(!candidates_ || candidates_ == packet.instanceBuffer);
+        candidates_ = packet.instanceBuffer;
+        const auto drawIndex = gsl::narrow_cast<uint32_t>(draws_.size());
+        draws_.push_back({ packet.firstInstance, packet.instanceCount, boundingRadius });
+        commands_.emplace_back(packet.indexCount, 0, packet.firstIndex, packet.vertexOffset, 0);
+
+        /* The cull pass compacts each draw's survivors into the same range they came from, so the range's offset
+         * stands in for firstInstance, which indirect draws may only use with the drawIndirectFirstInstance feature. */
+        DrawPacket culled = packet;
+        culled.instanceBuffer = visible_->get();
+        culled.instanceOffset = vk::DeviceSize{ packet.firstInstance } * sizeof(InstanceData);
+        culled.firstInstance = 0;
+        culled.indirectBuffer = indirect_->get();
+        culled.indirectOffset = vk::DeviceSize{ drawIndex } * sizeof(vk::DrawIndexedIndirectCommand);
+        return culled;
+    }
+
+    /* Records the Hi-Z build and the cull pass, outside of the render pass. */
+    void recordCull(const vk::CommandBuffer& commandBuffer)
+    {
+        hiz_.recordTransition(commandBuffer, vk::ImageLayout::eGeneral);
+        const bool occlusionEnabled = depthViewProjection_.has_value();
+        /* Built even without draws of its own, for other passes that test against it. */
+        if (occlusionEnabled)
+            recordHiZ_(commandBuffer);
+        if (draws_.empty())
+            return;
+
+        commandBuffer.updateBuffer<vk::DrawIndexedIndirectCommand>(indirect_->get(), 0, commands_);
+        const vk::MemoryBarrier resetBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, resetBarrier, {}, {});
+
+        const vk::DescriptorBufferInfo candidates(candidates_, 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo visible(visible_->get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo indirect(indirect_->get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorImageInfo hiz(*sampler_, hiz_.view(), vk::ImageLayout::eGeneral);
+        std::array writes = {
+            vk::WriteDescriptorSet({}, 0, 0, vk::DescriptorType::eStorageBuffer, {}, candidates),
+            vk::WriteDescriptorSet({}, 1, 0, vk::DescriptorType::eStorageBuffer, {}, visible),
+            vk::WriteDescriptorSet({}, 2, 0, vk::DescriptorType::eStorageBuffer, {}, indirect),
+            vk::WriteDescriptorSet({}, 3, 0, vk::DescriptorType::eCombinedImageSampler, hiz),
+        };
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *cullPipeline_);
+        cullDescriptors_.bind(commandBuffer, vk::PipelineBindPoint::eCompute, *cullPipelineLayout_, writes);
+        for (uint32_t drawIndex = 0; drawIndex < draws_.size(); drawIndex++)
+        {
+            const Draw& draw = draws_[drawIndex];
+            if (draw.instanceCount == 0)
+                continue;
+            const CullPushConstants constants{ depthViewProjection_.value_or(glm::mat4(1.0f)), draw.firstInstance, draw.instanceCount,
+                                               drawIndex, draw.boundingRadius, occlusionEnabled ? 1u : 0u };
+            commandBuffer.pushConstants<CullPushConstants>(*cullPipelineLayout_, vk::ShaderStageFlagBits::eCompute, 0, constants);
+            commandBuffer.dispatch((draw.instanceCount + cullGroupSize_ - 1) / cullGroupSize_, 1, 1);
+        }
+        const vk::MemoryBarrier cullBarrier(vk::AccessFlagBits::eShaderWrite,
+                                            vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eVertexAttributeRead);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                      vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput, {}, cullBarrier, {}, {});
+    }
+
+    /* Ends a frame whose depth was rendered with viewProjection, which the next frame is culled against. */
+    void endFrame(VulkanStream& stream, const vk::Queue& queue, const glm::mat4& viewProjection)
+    {
+        depth_.assumeLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+        depthViewProjection_ = viewProjection;
+        cullDescriptors_.endFrame(stream);
+
+        pollStats_();
+        if (!pendingStats_ && !draws_.empty() && frameNumber_ % statsInterval_ == 0)
+        {
+            uint64_t tested = 0;
+            for (const Draw& draw : draws_)
+                tested += draw.instanceCount;
+            const vk::DeviceSize size = draws_.size() * sizeof(vk::DrawIndexedIndirectCommand);
+            pendingStats_.emplace(readback_.readback(stream, queue, *indirect_, 0, size), tested);
+        }
+        frameNumber_++;
+    }
+
+    /* Totals over the sampled frames since the last call. */
+    OcclusionStats takeStats()
+    {
+        pollStats_();
+        return std::exchange(stats_, {});
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_device.h"
+#include "vk_shader.h"
+#include "metrics.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+/* What a VulkanParticleSystem step simulates. World units are arbitrary; times are in seconds. */
+struct ParticleSettings
+{
+    glm::vec3 emitterPosition{ 0.0f };
+    /* Particles spawn anywhere within this distance of emitterPosition... */
+    float emitterRadius = 0.1f;
+    glm::vec3 emitterVelocity{ 0.0f, 5.0f, 0.0f };
+    /* ...with emitterVelocity plus a random velocity up to this fast. */
+    float velocitySpread = 1.5f;
+    glm::vec3 gravity{ 0.0f, -9.81f, 0.0f };
+    /* Colliders: a sphere as center and radius, and the ground as the plane (normal, distance) with its normal pointing
+     * up, which particles never fall through. */
+    glm::vec4 sphere{ 0.0f, 1.0f, 0.0f, 0.5f };
+    glm::vec4 ground{ 0.0f, 1.0f, 0.0f, 0.0f };
+    /* Of the speed along the normal, kept by a bounce. */
+    float restitution = 0.5f;
+    /* Particles live between half of this and all of it. */
+    float lifetime = 4.0f;
+    /* Particles emitted per second, as far as there are dead ones to revive. */
+    float emitRate = 100000.0f;
+};
+
+/* A particle system simulated and drawn entirely on the GPU, as a heavy compute plus draw workload. The particles'
+ * positions and velocities are device-local arrays of their own, and every particle is on either the dead list or one
+ * of two alive lists. A step sizes itself in a single-thread dispatch, which revives as many dead particles as it
+ * emits and writes the indirect dispatches of the emit and simulate passes. The simulate pass integrates and collides
+ * the current list, returning the particles that died to the dead list and compacting the survivors into the other
+ * list, whose count is the vertex count of the indirect draw that renders it. Nothing is read back.
+ *
+ * Per frame: recordStep() outside of a render pass, then recordDraw() inside one compatible with the render pass the
+ * system was created with. */
+class VulkanParticleSystem
+{
+    using ParticleBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer, VulkanBufferType::DeviceLocal>;
+    using CounterBuffer = VulkanBuffer<vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+                                       VulkanBufferType::DeviceLocal>;
+
+    /* The Counters block the particle shaders share. */
+    struct Counters
+    {
+        std::array<vk::DrawIndirectCommand, 2> draws;
+        vk::DispatchIndirectCommand emitDispatch;
+        vk::DispatchIndirectCommand simulateDispatch;
+        uint32_t deadCount;
+        uint32_t emitCount;
+        uint32_t emitDead;
+        uint32_t emitAlive;
+    };
+    static_assert(sizeof(Counters) == 18 * sizeof(uint32_t) && offsetof(Counters, emitDispatch) == 32 && offsetof(Counters, simulateDispatch) == 44);
+
+    struct StepPushConstants
+    {
+        glm::vec4 emitterPosition;
+        glm::vec4 emitterVelocity;
+        glm::vec4 gravity;
+        glm::vec4 sphere;
+        glm::vec4 ground;
+        float restitution;
+        float lifetime;
+        uint32_t emitRequest;
+        uint32_t current;
+        uint32_t capacity;
+        uint32_t seed;
+        uint32_t maxGroupCount;
+    };
+    struct DrawPushConstants
+    {
+        glm::mat4 viewProjection;
+        uint32_t list;
+        uint32_t capacity;
+    };
+
+    /* The local size of the particle shaders. */
+    constexpr static uint32_t groupSize_ = 256;
+
+    const VulkanDevice& device_;
+    uint32_t capacity_;
+    uint32_t maxGroupCount_;
+    ParticleBuffer positions_;
+    ParticleBuffer velocities_;
+    ParticleBuffer alive_;
+    ParticleBuffer dead_;
+    CounterBuffer counters_;
+    /* The buffers never change, so both layouts share one static set. */
+    vk::raii::DescriptorSetLayout setLayout_;
+    vk::raii::DescriptorPool descriptorPool_;
+    vk::DescriptorSet set_;
+    vk::raii::PipelineLayout stepLayout_;
+    vk::raii::PipelineLayout drawLayout_;
+    vk::raii::Pipeline initPipeline_;
+    vk::raii::Pipeline dispatchPipeline_;
+    vk::raii::Pipeline emitPipeline_;
+    vk::raii::Pipeline simulatePipeline_;
+    vk::raii::Pipeline drawPipeline_;
+
+    bool initialized_ = false;
+    /* The alive list the next step starts from, which the last one compacted into. */
+    uint32_t current_ = 0;
+    uint32_t stepNumber_ = 0;
+    double emitCarry_ = 0.0;
+
+    static vk::raii::DescriptorSetLayout createSetLayout_(const VulkanDevice& device)
+    {
+        const auto bindings = descriptorSetLayoutBindings({ "particle_init", "particle_dispatch", "particle_emit", "particle_simulate",
+                                                            "particle_vertex_shader" });
+        return device.device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo({}, bindings));
+    }
+
+    static vk::raii::DescriptorPool createDescriptorPool_(const VulkanDevice& device)
+    {
+        const vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, 5);
+        return device.device.createDescriptorPool(vk::DescriptorPoolCreateInfo({}, 1, poolSize));
+    }
+
+    template <typename PushConstants>
+    static vk::raii::PipelineLayout createPipelineLayout_(const VulkanDevice& device, const vk::DescriptorSetLayout& setLayout,
+                                                          std::initializer_list<std::string_view> shaders)
+    {
+        const vk::PushConstantRange pushConstants = pushConstantRange<PushConstants>(shaders);
+        return device.device.createPipelineLayout(vk::PipelineLayoutCreateInfo({}, setLayout, pushConstants));
+    }
+
+    /* Points, depth tested against the scene but not written, so that they neither hide each other nor end up in the
+     * next frame's occlusion culling. */
+    static vk::raii::Pipeline createDrawPipeline_(const VulkanDevice& device, const vk::RenderPass& renderPass, const vk::PipelineLayout& pipelineLayout)
+    {
+        const auto vertexShaderModule = createShader("particle_vertex_shader", device);
+        const auto fragmentShaderModule = createShader("fragment_shader", device);
+        using enum vk::DynamicState;
+        const std::array dynamicStates = { eViewport, eScissor };
+        using enum vk::ColorComponentFlagBits;
+        std::array colorBlendAttachments = { vk::PipelineColorBlendAttachmentState(false).setColorWriteMask(eR | eG | eB | eA) };
+
+        const std::array shaderStages   = { vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *vertexShaderModule, "main"),
+                                            vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *fragmentShaderModule, "main") };
+        const auto vertexInputInfo      = vk::PipelineVertexInputStateCreateInfo();
+        const auto dynamicStateInfo     = vk::PipelineDynamicStateCreateInfo({}, dynamicStates);
+        const auto inputAssemblyInfo    = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::ePointList);
+        const auto viewportInfo         = vk::PipelineViewportStateCreateInfo({}, 1, nullptr, 1, nullptr);
+        const auto rasterizationInfo    = vk::PipelineRasterizationStateCreateInfo({}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone,
+                                                                                   vk::FrontFace::eClockwise, false, {}, {}, {}, 1.0f);
+        const auto multisampleInfo      = vk::PipelineMultisampleStateCreateInfo({}, vk::SampleCountFlagBits::e1, false, 1.0f, nullptr, false, false);
+        const auto colorBlendInfo       = vk::PipelineColorBlendStateCreateInfo({}, false, {}, colorBlendAttachments);
+        const auto depthStencilInfo     = vk::PipelineDepthStencilStateCreateInfo({}, true, false, vk::CompareOp::eLess);
+
+        const auto graphicsPipelineInfo = vk::GraphicsPipelineCreateInfo({}, shaderStages, &vertexInputInfo, &inputAssemblyInfo, nullptr, &viewportInfo,
+                                                                         &rasterizationInfo, &multisampleInfo, &depthStencilInfo, &colorBlendInfo,
+                                                                         &dynamicStateInfo, pipelineLayout, renderPass, 0);
+        auto pipeline = device.device.createGraphicsPipeline(nullptr, graphicsPipelineInfo);
+        metrics::pipelinesCreated.add();
+        return pipeline;
+    }
+
+    static uint32_t checkCapacity_(const VulkanDevice& device, uint32_t capacity)
+    {
+        Expects(capacity > 0);
+        if (!fits(device, capacity))
+            throw FatalError(std::to_string(capacity) + " particles exceed the device's storage buffer range");
+        return capacity;
+    }
+
+    void writeSet_()
+    {
+        const vk::DescriptorSetLayout setLayout = *setLayout_;
+        /* Freed along with the pool. */
+        set_ = (*device_.device).allocateDescriptorSets(vk::DescriptorSetAllocateInfo(*descriptorPool_, setLayout)).front();
+        const vk::DescriptorBufferInfo positions(positions_.get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo velocities(velocities_.get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo alive(alive_.get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo dead(dead_.get(), 0, VK_WHOLE_SIZE);
+        const vk::DescriptorBufferInfo counters(counters_.get(), 0, VK_WHOLE_SIZE);
+        /* One write per binding, as the vertex shader only sees some of them. */
+        const std::array writes = {
+            vk::WriteDescriptorSet(set_, 0, 0, vk::DescriptorType::eStorageBuffer, {}, positions),
+            vk::WriteDescriptorSet(set_, 1, 0, vk::DescriptorType::eStorageBuffer, {}, velocities),
+            vk::WriteDescriptorSet(set_, 2, 0, vk::DescriptorType::eStorageBuffer, {}, alive),
+            vk::WriteDescriptorSet(set_, 3, 0, vk::DescriptorType::eStorageBuffer, {}, dead),
+            vk::WriteDescriptorSet(set_, 4, 0, vk::DescriptorType::eStorageBuffer, {}, counters),
+        };
+        device_.device.updateDescriptorSets(writes, {});
+    }
+
+    uint32_t groupCount_(uint32_t count) const noexcept
+    {
+        return std::min((count + groupSize_ - 1) / groupSize_, maxGroupCount_);
+    }
+
+    /* Makes the compute writes so far visible to the rest of the step and to the draw. */
+    static void recordComputeBarrier_(const vk::CommandBuffer& commandBuffer, vk::PipelineStageFlags destinationStages, vk::AccessFlags destinationAccess)
+    {
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, destinationAccess);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, destinationStages, {}, barrier, {}, {});
+    }
+public:
+    /* Whether the device can bind the buffers of capacity particles, the largest being the positions and velocities. */
+    static bool fits(const VulkanDevice& device, uint32_t capacity)
+    {
+        return uint64_t{ capacity } * sizeof(glm::vec4) <= device.physicalDevice.getProperties().limits.maxStorageBufferRange;
+    }
+
+    /* renderPass is only used to create the draw pipeline. */
+    VulkanParticleSystem(const VulkanDevice& device, uint32_t capacity, const vk::RenderPass& renderPass) :
+        device_(device),
+        capacity_(checkCapacity_(device, capacity)),
+        maxGroupCount_(device.physicalDevice.getProperties().limits.maxComputeWorkGroupCount[0]),
+        positions_(device, vk::DeviceSize{ capacity } * sizeof(glm::vec4)),
+        velocities_(device, vk::DeviceSize{ capacity } * sizeof(glm::vec4)),
+        alive_(device, vk::DeviceSize{ capacity } * 2 * sizeof(uint32_t)),
+        dead_(device, vk::DeviceSize{ capacity } * sizeof(uint32_t)),
+        counters_(device, sizeof(Counters)),
+        setLayout_(createSetLayout_(device)),
+        descriptorPool_(createDescriptorPool_(device)),
+        stepLayout_(createPipelineLayout_<StepPushConstants>(device, *setLayout_, { "particle_init", "particle_dispatch", "particle_emit",
+                                                                                             "particle_simulate" })),
+        drawLayout_(createPipelineLayout_<DrawPushConstants>(device, *setLayout_, { "particle_vertex_shader", "fragment_shader" })),
+        initPipeline_(createComputePipeline("particle_init", *stepLayout_, device)),
+        dispatchPipeline_(createComputePipeline("particle_dispatch", *stepLayout_, device)),
+        emitPipeline_(createComputePipeline("particle_emit", *stepLayout_, device)),
+        simulatePipeline_(createComputePipeline("particle_simulate", *stepLayout_, device)),
+        drawPipeline_(createDrawPipeline_(device, renderPass, *drawLayout_))
+    {
+        writeSet_();
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanParticleSystem)
+
+    uint32_t capacity() const noexcept { return capacity_; }
+
+    /* Records a step of timeStep seconds, outside of a render pass. The first one also puts every particle on the dead
+     * list. */
+    void recordStep(const vk::CommandBuffer& commandBuffer, const ParticleSettings& settings, float timeStep)
+    {
+        const double wanted = emitCarry_ + static_cast<double>(settings.emitRate) * timeStep;
+        const double emitted = std::min(std::floor(wanted), static_cast<double>(capacity_));
+        emitCarry_ = wanted - std::floor(wanted);
+        const StepPushConstants constants{
+            glm::vec4(settings.emitterPosition, settings.emitterRadius), glm::vec4(settings.emitterVelocity, settings.velocitySpread),
+            glm::vec4(settings.gravity, timeStep), settings.sphere, settings.ground, settings.restitution, settings.lifetime,
+            static_cast<uint32_t>(emitted), current_, capacity_, stepNumber_, maxGroupCount_ };
+
+        /* The previous frame's draw reads what this step overwrites. */
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader,
+                                      vk::PipelineStageFlagBits::eComputeShader, {}, {}, {}, {});
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *stepLayout_, 0, set_, {});
+        commandBuffer.pushConstants<StepPushConstants>(*stepLayout_, vk::ShaderStageFlagBits::eCompute, 0, constants);
+        using enum vk::AccessFlagBits;
+        const vk::AccessFlags computeAccess = eShaderRead | eShaderWrite;
+        if (!initialized_)
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *initPipeline_);
+            commandBuffer.dispatch(groupCount_(capacity_), 1, 1);
+            recordComputeBarrier_(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, computeAccess);
+            initialized_ = true;
+        }
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *dispatchPipeline_);
+        commandBuffer.dispatch(1, 1, 1);
+        recordComputeBarrier_(commandBuffer, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader,
+                              eIndirectCommandRead | computeAccess);
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *emitPipeline_);
+        commandBuffer.dispatchIndirect(counters_.get(), offsetof(Counters, emitDispatch));
+        recordComputeBarrier_(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, computeAccess);
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *simulatePipeline_);
+        commandBuffer.dispatchIndirect(counters_.get(), offsetof(Counters, simulateDispatch));
+        /* For the draw, and for the next step. */
+        recordComputeBarrier_(commandBuffer,
+                              vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eComputeShader,
+                              eIndirectCommandRead | computeAccess);
+        current_ = 1 - current_;
+        stepNumber_++;
+    }
+
+    /* Records the draw of every particle alive after the last step, inside a render pass. */
+    void recordDraw(const vk::CommandBuffer& commandBuffer, const glm::mat4& viewProjection, const vk::Rect2D& renderArea) const
+    {
+        Expects(initialized_);
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *drawPipeline_);
+        commandBuffer.setViewport(0, vk::Viewport(static_cast<float>(renderArea.offset.x), static_cast<float>(renderArea.offset.y),
+                                                  static_cast<float>(renderArea.extent.width), static_cast<float>(renderArea.extent.height), 0.0f, 1.0f));
+        commandBuffer.setScissor(0, renderArea);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *drawLayout_, 0, set_, {});
+        commandBuffer.pushConstants<DrawPushConstants>(*drawLayout_, vk::ShaderStageFlagBits::eVertex, 0, DrawPushConstants{ viewProjection, current_, capacity_ });
+        commandBuffer.drawIndirect(counters_.get(), offsetof(Counters, draws) + current_ * sizeof(vk::DrawIndirectCommand), 1, sizeof(vk::DrawIndirectCommand));
+        metrics::draws.add();
+    }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_device.h"
+#include "vk_shader.h"
+#include "vk_vertex.h"
+#include "metrics.h"
+#include "render_queue.h"
+
+#include <glm/glm.hpp>
+
+#include <map>
+
+/* The scene's render pass and graphics pipelines, shared by the engine and vulkan-replay so that a replayed capture
+ * draws with exactly the pipelines it was captured with. */
+
+struct VertexPushConstants
+{
+    glm::mat4 viewProjection;
+};
+
+/* Of pipelines with VertexInput::Pulled, which read the mesh's PackedVertex array at vertices. */
+struct PulledVertexPushConstants
+{
+    glm::mat4 viewProjection;
+    vk::DeviceAddress vertices;
+};
+
+using SceneVertexLayout = VertexLayout<PackedVertex, InstanceData>;
+
+/* SceneVertexLayout without the per-vertex binding; the instance binding and locations stay where they were. */
+inline const vk::PipelineVertexInputStateCreateInfo pulledVertexInputInfo = []
+{
+    constexpr uint32_t firstInstanceLocation = VertexLayout<PackedVertex>::locationCount;
+    return vk::PipelineVertexInputStateCreateInfo({}, 1, &SceneVertexLayout::bindings[1],
+                                                  static_cast<uint32_t>(SceneVertexLayout::attributes.size() - firstInstanceLocation),
+                                                  &SceneVertexLayout::attributes[firstInstanceLocation]);
+}();
+
+/* The depth attachment is stored and left readable, as the next frame's occlusion culling builds its Hi-Z pyramid
+ * from it. The color attachment ends up in finalColorLayout, ready to present by default. */
+inline vk::raii::RenderPass createRenderPass(vk::Format colorFormat, vk::Format depthFormat, const VulkanDevice& device,
+                                             vk::ImageLayout finalColorLayout = vk::ImageLayout::ePresentSrcKHR)
+{
+    auto colorAttachment = vk::AttachmentDescription({}, colorFormat, vk::SampleCountFlagBits::e1,
+                                                     vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+                                                     vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                                                     vk::ImageLayout::eUndefined, finalColorLayout);
+    auto depthAttachment = vk::AttachmentDescription({}, depthFormat, vk::SampleCountFlagBits::e1,
+                                                     vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+                                                     vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+                                                     vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
+    std::array attachments = { colorAttachment, depthAttachment };
+    std::array colorAttachmentRefs = { vk::AttachmentReference(0u, vk::ImageLayout::eColorAttachmentOptimal) };
+    const auto depthAttachmentRef = vk::AttachmentReference(1u, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    std::array subpasses = { vk::SubpassDescription({}, vk::PipelineBindPoint::eGraphics, {}, colorAttachmentRefs, {}, &depthAttachmentRef) };
+    using enum vk::PipelineStageFlagBits;
+    std::array subpassDependencies = {
+        vk::SubpassDependency(VK_SUBPASS_EXTERNAL, 0u, eColorAttachmentOutput, eColorAttachmentOutput, {}, vk::AccessFlagBits::eColorAttachmentWrite),
+        /* The Hi-Z build reads the previous frame's depth before it is cleared... */
+        vk::SubpassDependency(VK_SUBPASS_EXTERNAL, 0u, eComputeShader, eEarlyFragmentTests | eLateFragmentTests, {},
+                              vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite),
+        /* ...and this frame's depth after it is written. */
+        vk::SubpassDependency(0u, VK_SUBPASS_EXTERNAL, eEarlyFragmentTests | eLateFragmentTests, eComputeShader,
+                              vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::AccessFlagBits::eShaderRead),
+    };
+    const vk::RenderPassCreateInfo renderPassInfo({}, attachments, subpasses, subpassDependencies);
+    return device.device.createRenderPass(renderPassInfo);
+}
+
+inline vk::raii::PipelineLayout createPipelineLayout(const VulkanDevice& device)
+{
+    /* One layout for both vertex inputs, so that the push constants of either fit. */
+    const auto vertexPushConstant =
+        pushConstantRange<PulledVertexPushConstants>({ "instanced_vertex_shader", "pulled_vertex_shader", "fragment_shader" });
+    const auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo({}, {}, vertexPushConstant);
+    return device.device.createPipelineLayout(pipelineLayoutInfo);
+}
+
+enum class DepthPass
+{
+    PrePass, // depth only; draws write the nearest depth
+    Shading, // color; draws shade only the fragments that survived the pre-pass
+};
+
+/* Viewport, scissor and RasterState are dynamic, so a pipeline depends only on the shaders and attachments, and
+ * survives window resizes. renderPass only has to be compatible with the ones the pipeline is used in. Pulled
+ * pipelines draw any mesh of PackedVertex without a vertex buffer bound; see PulledVertexPushConstants. */
+inline vk::raii::Pipeline createPipeline(const vk::RenderPass& renderPass,
+                                         const vk::PipelineLayout& pipelineLayout,
+                                         DepthPass depthPass,
+                                         VertexInput vertexInput,
+                                         const VulkanDevice& device,
+                                         vk::Optional<const vk::raii::PipelineCache> pipelineCache = nullptr)
+{
+    const bool pulled = vertexInput == VertexInput::Pulled;
+    const ShaderModuleInfo vertexShader = ShaderArchive::global().get(pulled ? "pulled_vertex_shader" : "instanced_vertex_shader");
+    const auto& vertexInputInfo = pulled ? pulledVertexInputInfo : SceneVertexLayout::info;
+    validateVertexInput(vertexShader, vertexInputInfo);
+    const auto vertexShaderModule = createShader(vertexShader, device);
+    const auto fragmentShaderModule = createShader("fragment_shader", device);
+    using enum vk::DynamicState;
+    const std::array dynamicStates = { eViewport, eScissor, eCullMode, eFrontFace, ePrimitiveTopology,
+                                       eDepthTestEnable, eDepthWriteEnable, eDepthCompareOp };
+    using enum vk::ColorComponentFlagBits;
+    const vk::ColorComponentFlags colorWriteMask = depthPass == DepthPass::PrePass ? vk::ColorComponentFlags() : eR | eG | eB | eA;
+    std::array colorBlendAttachments = { vk::PipelineColorBlendAttachmentState(false).setColorWriteMask(colorWriteMask) };
+
+    auto vertexShaderStageInfo      = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *vertexShaderModule, "main");
+    auto fragmentShaderStageInfo    = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *fragmentShaderModule, "main");
+    const std::array shaderStages   = { vertexShaderStageInfo, fragmentShaderStageInfo };
+    const auto dynamicStateInfo     = vk::PipelineDynamicStateCreateInfo({}, dynamicStates);
+    const auto inputAssemblyInfo    = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
+    const auto viewportInfo         = vk::PipelineViewportStateCreateInfo({}, 1, nullptr, 1, nullptr);
+    const auto rasterizationInfo    = vk::PipelineRasterizationStateCreateInfo({}, false, false, vk::PolygonMode::eFill, {}, {}, false, {}, {}, {}, 1.0f);
+    const auto multisampleInfo      = vk::PipelineMultisampleStateCreateInfo({}, vk::SampleCountFlagBits::e1, false, 1.0f, nullptr, false, false);
+    const auto colorBlendInfo       = vk::PipelineColorBlendStateCreateInfo({}, false, {}, colorBlendAttachments);
+    const auto depthStencilInfo     = vk::PipelineDepthStencilStateCreateInfo();
+
+    auto graphicsPipelineInfo       = vk::GraphicsPipelineCreateInfo({}, shaderStages, &vertexInputInfo, &inputAssemblyInfo, nullptr, &viewportInfo,
+                                                                     &rasterizationInfo, &multisampleInfo, &depthStencilInfo, &colorBlendInfo,
+                                                                     &dynamicStateInfo, pipelineLayout, renderPass, 0);
+    /* The pre-pass has no fragment shader. */
+    if (depthPass == DepthPass::PrePass)
+        graphicsPipelineInfo.setStageCount(1);
+    auto pipeline = device.device.createGraphicsPipeline(pipelineCache, graphicsPipelineInfo);
+    metrics::pipelinesCreated.add();
+    return pipeline;
+}
+
+/* The depth state of each pass. Both passes run the same vertex shader, so the shading pass sees exactly the
+ * pre-pass depths. */
+inline RasterState depthPassState(DepthPass depthPass)
+{
+    RasterState state;
+    state.depthWrite = depthPass == DepthPass::PrePass;
+    state.depthCompare = depthPass == DepthPass::PrePass ? vk::CompareOp::eLess : vk::CompareOp::eEqual;
+    return state;
+}
+
+/* Everything a scene pipeline is created from; RasterState, viewport and scissor aren't, being dynamic. */
+struct PipelineKey
+{
+    DepthPass depthPass;
+    vk::Format colorFormat;
+    vk::Format depthFormat;
+    VertexInput vertexInput = VertexInput::Attributes;
+
+    auto operator<=>(const PipelineKey&) const = default;
+};
+
+/* The scene's pipelines and their layout, created on first use of their key and kept for the cache's lifetime, which
+ * can span any number of render passes and swapchains. A vk::PipelineCache backs it, so that even a new key, say after
+ * the surface format changed, reuses what the driver compiled before. */
+class VulkanPipelineCache
+{
+    const VulkanDevice& device_;
+    vk::raii::PipelineCache cache_;
+    vk::raii::PipelineLayout layout_;
+    std::map<PipelineKey, vk::raii::Pipeline> pipelines_;
+public:
+    explicit VulkanPipelineCache(const VulkanDevice& device) :
+        device_(device),
+        cache_(device.device.createPipelineCache(vk::PipelineCacheCreateInfo())),
+        layout_(createPipelineLayout(device))
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanPipelineCache)
+
+    const vk::raii::PipelineLayout& layout() const noexcept { return layout_; }
+    size_t size() const noexcept { return pipelines_.size(); }
+
+    /* renderPass is only used to create the pipeline, and has to have the key's formats. */
+    vk::Pipeline get(const PipelineKey& key, const vk::RenderPass& renderPass)
+    {
+        auto found = pipelines_.find(key);
+        if (found == pipelines_.end())
+            found = pipelines_.emplace(key, createPipeline(renderPass, *layout_, key.depthPass, key.vertexInput, device_, cache_)).first;
+        return *found->second;
+    }
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_device.h"
+#include "vk_stream.h"
+
+#include <array>
+#include <optional>
+
+struct PipelineStatistics
+{
+    uint64_t vertexInvocations = 0;
+    uint64_t clippingInvocations = 0;
+    uint64_t clippingPrimitives = 0;
+    uint64_t fragmentInvocations = 0;
+};
+
+/* GPU pipeline statistics of one range of every frame's commands, through a ring of queries that are read without
+ * waiting once their frame has retired. The range can span secondary command buffers, which have to be recorded with
+ * inheritedStatistics() in their inheritance info. Needs the pipelineStatistics optional feature. */
+class VulkanPipelineStatistics
+{
+    using enum vk::QueryPipelineStatisticFlagBits;
+    /* Results come in the order of the flag bits, which is the order of PipelineStatistics. */
+    constexpr static vk::QueryPipelineStatisticFlags statistics_ = eVertexShaderInvocations | eClippingInvocations | eClippingPrimitives |
+                                                                    eFragmentShaderInvocations;
+    constexpr static uint32_t statisticCount_ = 4;
+
+    struct Query
+    {
+        std::optional<VulkanStreamEvent> retireEvent;
+        bool pending = false;
+    };
+
+    vk::raii::QueryPool pool_;
+    std::vector<Query> queries_;
+    std::optional<uint32_t> current_;
+public:
+    /* queryCount bounds the frames in flight that are measured; frames beyond it go unmeasured. */
+    explicit VulkanPipelineStatistics(const VulkanDevice& device, uint32_t queryCount = 4) :
+        pool_(device.device.createQueryPool(vk::QueryPoolCreateInfo({}, vk::QueryType::ePipelineStatistics, queryCount, statistics_))),
+        queries_(queryCount)
+    {
+        Expects(device.optionalFeatures.pipelineStatistics);
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanPipelineStatistics)
+
+    static constexpr vk::QueryPipelineStatisticFlags inheritedStatistics() noexcept { return statistics_; }
+
+    /* Begins measuring, outside of a render pass. Queries are only reused once collect() has read them. */
+    void recordBegin(const vk::CommandBuffer& commandBuffer)
+    {
+        Expects(!current_);
+        const auto query = std::ranges::find_if(queries_, [](const Query& query) { return !query.pending; });
+        if (query == queries_.end())
+            return;
+        current_ = gsl::narrow_cast<uint32_t>(query - queries_.begin());
+        commandBuffer.resetQueryPool(*pool_, *current_, 1);
+        commandBuffer.beginQuery(*pool_, *current_, {});
+    }
+
+    void recordEnd(const vk::CommandBuffer& commandBuffer)
+    {
+        if (current_)
+            commandBuffer.endQuery(*pool_, *current_);
+    }
+
+    /* After submitting the commands between recordBegin() and recordEnd() to stream. */
+    void endFrame(const VulkanStream& stream)
+    {
+        if (!current_)
+            return;
+        Query& query = queries_[*current_];
+        query.retireEvent.emplace(stream.getLastEvent());
+        query.pending = true;
+        current_.reset();
+    }
+
+    /* Hands the results of the frames that retired since the last call to f. Doesn't allocate or wait. */
+    template <std::invocable<const PipelineStatistics&> F>
+    void collect(F&& f)
+    {
+        for (uint32_t i = 0; i < queries_.size(); i++)
+        {
+            Query& query = queries_[i];
+            if (!query.pending || !query.retireEvent->completed())
+                continue;
+            std::array<uint64_t, statisticCount_> values{};
+            const vk::Result result = pool_.getDevice().getQueryPoolResults(*pool_, i, 1, sizeof(values), values.data(), sizeof(values),
+                                                                            vk::QueryResultFlagBits::e64);
+            query.pending = false;
+            if (result == vk::Result::eSuccess)
+                f(PipelineStatistics{ values[0], values[1], values[2], values[3] });
+        }
+    }
+};
+
+/* GPU time between two points of a frame's commands, read back by waiting, for tools that wait for every frame anyway.
+ * Needs timestamps on the queue family the commands are submitted to; see isSupported(). */
+class VulkanFrameTimer
+{
+    vk::raii::QueryPool pool_;
+    double nanosecondsPerTick_;
+    uint64_t validMask_;
+public:
+    static bool isSupported(const VulkanDevice& device, const VulkanQueueInfo& queue)
+    {
+        return device.physicalDevice.getQueueFamilyProperties().at(queue.familyIndex).timestampValidBits != 0;
+    }
+
+    VulkanFrameTimer(const VulkanDevice& device, const VulkanQueueInfo& queue) :
+        pool_(device.device.createQueryPool(vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, 2))),
+        nanosecondsPerTick_(device.physicalDevice.getProperties().limits.timestampPeriod)
+    {
+        Expects(isSupported(device, queue));
+        const uint32_t validBits = device.physicalDevice.getQueueFamilyProperties()[queue.familyIndex].timestampValidBits;
+        validMask_ = validBits >= 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << validBits) - 1;
+    }
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanFrameTimer)
+
+    /* At the start of the frame's first command buffer... */
+    void recordStart(const vk::CommandBuffer& commandBuffer)
+    {
+        commandBuffer.resetQueryPool(*pool_, 0, 2);
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *pool_, 0);
+    }
+    /* ...and at the end of its last one. */
+    void recordEnd(const vk::CommandBuffer& commandBuffer)
+    {
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *pool_, 1);
+    }
+
+    /* Waits for the frame's end timestamp. */
+    double milliseconds() const
+    {
+        std::array<uint64_t, 2> ticks{};
+        const vk::Result result = pool_.getDevice().getQueryPoolResults(*pool_, 0, 2, sizeof(ticks), ticks.data(), sizeof(uint64_t),
+                                                                       vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+        if (result != vk::Result::eSuccess)
+            throw FatalError("Failed to read timestamps: " + vk::to_string(result));
+        return static_cast<double>((ticks[1] - ticks[0]) & validMask_) * nanosecondsPerTick_ * 1e-6;
+    }
+};
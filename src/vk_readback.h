@@ -0,0 +1,221 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffer.h"
+#include "vk_device.h"
+#include "vk_image.h"
+#include "vk_stream.h"
+
+#include <deque>
+#include <memory>
+#include <numeric>
+#include <optional>
+
+class VulkanReadbackRing;
+
+namespace detail
+{
+
+struct ReadbackSlot
+{
+    VulkanReadbackRing* ring;
+    vk::DeviceSize offset;
+    vk::DeviceSize size;
+    vk::DeviceSize alignedSize;
+    std::optional<VulkanStreamEvent> event;
+    bool invalidated = false;
+};
+
+}
+
+/* Future-like handle to a pending readback. The data stays valid for as long as the handle is held; the ring reuses
+ * the region only after the handle is dropped. */
+class ReadbackHandle
+{
+    friend class VulkanReadbackRing;
+
+    std::shared_ptr<detail::ReadbackSlot> slot_;
+
+    explicit ReadbackHandle(std::shared_ptr<detail::ReadbackSlot> slot) noexcept : slot_(std::move(slot)) {}
+public:
+    DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(ReadbackHandle)
+
+    /* Non-blocking; one semaphore counter query. */
+    [[nodiscard]] bool ready() const { return slot_->event->completed(); }
+    void wait() const { slot_->event->synchronize(); }
+    /* For co_await-ing through VulkanTimelineWaiter. */
+    const VulkanStreamEvent& event() const noexcept { return *slot_->event; }
+
+    /* Blocks if the copy hasn't retired yet, so check ready() first on hot paths. */
+    inline gsl::span<const std::byte> get() const;
+    template <typename T>
+    gsl::span<const T> getAs() const
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto bytes = get();
+        return { reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T) };
+    }
+};
+
+/* Persistently mapped, host-cached ring buffer that GPU data is copied into, read back on the CPU once the stream's
+ * timeline passes the copy. Regions are sub-allocated in submission order and aligned to nonCoherentAtomSize, so that
+ * invalidating one readback never touches its neighbours, and to optimalBufferCopyOffsetAlignment. Image readbacks are
+ * further aligned to their format's texel block size and to 4 bytes, as copies from images require, which for formats
+ * like R32G32B32 is not a power of two. */
+class VulkanReadbackRing
+{
+    friend class ReadbackHandle;
+
+    vk::Device device_;
+    VulkanBuffer<vk::BufferUsageFlagBits::eTransferDst, VulkanBufferType::Readback> buffer_;
+    gsl::span<std::byte> mapped_;
+    vk::DeviceSize alignment_;
+    vk::DeviceSize head_ = 0;
+    std::deque<std::shared_ptr<detail::ReadbackSlot>> slots_;
+
+    /* Frees the oldest regions whose copies have retired and whose handles are gone. */
+    void reclaim_()
+    {
+        while (!slots_.empty())
+        {
+            const auto& slot = slots_.front();
+            if (slot.use_count() > 1 || (slot->event && !slot->event->completed()))
+                break;
+            slots_.pop_front();
+        }
+    }
+
+    std::optional<vk::DeviceSize> tryAllocate_(vk::DeviceSize size, vk::DeviceSize offsetAlignment) noexcept
+    {
+        const vk::DeviceSize capacity = buffer_.size();
+        if (slots_.empty())
+        {
+            head_ = 0;
+            return size <= capacity ? std::optional<vk::DeviceSize>(0) : std::nullopt;
+        }
+        const vk::DeviceSize tail = slots_.front()->offset;
+        const vk::DeviceSize head = (head_ + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+        if (head_ > tail)
+        {
+            /* Live region is [tail, head). */
+            if (head + size <= capacity)
+                return head;
+            if (size <= tail)
+                return 0;
+            return std::nullopt;
+        }
+        /* Live region wrapped around: [tail, capacity) and [0, head). */
+        if (head + size <= tail)
+            return head;
+        return std::nullopt;
+    }
+
+    /* offsetAlignment is what the copy needs on top of the ring's own alignment. */
+    std::shared_ptr<detail::ReadbackSlot> allocate_(vk::DeviceSize size, vk::DeviceSize offsetAlignment = 1)
+    {
+        const vk::DeviceSize alignedSize = (size + alignment_ - 1) / alignment_ * alignment_;
+        offsetAlignment = std::lcm(alignment_, offsetAlignment);
+        reclaim_();
+        auto offset = tryAllocate_(alignedSize, offsetAlignment);
+        if (!offset && !slots_.empty() && slots_.front().use_count() == 1)
+        {
+            /* The ring is too small for the readbacks in flight. Stalling on the oldest one is the only way out. */
+            slots_.front()->event->synchronize();
+            reclaim_();
+            offset = tryAllocate_(alignedSize, offsetAlignment);
+        }
+        if (!offset)
+            throw FatalError("Readback ring exhausted; readback handles are being held for too long or the ring is too small");
+
+        head_ = *offset + alignedSize;
+        auto slot = std::make_shared<detail::ReadbackSlot>(detail::ReadbackSlot{ this, *offset, size, alignedSize, std::nullopt });
+        slots_.push_back(slot);
+        return slot;
+    }
+
+    void invalidate_(detail::ReadbackSlot& slot) const
+    {
+        if (slot.invalidated)
+            return;
+        if (!buffer_.isCoherent())
+        {
+            /* The allocation is atom-aligned, but may only be rounded up to the atom size within the memory object. */
+            const vk::DeviceSize size = slot.offset + slot.alignedSize <= buffer_.capacity() ? slot.alignedSize : VK_WHOLE_SIZE;
+            device_.invalidateMappedMemoryRanges(vk::MappedMemoryRange(buffer_.getMemory(), slot.offset, size));
+        }
+        slot.invalidated = true;
+    }
+
+    /* Submits recordCopy(commandBuffer, ringOffset), which copies into the ring at ringOffset, to stream. */
+    ReadbackHandle submit_(VulkanStream& stream, const vk::Queue& queue, std::shared_ptr<detail::ReadbackSlot> slot, const auto& recordCopy)
+    {
+        auto recorder = [&](const vk::CommandBuffer& commandBuffer)
+        {
+            recordCopy(commandBuffer, slot->offset);
+            /* Make the transfer write available to host reads once the timeline semaphore signals. */
+            const vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, barrier, {}, {});
+        };
+        stream.submitWork(queue, recorder);
+        slot->event.emplace(stream.getLastEvent());
+        return ReadbackHandle(std::move(slot));
+    }
+public:
+    VulkanReadbackRing(const VulkanDevice& device, vk::DeviceSize size) :
+        device_(*device.device),
+        buffer_(device, size),
+        mapped_(buffer_.mapped()),
+        alignment_(std::lcm(std::max<vk::DeviceSize>(device.physicalDevice.getProperties().limits.nonCoherentAtomSize, 1),
+                            std::max<vk::DeviceSize>(device.physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment, 1)))
+    {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanReadbackRing)
+
+    /* Copies size bytes at offset in source into the ring on stream. Returns immediately. */
+    template <vk::BufferUsageFlags usage, VulkanBufferType bufferType>
+    [[nodiscard]] ReadbackHandle readback(VulkanStream& stream, const vk::Queue& queue, const VulkanBuffer<usage, bufferType>& source,
+                                          vk::DeviceSize offset, vk::DeviceSize size)
+    {
+        static_assert(static_cast<bool>(usage & vk::BufferUsageFlagBits::eTransferSrc), "Source buffer must have TransferSrc buffer usage flag");
+        Expects(offset + size <= source.size());
+        auto slot = allocate_(size);
+
+        auto recordCopy = [&](const vk::CommandBuffer& commandBuffer, vk::DeviceSize ringOffset)
+        {
+            commandBuffer.copyBuffer(source.get(), buffer_.get(), vk::BufferCopy(offset, ringOffset, size));
+        };
+        return submit_(stream, queue, std::move(slot), recordCopy);
+    }
+    template <vk::BufferUsageFlags usage, VulkanBufferType bufferType>
+    [[nodiscard]] ReadbackHandle readback(VulkanStream& stream, const vk::Queue& queue, const VulkanBuffer<usage, bufferType>& source)
+    {
+        return readback(stream, queue, source, 0, source.size());
+    }
+    /* Copies a mip of source into the ring on stream, tightly packed, and moves the mip back to the layout it was in.
+     * The mip must have been written, and source's commands must all be recorded on stream. Returns immediately. */
+    template <vk::ImageUsageFlags usage>
+    [[nodiscard]] ReadbackHandle readback(VulkanStream& stream, const vk::Queue& queue, VulkanImage<usage>& source, uint32_t mip)
+    {
+        const auto block = getFormatBlockInfo(source.format());
+        Expects(block && mip < source.mipLevels() && source.layout(mip) != vk::ImageLayout::eUndefined);
+        auto slot = allocate_(getMipSize(*block, source.extent(), mip), std::lcm(vk::DeviceSize{ block->bytes }, vk::DeviceSize{ 4 }));
+        auto recordCopy = [&](const vk::CommandBuffer& commandBuffer, vk::DeviceSize ringOffset)
+        {
+            const vk::ImageLayout layout = source.layout(mip);
+            source.recordCopyToBuffer(commandBuffer, buffer_, ringOffset, mip);
+            source.recordTransition(commandBuffer, layout, mip, 1);
+        };
+        return submit_(stream, queue, std::move(slot), recordCopy);
+    }
+
+    /* Readbacks still occupying the ring. */
+    size_t pending() const noexcept { return slots_.size(); }
+};
+
+gsl::span<const std::byte> ReadbackHandle::get() const
+{
+    if (!ready())
+        wait();
+    detail::ReadbackSlot& slot = *slot_;
+    slot.ring->invalidate_(slot);
+    return slot.ring->mapped_.subspan(gsl::narrow<size_t>(slot.offset), gsl::narrow<size_t>(slot.size));
+}
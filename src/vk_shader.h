@@ -0,0 +1,154 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_device.h"
+#include "shader_archive.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Creates a module from the shader archive the build packs from src/shaders. The code is read straight out of the
+ * mapping, so nothing is copied on the way to the driver. */
+inline vk::raii::ShaderModule createShader(const ShaderModuleInfo& shader, const VulkanDevice& device)
+{
+    const vk::ShaderModuleCreateInfo shaderInfo({}, shader.code.size_bytes(), shader.code.data());
+    return device.device.createShaderModule(shaderInfo);
+}
+
+inline vk::raii::ShaderModule createShader(std::string_view name, const VulkanDevice& device)
+{
+    return createShader(ShaderArchive::global().get(name), device);
+}
+
+/* The push constant range of a pipeline layout whose shaders share the block T, covering the stages of those that
+ * use it. Throws if T is smaller than the block any of them was compiled with, so that the struct the CPU fills can't
+ * silently drift from the shaders. */
+template <typename T>
+vk::PushConstantRange pushConstantRange(std::initializer_list<std::string_view> shaders)
+{
+    vk::ShaderStageFlags stages;
+    for (const std::string_view name : shaders)
+    {
+        const ShaderModuleInfo shader = ShaderArchive::global().get(name);
+        if (shader.pushConstantSize > sizeof(T))
+            throw FatalError("Shader " + std::string(name) + " expects " + std::to_string(shader.pushConstantSize) +
+                             " bytes of push constants, but the layout provides " + std::to_string(sizeof(T)));
+        if (shader.pushConstantSize != 0)
+            stages |= shader.stage;
+    }
+    return vk::PushConstantRange(stages, 0, sizeof(T));
+}
+
+/* The bindings of descriptor set `set` declared by any of shaders, each visible to the stages of the shaders that
+ * declare it. Throws if two of them declare a binding differently. */
+inline std::vector<vk::DescriptorSetLayoutBinding> descriptorSetLayoutBindings(std::initializer_list<std::string_view> shaders,
+                                                                               uint32_t set = 0)
+{
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    for (const std::string_view name : shaders)
+    {
+        const ShaderModuleInfo shader = ShaderArchive::global().get(name);
+        for (const shader_pack::DescriptorBinding& descriptor : shader.descriptorBindings)
+        {
+            if (descriptor.set != set)
+                continue;
+            const auto type = static_cast<vk::DescriptorType>(descriptor.type);
+            const auto found = std::ranges::find(bindings, descriptor.binding, &vk::DescriptorSetLayoutBinding::binding);
+            if (found == bindings.end())
+                bindings.emplace_back(descriptor.binding, type, descriptor.count, shader.stage);
+            else if (found->descriptorType != type || found->descriptorCount != descriptor.count)
+                throw FatalError("Shader " + std::string(name) + " declares binding " + std::to_string(descriptor.binding) +
+                                 " of set " + std::to_string(set) + " unlike the other shaders");
+            else
+                found->stageFlags |= shader.stage;
+        }
+    }
+    std::ranges::sort(bindings, {}, &vk::DescriptorSetLayoutBinding::binding);
+    return bindings;
+}
+
+/* The type a shader reads a vertex attribute of format as. Normalized, scaled and floating point formats all read as
+ * floats; only the integer formats don't. */
+constexpr shader_pack::ComponentType vertexComponentType(vk::Format format) noexcept
+{
+    using enum vk::Format;
+    using enum shader_pack::ComponentType;
+    switch (format)
+    {
+    case eR8Uint:
+    case eR8G8Uint:
+    case eR8G8B8Uint:
+    case eB8G8R8Uint:
+    case eR8G8B8A8Uint:
+    case eB8G8R8A8Uint:
+    case eA8B8G8R8UintPack32:
+    case eA2R10G10B10UintPack32:
+    case eA2B10G10R10UintPack32:
+    case eR16Uint:
+    case eR16G16Uint:
+    case eR16G16B16Uint:
+    case eR16G16B16A16Uint:
+    case eR32Uint:
+    case eR32G32Uint:
+    case eR32G32B32Uint:
+    case eR32G32B32A32Uint:
+    case eR64Uint:
+    case eR64G64Uint:
+    case eR64G64B64Uint:
+    case eR64G64B64A64Uint:
+        return Uint;
+    case eR8Sint:
+    case eR8G8Sint:
+    case eR8G8B8Sint:
+    case eB8G8R8Sint:
+    case eR8G8B8A8Sint:
+    case eB8G8R8A8Sint:
+    case eA8B8G8R8SintPack32:
+    case eA2R10G10B10SintPack32:
+    case eA2B10G10R10SintPack32:
+    case eR16Sint:
+    case eR16G16Sint:
+    case eR16G16B16Sint:
+    case eR16G16B16A16Sint:
+    case eR32Sint:
+    case eR32G32Sint:
+    case eR32G32B32Sint:
+    case eR32G32B32A32Sint:
+    case eR64Sint:
+    case eR64G64Sint:
+    case eR64G64B64Sint:
+    case eR64G64B64A64Sint:
+        return Sint;
+    default:
+        return Float;
+    }
+}
+
+/* Throws unless every input of the vertex shader is fed an attribute of the same numeric type. */
+inline void validateVertexInput(const ShaderModuleInfo& shader, const vk::PipelineVertexInputStateCreateInfo& vertexInputInfo)
+{
+    const gsl::span<const vk::VertexInputAttributeDescription> attributes(vertexInputInfo.pVertexAttributeDescriptions,
+                                                                           vertexInputInfo.vertexAttributeDescriptionCount);
+    for (const shader_pack::VertexInput& input : shader.vertexInputs)
+    {
+        const auto attribute = std::ranges::find(attributes, input.location, &vk::VertexInputAttributeDescription::location);
+        if (attribute == attributes.end())
+            throw FatalError("No vertex attribute for location " + std::to_string(input.location) + " of " + std::string(shader.name));
+        if (vertexComponentType(attribute->format) != input.type)
+            throw FatalError("Vertex attribute " + vk::to_string(attribute->format) + " at location " + std::to_string(input.location) +
+                             " doesn't match the type " + std::string(shader.name) + " reads it as");
+    }
+}
+
+/* Compute pipeline from a single shader with entry point main. */
+inline vk::raii::Pipeline createComputePipeline(std::string_view name, const vk::PipelineLayout& pipelineLayout,
+                                                const VulkanDevice& device)
+{
+    const auto shaderModule = createShader(name, device);
+    const vk::ComputePipelineCreateInfo pipelineInfo(
+        {}, vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *shaderModule, "main"), pipelineLayout);
+    return device.device.createComputePipeline(nullptr, pipelineInfo);
+}
@@ -4,7 +4,10 @@
 #include "vk_swapchain.h"
 #include "vk_sync.h"
 #include "vk_command.h"
+#include "frame_arena.h"
+#include "metrics.h"
 
+#include <memory_resource>
 #include <queue>
 #include <ranges>
 #include <thread>
@@ -30,6 +33,10 @@ public:
     template <std::same_as<VulkanStreamEvent> ...Events>
     static inline void submitEvents(const vk::Queue& queue, const VulkanStreamEvent& signalEvent, const Events&... waitEvents);
 
+    const VulkanStream& stream() const noexcept { return stream_; }
+    vk::Semaphore semaphore() const noexcept { return getSemaphore(*this); }
+    uint64_t value() const noexcept { return timelineValue_; }
+    [[nodiscard]] inline bool completed() const;
     inline void synchronize() const;
 };
 
@@ -39,9 +46,20 @@ class VulkanStream
     friend class VulkanGraphicsStream;
 
     std::shared_ptr<VulkanCommandPool> commandPool_;
-    std::optional<VulkanCommandBuffer> currentCommandBuffer_;
+    /* Submitted command buffers with the timeline value that retires them, oldest first. Recycled without waiting
+     * once retired. Only a few are ever in flight, and unlike a deque the vector stops allocating once it has grown. */
+    std::vector<std::pair<uint64_t, VulkanCommandBuffer>> inFlightCommandBuffers_;
     VulkanTimelineSemaphore semaphore_;
     uint64_t lastValue_ = 0;
+
+    void retireCommandBuffers_()
+    {
+        if (inFlightCommandBuffers_.empty())
+            return;
+        const uint64_t completed = completedValue();
+        const auto retired = std::ranges::find_if(inFlightCommandBuffers_, [completed](const auto& entry) { return entry.first > completed; });
+        inFlightCommandBuffers_.erase(inFlightCommandBuffers_.begin(), retired);
+    }
 public:
     VulkanStream(const vk::Device& device, std::shared_ptr<VulkanCommandPool> commandPool)
         : commandPool_(commandPool), semaphore_(device) {}
@@ -63,19 +81,39 @@ public:
 
     void submitWork(const vk::Queue& queue, VulkanCommandRecorder auto& recorder, const vk::ArrayProxy<VulkanStreamEvent>& waitEvents = {})
     {
-        auto waitSemaphoreValues = std::views::transform(waitEvents, VulkanStreamEvent::getSemaphoreValue) | std::ranges::to<std::vector>();
-        auto waitSemaphores      = std::views::transform(waitEvents, VulkanStreamEvent::getSemaphore)      | std::ranges::to<std::vector>();
+        /* Per-submit scratch comes from the frame arena, so steady-state submits don't touch the heap. */
+        std::pmr::memory_resource* scratch = frameMemoryResource();
+        std::pmr::vector<uint64_t> waitSemaphoreValues(scratch);
+        std::pmr::vector<vk::Semaphore> waitSemaphores(scratch);
+        waitSemaphoreValues.reserve(waitEvents.size() + 1);
+        waitSemaphores.reserve(waitEvents.size() + 1);
+        for (const VulkanStreamEvent& event : waitEvents)
+        {
+            waitSemaphoreValues.push_back(VulkanStreamEvent::getSemaphoreValue(event));
+            waitSemaphores.push_back(VulkanStreamEvent::getSemaphore(event));
+        }
         waitSemaphoreValues.push_back(lastValue_);
         waitSemaphores.push_back(semaphore_.get());
 
+        retireCommandBuffers_();
+        VulkanCommandBuffer commandBuffer = commandPool_->checkOut();
+        commandBuffer.recordOnce(recorder);
         const vk::TimelineSemaphoreSubmitInfo timelineSubmit(waitSemaphoreValues, ++lastValue_);
-        currentCommandBuffer_ = commandPool_->checkOut();
-        currentCommandBuffer_->recordOnce(recorder);
-        const vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-        const vk::SubmitInfo submitInfo(waitSemaphores, waitStage, {}, semaphore_.get(), &timelineSubmit);
-        currentCommandBuffer_->submitTo(queue, submitInfo);
+        /* One stage mask per wait. Earlier work may have produced anything this work consumes (uploads no longer stall
+         * the host in between), so the wait has to cover every stage. */
+        const std::pmr::vector<vk::PipelineStageFlags> waitStages(waitSemaphores.size(), vk::PipelineStageFlagBits::eAllCommands, scratch);
+        const vk::SubmitInfo submitInfo(waitSemaphores, waitStages, {}, semaphore_.get(), &timelineSubmit);
+        commandBuffer.submitTo(queue, submitInfo);
+        inFlightCommandBuffers_.emplace_back(lastValue_, std::move(commandBuffer));
+        metrics::submits.add();
     }
-    
+
+    /* Highest timeline value the GPU has finished. One semaphore counter query. */
+    uint64_t completedValue() const
+    {
+        return semaphore_.counter();
+    }
+
     void synchronize() const
     {
         semaphore_.wait(lastValue_);
@@ -85,11 +123,24 @@ public:
 class VulkanGraphicsStream : public VulkanStream
 {
 private:
-    VulkanSemaphore acquireSemaphore_;
-    VulkanSemaphore presentSemaphore_;
+    vk::Device device_;
+    /* One acquire semaphore per frame in flight, reused once the timeline passes the value its frame ended at, which
+     * is after the wait on it. A present semaphore is only known to be unsignaled again once its swapchain image is
+     * acquired anew, so there is one per image instead. */
+    std::vector<VulkanSemaphore> acquireSemaphores_;
+    std::vector<uint64_t> frameEndValues_;
+    std::vector<VulkanSemaphore> presentSemaphores_;
+    size_t frame_ = 0;
 public:
-    VulkanGraphicsStream(const vk::Device& device, std::shared_ptr<VulkanCommandPool> commandPool)
-        : VulkanStream(device, commandPool), acquireSemaphore_(device), presentSemaphore_(device) {}
+    /* framesInFlight bounds how many frames the CPU records ahead of the GPU. */
+    VulkanGraphicsStream(const vk::Device& device, std::shared_ptr<VulkanCommandPool> commandPool, uint32_t framesInFlight = 2)
+        : VulkanStream(device, commandPool), device_(device), frameEndValues_(framesInFlight, 0)
+    {
+        Expects(framesInFlight > 0);
+        acquireSemaphores_.reserve(framesInFlight);
+        for (uint32_t i = 0; i < framesInFlight; i++)
+            acquireSemaphores_.emplace_back(device);
+    }
     DECLARE_CONSTRUCTORS_MOVE_DEFAULTED(VulkanGraphicsStream)
 
     using VulkanStream::submitWork;
@@ -97,9 +148,15 @@ public:
     void submitWork(const vk::Queue& queue, const vk::RenderPassBeginInfo& renderPassInfo, VulkanCommandRecorder auto& recorder,
                     const vk::ArrayProxy<VulkanStreamEvent>& waitEvents = {})
     {
-        auto wrappedRecorder = [&renderPassInfo, &recorder](const vk::CommandBuffer& commandBuffer)
+        submitWork(queue, renderPassInfo, vk::SubpassContents::eInline, recorder, waitEvents);
+    }
+    /* With eSecondaryCommandBuffers, recorder may only call executeCommands. */
+    void submitWork(const vk::Queue& queue, const vk::RenderPassBeginInfo& renderPassInfo, vk::SubpassContents contents,
+                    VulkanCommandRecorder auto& recorder, const vk::ArrayProxy<VulkanStreamEvent>& waitEvents = {})
+    {
+        auto wrappedRecorder = [&renderPassInfo, contents, &recorder](const vk::CommandBuffer& commandBuffer)
         {
-            commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+            commandBuffer.beginRenderPass(renderPassInfo, contents);
             recorder(commandBuffer);
             commandBuffer.endRenderPass();
         };
@@ -107,27 +164,40 @@ public:
     }
 
     /* TODO: Don't return raw, unencapsulated uint32_t to be later received by present(). */
+    /* Blocks only while framesInFlight frames are still on the GPU. */
     uint32_t acquireNextImage(const vk::Queue& queue, const VulkanSwapchain& swapchain)
     {
-        const uint32_t imageIndex = swapchain.acquireNextImage(acquireSemaphore_.get());
+        semaphore_.wait(frameEndValues_[frame_]);
+        const vk::Semaphore& acquireSemaphore = acquireSemaphores_[frame_].get();
+        const uint32_t imageIndex = swapchain.acquireNextImage(acquireSemaphore);
+        while (presentSemaphores_.size() < swapchain.size())
+            presentSemaphores_.emplace_back(device_);
 
         constexpr uint64_t acquireSemaphoreValue = std::numeric_limits<uint64_t>::max(); // will be ignored since acquireSemaphore isn't timeline
         const vk::TimelineSemaphoreSubmitInfo timelineSubmit(acquireSemaphoreValue, ++lastValue_);
         const vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eNone;
-        queue.submit(vk::SubmitInfo{ acquireSemaphore_.get(), waitStage, {}, semaphore_.get(), &timelineSubmit });
+        queue.submit(vk::SubmitInfo{ acquireSemaphore, waitStage, {}, semaphore_.get(), &timelineSubmit });
 
         return imageIndex;
     }
     
-    void present(const vk::Queue& queue, const VulkanSwapchain& swapchain, uint32_t imageIndex)
+    /* A nonzero presentId tags the present for VK_KHR_present_wait; only pass one if the device enabled it. */
+    void present(const vk::Queue& queue, const VulkanSwapchain& swapchain, uint32_t imageIndex, uint64_t presentId = 0)
     {
         constexpr uint64_t presentSemaphoreValue = std::numeric_limits<uint64_t>::max(); // will be ignored since presentSemaphore isn't timeline
         const vk::TimelineSemaphoreSubmitInfo timelineSubmit(lastValue_, presentSemaphoreValue);
         const vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eNone;
-        queue.submit(vk::SubmitInfo{ semaphore_.get(), waitStage, {}, presentSemaphore_.get(), &timelineSubmit });
+        const vk::Semaphore& presentSemaphore = presentSemaphores_.at(imageIndex).get();
+        queue.submit(vk::SubmitInfo{ semaphore_.get(), waitStage, {}, presentSemaphore, &timelineSubmit });
 
-        const vk::PresentInfoKHR presentInfo(presentSemaphore_.get(), *swapchain.getSwapchain(), imageIndex, {});
+        vk::PresentInfoKHR presentInfo(presentSemaphore, *swapchain.getSwapchain(), imageIndex, {});
+        const vk::PresentIdKHR presentIdInfo(1, &presentId);
+        if (presentId != 0)
+            presentInfo.setPNext(&presentIdInfo);
         VK_CHECK(queue.presentKHR(presentInfo));
+
+        frameEndValues_[frame_] = lastValue_;
+        frame_ = (frame_ + 1) % frameEndValues_.size();
     }
 };
 
@@ -144,6 +214,11 @@ void VulkanStreamEvent::submitEvents(const vk::Queue& queue, const VulkanStreamE
     queue.submit(submitInfo);
 }
 
+bool VulkanStreamEvent::completed() const
+{
+    return stream_.completedValue() >= timelineValue_;
+}
+
 void VulkanStreamEvent::synchronize() const
 {
     stream_.semaphore_.wait(timelineValue_);
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_memory.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+class VulkanSubAllocator;
+
+namespace detail
+{
+
+/* One large allocation carved into aligned ranges. Free ranges are keyed by offset, so that freeing can coalesce
+ * with both neighbours in O(log n). */
+struct SubAllocationBlock
+{
+    VulkanAllocation allocation;
+    MemoryCategory category;
+    std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+    vk::DeviceSize usedBytes = 0;
+    size_t liveCount = 0;
+};
+
+}
+
+/* A range of device memory handed out by a VulkanSubAllocator; returns the range when destroyed. Large requests get
+ * an allocation of their own, which offset() reports as starting at 0. */
+class VulkanSubAllocation
+{
+    friend class VulkanSubAllocator;
+
+    VulkanSubAllocator* allocator_ = nullptr;
+    detail::SubAllocationBlock* block_ = nullptr;
+    std::optional<VulkanAllocation> dedicated_;
+    vk::DeviceSize offset_ = 0;
+    vk::DeviceSize size_ = 0;
+
+    VulkanSubAllocation(VulkanSubAllocator& allocator, detail::SubAllocationBlock& block, vk::DeviceSize offset, vk::DeviceSize size) noexcept :
+        allocator_(&allocator), block_(&block), offset_(offset), size_(size)
+    {}
+    explicit VulkanSubAllocation(VulkanAllocation dedicated) noexcept :
+        dedicated_(std::move(dedicated)), size_(dedicated_->size())
+    {}
+public:
+    VulkanSubAllocation(const VulkanSubAllocation&) = delete;
+    VulkanSubAllocation& operator=(const VulkanSubAllocation&) = delete;
+    VulkanSubAllocation(VulkanSubAllocation&& other) noexcept :
+        allocator_(std::exchange(other.allocator_, nullptr)), block_(std::exchange(other.block_, nullptr)),
+        dedicated_(std::move(other.dedicated_)), offset_(other.offset_), size_(other.size_)
+    {}
+    VulkanSubAllocation& operator=(VulkanSubAllocation&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release_();
+            allocator_ = std::exchange(other.allocator_, nullptr);
+            block_ = std::exchange(other.block_, nullptr);
+            dedicated_ = std::move(other.dedicated_);
+            offset_ = other.offset_;
+            size_ = other.size_;
+        }
+        return *this;
+    }
+    ~VulkanSubAllocation() { release_(); }
+
+    const vk::raii::DeviceMemory& memory() const noexcept { return dedicated_ ? dedicated_->memory() : block_->allocation.memory(); }
+    vk::DeviceSize offset() const noexcept { return offset_; }
+    vk::DeviceSize size() const noexcept { return size_; }
+    const VulkanAllocation& allocation() const noexcept { return dedicated_ ? *dedicated_ : block_->allocation; }
+    bool dedicated() const noexcept { return dedicated_.has_value(); }
+private:
+    inline void release_() noexcept;
+};
+
+/* Sub-allocates resources from large blocks, so that creating an image costs a free-list lookup instead of a
+ * vkAllocateMemory call, and the device's maxMemoryAllocationCount is never approached. Blocks are allocated through
+ * the VulkanMemoryManager, so they are budgeted like everything else, and a block is only shared by resources of one
+ * memory type and category.
+ *
+ * Only use it for optimally tiled images: linear resources in the same block would have to respect
+ * bufferImageGranularity, which the free list doesn't. Thread-safe. */
+class VulkanSubAllocator
+{
+    friend class VulkanSubAllocation;
+
+    constexpr static vk::DeviceSize blockSize_ = vk::DeviceSize(64) << 20;
+
+    VulkanMemoryManager& manager_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<detail::SubAllocationBlock>> blocks_;
+
+    static vk::DeviceSize alignUp_(vk::DeviceSize value, vk::DeviceSize alignment) noexcept
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    /* First fit; returns the aligned offset and takes the range out of the free list. */
+    static std::optional<vk::DeviceSize> tryAllocate_(detail::SubAllocationBlock& block, vk::DeviceSize size, vk::DeviceSize alignment)
+    {
+        for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it)
+        {
+            const auto [rangeOffset, rangeSize] = *it;
+            const vk::DeviceSize offset = alignUp_(rangeOffset, alignment);
+            if (offset + size > rangeOffset + rangeSize)
+                continue;
+            block.freeRanges.erase(it);
+            /* Keep the alignment padding and the tail free. */
+            if (offset > rangeOffset)
+                block.freeRanges.emplace(rangeOffset, offset - rangeOffset);
+            if (offset + size < rangeOffset + rangeSize)
+                block.freeRanges.emplace(offset + size, rangeOffset + rangeSize - offset - size);
+            block.usedBytes += size;
+            block.liveCount++;
+            return offset;
+        }
+        return std::nullopt;
+    }
+
+    void free_(detail::SubAllocationBlock& block, vk::DeviceSize offset, vk::DeviceSize size) noexcept
+    {
+        const std::scoped_lock lock(mutex_);
+        auto [it, inserted] = block.freeRanges.emplace(offset, size);
+        if (const auto next = std::next(it); next != block.freeRanges.end() && it->first + it->second == next->first)
+        {
+            it->second += next->second;
+            block.freeRanges.erase(next);
+        }
+        if (it != block.freeRanges.begin())
+            if (const auto previous = std::prev(it); previous->first + previous->second == it->first)
+            {
+                previous->second += it->second;
+                block.freeRanges.erase(it);
+            }
+        block.usedBytes -= size;
+        block.liveCount--;
+
+        /* Give empty blocks back, but keep one per memory type and category around to absorb churn. */
+        if (block.liveCount == 0)
+        {
+            const auto sameKind = [&block](const auto& other)
+            {
+                return other.get() != &block && other->liveCount == 0 && other->category == block.category &&
+                       other->allocation.memoryType() == block.allocation.memoryType();
+            };
+            if (std::ranges::any_of(blocks_, sameKind))
+                std::erase_if(blocks_, [&block](const auto& other) { return other.get() == &block; });
+        }
+    }
+public:
+    explicit VulkanSubAllocator(VulkanMemoryManager& manager) : manager_(manager) {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanSubAllocator)
+
+    VulkanSubAllocation allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags required,
+                                 MemoryCategory category, MemoryPriority priority = MemoryPriority::Normal)
+    {
+        /* Big resources would mostly waste a block; they also are the ones worth demoting or evicting on their own. */
+        if (requirements.size > blockSize_ / 2)
+            return VulkanSubAllocation(manager_.allocate(requirements, required, category, priority));
+
+        const std::scoped_lock lock(mutex_);
+        for (const auto& block : blocks_)
+        {
+            const VulkanAllocation& allocation = block->allocation;
+            if (block->category != category || !(requirements.memoryTypeBits & (1u << allocation.memoryType())) ||
+                (allocation.flags() & required) != required)
+                continue;
+            if (const auto offset = tryAllocate_(*block, requirements.size, requirements.alignment))
+                return VulkanSubAllocation(*this, *block, *offset, requirements.size);
+        }
+
+        const vk::MemoryRequirements blockRequirements(blockSize_, requirements.alignment, requirements.memoryTypeBits);
+        auto& block = blocks_.emplace_back(std::make_unique<detail::SubAllocationBlock>(
+            detail::SubAllocationBlock{ manager_.allocate(blockRequirements, required, category, priority), category }));
+        block->freeRanges.emplace(0, blockSize_);
+        const auto offset = tryAllocate_(*block, requirements.size, requirements.alignment);
+        Expects(offset.has_value());
+        return VulkanSubAllocation(*this, *block, *offset, requirements.size);
+    }
+
+    /* Bytes in use and reserved by blocks, for judging fragmentation. */
+    std::pair<vk::DeviceSize, vk::DeviceSize> usage()
+    {
+        const std::scoped_lock lock(mutex_);
+        vk::DeviceSize used = 0;
+        for (const auto& block : blocks_)
+            used += block->usedBytes;
+        return { used, blocks_.size() * blockSize_ };
+    }
+};
+
+void VulkanSubAllocation::release_() noexcept
+{
+    if (allocator_)
+        allocator_->free_(*block_, offset_, size_);
+    allocator_ = nullptr;
+    block_ = nullptr;
+    dedicated_.reset();
+}
@@ -4,13 +4,81 @@
 #include "vk_command.h"
 #include "vk_device.h"
 
+#include <algorithm>
 #include <memory>
 #include <optional>
 
 struct SDL_Window;
 
+/* What the swapchain is tuned for. */
+enum class PresentPolicy
+{
+    /* Shortest path from input to display without tearing: mailbox with the smallest queue, and frame starts paced to
+     * just before the display needs them when present wait is available. Without mailbox, this falls back to FIFO. */
+    LowestLatency,
+    /* LowestLatency, but falling back to immediate rather than FIFO. Immediate replaces the image being scanned out
+     * mid-refresh, so the display tears; in exchange, a frame never waits up to a refresh interval for vblank. */
+    LowestLatencyTearing,
+    /* FIFO with as few images as the surface allows, so the display throttles the CPU and GPU to the refresh rate. */
+    LowestPower,
+    /* Never block on the display: immediate, which tears, or mailbox, with one image more than the minimum. */
+    MaxThroughput,
+};
+
+struct PresentConfiguration
+{
+    vk::PresentModeKHR presentMode;
+    uint32_t imageCount;
+};
+
+/* Picks the first supported mode in the policy's preference order, falling back to FIFO, which every surface supports.
+ * The image count always honors the surface's minImageCount and maxImageCount. */
+inline PresentConfiguration selectPresentConfiguration(PresentPolicy policy,
+                                                       gsl::span<const vk::PresentModeKHR> supportedModes,
+                                                       const vk::SurfaceCapabilitiesKHR& capabilities)
+{
+    using enum vk::PresentModeKHR;
+    gsl::span<const vk::PresentModeKHR> preferredModes;
+    switch (policy)
+    {
+    case PresentPolicy::LowestLatency:
+    {
+        /* Not FIFO relaxed, which tears whenever a frame is late. */
+        static constexpr std::array modes = { eMailbox };
+        preferredModes = modes;
+        break;
+    }
+    case PresentPolicy::LowestLatencyTearing:
+    {
+        static constexpr std::array modes = { eMailbox, eImmediate };
+        preferredModes = modes;
+        break;
+    }
+    case PresentPolicy::LowestPower:
+        break;
+    case PresentPolicy::MaxThroughput:
+    {
+        static constexpr std::array modes = { eImmediate, eMailbox, eFifoRelaxed };
+        preferredModes = modes;
+        break;
+    }
+    }
+    const auto mode = std::ranges::find_if(preferredModes, [&](vk::PresentModeKHR preferred) { return std::ranges::contains(supportedModes, preferred); });
+    const vk::PresentModeKHR presentMode = mode != preferredModes.end() ? *mode : eFifo;
+
+    /* Mailbox needs a third image to always have one to render into while one is queued and one is displayed. */
+    uint32_t imageCount = presentMode == eMailbox ? 3 : 2;
+    if (policy == PresentPolicy::MaxThroughput)
+        imageCount = std::max(imageCount, capabilities.minImageCount + 1);
+    imageCount = std::max(imageCount, capabilities.minImageCount);
+    if (capabilities.maxImageCount != 0)
+        imageCount = std::min(imageCount, capabilities.maxImageCount);
+    return { presentMode, imageCount };
+}
+
 class VulkanSwapchain
 {
+    PresentConfiguration configuration_;
     vk::raii::SwapchainKHR swapchain_;
     std::vector<vk::Image> swapchainImages_;
     std::vector<vk::raii::ImageView> swapchainImageViews_;
@@ -18,8 +86,11 @@ public:
     VulkanSwapchain(const VulkanDevice& device,
                     const vk::SurfaceKHR& surface,
                     const vk::SurfaceFormatKHR& surfaceFormat,
-                    const vk::Extent2D& imageExtent)
-        : swapchain_(createSwapchain(device, surface, surfaceFormat, imageExtent))
+                    const vk::Extent2D& imageExtent,
+                    PresentPolicy policy = PresentPolicy::LowestLatency)
+        : configuration_(selectPresentConfiguration(policy, device.physicalDevice.getSurfacePresentModesKHR(surface),
+                                                    device.physicalDevice.getSurfaceCapabilitiesKHR(surface))),
+          swapchain_(createSwapchain(device, surface, surfaceFormat, imageExtent, configuration_))
     {
         swapchainImages_ = swapchain_.getImages();
         for (auto& image : swapchainImages_)
@@ -39,33 +110,24 @@ public:
         return imageValue;
     }
     const vk::raii::SwapchainKHR& getSwapchain() const noexcept { return swapchain_; }
+    vk::PresentModeKHR presentMode() const noexcept { return configuration_.presentMode; }
     size_t size() const noexcept { return swapchainImageViews_.size(); }
     const vk::raii::ImageView& getImageView(size_t index) const { return swapchainImageViews_.at(index); }
 private:
     static vk::raii::SwapchainKHR createSwapchain(const VulkanDevice& device,
                                                   const vk::SurfaceKHR& surface,
                                                   const vk::SurfaceFormatKHR& surfaceFormat,
-                                                  const vk::Extent2D& imageExtent)
+                                                  const vk::Extent2D& imageExtent,
+                                                  const PresentConfiguration& configuration)
     {
-        auto presentModes = device.physicalDevice.getSurfacePresentModesKHR(surface);
-        auto presentMode = vk::PresentModeKHR::eFifo;
-        for (auto& mode : presentModes)
-            if (mode == vk::PresentModeKHR::eMailbox)
-            {
-                presentMode = mode;
-                break;
-            }
         const auto surfaceCapabilities = device.physicalDevice.getSurfaceCapabilitiesKHR(surface);
-        uint32_t imageCount = 2;
-        if (surfaceCapabilities.maxImageCount != 0)
-            imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
         const vk::SwapchainCreateInfoKHR swapchainInfo(
             {}, surface,
-            imageCount, surfaceFormat.format, surfaceFormat.colorSpace,
+            configuration.imageCount, surfaceFormat.format, surfaceFormat.colorSpace,
             imageExtent, 1, vk::ImageUsageFlagBits::eColorAttachment,
             vk::SharingMode::eExclusive, {},
             surfaceCapabilities.currentTransform,
-            vk::CompositeAlphaFlagBitsKHR::eOpaque, presentMode,
+            vk::CompositeAlphaFlagBitsKHR::eOpaque, configuration.presentMode,
             false);
         return device.device.createSwapchainKHR(swapchainInfo);
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vk_types.h"
+#include "metrics.h"
 
 #include <chrono>
 #include <limits>
@@ -25,7 +26,15 @@ private:
     vk::UniqueSemaphore semaphore_;
     constexpr static auto semaphoreTypeInfo_ = vk::SemaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline);
 
-    [[nodiscard]] vk::Result wait(uint64_t value, uint64_t timeout) const { return device_.waitSemaphores(vk::SemaphoreWaitInfo{ {}, *semaphore_, value }, timeout); }
+    [[nodiscard]] vk::Result wait(uint64_t value, uint64_t timeout) const
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const vk::Result result = device_.waitSemaphores(vk::SemaphoreWaitInfo{ {}, *semaphore_, value }, timeout);
+        metrics::semaphoreWaits.add();
+        metrics::semaphoreWaitMicroseconds.add(gsl::narrow_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()));
+        return result;
+    }
 public:
     VulkanTimelineSemaphore(const vk::Device& device) :
         device_(device), semaphore_(device.createSemaphoreUnique({ {}, &semaphoreTypeInfo_ }))
@@ -0,0 +1,411 @@
+#pragma once
+
+#include "vk_types.h"
+#include "ktx2.h"
+#include "vk_buffer.h"
+#include "vk_deletion.h"
+#include "vk_device.h"
+#include "vk_image.h"
+#include "vk_memory.h"
+#include "vk_stream.h"
+#include "job_system.h"
+
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <optional>
+
+constexpr vk::ImageUsageFlags textureUsage =
+    vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
+
+/* Texture loaded from a KTX2 file by a VulkanTextureStreamer. Mips become resident smallest first; view() only
+ * covers the resident ones, so it can be sampled as soon as ready() is, at a lower resolution to begin with. Low-priority
+ * textures may lose their top mips again under memory pressure, so the view and image can change at any update(). */
+class VulkanTexture
+{
+    friend class VulkanTextureStreamer;
+
+    struct InFlightMip
+    {
+        uint32_t mip;
+        /* Empty for mips copied on the host, which are resident as soon as they are listed. */
+        std::optional<VulkanStreamEvent> event;
+    };
+
+    /* Released once every mip is resident. */
+    std::optional<MappedFile> file_;
+    std::optional<Ktx2Image> ktx_;
+    FormatBlockInfo block_;
+    /* Uploaded with host image copies rather than through staging buffers. */
+    bool hostCopy_;
+    MemoryPriority priority_;
+    VulkanImage<textureUsage> image_;
+    vk::raii::ImageView view_ = nullptr;
+    uint32_t residentMip_;
+    /* Lowest mip uploaded or being uploaded. */
+    uint32_t requestedMip_;
+    std::deque<InFlightMip> inFlight_;
+    /* Set by the memory manager, on whichever thread evicts, and acted on by the next update(). Shared with the eviction
+     * callback, which may still be running as the texture goes away. */
+    std::shared_ptr<std::atomic<bool>> evicted_ = std::make_shared<std::atomic<bool>>(false);
+    EvictionRegistration eviction_;
+
+    VulkanTexture(const VulkanDevice& device, MappedFile file, const FormatBlockInfo& block, MemoryPriority priority, bool hostCopy) :
+        file_(std::move(file)),
+        ktx_(file_->data()),
+        block_(block),
+        hostCopy_(hostCopy),
+        priority_(priority),
+        image_(device, ktx_->format(), ktx_->extent(),
+               ktx_->generateMips() ? getMipLevelCount(ktx_->extent()) : ktx_->levelCount(), priority,
+               hostCopy ? vk::ImageUsageFlags(vk::ImageUsageFlagBits::eHostTransferEXT) : vk::ImageUsageFlags()),
+        residentMip_(image_.mipLevels()),
+        requestedMip_(image_.mipLevels())
+    {}
+
+    /* The next mip to upload; mip 0 covers the whole chain when it is generated on the GPU. */
+    uint32_t nextMip_() const noexcept { return ktx_->generateMips() ? 0 : requestedMip_ - 1; }
+public:
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanTexture)
+
+    bool ready() const noexcept { return residentMip_ < image_.mipLevels(); }
+    bool fullyResident() const noexcept { return residentMip_ == 0; }
+    /* Highest-resolution mip that can be sampled, mipLevels() before the texture is ready. */
+    uint32_t residentMip() const noexcept { return residentMip_; }
+    uint32_t mipLevels() const noexcept { return image_.mipLevels(); }
+    /* Uploaded with VK_EXT_host_image_copy instead of staging buffers. */
+    bool hostCopy() const noexcept { return hostCopy_; }
+    /* For frames that sample the texture, so that eviction picks the textures unused the longest. */
+    void markUsed() const { eviction_.markUsed(); }
+    vk::ImageView view() const { Expects(ready()); return *view_; }
+    const VulkanImage<textureUsage>& image() const noexcept { return image_; }
+    /* For recording commands on the image, such as readbacks, on the stream that update() is given. */
+    VulkanImage<textureUsage>& image() noexcept { return image_; }
+};
+
+/* Streams textures from memory-mapped KTX2 files. Compressed payloads (BCn, ETC2, ASTC) are uploaded as they are,
+ * so they stay compressed in VRAM at 4 to 8 times less than RGBA8; files without mips get their chain generated on the
+ * GPU instead. Loading only parses the header, and update() uploads within a per-frame byte budget, smallest mips
+ * first, so that every texture becomes usable at low resolution quickly. Nothing ever waits on the GPU: staging
+ * buffers are reused once their copies have retired, and mips become resident when the update after that notices.
+ * With VK_EXT_host_image_copy, textures whose format allows it skip all that: their mips are copied straight from the
+ * mapped file into the image on the CPU, spread over the job system's workers when update() is given it, and become
+ * resident at the next update.
+ *
+ * Fully resident textures loaded with MemoryPriority::Low are registered with the memory manager as evictable, if their
+ * image has memory of its own, as freeing part of a shared block would free nothing. When their heap runs over budget,
+ * the next update() replaces such a texture's image with one holding only its mips from evictedMips_ on, copied over
+ * on the GPU: the texture keeps being sampled, at a quarter of the resolution and a sixteenth of the memory. */
+class VulkanTextureStreamer
+{
+    struct StagingBuffer
+    {
+        VulkanBuffer<vk::BufferUsageFlagBits::eTransferSrc, VulkanBufferType::Staging> buffer;
+        std::optional<VulkanStreamEvent> event;
+    };
+
+    struct Upload
+    {
+        VulkanTexture* texture;
+        uint32_t mip;
+        /* Into the staging buffer; empty for host copies. */
+        std::optional<vk::DeviceSize> offset;
+    };
+
+    constexpr static vk::DeviceSize minStagingSize_ = vk::DeviceSize(4) << 20;
+    /* Top mips an evicted texture loses. */
+    constexpr static uint32_t evictedMips_ = 2;
+
+    /* Where host copies leave mips, ready to sample. */
+    constexpr static vk::ImageLayout hostCopyLayout_ = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+    const VulkanDevice& device_;
+    bool hostCopyToShaderRead_ = false;
+    std::vector<std::shared_ptr<VulkanTexture>> streaming_;
+    std::vector<StagingBuffer> staging_;
+    std::vector<std::weak_ptr<VulkanTexture>> evictable_;
+
+    static bool canCopyToShaderRead_(const VulkanDevice& device)
+    {
+        if (!device.optionalFeatures.hostImageCopy)
+            return false;
+        auto properties = device.physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceHostImageCopyPropertiesEXT>();
+        auto& hostImageCopy = properties.get<vk::PhysicalDeviceHostImageCopyPropertiesEXT>();
+        std::vector<vk::ImageLayout> layouts(hostImageCopy.copyDstLayoutCount);
+        hostImageCopy.pCopyDstLayouts = layouts.data();
+        hostImageCopy.pCopySrcLayouts = nullptr;
+        hostImageCopy.copySrcLayoutCount = 0;
+        /* Again to fill in the layouts, which the raii wrapper can't. */
+        (*device.physicalDevice).getProperties2(&properties.get<vk::PhysicalDeviceProperties2>(), *device.physicalDevice.getDispatcher());
+        return std::ranges::find(layouts, hostCopyLayout_) != layouts.end();
+    }
+
+    /* Host copies need the format to support them, and a whole chain to copy, as mips can only be generated on the GPU. */
+    bool hostCopySupported_(const Ktx2Image& ktx) const
+    {
+        if (!hostCopyToShaderRead_ || ktx.generateMips())
+            return false;
+        const auto properties = device_.physicalDevice.getFormatProperties2<vk::FormatProperties2, vk::FormatProperties3>(ktx.format());
+        return static_cast<bool>(properties.get<vk::FormatProperties3>().optimalTilingFeatures & vk::FormatFeatureFlagBits2::eHostImageTransferEXT);
+    }
+
+    bool formatSupported_(const FormatBlockInfo& block) const noexcept
+    {
+        const VulkanOptionalFeatures& features = device_.optionalFeatures;
+        switch (block.compression)
+        {
+        case CompressionScheme::None:   return true;
+        case CompressionScheme::BC:     return features.textureCompressionBC;
+        case CompressionScheme::ETC2:   return features.textureCompressionETC2;
+        case CompressionScheme::ASTC:   return features.textureCompressionASTC;
+        }
+        return false;
+    }
+
+    /* Makes mips whose copies have retired resident, and stops tracking textures that are done or were dropped. */
+    void retire_(const VulkanStream& stream, VulkanDeletionQueue& deletionQueue)
+    {
+        for (auto& texture : streaming_)
+        {
+            const uint32_t residentMip = texture->residentMip_;
+            while (!texture->inFlight_.empty() && (!texture->inFlight_.front().event || texture->inFlight_.front().event->completed()))
+            {
+                texture->residentMip_ = texture->inFlight_.front().mip;
+                texture->inFlight_.pop_front();
+            }
+            if (texture->residentMip_ != residentMip)
+            {
+                /* Frames already submitted may still sample through the old view. */
+                if (*texture->view_)
+                    deletionQueue.defer(stream, std::move(texture->view_));
+                texture->view_ = texture->image_.createView(device_, texture->residentMip_, texture->mipLevels() - texture->residentMip_);
+            }
+            if (texture->fullyResident() && texture->file_)
+            {
+                texture->ktx_.reset();
+                texture->file_.reset();
+                if (registerEvictable_(*texture))
+                    evictable_.push_back(texture);
+            }
+        }
+        std::erase_if(streaming_, [&](std::shared_ptr<VulkanTexture>& texture)
+        {
+            if (texture.use_count() > 1)
+                return texture->fullyResident();
+            /* Nobody holds the texture anymore, but copies into it may be in flight. */
+            deletionQueue.defer(stream, std::move(texture));
+            return true;
+        });
+    }
+
+    bool registerEvictable_(VulkanTexture& texture)
+    {
+        const VulkanSubAllocation& memory = texture.image_.memory();
+        if (texture.priority_ != MemoryPriority::Low || !memory.dedicated() || texture.mipLevels() <= evictedMips_)
+            return false;
+        texture.eviction_ = device_.memory->registerEvictable(memory.allocation(), texture.priority_,
+                                                              [evicted = texture.evicted_] { evicted->store(true, std::memory_order_relaxed); });
+        return true;
+    }
+
+    /* Replaces the images of evicted textures with ones of their lower mips. The old images go once the frames that
+     * may sample them have retired. */
+    void shrinkEvicted_(VulkanStream& stream, const vk::Queue& queue, VulkanDeletionQueue& deletionQueue)
+    {
+        std::vector<std::shared_ptr<VulkanTexture>> evicted;
+        std::erase_if(evictable_, [&](const std::weak_ptr<VulkanTexture>& weakTexture)
+        {
+            auto texture = weakTexture.lock();
+            if (!texture || !texture->evicted_->exchange(false, std::memory_order_relaxed))
+                return !texture;
+            evicted.push_back(std::move(texture));
+            return true;
+        });
+        if (evicted.empty())
+            return;
+
+        std::vector<VulkanImage<textureUsage>> images;
+        images.reserve(evicted.size());
+        for (const auto& texture : evicted)
+        {
+            const VulkanImage<textureUsage>& image = texture->image_;
+            images.emplace_back(device_, image.format(), getMipExtent(image.extent(), evictedMips_), image.mipLevels() - evictedMips_, texture->priority_);
+        }
+        auto recorder = [&](const vk::CommandBuffer& commandBuffer)
+        {
+            for (size_t i = 0; i < evicted.size(); i++)
+            {
+                for (uint32_t mip = 0; mip < images[i].mipLevels(); mip++)
+                    images[i].recordCopyFromImage(commandBuffer, evicted[i]->image_, mip + evictedMips_, mip);
+                images[i].recordTransition(commandBuffer, vk::ImageLayout::eShaderReadOnlyOptimal);
+            }
+        };
+        stream.submitWork(queue, recorder);
+
+        for (size_t i = 0; i < evicted.size(); i++)
+        {
+            VulkanTexture& texture = *evicted[i];
+            texture.eviction_.reset();
+            deletionQueue.defer(stream, std::move(texture.view_));
+            deletionQueue.defer(stream, std::move(texture.image_));
+            texture.image_ = std::move(images[i]);
+            texture.view_ = texture.image_.createView(device_, 0, texture.mipLevels());
+            if (registerEvictable_(texture))
+                evictable_.push_back(evicted[i]);
+        }
+    }
+
+    /* Picks mips to upload within byteBudget, one per texture per round and least resident textures first. At least
+     * one mip goes every update, so that mips larger than the budget still make it. */
+    std::vector<Upload> schedule_(vk::DeviceSize byteBudget, vk::DeviceSize& totalSize)
+    {
+        std::vector<VulkanTexture*> candidates;
+        for (const auto& texture : streaming_)
+            if (texture->requestedMip_ > 0)
+                candidates.push_back(texture.get());
+        std::ranges::stable_sort(candidates, std::greater{}, [](const VulkanTexture* texture) { return texture->requestedMip_; });
+
+        std::vector<Upload> uploads;
+        totalSize = 0;
+        for (bool progress = true; progress;)
+        {
+            progress = false;
+            for (VulkanTexture* texture : candidates)
+            {
+                if (texture->requestedMip_ == 0)
+                    continue;
+                const uint32_t mip = texture->nextMip_();
+                /* copyBufferToImage wants offsets aligned to both 4 and the texel block size. Host copies don't use
+                 * staging, but count towards the budget all the same, as they take as long as the memcpy would. */
+                const vk::DeviceSize alignment = std::lcm(vk::DeviceSize(4), vk::DeviceSize(texture->block_.bytes));
+                const vk::DeviceSize offset = (totalSize + alignment - 1) / alignment * alignment;
+                const vk::DeviceSize size = texture->ktx_->level(mip).size();
+                if (!uploads.empty() && offset + size > byteBudget)
+                    continue;
+                uploads.push_back({ texture, mip, texture->hostCopy_ ? std::optional<vk::DeviceSize>() : offset });
+                texture->requestedMip_ = mip;
+                totalSize = offset + size;
+                progress = true;
+            }
+        }
+        return uploads;
+    }
+
+    StagingBuffer& checkOutStaging_(vk::DeviceSize size)
+    {
+        for (StagingBuffer& staging : staging_)
+            if (staging.buffer.size() >= size && (!staging.event || staging.event->completed()))
+                return staging;
+        return staging_.emplace_back(StagingBuffer{ { device_, std::max(size, minStagingSize_) }, std::nullopt });
+    }
+public:
+    explicit VulkanTextureStreamer(const VulkanDevice& device) : device_(device), hostCopyToShaderRead_(canCopyToShaderRead_(device)) {}
+    DECLARE_CONSTRUCTORS_MOVE_DELETED(VulkanTextureStreamer)
+
+    /* Maps and validates the file and creates the image; the data is uploaded by later update() calls. */
+    std::shared_ptr<VulkanTexture> load(const std::filesystem::path& path, MemoryPriority priority = MemoryPriority::Normal)
+    {
+        MappedFile file(path);
+        const Ktx2Image ktx(file.data());
+        const auto block = getFormatBlockInfo(ktx.format());
+        if (!block || !formatSupported_(*block))
+            throw FatalError("Texture format of " + path.string() + " is not supported by the device");
+        if (ktx.generateMips() && block->compression != CompressionScheme::None)
+            throw FatalError("Mips of compressed texture " + path.string() + " must be generated offline");
+        for (uint32_t mip = 0; mip < ktx.levelCount(); mip++)
+            if (ktx.level(mip).size() < getMipSize(*block, ktx.extent(), mip))
+                throw FatalError("Truncated mip level in " + path.string());
+
+        const bool hostCopy = hostCopySupported_(ktx);
+        auto texture = std::shared_ptr<VulkanTexture>(new VulkanTexture(device_, std::move(file), *block, priority, hostCopy));
+        texture->file_->prefetch(texture->ktx_->level(texture->nextMip_()));
+        streaming_.push_back(texture);
+        return texture;
+    }
+
+    /* Once per frame, on the stream that samples the textures, before recording the frame's draws. With jobs, host
+     * copies run on its workers; this waits for them either way. */
+    void update(VulkanStream& stream, const vk::Queue& queue, VulkanDeletionQueue& deletionQueue,
+                vk::DeviceSize byteBudget = vk::DeviceSize(8) << 20, JobSystem* jobs = nullptr)
+    {
+        shrinkEvicted_(stream, queue, deletionQueue);
+        retire_(stream, deletionQueue);
+        vk::DeviceSize totalSize = 0;
+        const std::vector<Upload> uploads = schedule_(byteBudget, totalSize);
+        if (uploads.empty())
+            return;
+
+        std::vector<Upload> hostUploads;
+        std::vector<Upload> stagedUploads;
+        vk::DeviceSize stagingSize = 0;
+        for (const Upload& upload : uploads)
+        {
+            if (!upload.offset)
+            {
+                hostUploads.push_back(upload);
+                continue;
+            }
+            stagedUploads.push_back(upload);
+            stagingSize = *upload.offset + upload.texture->ktx_->level(upload.mip).size();
+        }
+
+        const auto copyOnHost = [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const Upload& upload = hostUploads[i];
+                upload.texture->image_.copyFromHost(device_, upload.texture->ktx_->level(upload.mip), upload.mip, hostCopyLayout_);
+            }
+        };
+        if (jobs && hostUploads.size() > 1)
+            jobs->parallelFor(hostUploads.size(), 1, copyOnHost);
+        else
+            copyOnHost(0, hostUploads.size());
+        for (const Upload& upload : hostUploads)
+            upload.texture->inFlight_.push_back({ upload.mip, std::nullopt });
+
+        if (!stagedUploads.empty())
+        {
+            StagingBuffer& staging = checkOutStaging_(stagingSize);
+            const gsl::span<std::byte> mapped = staging.buffer.mapped();
+            for (const Upload& upload : stagedUploads)
+            {
+                const auto level = upload.texture->ktx_->level(upload.mip);
+                std::ranges::copy(level, mapped.subspan(gsl::narrow<size_t>(*upload.offset)).begin());
+            }
+
+            auto recorder = [&](const vk::CommandBuffer& commandBuffer)
+            {
+                for (const Upload& upload : stagedUploads)
+                {
+                    auto& image = upload.texture->image_;
+                    const vk::DeviceSize size = getMipSize(upload.texture->block_, image.extent(), upload.mip);
+                    Expects(*upload.offset + size <= staging.buffer.size());
+                    image.recordCopyFromBuffer(commandBuffer, staging.buffer, *upload.offset, upload.mip);
+                    if (upload.texture->ktx_->generateMips())
+                        image.recordGenerateMips(commandBuffer, upload.mip);
+                    else
+                        image.recordTransition(commandBuffer, vk::ImageLayout::eShaderReadOnlyOptimal, upload.mip, 1);
+                }
+            };
+            stream.submitWork(queue, recorder);
+
+            const VulkanStreamEvent event = stream.getLastEvent();
+            staging.event.emplace(event);
+            for (const Upload& upload : stagedUploads)
+                upload.texture->inFlight_.push_back({ upload.mip, event });
+        }
+        for (const Upload& upload : uploads)
+        {
+            /* Get the next mip's pages in from disk while this one is copied. */
+            VulkanTexture& texture = *upload.texture;
+            if (texture.requestedMip_ > 0)
+                texture.file_->prefetch(texture.ktx_->level(texture.nextMip_()));
+        }
+    }
+
+    /* Textures with mips still to upload. */
+    size_t pending() const noexcept { return streaming_.size(); }
+};
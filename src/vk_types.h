@@ -305,31 +305,4 @@ struct VulkanQueueInfo
         : familyIndex(familyIndex_), index(index_), queue(std::move(queue_)) {}
 };
 
-struct VertexInfo
-{
-private:
-    std::vector<vk::VertexInputBindingDescription> bindings_;
-    std::vector<vk::VertexInputAttributeDescription> attributes_;
-public:
-    vk::PipelineVertexInputStateCreateInfo info;
-
-    VertexInfo(std::vector<vk::VertexInputBindingDescription>&& bindings,
-               std::vector<vk::VertexInputAttributeDescription>&& attributes)
-        : bindings_(std::move(bindings)), attributes_(std::move(attributes)), info({}, bindings_, attributes_)
-    {}
-};
-
 #define VULKAN_offsetof(s, m) gsl::narrow<uint32_t>(offsetof(s, m))
-
-struct SimpleVertex
-{
-    glm::vec3 position;
-    glm::vec3 color;
-
-    static VertexInfo getVertexInputInfo()
-    {
-        return VertexInfo({ { 0, sizeof(SimpleVertex) } },
-                          { { 0, 0, vk::Format::eR32G32B32Sfloat, VULKAN_offsetof(SimpleVertex, position) },
-                            { 1, 0, vk::Format::eR32G32B32Sfloat, VULKAN_offsetof(SimpleVertex, color) } });
-    }
-};
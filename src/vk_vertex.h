@@ -0,0 +1,334 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+/* CPU-side encoders for packed vertex attributes. Everything here is constexpr so that static vertex data can be
+ * quantized at compile time. */
+namespace vertex_encoding
+{
+
+constexpr float clamp(float value, float low, float high) noexcept { return value < low ? low : (value > high ? high : value); }
+constexpr int32_t roundToInt(float value) noexcept { return static_cast<int32_t>(value >= 0.0f ? value + 0.5f : value - 0.5f); }
+constexpr float abs(float value) noexcept { return value < 0.0f ? -value : value; }
+constexpr float signNotZero(float value) noexcept { return value < 0.0f ? -1.0f : 1.0f; }
+
+/* IEEE 754 binary32 to binary16, rounding to nearest even. */
+constexpr uint16_t encodeHalf(float value) noexcept
+{
+    const uint32_t bits = std::bit_cast<uint32_t>(value);
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t exponent = (bits >> 23) & 0xffu;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (exponent == 0xffu) // Inf and NaN
+        return static_cast<uint16_t>(sign | 0x7c00u | (mantissa != 0u ? 0x200u : 0u));
+
+    const int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if (halfExponent >= 0x1f)
+        return static_cast<uint16_t>(sign | 0x7c00u);
+    if (halfExponent <= 0)
+    {
+        /* Result is a half subnormal (or flushes to signed zero). */
+        if (halfExponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000u;
+        const uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+        const uint32_t halfway = 1u << (shift - 1u);
+        if (remainder > halfway || (remainder == halfway && (half & 1u) != 0u))
+            half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fffu;
+    /* A carry out of the mantissa correctly bumps the exponent, up to infinity. */
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u) != 0u))
+        half++;
+    return static_cast<uint16_t>(sign | half);
+}
+
+constexpr float decodeHalf(uint16_t half) noexcept
+{
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1fu;
+    uint32_t mantissa = half & 0x3ffu;
+
+    if (exponent == 0x1fu)
+        return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+    if (exponent == 0u)
+    {
+        if (mantissa == 0u)
+            return std::bit_cast<float>(sign);
+        /* Renormalize the half subnormal. */
+        uint32_t floatExponent = 127 - 15 + 1;
+        while ((mantissa & 0x400u) == 0u)
+        {
+            mantissa <<= 1;
+            floatExponent--;
+        }
+        return std::bit_cast<float>(sign | (floatExponent << 23) | ((mantissa & 0x3ffu) << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+}
+
+constexpr int16_t encodeSnorm16(float value) noexcept { return static_cast<int16_t>(roundToInt(clamp(value, -1.0f, 1.0f) * 32767.0f)); }
+constexpr int8_t encodeSnorm8(float value) noexcept { return static_cast<int8_t>(roundToInt(clamp(value, -1.0f, 1.0f) * 127.0f)); }
+constexpr uint8_t encodeUnorm8(float value) noexcept { return static_cast<uint8_t>(roundToInt(clamp(value, 0.0f, 1.0f) * 255.0f)); }
+
+/* Octahedral mapping of a unit vector onto [-1, 1]^2. Decode in GLSL with:
+ *     vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+ *     float t = max(-n.z, 0.0);
+ *     n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+ *     n = normalize(n);
+ */
+constexpr std::array<float, 2> encodeOctahedral(const glm::vec3& normal) noexcept
+{
+    const float l1Norm = abs(normal.x) + abs(normal.y) + abs(normal.z);
+    if (l1Norm == 0.0f)
+        return { 0.0f, 0.0f };
+    const float x = normal.x / l1Norm;
+    const float y = normal.y / l1Norm;
+    if (normal.z >= 0.0f)
+        return { x, y };
+    return { (1.0f - abs(y)) * signNotZero(x), (1.0f - abs(x)) * signNotZero(y) };
+}
+
+}
+
+/* Packed attribute types. Each one has a matching VertexAttributeTraits specialization below. */
+
+/* Four half floats. Three-component 16-bit formats are poorly supported as vertex inputs, so xyz positions are padded
+ * with w = 1. */
+struct PackedHalf4
+{
+    std::array<uint16_t, 4> bits;
+
+    constexpr static PackedHalf4 encode(const glm::vec4& value) noexcept
+    {
+        using vertex_encoding::encodeHalf;
+        return { { encodeHalf(value.x), encodeHalf(value.y), encodeHalf(value.z), encodeHalf(value.w) } };
+    }
+    constexpr static PackedHalf4 encode(const glm::vec3& value) noexcept { return encode(glm::vec4(value, 1.0f)); }
+    constexpr glm::vec3 decode() const noexcept
+    {
+        using vertex_encoding::decodeHalf;
+        return { decodeHalf(bits[0]), decodeHalf(bits[1]), decodeHalf(bits[2]) };
+    }
+};
+
+struct PackedHalf2
+{
+    std::array<uint16_t, 2> bits;
+
+    constexpr static PackedHalf2 encode(const glm::vec2& value) noexcept
+    {
+        using vertex_encoding::encodeHalf;
+        return { { encodeHalf(value.x), encodeHalf(value.y) } };
+    }
+};
+
+/* Octahedral-encoded unit vector. Needs decoding in the shader, see vertex_encoding::encodeOctahedral. */
+struct PackedOctahedral16
+{
+    std::array<int16_t, 2> bits;
+
+    constexpr static PackedOctahedral16 encode(const glm::vec3& normal) noexcept
+    {
+        using vertex_encoding::encodeSnorm16;
+        const auto [x, y] = vertex_encoding::encodeOctahedral(normal);
+        return { { encodeSnorm16(x), encodeSnorm16(y) } };
+    }
+};
+
+/* Signed normalized xyz with a padding byte. Can be consumed by the shader as a vec3 directly. */
+struct PackedSnorm8x4
+{
+    std::array<int8_t, 4> bits;
+
+    constexpr static PackedSnorm8x4 encode(const glm::vec3& value) noexcept
+    {
+        using vertex_encoding::encodeSnorm8;
+        return { { encodeSnorm8(value.x), encodeSnorm8(value.y), encodeSnorm8(value.z), 0 } };
+    }
+};
+
+struct PackedColor
+{
+    std::array<uint8_t, 4> bits;
+
+    constexpr static PackedColor encode(const glm::vec4& color) noexcept
+    {
+        using vertex_encoding::encodeUnorm8;
+        return { { encodeUnorm8(color.x), encodeUnorm8(color.y), encodeUnorm8(color.z), encodeUnorm8(color.w) } };
+    }
+    constexpr static PackedColor encode(const glm::vec3& color) noexcept { return encode(glm::vec4(color, 1.0f)); }
+};
+
+/* Maps a C++ attribute type to its Vulkan format. Types wider than one location (e.g. matrices) span locationCount
+ * consecutive locations, locationStride bytes apart. */
+template <typename T>
+struct VertexAttributeTraits;
+
+template <vk::Format Format, uint32_t LocationCount = 1, uint32_t LocationStride = 0>
+struct VertexAttributeTraitsBase
+{
+    constexpr static vk::Format format = Format;
+    constexpr static uint32_t locationCount = LocationCount;
+    constexpr static uint32_t locationStride = LocationStride;
+};
+
+template <> struct VertexAttributeTraits<float>              : VertexAttributeTraitsBase<vk::Format::eR32Sfloat> {};
+template <> struct VertexAttributeTraits<glm::vec2>          : VertexAttributeTraitsBase<vk::Format::eR32G32Sfloat> {};
+template <> struct VertexAttributeTraits<glm::vec3>          : VertexAttributeTraitsBase<vk::Format::eR32G32B32Sfloat> {};
+template <> struct VertexAttributeTraits<glm::vec4>          : VertexAttributeTraitsBase<vk::Format::eR32G32B32A32Sfloat> {};
+template <> struct VertexAttributeTraits<uint32_t>           : VertexAttributeTraitsBase<vk::Format::eR32Uint> {};
+template <> struct VertexAttributeTraits<glm::mat4>          : VertexAttributeTraitsBase<vk::Format::eR32G32B32A32Sfloat, 4, sizeof(glm::vec4)> {};
+template <> struct VertexAttributeTraits<PackedHalf4>        : VertexAttributeTraitsBase<vk::Format::eR16G16B16A16Sfloat> {};
+template <> struct VertexAttributeTraits<PackedHalf2>        : VertexAttributeTraitsBase<vk::Format::eR16G16Sfloat> {};
+template <> struct VertexAttributeTraits<PackedOctahedral16> : VertexAttributeTraitsBase<vk::Format::eR16G16Snorm> {};
+template <> struct VertexAttributeTraits<PackedSnorm8x4>     : VertexAttributeTraitsBase<vk::Format::eR8G8B8A8Snorm> {};
+template <> struct VertexAttributeTraits<PackedColor>        : VertexAttributeTraitsBase<vk::Format::eR8G8B8A8Unorm> {};
+
+template <typename T>
+concept VertexAttributeType = requires
+{
+    { VertexAttributeTraits<T>::format } -> std::convertible_to<vk::Format>;
+};
+
+struct VertexAttribute
+{
+    vk::Format format;
+    uint32_t offset;
+    uint32_t locationCount;
+    uint32_t locationStride;
+};
+
+template <VertexAttributeType T>
+constexpr VertexAttribute makeVertexAttribute(size_t offset) noexcept
+{
+    using Traits = VertexAttributeTraits<T>;
+    return { Traits::format, static_cast<uint32_t>(offset), Traits::locationCount, Traits::locationStride };
+}
+
+/* Use inside a vertex struct's getVertexAttributes(), where the struct is complete. */
+#define VERTEX_ATTRIBUTE(s, m) makeVertexAttribute<decltype(s::m)>(offsetof(s, m))
+
+/* A vertex struct describes one binding. It may declare a static inputRate, otherwise it is per-vertex. */
+template <typename T>
+concept VertexType = std::is_standard_layout_v<T> && requires
+{
+    { T::getVertexAttributes() } -> Array;
+    as_constexpr(T::getVertexAttributes());
+};
+
+template <VertexType T>
+constexpr vk::VertexInputRate vertexInputRate() noexcept
+{
+    if constexpr (requires { T::inputRate; })
+        return T::inputRate;
+    else
+        return vk::VertexInputRate::eVertex;
+}
+
+/* Compile-time vertex input state. Each vertex struct becomes one binding, numbered in order, and attribute locations
+ * are assigned consecutively across all bindings. */
+template <VertexType... Bindings>
+struct VertexLayout
+{
+private:
+    template <VertexType T>
+    constexpr static uint32_t locationCount_()
+    {
+        uint32_t count = 0;
+        for (const VertexAttribute& attribute : T::getVertexAttributes())
+            count += attribute.locationCount;
+        return count;
+    }
+public:
+    constexpr static uint32_t locationCount = (locationCount_<Bindings>() + ... + 0u);
+
+    constexpr static std::array<vk::VertexInputBindingDescription, sizeof...(Bindings)> bindings = []
+    {
+        std::array<vk::VertexInputBindingDescription, sizeof...(Bindings)> out{};
+        uint32_t binding = 0;
+        ((out[binding] = vk::VertexInputBindingDescription(binding, static_cast<uint32_t>(sizeof(Bindings)), vertexInputRate<Bindings>()),
+          binding++), ...);
+        return out;
+    }();
+
+    constexpr static std::array<vk::VertexInputAttributeDescription, locationCount> attributes = []
+    {
+        std::array<vk::VertexInputAttributeDescription, locationCount> out{};
+        uint32_t binding = 0;
+        uint32_t location = 0;
+        ([&]()
+        {
+            for (const VertexAttribute& attribute : Bindings::getVertexAttributes())
+                for (uint32_t i = 0; i < attribute.locationCount; i++, location++)
+                    out[location] = vk::VertexInputAttributeDescription(
+                        location, binding, attribute.format, attribute.offset + i * attribute.locationStride);
+            binding++;
+        }(), ...);
+        return out;
+    }();
+
+    constexpr static vk::PipelineVertexInputStateCreateInfo info = vk::PipelineVertexInputStateCreateInfo(
+        {}, static_cast<uint32_t>(bindings.size()), bindings.data(), static_cast<uint32_t>(attributes.size()), attributes.data());
+};
+
+/* How a pipeline's vertex shader gets the mesh's vertices: from attributes of a vertex buffer bound to binding 0, or
+ * by pulling them through a buffer device address, with no vertex buffer bound. */
+enum class VertexInput
+{
+    Attributes,
+    Pulled,
+};
+
+struct SimpleVertex
+{
+    glm::vec3 position;
+    glm::vec3 color;
+
+    constexpr static auto getVertexAttributes()
+    {
+        return std::array{ VERTEX_ATTRIBUTE(SimpleVertex, position), VERTEX_ATTRIBUTE(SimpleVertex, color) };
+    }
+};
+
+/* Quantized counterpart of SimpleVertex at half the size. Binary compatible with the same vertex shader inputs. */
+struct PackedVertex
+{
+    PackedHalf4 position;
+    PackedColor color;
+
+    constexpr static PackedVertex encode(const SimpleVertex& vertex) noexcept
+    {
+        return { PackedHalf4::encode(vertex.position), PackedColor::encode(vertex.color) };
+    }
+    constexpr static auto getVertexAttributes()
+    {
+        return std::array{ VERTEX_ATTRIBUTE(PackedVertex, position), VERTEX_ATTRIBUTE(PackedVertex, color) };
+    }
+};
+static_assert(sizeof(PackedVertex) * 2 == sizeof(SimpleVertex));
+
+/* Per-instance attributes for instanced draws, in a second binding after the mesh's vertices: a model transform and a
+ * color that tints the mesh's vertex colors. */
+struct InstanceData
+{
+    glm::mat4 transform;
+    PackedColor color;
+
+    constexpr static vk::VertexInputRate inputRate = vk::VertexInputRate::eInstance;
+    constexpr static auto getVertexAttributes()
+    {
+        return std::array{ VERTEX_ATTRIBUTE(InstanceData, transform), VERTEX_ATTRIBUTE(InstanceData, color) };
+    }
+};
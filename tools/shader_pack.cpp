@@ -0,0 +1,468 @@
+#include "shader_pack_format.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Packs compiled SPIR-V modules into one shader archive for ShaderArchive, with the reflection data the runtime
+ * validates pipeline layouts against. Modules are named after their file names without extension:
+ *     shader-pack <archive> <module.spv>... */
+
+namespace
+{
+
+/* The little of SPIR-V that reflection needs. */
+namespace spirv
+{
+
+constexpr uint32_t magic = 0x07230203;
+constexpr size_t headerWords = 5;
+
+enum Op : uint16_t
+{
+    OpEntryPoint = 15,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+};
+
+enum Decoration : uint32_t
+{
+    BufferBlock = 3,
+    ArrayStride = 6,
+    MatrixStride = 7,
+    BuiltIn = 11,
+    Location = 30,
+    Binding = 33,
+    DescriptorSet = 34,
+    Offset = 35,
+};
+
+enum StorageClass : uint32_t
+{
+    UniformConstant = 0,
+    Input = 1,
+    Uniform = 2,
+    PushConstant = 9,
+    StorageBuffer = 12,
+    PhysicalStorageBuffer = 5349,
+};
+
+enum Dim : uint32_t
+{
+    DimBuffer = 5,
+    DimSubpassData = 6,
+};
+
+}
+
+struct Type
+{
+    uint16_t op = 0;
+    std::vector<uint32_t> operands; // Without the result id
+};
+
+struct Member
+{
+    uint32_t offset = 0;
+    std::optional<uint32_t> matrixStride;
+};
+
+struct Reflection
+{
+    shader_pack::Stage stage = shader_pack::Stage::Vertex;
+    uint32_t pushConstantSize = 0;
+    std::vector<shader_pack::VertexInput> vertexInputs;
+    std::vector<shader_pack::DescriptorBinding> descriptorBindings;
+};
+
+class Reflector
+{
+    std::map<uint32_t, Type> types_;
+    std::map<uint32_t, uint32_t> constants_;
+    std::map<uint32_t, uint32_t> arrayStrides_;
+    std::map<uint32_t, uint32_t> locations_;
+    std::set<uint32_t> builtIns_;
+    std::set<uint32_t> bufferBlocks_;
+    std::map<uint32_t, uint32_t> descriptorSets_;
+    std::map<uint32_t, uint32_t> bindings_;
+    std::map<std::pair<uint32_t, uint32_t>, Member> members_;
+    /* Pointer type and storage class of every variable. */
+    std::map<uint32_t, std::pair<uint32_t, uint32_t>> variables_;
+
+    const Type& type_(uint32_t id) const
+    {
+        const auto found = types_.find(id);
+        if (found == types_.end())
+            throw std::runtime_error("Reference to unknown type " + std::to_string(id));
+        return found->second;
+    }
+
+    /* Size in bytes as laid out by the explicit offsets and strides of a push constant block. */
+    uint32_t size_(uint32_t id, std::optional<uint32_t> matrixStride = std::nullopt) const
+    {
+        const Type& type = type_(id);
+        switch (type.op)
+        {
+        case spirv::OpTypeInt:
+        case spirv::OpTypeFloat:
+            return type.operands.at(0) / 8;
+        case spirv::OpTypeVector:
+            return type.operands.at(1) * size_(type.operands.at(0));
+        case spirv::OpTypeMatrix:
+            return type.operands.at(1) * matrixStride.value_or(size_(type.operands.at(0)));
+        case spirv::OpTypeArray:
+        {
+            const uint32_t length = constants_.at(type.operands.at(1));
+            const auto stride = arrayStrides_.find(id);
+            return length * (stride != arrayStrides_.end() ? stride->second : size_(type.operands.at(0)));
+        }
+        case spirv::OpTypeStruct:
+        {
+            uint32_t end = 0;
+            for (uint32_t member = 0; member < type.operands.size(); member++)
+            {
+                const auto found = members_.find({ id, member });
+                const Member layout = found != members_.end() ? found->second : Member{};
+                end = std::max(end, layout.offset + size_(type.operands[member], layout.matrixStride));
+            }
+            return end;
+        }
+        case spirv::OpTypePointer:
+            /* A buffer reference, i.e. a device address. */
+            if (type.operands.at(0) == spirv::PhysicalStorageBuffer)
+                return sizeof(uint64_t);
+            throw std::runtime_error("Unsupported pointer in a push constant block");
+        default:
+            throw std::runtime_error("Unsupported type in a push constant block");
+        }
+    }
+
+    /* Type and array length of a resource variable of storageClass whose type, with arrays, is typeId. */
+    shader_pack::DescriptorBinding descriptorBinding_(uint32_t storageClass, uint32_t typeId) const
+    {
+        using enum shader_pack::DescriptorType;
+        const Type* type = &type_(typeId);
+        uint32_t count = 1;
+        if (type->op == spirv::OpTypeRuntimeArray)
+            throw std::runtime_error("Unsupported unbounded descriptor array");
+        if (type->op == spirv::OpTypeArray)
+        {
+            count = constants_.at(type->operands.at(1));
+            typeId = type->operands.at(0);
+            type = &type_(typeId);
+        }
+        const auto binding = [&](shader_pack::DescriptorType descriptorType) { return shader_pack::DescriptorBinding{ 0, 0, descriptorType, count }; };
+        if (storageClass == spirv::StorageBuffer)
+            return binding(StorageBuffer);
+        if (storageClass == spirv::Uniform)
+            return binding(bufferBlocks_.contains(typeId) ? StorageBuffer : UniformBuffer);
+        switch (type->op)
+        {
+        case spirv::OpTypeSampler:
+            return binding(Sampler);
+        case spirv::OpTypeSampledImage:
+            return binding(CombinedImageSampler);
+        case spirv::OpTypeImage:
+        {
+            const uint32_t dim = type->operands.at(1);
+            const bool sampled = type->operands.at(5) == 1;
+            if (dim == spirv::DimSubpassData)
+                return binding(InputAttachment);
+            if (dim == spirv::DimBuffer)
+                return binding(sampled ? UniformTexelBuffer : StorageTexelBuffer);
+            return binding(sampled ? SampledImage : StorageImage);
+        }
+        default:
+            throw std::runtime_error("Unsupported descriptor type");
+        }
+    }
+
+    void addVertexInput_(std::vector<shader_pack::VertexInput>& inputs, uint32_t location, uint32_t typeId) const
+    {
+        const Type& type = type_(typeId);
+        switch (type.op)
+        {
+        case spirv::OpTypeInt:
+            inputs.push_back({ location, type.operands.at(1) != 0 ? shader_pack::ComponentType::Sint : shader_pack::ComponentType::Uint, 1 });
+            return;
+        case spirv::OpTypeFloat:
+            inputs.push_back({ location, shader_pack::ComponentType::Float, 1 });
+            return;
+        case spirv::OpTypeVector:
+        {
+            const size_t first = inputs.size();
+            addVertexInput_(inputs, location, type.operands.at(0));
+            inputs[first].componentCount = type.operands.at(1);
+            return;
+        }
+        case spirv::OpTypeMatrix:
+            for (uint32_t column = 0; column < type.operands.at(1); column++)
+                addVertexInput_(inputs, location + column, type.operands.at(0));
+            return;
+        case spirv::OpTypeArray:
+        {
+            const uint32_t length = constants_.at(type.operands.at(1));
+            for (uint32_t i = 0; i < length; i++)
+            {
+                const size_t first = inputs.size();
+                addVertexInput_(inputs, location, type.operands.at(0));
+                location += static_cast<uint32_t>(inputs.size() - first);
+            }
+            return;
+        }
+        default:
+            throw std::runtime_error("Unsupported vertex input type");
+        }
+    }
+public:
+    Reflection reflect(std::span<const uint32_t> words)
+    {
+        if (words.size() < spirv::headerWords || words[0] != spirv::magic)
+            throw std::runtime_error("Not a SPIR-V module");
+        std::optional<shader_pack::Stage> stage;
+        for (size_t i = spirv::headerWords; i < words.size();)
+        {
+            const uint32_t wordCount = words[i] >> 16;
+            const auto op = static_cast<uint16_t>(words[i] & 0xffff);
+            if (wordCount == 0 || i + wordCount > words.size())
+                throw std::runtime_error("Truncated SPIR-V instruction");
+            const auto operands = words.subspan(i + 1, wordCount - 1);
+            switch (op)
+            {
+            case spirv::OpEntryPoint:
+                if (!stage)
+                    stage = static_cast<shader_pack::Stage>(operands[0]);
+                break;
+            case spirv::OpTypeInt:
+            case spirv::OpTypeFloat:
+            case spirv::OpTypeVector:
+            case spirv::OpTypeMatrix:
+            case spirv::OpTypeImage:
+            case spirv::OpTypeSampler:
+            case spirv::OpTypeSampledImage:
+            case spirv::OpTypeArray:
+            case spirv::OpTypeRuntimeArray:
+            case spirv::OpTypeStruct:
+            case spirv::OpTypePointer:
+                types_[operands[0]] = { op, { operands.begin() + 1, operands.end() } };
+                break;
+            case spirv::OpConstant:
+                constants_[operands[1]] = operands[2];
+                break;
+            case spirv::OpVariable:
+                variables_[operands[1]] = { operands[0], operands[2] };
+                break;
+            case spirv::OpDecorate:
+                if (operands[1] == spirv::ArrayStride)
+                    arrayStrides_[operands[0]] = operands[2];
+                else if (operands[1] == spirv::Location)
+                    locations_[operands[0]] = operands[2];
+                else if (operands[1] == spirv::BuiltIn)
+                    builtIns_.insert(operands[0]);
+                else if (operands[1] == spirv::BufferBlock)
+                    bufferBlocks_.insert(operands[0]);
+                else if (operands[1] == spirv::DescriptorSet)
+                    descriptorSets_[operands[0]] = operands[2];
+                else if (operands[1] == spirv::Binding)
+                    bindings_[operands[0]] = operands[2];
+                break;
+            case spirv::OpMemberDecorate:
+                if (operands[2] == spirv::Offset)
+                    members_[{ operands[0], operands[1] }].offset = operands[3];
+                else if (operands[2] == spirv::MatrixStride)
+                    members_[{ operands[0], operands[1] }].matrixStride = operands[3];
+                break;
+            default:
+                break;
+            }
+            i += wordCount;
+        }
+        if (!stage)
+            throw std::runtime_error("SPIR-V module without an entry point");
+
+        Reflection reflection;
+        reflection.stage = *stage;
+        for (const auto& [id, variable] : variables_)
+        {
+            const auto [pointerType, storageClass] = variable;
+            const uint32_t pointee = type_(pointerType).operands.at(1);
+            if (storageClass == spirv::PushConstant)
+                reflection.pushConstantSize = std::max(reflection.pushConstantSize, size_(pointee));
+            else if (storageClass == spirv::Input && *stage == shader_pack::Stage::Vertex && !builtIns_.contains(id))
+            {
+                const auto location = locations_.find(id);
+                if (location == locations_.end())
+                    throw std::runtime_error("Vertex input without a location");
+                addVertexInput_(reflection.vertexInputs, location->second, pointee);
+            }
+            else if (storageClass == spirv::UniformConstant || storageClass == spirv::Uniform || storageClass == spirv::StorageBuffer)
+            {
+                const auto binding = bindings_.find(id);
+                if (binding == bindings_.end())
+                    throw std::runtime_error("Resource without a binding");
+                shader_pack::DescriptorBinding descriptor = descriptorBinding_(storageClass, pointee);
+                const auto set = descriptorSets_.find(id);
+                descriptor.set = set != descriptorSets_.end() ? set->second : 0;
+                descriptor.binding = binding->second;
+                reflection.descriptorBindings.push_back(descriptor);
+            }
+        }
+        std::ranges::sort(reflection.vertexInputs, {}, &shader_pack::VertexInput::location);
+        std::ranges::sort(reflection.descriptorBindings, {}, [](const shader_pack::DescriptorBinding& descriptor)
+        {
+            return std::pair(descriptor.set, descriptor.binding);
+        });
+        return reflection;
+    }
+};
+
+std::vector<uint32_t> readSpirv(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Failed to open " + path.string());
+    const auto size = static_cast<size_t>(file.tellg());
+    if (size % sizeof(uint32_t) != 0)
+        throw std::runtime_error(path.string() + " is not a whole number of SPIR-V words");
+    std::vector<uint32_t> words(size / sizeof(uint32_t));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(words.data()), static_cast<std::streamsize>(size));
+    return words;
+}
+
+struct Input
+{
+    std::string name;
+    std::vector<uint32_t> code;
+    Reflection reflection;
+};
+
+template <typename T>
+void append(std::vector<std::byte>& archive, std::span<const T> values)
+{
+    const auto bytes = std::as_bytes(values);
+    archive.insert(archive.end(), bytes.begin(), bytes.end());
+}
+
+std::vector<std::byte> pack(const std::vector<Input>& inputs)
+{
+    const auto moduleCount = static_cast<uint32_t>(inputs.size());
+    const uint32_t bucketCount = std::bit_ceil(std::max(moduleCount * 2, 2u));
+    std::vector<uint32_t> buckets(bucketCount, shader_pack::emptyBucket);
+    std::vector<shader_pack::Module> modules(moduleCount);
+    std::vector<shader_pack::VertexInput> vertexInputs;
+    std::vector<shader_pack::DescriptorBinding> descriptorBindings;
+    for (uint32_t i = 0; i < moduleCount; i++)
+    {
+        const Input& input = inputs[i];
+        const uint64_t hash = shader_pack::hashName(input.name);
+        for (const shader_pack::Module& other : std::span(modules).first(i))
+            if (other.nameHash == hash)
+                throw std::runtime_error("Two shaders hash alike or share the name " + input.name);
+        uint32_t bucket = static_cast<uint32_t>(hash) & (bucketCount - 1);
+        while (buckets[bucket] != shader_pack::emptyBucket)
+            bucket = (bucket + 1) & (bucketCount - 1);
+        buckets[bucket] = i;
+        modules[i] = { hash, 0, static_cast<uint32_t>(input.name.size()), 0, static_cast<uint32_t>(input.code.size() * sizeof(uint32_t)),
+                       input.reflection.stage, input.reflection.pushConstantSize, static_cast<uint32_t>(vertexInputs.size()),
+                       static_cast<uint32_t>(input.reflection.vertexInputs.size()), static_cast<uint32_t>(descriptorBindings.size()),
+                       static_cast<uint32_t>(input.reflection.descriptorBindings.size()) };
+        vertexInputs.insert(vertexInputs.end(), input.reflection.vertexInputs.begin(), input.reflection.vertexInputs.end());
+        descriptorBindings.insert(descriptorBindings.end(), input.reflection.descriptorBindings.begin(), input.reflection.descriptorBindings.end());
+    }
+
+    /* Offsets of the variable-size parts follow from the fixed-size ones. */
+    size_t offset = sizeof(shader_pack::Header) + buckets.size() * sizeof(uint32_t) + modules.size() * sizeof(shader_pack::Module) +
+                    vertexInputs.size() * sizeof(shader_pack::VertexInput) + descriptorBindings.size() * sizeof(shader_pack::DescriptorBinding);
+    for (uint32_t i = 0; i < moduleCount; i++)
+    {
+        modules[i].nameOffset = static_cast<uint32_t>(offset);
+        offset += inputs[i].name.size();
+    }
+    offset = (offset + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    const size_t codeStart = offset;
+    for (uint32_t i = 0; i < moduleCount; i++)
+    {
+        modules[i].codeOffset = static_cast<uint32_t>(offset);
+        offset += modules[i].codeSize;
+    }
+
+    std::vector<std::byte> archive;
+    archive.reserve(offset);
+    const shader_pack::Header header{ shader_pack::magic, shader_pack::version, moduleCount, bucketCount };
+    append(archive, std::span(&header, 1));
+    append(archive, std::span<const uint32_t>(buckets));
+    append(archive, std::span<const shader_pack::Module>(modules));
+    append(archive, std::span<const shader_pack::VertexInput>(vertexInputs));
+    append(archive, std::span<const shader_pack::DescriptorBinding>(descriptorBindings));
+    for (const Input& input : inputs)
+        append(archive, std::span<const char>(input.name));
+    archive.resize(codeStart);
+    for (const Input& input : inputs)
+        append(archive, std::span<const uint32_t>(input.code));
+    return archive;
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: shader-pack <archive> <module.spv>..." << std::endl;
+        return 2;
+    }
+    try
+    {
+        std::vector<Input> inputs;
+        for (int i = 2; i < argc; i++)
+        {
+            const std::filesystem::path path = argv[i];
+            Input input{ path.stem().string(), readSpirv(path), {} };
+            try
+            {
+                input.reflection = Reflector().reflect(input.code);
+            }
+            catch (const std::exception& e)
+            {
+                throw std::runtime_error(path.string() + ": " + e.what());
+            }
+            inputs.push_back(std::move(input));
+        }
+
+        const std::vector<std::byte> archive = pack(inputs);
+        std::ofstream file(argv[1], std::ios::binary);
+        file.write(reinterpret_cast<const char*>(archive.data()), static_cast<std::streamsize>(archive.size()));
+        if (!file)
+            throw std::runtime_error(std::string("Failed to write ") + argv[1]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "shader-pack: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}